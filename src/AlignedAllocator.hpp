@@ -0,0 +1,73 @@
+#ifndef _ALIGNEDALLOCATOR_HPP_
+#define _ALIGNEDALLOCATOR_HPP_
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+#ifdef _MSC_VER
+#include <malloc.h>
+#endif
+
+/**
+ * Allocator for std::vector that places the data on an Alignment-byte boundary (e.g. 64 for a cache line), so SIMD
+ * loads never straddle cache lines
+ */
+template <typename T, std::size_t Alignment>
+struct AlignedAllocator
+{
+	typedef T value_type;
+
+	template <typename U>
+	struct rebind
+	{
+		typedef AlignedAllocator<U, Alignment> other;
+	};
+
+	AlignedAllocator() {}
+
+	template <typename U>
+	AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+
+	T* allocate(std::size_t n)
+	{
+		if (n == 0) {
+			return nullptr;
+		}
+#ifdef _MSC_VER
+		void* p = _aligned_malloc(n * sizeof(T), Alignment);
+#else
+		void* p = nullptr;
+		if (posix_memalign(&p, Alignment, n * sizeof(T)) != 0) {
+			p = nullptr;
+		}
+#endif
+		if (p == nullptr) {
+			throw std::bad_alloc();
+		}
+		return static_cast<T*>(p);
+	}
+
+	void deallocate(T* p, std::size_t)
+	{
+#ifdef _MSC_VER
+		_aligned_free(p);
+#else
+		free(p);
+#endif
+	}
+};
+
+template <typename T, typename U, std::size_t Alignment>
+bool operator==(const AlignedAllocator<T, Alignment>&, const AlignedAllocator<U, Alignment>&)
+{
+	return true;
+}
+
+template <typename T, typename U, std::size_t Alignment>
+bool operator!=(const AlignedAllocator<T, Alignment>&, const AlignedAllocator<U, Alignment>&)
+{
+	return false;
+}
+
+#endif
@@ -0,0 +1,896 @@
+#include "BVH.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <math.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+using std::vector;
+
+namespace
+{
+	// Number of candidate split planes evaluated per axis when building
+	const int SAH_BINS = 16;
+	// Largest leaf the SAH may decide to keep, bigger ranges are always split
+	const int MAX_LEAF_SIZE = 4;
+	// Relative cost of visiting a node compared to intersecting one sphere
+	const double TRAVERSAL_COST = 1.0;
+
+	// Range of sphere indices still to be split into a subtree rooted at node
+	struct BuildTask
+	{
+		int node;
+		int first;
+		int count;
+		int depth;
+	};
+
+	// Sphere center, split into components so the build can index it by axis
+	struct Centroid
+	{
+		double v[3];
+	};
+
+	// Largest range of spheres the LBVH keeps as one leaf instead of following its splits down to single spheres
+	const int LBVH_LEAF_SIZE = 4;
+	// The LBVH moves from 30-bit Morton codes (10 bits per axis) to 63-bit (21 bits per axis) once more than one
+	// sphere in this many has the same 30-bit code as the one before it
+	const int MORTON30_DUPLICATE_RATIO = 16;
+	// Spheres per job of the parallel LBVH passes
+	const int LBVH_CHUNK = 1 << 14;
+	// Number of subtrees a refit hands to the worker threads (fewer if the tree runs out of inner nodes first)
+	const int REFIT_SUBTREES = 64;
+
+	// 63-bit Morton code of a sphere center and the index of the sphere. 30-bit codes and their index fit in one
+	// uint64_t instead (code in the high half)
+	struct MortonKey
+	{
+		uint64_t code;
+		int index;
+	};
+
+	uint64_t codeOf(uint64_t key)
+	{
+		return key;
+	}
+
+	uint64_t codeOf(const MortonKey& key)
+	{
+		return key.code;
+	}
+
+	// Range of Morton sorted spheres still to be laid out as a subtree rooted at node, and the inner node of the
+	// sorted order that splits it
+	struct MortonTask
+	{
+		int node;
+		int inner;
+		int first;
+		int count;
+		int depth;
+	};
+
+	double axisOf(const Vector& v, int axis)
+	{
+		return axis == 0 ? v.getI() : (axis == 1 ? v.getJ() : v.getK());
+	}
+
+	/** Spread the low 21 bits of v out to every third bit, so the bits of three axes can be interleaved
+	*/
+	uint64_t spreadBits(uint64_t v)
+	{
+		v &= 0x1fffff;
+		v = (v | v << 32) & 0x1f00000000ffff;
+		v = (v | v << 16) & 0x1f0000ff0000ff;
+		v = (v | v << 8) & 0x100f00f00f00f00f;
+		v = (v | v << 4) & 0x10c30c30c30c30c3;
+		v = (v | v << 2) & 0x1249249249249249;
+		return v;
+	}
+
+	/** Number of leading zero bits of a nonzero 64-bit value
+	*/
+	int leadingZeros(uint64_t v)
+	{
+#if defined(__GNUC__)
+		return __builtin_clzll(v);
+#elif defined(_MSC_VER)
+		unsigned long bit;
+		_BitScanReverse64(&bit, v);
+		return 63 - int(bit);
+#else
+		int zeros = 0;
+		for (uint64_t top = uint64_t(1) << 63; !(v & top); top >>= 1) {
+			zeros++;
+		}
+		return zeros;
+#endif
+	}
+
+	/** Call f(job) for every job in [0, jobs), on the scheduler's workers if there is one
+	*/
+	template <typename F>
+	void parallelFor(const TileScheduler* scheduler, int jobs, F f)
+	{
+		if (scheduler && jobs > 1) {
+			scheduler->run(jobs, [&f](int job, int) { f(job); });
+		}
+		else {
+			for (int job = 0; job < jobs; job++) {
+				f(job);
+			}
+		}
+	}
+
+	/** Least significant digit first radix sort of keys by bits [lowBit, highBit) of their code, 8 bits per pass,
+	* skipping the passes where every code has the same digit. Every chunk of keys counts its digits, then writes its
+	* keys into slots of its own (after the same digits of earlier chunks), so the chunks run in parallel and the sort
+	* stays stable
+	*/
+	template <typename Key>
+	void radixSort(vector<Key>& keys, int lowBit, int highBit, const TileScheduler* scheduler)
+	{
+		const int radix = 256;
+		size_t n = keys.size();
+		int chunks = int((n + LBVH_CHUNK - 1) / LBVH_CHUNK);
+		vector<Key> sorted(n);
+		vector<size_t> slots(size_t(chunks) * radix);
+
+		for (int shift = lowBit; shift < highBit; shift += 8) {
+			std::fill(slots.begin(), slots.end(), 0);
+			parallelFor(scheduler, chunks, [&](int chunk) {
+				size_t* count = &slots[size_t(chunk) * radix];
+				size_t end = std::min(n, size_t(chunk + 1) * LBVH_CHUNK);
+				for (size_t i = size_t(chunk) * LBVH_CHUNK; i < end; i++) {
+					count[codeOf(keys[i]) >> shift & (radix - 1)]++;
+				}
+			});
+
+			// Slots in digit order, and within a digit in chunk order
+			size_t offset = 0;
+			bool oneDigit = false;
+			for (int digit = 0; digit < radix; digit++) {
+				size_t digitStart = offset;
+				for (int chunk = 0; chunk < chunks; chunk++) {
+					size_t count = slots[size_t(chunk) * radix + digit];
+					slots[size_t(chunk) * radix + digit] = offset;
+					offset += count;
+				}
+				oneDigit = oneDigit || offset - digitStart == n;
+			}
+			if (oneDigit) {
+				continue;
+			}
+
+			parallelFor(scheduler, chunks, [&](int chunk) {
+				size_t* slot = &slots[size_t(chunk) * radix];
+				size_t end = std::min(n, size_t(chunk + 1) * LBVH_CHUNK);
+				for (size_t i = size_t(chunk) * LBVH_CHUNK; i < end; i++) {
+					sorted[slot[codeOf(keys[i]) >> shift & (radix - 1)]++] = keys[i];
+				}
+			});
+			keys.swap(sorted);
+		}
+	}
+}
+
+/** Empty box: min = +inf, max = -inf
+*/
+AABB::AABB()
+{
+	for (int a = 0; a < 3; a++) {
+		min[a] = INFINITY;
+		max[a] = -INFINITY;
+	}
+}
+
+/** Grow box to contain point p
+*/
+void AABB::grow(const Vector& p)
+{
+	for (int a = 0; a < 3; a++) {
+		double value = axisOf(p, a);
+		min[a] = std::min(min[a], value);
+		max[a] = std::max(max[a], value);
+	}
+}
+
+/** Grow box to contain box b
+*/
+void AABB::grow(const AABB& b)
+{
+	for (int a = 0; a < 3; a++) {
+		min[a] = std::min(min[a], b.min[a]);
+		max[a] = std::max(max[a], b.max[a]);
+	}
+}
+
+/** Surface area: 2(xy + yz + zx)
+*/
+double AABB::surfaceArea() const
+{
+	double x = max[0] - min[0];
+	double y = max[1] - min[1];
+	double z = max[2] - min[2];
+	if (x < 0 || y < 0 || z < 0) {
+		return 0;
+	}
+	return 2 * (x * y + y * z + z * x);
+}
+
+/** Slab test: intersect the ray's [0, tMax] interval with the interval it spends between each pair of planes
+*/
+bool AABB::intersect(const double origin[3], const double invDirection[3], double tMax, double& tEntry) const
+{
+	double tNear = 0;
+	double tFar = tMax;
+	for (int a = 0; a < 3; a++) {
+		double t0 = (min[a] - origin[a]) * invDirection[a];
+		double t1 = (max[a] - origin[a]) * invDirection[a];
+		if (t0 > t1) {
+			std::swap(t0, t1);
+		}
+		tNear = t0 > tNear ? t0 : tNear;
+		tFar = t1 < tFar ? t1 : tFar;
+		if (tNear > tFar) {
+			return false;
+		}
+	}
+	tEntry = tNear;
+	return true;
+}
+
+/** Create empty hierarchy
+*/
+BVH::BVH() :
+	buildCost(0)
+{}
+
+/** Hierarchy by the chosen builder, then the leaf geometry in leaf order
+*/
+void BVH::build(const vector<Sphere>& spheres, BVHBuilder builder, const TileScheduler* scheduler)
+{
+	nodes.clear();
+	indices.resize(spheres.size());
+	buildCost = 0;
+	if (spheres.empty()) {
+		leafSpheres.build(spheres);
+		leafSpheresF.build(spheres);
+		return;
+	}
+
+	if (builder == BVHBuilder::LBVH) {
+		buildLBVH(spheres, scheduler);
+	}
+	else {
+		vector<AABB> boxes(spheres.size());
+		vector<Vector> centers(spheres.size());
+		for (int i = 0; i < spheres.size(); i++) {
+			centers[i] = spheres[i].position();
+			double r = spheres[i].radius();
+			boxes[i].grow(centers[i] - Vector(r, r, r));
+			boxes[i].grow(centers[i] + Vector(r, r, r));
+		}
+		buildSAH(boxes, centers);
+	}
+
+	leafSpheres.build(spheres, indices);
+	leafSpheresF.build(spheres, indices);
+	buildCost = sahCost();
+}
+
+/** Boxes alone, split at their centers
+*/
+void BVH::build(const vector<AABB>& boxes)
+{
+	nodes.clear();
+	indices.resize(boxes.size());
+	vector<Sphere> none;
+	leafSpheres.build(none);
+	leafSpheresF.build(none);
+	buildCost = 0;
+	if (boxes.empty()) {
+		return;
+	}
+
+	vector<Vector> centers(boxes.size());
+	for (int i = 0; i < boxes.size(); i++) {
+		centers[i] = Vector((boxes[i].min[0] + boxes[i].max[0]) / 2, (boxes[i].min[1] + boxes[i].max[1]) / 2,
+			(boxes[i].min[2] + boxes[i].max[2]) / 2);
+	}
+	buildSAH(boxes, centers);
+	buildCost = sahCost();
+}
+
+/** Top-down build: split each node along the binned SAH plane with the lowest cost, until a leaf is cheaper
+*/
+void BVH::buildSAH(const vector<AABB>& boxes, const vector<Vector>& centers)
+{
+	// Centroid of every box
+	vector<Centroid> centroids(boxes.size());
+	for (int i = 0; i < boxes.size(); i++) {
+		centroids[i] = Centroid{ { centers[i].getI(), centers[i].getJ(), centers[i].getK() } };
+		indices[i] = i;
+	}
+
+	// A binary tree with at least one box per leaf has at most 2n - 1 nodes
+	nodes.reserve(2 * boxes.size() - 1);
+	nodes.push_back(Node());
+
+	vector<BuildTask> tasks;
+	tasks.push_back(BuildTask{ 0, 0, int(boxes.size()), 0 });
+	while (!tasks.empty()) {
+		BuildTask task = tasks.back();
+		tasks.pop_back();
+
+		AABB bounds;
+		AABB centroidBounds;
+		for (int i = task.first; i < task.first + task.count; i++) {
+			bounds.grow(boxes[indices[i]]);
+			const Centroid& c = centroids[indices[i]];
+			for (int a = 0; a < 3; a++) {
+				centroidBounds.min[a] = std::min(centroidBounds.min[a], c.v[a]);
+				centroidBounds.max[a] = std::max(centroidBounds.max[a], c.v[a]);
+			}
+		}
+		nodes[task.node].bounds = bounds;
+		nodes[task.node].leftFirst = task.first;
+		nodes[task.node].count = task.count;
+
+		if (task.count == 1 || task.depth + 1 >= MAX_DEPTH) {
+			continue;
+		}
+
+		// Find the cheapest split plane: cost = traversal + (A_left * N_left + A_right * N_right) / A
+		double bestCost = INFINITY;
+		int bestAxis = -1;
+		int bestBin = 0;
+		for (int axis = 0; axis < 3; axis++) {
+			double lo = centroidBounds.min[axis];
+			double extent = centroidBounds.max[axis] - lo;
+			if (extent <= 0) {
+				continue;
+			}
+			double binScale = SAH_BINS / extent;
+
+			AABB binBounds[SAH_BINS];
+			int binCount[SAH_BINS] = {};
+			for (int i = task.first; i < task.first + task.count; i++) {
+				int bin = std::min(SAH_BINS - 1, int((centroids[indices[i]].v[axis] - lo) * binScale));
+				binBounds[bin].grow(boxes[indices[i]]);
+				binCount[bin]++;
+			}
+
+			// Sweep from the right to get the area and count of everything right of each plane
+			double rightArea[SAH_BINS];
+			int rightCount[SAH_BINS];
+			AABB right;
+			int count = 0;
+			for (int b = SAH_BINS - 1; b > 0; b--) {
+				right.grow(binBounds[b]);
+				count += binCount[b];
+				rightArea[b] = right.surfaceArea();
+				rightCount[b] = count;
+			}
+
+			// Then from the left, evaluating the plane between bin b - 1 and bin b
+			AABB left;
+			count = 0;
+			for (int b = 1; b < SAH_BINS; b++) {
+				left.grow(binBounds[b - 1]);
+				count += binCount[b - 1];
+				if (count == 0 || rightCount[b] == 0) {
+					continue;
+				}
+				double cost = left.surfaceArea() * count + rightArea[b] * rightCount[b];
+				if (cost < bestCost) {
+					bestCost = cost;
+					bestAxis = axis;
+					bestBin = b;
+				}
+			}
+		}
+
+		// All centroids in the same place: nothing to split on
+		if (bestAxis < 0) {
+			continue;
+		}
+
+		double area = bounds.surfaceArea();
+		double splitCost = TRAVERSAL_COST + (area > 0 ? bestCost / area : 0);
+		double leafCost = task.count;
+		if (splitCost >= leafCost && task.count <= MAX_LEAF_SIZE) {
+			continue;
+		}
+
+		// Move spheres left of the plane to the front of the range
+		double lo = centroidBounds.min[bestAxis];
+		double binScale = SAH_BINS / (centroidBounds.max[bestAxis] - lo);
+		int* middle = std::partition(&indices[task.first], &indices[task.first] + task.count, [&](int index) {
+			return std::min(SAH_BINS - 1, int((centroids[index].v[bestAxis] - lo) * binScale)) < bestBin;
+		});
+		int leftCount = int(middle - &indices[task.first]);
+
+		int leftChild = int(nodes.size());
+		nodes.push_back(Node());
+		nodes.push_back(Node());
+		nodes[task.node].leftFirst = leftChild;
+		nodes[task.node].count = 0;
+
+		tasks.push_back(BuildTask{ leftChild, task.first, leftCount, task.depth + 1 });
+		tasks.push_back(BuildTask{ leftChild + 1, task.first + leftCount, task.count - leftCount, task.depth + 1 });
+	}
+}
+
+/** Linear BVH: Morton code of every sphere center within the box around all centers, radix sort by code, then each
+* inner node of the sorted order found on its own (Karras 2012) and the tree laid out top-down like buildSAH's. Ranges
+* of up to LBVH_LEAF_SIZE spheres become leaves, and the boxes are filled in bottom-up
+*/
+void BVH::buildLBVH(const vector<Sphere>& spheres, const TileScheduler* scheduler)
+{
+	int n = int(spheres.size());
+	int chunks = (n + LBVH_CHUNK - 1) / LBVH_CHUNK;
+
+	AABB centerBounds;
+	for (int i = 0; i < n; i++) {
+		centerBounds.grow(spheres[i].position());
+	}
+	double invExtent[3];
+	for (int a = 0; a < 3; a++) {
+		double extent = centerBounds.max[a] - centerBounds.min[a];
+		invExtent[a] = extent > 0 ? 1 / extent : 0;
+	}
+	// Code of sphere i with each axis of the box around the centers cut into 2^axisBits cells
+	auto mortonCode = [&](int i, int axisBits) {
+		Vector center = spheres[i].position();
+		double cells = (1 << axisBits) - 1;
+		uint64_t code = 0;
+		for (int a = 0; a < 3; a++) {
+			code |= spreadBits(uint64_t((axisOf(center, a) - centerBounds.min[a]) * invExtent[a] * cells)) << (2 - a);
+		}
+		return code;
+	};
+
+	// 30-bit codes pack with their index into 8 bytes, so they sort the fastest
+	vector<uint64_t> codes(n);
+	vector<uint64_t> packed(n);
+	parallelFor(scheduler, chunks, [&](int chunk) {
+		int end = std::min(n, (chunk + 1) * LBVH_CHUNK);
+		for (int i = chunk * LBVH_CHUNK; i < end; i++) {
+			packed[i] = mortonCode(i, 10) << 32 | uint64_t(i);
+		}
+	});
+	radixSort(packed, 32, 62, scheduler);
+	int duplicates = 0;
+	for (int i = 1; i < n; i++) {
+		duplicates += packed[i] >> 32 == packed[i - 1] >> 32;
+	}
+
+	if (duplicates <= n / MORTON30_DUPLICATE_RATIO) {
+		parallelFor(scheduler, chunks, [&](int chunk) {
+			int end = std::min(n, (chunk + 1) * LBVH_CHUNK);
+			for (int i = chunk * LBVH_CHUNK; i < end; i++) {
+				codes[i] = packed[i] >> 32;
+				indices[i] = int(packed[i] & 0xffffffff);
+			}
+		});
+	}
+	else {
+		// Too many spheres share a cell to tell apart: use finer cells
+		vector<MortonKey> keys(n);
+		parallelFor(scheduler, chunks, [&](int chunk) {
+			int end = std::min(n, (chunk + 1) * LBVH_CHUNK);
+			for (int i = chunk * LBVH_CHUNK; i < end; i++) {
+				keys[i] = MortonKey{ mortonCode(i, 21), i };
+			}
+		});
+		radixSort(keys, 0, 63, scheduler);
+		for (int i = 0; i < n; i++) {
+			codes[i] = keys[i].code;
+			indices[i] = keys[i].index;
+		}
+	}
+
+	// Length of the prefix shared by sorted codes i and j (-1 if j is out of range). Equal codes are told apart by
+	// their position, so every range has a split
+	auto commonPrefix = [&codes, n](int i, int j) {
+		if (j < 0 || j >= n) {
+			return -1;
+		}
+		uint64_t difference = codes[i] ^ codes[j];
+		return difference ? leadingZeros(difference) : 64 + leadingZeros(uint64_t(i ^ j));
+	};
+
+	// Inner node i covers a range with one end at code i and splits it after code splits[i]
+	vector<int> splits(n - 1);
+	parallelFor(scheduler, chunks, [&](int chunk) {
+		int end = std::min(n - 1, (chunk + 1) * LBVH_CHUNK);
+		for (int i = chunk * LBVH_CHUNK; i < end; i++) {
+			// The range grows towards the neighbour sharing the longer prefix, as far as codes share more than the
+			// prefix with the other neighbour: find its length by doubling, then by bisection
+			int direction = commonPrefix(i, i + 1) > commonPrefix(i, i - 1) ? 1 : -1;
+			int minPrefix = commonPrefix(i, i - direction);
+			int maxLength = 2;
+			while (commonPrefix(i, i + maxLength * direction) > minPrefix) {
+				maxLength *= 2;
+			}
+			int length = 0;
+			for (int step = maxLength / 2; step > 0; step /= 2) {
+				if (commonPrefix(i, i + (length + step) * direction) > minPrefix) {
+					length += step;
+				}
+			}
+
+			// Split after the furthest code that shares more than the prefix common to the whole range
+			int nodePrefix = commonPrefix(i, i + length * direction);
+			int offset = 0;
+			int step = length;
+			do {
+				step = (step + 1) / 2;
+				if (commonPrefix(i, i + (offset + step) * direction) > nodePrefix) {
+					offset += step;
+				}
+			} while (step > 1);
+			splits[i] = i + offset * direction + std::min(direction, 0);
+		}
+	});
+
+	// A binary tree with at least one sphere per leaf has at most 2n - 1 nodes
+	nodes.reserve(2 * n - 1);
+	nodes.push_back(Node());
+
+	vector<MortonTask> tasks;
+	tasks.push_back(MortonTask{ 0, 0, 0, n, 0 });
+	while (!tasks.empty()) {
+		MortonTask task = tasks.back();
+		tasks.pop_back();
+
+		Node& node = nodes[task.node];
+		node.leftFirst = task.first;
+		node.count = task.count;
+		if (task.count <= LBVH_LEAF_SIZE || task.depth + 1 >= MAX_DEPTH) {
+			for (int k = task.first; k < task.first + task.count; k++) {
+				Vector center = spheres[indices[k]].position();
+				double r = spheres[indices[k]].radius();
+				node.bounds.grow(center - Vector(r, r, r));
+				node.bounds.grow(center + Vector(r, r, r));
+			}
+			continue;
+		}
+
+		// The left part ends at the split and is covered by the inner node there, the right part by the next one
+		int split = splits[task.inner];
+		int leftCount = split + 1 - task.first;
+		int leftChild = int(nodes.size());
+		node.leftFirst = leftChild;
+		node.count = 0;
+		nodes.push_back(Node());
+		nodes.push_back(Node());
+
+		tasks.push_back(MortonTask{ leftChild, split, task.first, leftCount, task.depth + 1 });
+		tasks.push_back(MortonTask{ leftChild + 1, split + 1, split + 1, task.count - leftCount, task.depth + 1 });
+	}
+
+	// Inner boxes bottom-up: children always come after their parent
+	for (int i = int(nodes.size()) - 1; i >= 0; i--) {
+		Node& node = nodes[i];
+		if (node.count == 0) {
+			node.bounds = nodes[node.leftFirst].bounds;
+			node.bounds.grow(nodes[node.leftFirst + 1].bounds);
+		}
+	}
+}
+
+/** Split the tree into the top nodes and the subtrees below them. Each subtree is refitted as one job: its nodes
+* listed depth-first, then visited in reverse so children come before their parent, leaves taking their spheres'
+* boxes and geometry. The top nodes follow, deepest first
+*/
+void BVH::refit(const vector<Sphere>& spheres, const TileScheduler* scheduler)
+{
+	if (nodes.empty()) {
+		return;
+	}
+
+	vector<int> top;
+	vector<int> subtrees(1, 0);
+	bool split = true;
+	while (split && int(subtrees.size()) < REFIT_SUBTREES) {
+		split = false;
+		vector<int> next;
+		for (int n : subtrees) {
+			if (nodes[n].count > 0) {
+				next.push_back(n);
+				continue;
+			}
+			top.push_back(n);
+			next.push_back(nodes[n].leftFirst);
+			next.push_back(nodes[n].leftFirst + 1);
+			split = true;
+		}
+		subtrees.swap(next);
+	}
+
+	auto refitNode = [&](int n) {
+		Node& node = nodes[n];
+		if (node.count == 0) {
+			node.bounds = nodes[node.leftFirst].bounds;
+			node.bounds.grow(nodes[node.leftFirst + 1].bounds);
+			return;
+		}
+		node.bounds = AABB();
+		for (int k = node.leftFirst; k < node.leftFirst + node.count; k++) {
+			Vector center = spheres[indices[k]].position();
+			double r = spheres[indices[k]].radius();
+			node.bounds.grow(center - Vector(r, r, r));
+			node.bounds.grow(center + Vector(r, r, r));
+		}
+		leafSpheres.update(spheres, node.leftFirst, node.count);
+		leafSpheresF.update(spheres, node.leftFirst, node.count);
+	};
+
+	parallelFor(scheduler, int(subtrees.size()), [&](int job) {
+		vector<int> order;
+		vector<int> stack(1, subtrees[job]);
+		while (!stack.empty()) {
+			int n = stack.back();
+			stack.pop_back();
+			order.push_back(n);
+			if (nodes[n].count == 0) {
+				stack.push_back(nodes[n].leftFirst);
+				stack.push_back(nodes[n].leftFirst + 1);
+			}
+		}
+		for (int i = int(order.size()) - 1; i >= 0; i--) {
+			refitNode(order[i]);
+		}
+	});
+	for (int i = int(top.size()) - 1; i >= 0; i--) {
+		refitNode(top[i]);
+	}
+}
+
+/** Whether there is anything to traverse
+*/
+bool BVH::empty() const
+{
+	return nodes.empty();
+}
+
+/** Depth-first traversal, nearer child first, skipping every box the ray only enters beyond the nearest hit so far
+*/
+template <typename Real>
+int BVH::closestHit(const BasicVector<Real>& s, const BasicVector<Real>& d, Real& t, long long* tests) const
+{
+	if (nodes.empty()) {
+		return -1;
+	}
+
+	double tEntry;
+	// Boxes are always tested in double precision
+	double origin[3] = { s.getI(), s.getJ(), s.getK() };
+	double invDirection[3] = { 1 / double(d.getI()), 1 / double(d.getJ()), 1 / double(d.getK()) };
+	if (!nodes[0].bounds.intersect(origin, invDirection, t, tEntry)) {
+		return -1;
+	}
+
+	// Each entry is a node whose box the ray enters at entry[] (may be stale once a nearer hit is found)
+	int hitIndex = -1;
+	int stack[MAX_DEPTH + 1];
+	double entry[MAX_DEPTH + 1];
+	int stackSize = 0;
+	stack[stackSize] = 0;
+	entry[stackSize++] = tEntry;
+	while (stackSize > 0) {
+		stackSize--;
+		if (entry[stackSize] >= t) {
+			continue;
+		}
+		const Node& node = nodes[stack[stackSize]];
+
+		if (node.count > 0) {
+			RENDER_STATS(if (tests) *tests += node.count;)
+			int position = leafStore(Real()).closestHit(s, d, node.leftFirst, node.count, t);
+			if (position >= 0) {
+				hitIndex = indices[position];
+			}
+			continue;
+		}
+
+		double tLeft, tRight;
+		bool hitLeft = nodes[node.leftFirst].bounds.intersect(origin, invDirection, t, tLeft);
+		bool hitRight = nodes[node.leftFirst + 1].bounds.intersect(origin, invDirection, t, tRight);
+
+		// Push the farther child first so the nearer one is visited first
+		if (hitLeft && hitRight && tLeft < tRight) {
+			stack[stackSize] = node.leftFirst + 1;
+			entry[stackSize++] = tRight;
+			hitRight = false;
+		}
+		if (hitLeft) {
+			stack[stackSize] = node.leftFirst;
+			entry[stackSize++] = tLeft;
+		}
+		if (hitRight) {
+			stack[stackSize] = node.leftFirst + 1;
+			entry[stackSize++] = tRight;
+		}
+	}
+
+	return hitIndex;
+}
+
+/** Depth-first traversal of the whole packet, nearer child (by the packet's lowest entry t) first. Boxes are culled
+* for the packet as a whole; at a leaf only the rays that enter its box are tested against its spheres
+*/
+template <typename Real>
+void BVH::closestHit(BasicRayPacket<Real>& packet, long long* tests) const
+{
+	if (nodes.empty()) {
+		return;
+	}
+	if (!packet.coherent) {
+		for (int r = 0; r < packet.size; r++) {
+			int hitIndex = closestHit(packet.origin, packet.directions[r], packet.t[r], tests);
+			if (hitIndex >= 0) {
+				packet.hit[r] = hitIndex;
+			}
+		}
+		return;
+	}
+
+	const BasicSphereSoA<Real>& leaves = leafStore(Real());
+	double tMax = packet.maxT();
+	double tEntry;
+	if (!packet.intersectBox(nodes[0].bounds.min, nodes[0].bounds.max, tMax, tEntry)) {
+		return;
+	}
+
+	int stack[MAX_DEPTH + 1];
+	double entry[MAX_DEPTH + 1];
+	int stackSize = 0;
+	stack[stackSize] = 0;
+	entry[stackSize++] = tEntry;
+	while (stackSize > 0) {
+		stackSize--;
+		if (entry[stackSize] >= tMax) {
+			continue;
+		}
+		const Node& node = nodes[stack[stackSize]];
+
+		if (node.count > 0) {
+			for (int r = 0; r < packet.size; r++) {
+				double rayEntry;
+				if (!node.bounds.intersect(packet.originD, packet.invDirection[r], packet.t[r], rayEntry)) {
+					continue;
+				}
+				RENDER_STATS(if (tests) *tests += node.count;)
+				int position = leaves.closestHit(packet.origin, packet.directions[r], node.leftFirst, node.count, packet.t[r]);
+				if (position >= 0) {
+					packet.hit[r] = indices[position];
+				}
+			}
+			tMax = packet.maxT();
+			continue;
+		}
+
+		double tLeft, tRight;
+		const Node& left = nodes[node.leftFirst];
+		const Node& right = nodes[node.leftFirst + 1];
+		bool hitLeft = packet.intersectBox(left.bounds.min, left.bounds.max, tMax, tLeft);
+		bool hitRight = packet.intersectBox(right.bounds.min, right.bounds.max, tMax, tRight);
+
+		// Push the farther child first so the nearer one is visited first
+		if (hitLeft && hitRight && tLeft < tRight) {
+			stack[stackSize] = node.leftFirst + 1;
+			entry[stackSize++] = tRight;
+			hitRight = false;
+		}
+		if (hitLeft) {
+			stack[stackSize] = node.leftFirst;
+			entry[stackSize++] = tLeft;
+		}
+		if (hitRight) {
+			stack[stackSize] = node.leftFirst + 1;
+			entry[stackSize++] = tRight;
+		}
+	}
+}
+
+/** Depth-first traversal that returns at the first leaf with a hit - the order children are visited in does not
+* matter since any occluder will do
+*/
+template <typename Real>
+bool BVH::anyHit(const BasicVector<Real>& s, const BasicVector<Real>& d, Real tMax, long long* tests) const
+{
+	if (nodes.empty()) {
+		return false;
+	}
+
+	double tEntry;
+	// Boxes are always tested in double precision
+	double origin[3] = { s.getI(), s.getJ(), s.getK() };
+	double invDirection[3] = { 1 / double(d.getI()), 1 / double(d.getJ()), 1 / double(d.getK()) };
+
+	int stack[MAX_DEPTH + 1];
+	int stackSize = 0;
+	stack[stackSize++] = 0;
+	while (stackSize > 0) {
+		const Node& node = nodes[stack[--stackSize]];
+		if (!node.bounds.intersect(origin, invDirection, tMax, tEntry)) {
+			continue;
+		}
+
+		if (node.count > 0) {
+			RENDER_STATS(if (tests) *tests += node.count;)
+			if (leafStore(Real()).anyHit(s, d, node.leftFirst, node.count, tMax)) {
+				return true;
+			}
+			continue;
+		}
+
+		stack[stackSize++] = node.leftFirst + 1;
+		stack[stackSize++] = node.leftFirst;
+	}
+
+	return false;
+}
+
+// The precisions the ray tracer is built with
+template int BVH::closestHit(const Vector& s, const Vector& d, double& t, long long* tests) const;
+template int BVH::closestHit(const VectorF& s, const VectorF& d, float& t, long long* tests) const;
+template void BVH::closestHit(RayPacket& packet, long long* tests) const;
+template void BVH::closestHit(RayPacketF& packet, long long* tests) const;
+template bool BVH::anyHit(const Vector& s, const Vector& d, double tMax, long long* tests) const;
+template bool BVH::anyHit(const VectorF& s, const VectorF& d, float tMax, long long* tests) const;
+
+/** Leaf geometry in the precision of the query
+*/
+const SphereSoA& BVH::leafStore(double) const
+{
+	return leafSpheres;
+}
+
+const SphereSoAF& BVH::leafStore(float) const
+{
+	return leafSpheresF;
+}
+
+/** Area of every node relative to the root's, times its traversal cost or sphere count
+*/
+double BVH::sahCost() const
+{
+	if (nodes.empty()) {
+		return 0;
+	}
+	double rootArea = nodes[0].bounds.surfaceArea();
+	double cost = 0;
+	for (const Node& node : nodes) {
+		double weight = rootArea > 0 ? node.bounds.surfaceArea() / rootArea : 1;
+		cost += weight * (node.count > 0 ? node.count : TRAVERSAL_COST);
+	}
+	return cost;
+}
+
+/** Getter: cost of the tree as built
+*/
+double BVH::getBuildCost() const
+{
+	return buildCost;
+}
+
+/** Getter: flattened nodes
+*/
+const vector<BVH::Node>& BVH::getNodes() const
+{
+	return nodes;
+}
+
+/** Getter: sphere indices referenced by the leaves
+*/
+const vector<int>& BVH::getIndices() const
+{
+	return indices;
+}
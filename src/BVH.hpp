@@ -0,0 +1,172 @@
+#ifndef _BVH_HPP_
+#define _BVH_HPP_
+
+#include <vector>
+
+#include "RayPacket.hpp"
+#include "RenderStats.hpp"
+#include "Sphere.hpp"
+#include "SphereSoA.hpp"
+#include "TileScheduler.hpp"
+#include "Vector.hpp"
+
+/**
+ * Axis aligned bounding box, stored as its minimum and maximum corner (index 0 = x, 1 = y, 2 = z)
+ * An empty box has min = +inf and max = -inf so that growing it by anything gives that thing's bounds
+ */
+struct AABB
+{
+	double min[3];
+	double max[3];
+
+	AABB();
+
+	/**
+	 * Grow the box to also contain point p / box b
+	 */
+	void grow(const Vector& p);
+	void grow(const AABB& b);
+
+	/**
+	 * @return surface area of the box (0 for an empty box)
+	 */
+	double surfaceArea() const;
+
+	/**
+	 * @return true if the ray origin + t * direction enters the box for some t in [0, tMax]
+	 * @param invDirection - component-wise reciprocal of the ray direction
+	 * @param tEntry - set to the t at which the ray enters the box (0 if it starts inside)
+	 */
+	bool intersect(const double origin[3], const double invDirection[3], double tMax, double& tEntry) const;
+};
+
+/**
+ * How BVH::build groups the spheres into a hierarchy
+ */
+enum class BVHBuilder
+{
+	SAH,	// Top-down binned surface area heuristic: the cheapest trees to trace, the slowest build (default)
+	LBVH	// Linear BVH: spheres sorted along a Morton curve and split where their codes first differ, O(n) after the sort
+};
+
+/**
+ * Bounding volume hierarchy over a list of spheres, built top-down with the surface area heuristic (SAH), or for
+ * scenes that change every frame as a linear BVH (LBVH): sphere centers are quantized to Morton codes, radix sorted,
+ * and each node is split where the codes of its range first differ (Karras 2012)
+ * Nodes are stored in one array with the two children of a node next to each other, and the sphere geometry is copied
+ * into a SphereSoA in leaf order so each leaf is tested with the SIMD kernel. Queries come in double and float
+ * precision (Real); boxes are always tested in double, spheres in the precision of the query
+ */
+class BVH
+{
+public:
+	// Deepest node a build creates (also bounds the traversal stacks)
+	static const int MAX_DEPTH = 64;
+
+	/**
+	 * Node of the hierarchy. Leaves (count > 0) hold spheres getIndices()[leftFirst .. leftFirst + count),
+	 * inner nodes (count == 0) have children leftFirst and leftFirst + 1
+	 */
+	struct Node
+	{
+		AABB bounds;
+		int leftFirst{ 0 };
+		int count{ 0 };
+	};
+
+	/**
+	 * Create an empty hierarchy - call build before querying
+	 */
+	BVH();
+
+	/**
+	 * Build the hierarchy over the bounding boxes of spheres (replaces any previous hierarchy)
+	 * @param scheduler - if given, the LBVH spreads its Morton codes, sort and splits over its worker threads
+	 */
+	void build(const std::vector<Sphere>& spheres, BVHBuilder builder = BVHBuilder::SAH,
+		const TileScheduler* scheduler = nullptr);
+
+	/**
+	 * Build only the hierarchy (nodes and indices, which then refer to boxes) over arbitrary boxes with the SAH, for
+	 * structures whose leaves hold something other than spheres, e.g. the instances of a top-level BVH. Such a
+	 * hierarchy has no leaf geometry: traverse it through getNodes, not with the sphere queries
+	 */
+	void build(const std::vector<AABB>& boxes);
+
+	/**
+	 * Recompute every box bottom-up, and the leaf geometry, after spheres (the list the hierarchy was built from, same
+	 * length and order) moved or changed radius. The tree itself is kept, so refitting is far cheaper than a build but
+	 * the tree gets worse as the spheres move away from where it was built - compare sahCost with getBuildCost
+	 * @param scheduler - if given, subtrees are refitted in parallel on its worker threads
+	 */
+	void refit(const std::vector<Sphere>& spheres, const TileScheduler* scheduler = nullptr);
+
+	/**
+	 * @return true if there is no hierarchy (nothing built yet, or built from no spheres)
+	 */
+	bool empty() const;
+
+	/**
+	 * Find the nearest sphere that the ray with origin s and unit direction d intersects closer than t
+	 * @param t - distance limit on input (INFINITY for none), set to the distance of the returned sphere's intersection
+	 * @param tests - if given, increased by the number of ray-sphere tests made
+	 * @return index of that sphere in the list the hierarchy was built from, -1 if the ray misses every sphere (t is then unchanged)
+	 */
+	template <typename Real>
+	int closestHit(const BasicVector<Real>& s, const BasicVector<Real>& d, Real& t, long long* tests = nullptr) const;
+
+	/**
+	 * closestHit for every ray of a packet (packet.prepare must have been called): the packet goes down the
+	 * hierarchy together, culling each box with one interval test, and each ray is only tested on its own at the
+	 * leaves. Incoherent packets fall back to closestHit one ray at a time. Same results as closestHit per ray
+	 * CHANGES: packet.t and packet.hit of the rays that hit a sphere nearer than their t
+	 */
+	template <typename Real>
+	void closestHit(BasicRayPacket<Real>& packet, long long* tests = nullptr) const;
+
+	/**
+	 * Test whether the ray with origin s and unit direction d intersects any sphere closer than tMax. Stops at the
+	 * first one found instead of looking for the nearest (for shadow rays)
+	 */
+	template <typename Real>
+	bool anyHit(const BasicVector<Real>& s, const BasicVector<Real>& d, Real tMax, long long* tests = nullptr) const;
+
+	/**
+	 * Tree quality: expected cost of a ray that enters the root, by the surface area heuristic - every node's
+	 * traversal cost (inner nodes) or sphere count (leaves) weighted by its area relative to the root's. Lower is
+	 * better; compares hierarchies built over the same spheres (0 if empty)
+	 */
+	double sahCost() const;
+
+	/**
+	 * @return sahCost of the hierarchy when it was last built (0 if empty)
+	 */
+	double getBuildCost() const;
+
+	/**
+	 * Getters for the flattened hierarchy (root is node 0)
+	 */
+	const std::vector<Node>& getNodes() const;
+	const std::vector<int>& getIndices() const;
+
+private:
+	std::vector<Node> nodes;	// Node 0 is the root
+	std::vector<int> indices;	// Sphere indices, grouped by leaf
+	SphereSoA leafSpheres;	// Sphere geometry in the same order as indices
+	SphereSoAF leafSpheresF;	// The same in single precision, for float queries
+	double buildCost;	// sahCost right after the last build
+
+	/**
+	 * Fill nodes and indices (in leaf order) for the given bounding boxes and centers, or spheres
+	 */
+	void buildSAH(const std::vector<AABB>& boxes, const std::vector<Vector>& centers);
+	void buildLBVH(const std::vector<Sphere>& spheres, const TileScheduler* scheduler);
+
+	/**
+	 * @return leafSpheres or leafSpheresF, picked by the type of the (unused) argument
+	 */
+	const SphereSoA& leafStore(double) const;
+	const SphereSoAF& leafStore(float) const;
+};
+
+#endif
@@ -0,0 +1,460 @@
+#include "Grid.hpp"
+
+#include <algorithm>
+#include <math.h>
+
+using std::vector;
+
+namespace
+{
+	// Cells per sphere of a uniform grid, and of each refined cell of a two-level one
+	const double GRID_DENSITY = 1.0;
+	// Cells per sphere of the top grid of a two-level grid
+	const double TOP_DENSITY = 1.0 / 16;
+	// A top cell listing more spheres than this gets its own grid
+	const int REFINE_COUNT = 16;
+	// Most cells along one axis of any level
+	const int MAX_RESOLUTION = 1024;
+	// Boxes are widened by this fraction of a cell before binning, so rounding in the walk never misses a sphere
+	const double BIN_MARGIN = 1e-6;
+
+	// Grid::suits: fewest spheres worth a grid, least occupancy and most overlap (see Grid::Statistics)
+	const int SUITS_MIN_SPHERES = 10000;
+	const double SUITS_MIN_OCCUPANCY = 0.5;
+	const double SUITS_MAX_OVERLAP = 8;
+
+	/** Slab test like AABB::intersect, also giving the t at which the ray leaves the box
+	*/
+	bool clip(const AABB& box, const double origin[3], const double invDirection[3], double tMax, double& tNear,
+		double& tFar)
+	{
+		tNear = 0;
+		tFar = tMax;
+		for (int a = 0; a < 3; a++) {
+			double t0 = (box.min[a] - origin[a]) * invDirection[a];
+			double t1 = (box.max[a] - origin[a]) * invDirection[a];
+			if (t0 > t1) {
+				std::swap(t0, t1);
+			}
+			tNear = t0 > tNear ? t0 : tNear;
+			tFar = t1 < tFar ? t1 : tFar;
+			if (tNear > tFar) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	/** Cells along each axis of a box of the given extent cut into about `cells' cubes. Axes too thin for one cube are
+	* left one cell thick and the cells spread over the others
+	*/
+	void resolution(const double extent[3], double cells, int dims[3])
+	{
+		bool thin[3] = { false, false, false };
+		double side = 0;
+		for (int pass = 0; pass < 3; pass++) {
+			double volume = 1;
+			int axes = 0;
+			for (int a = 0; a < 3; a++) {
+				if (!thin[a]) {
+					volume *= extent[a];
+					axes++;
+				}
+			}
+			side = axes > 0 && volume > 0 ? std::pow(volume / std::max(cells, 1.0), 1.0 / axes) : INFINITY;
+			bool changed = false;
+			for (int a = 0; a < 3; a++) {
+				if (!thin[a] && !(extent[a] >= side)) {
+					thin[a] = true;
+					changed = true;
+				}
+			}
+			if (!changed) {
+				break;
+			}
+		}
+		for (int a = 0; a < 3; a++) {
+			dims[a] = thin[a] ? 1 : std::max(1, std::min(MAX_RESOLUTION, int(extent[a] / side + 0.5)));
+		}
+	}
+}
+
+/** Create empty grid
+*/
+Grid::Grid()
+{}
+
+/** Count, then fill each level's cell lists (a counting sort of sphere references by cell)
+*/
+void Grid::build(const vector<Sphere>& spheres, int levelCount)
+{
+	levels.clear();
+	cells.clear();
+	bounds = AABB();
+	if (spheres.empty()) {
+		cellSpheres.build(spheres);
+		cellSpheresF.build(spheres);
+		return;
+	}
+
+	vector<AABB> boxes(spheres.size());
+	vector<int> all(spheres.size());
+	for (int i = 0; i < spheres.size(); i++) {
+		Vector center = spheres[i].position();
+		double r = spheres[i].radius();
+		boxes[i].grow(center - Vector(r, r, r));
+		boxes[i].grow(center + Vector(r, r, r));
+		bounds.grow(boxes[i]);
+		all[i] = i;
+	}
+
+	// Add a level over [lo, hi) with about `density' cells per sphere of list, and bin those spheres into it
+	vector<int> order;
+	auto addLevel = [&](const double lo[3], const double hi[3], double density, const int* list, int count) {
+		Level level;
+		double extent[3];
+		for (int a = 0; a < 3; a++) {
+			extent[a] = hi[a] - lo[a];
+		}
+		resolution(extent, density * count, level.dims);
+		for (int a = 0; a < 3; a++) {
+			level.origin[a] = lo[a];
+			level.cellSize[a] = extent[a] / level.dims[a];
+			level.invCellSize[a] = extent[a] > 0 ? level.dims[a] / extent[a] : 0;
+		}
+		level.firstCell = int(cells.size());
+		levels.push_back(level);
+		cells.resize(cells.size() + size_t(level.dims[0]) * level.dims[1] * level.dims[2]);
+
+		// Cell range of each box, widened by the margin and clamped to the level
+		auto range = [&level](const AABB& box, int lo[3], int hi[3]) {
+			for (int a = 0; a < 3; a++) {
+				double from = (box.min[a] - level.origin[a]) * level.invCellSize[a] - BIN_MARGIN;
+				double to = (box.max[a] - level.origin[a]) * level.invCellSize[a] + BIN_MARGIN;
+				lo[a] = std::max(0, std::min(level.dims[a] - 1, int(std::floor(from))));
+				hi[a] = std::max(0, std::min(level.dims[a] - 1, int(std::floor(to))));
+			}
+		};
+		auto forCells = [&level, &range](const AABB& box, Cell* levelCells, int sphere, int* slots) {
+			int lo[3], hi[3];
+			range(box, lo, hi);
+			for (int z = lo[2]; z <= hi[2]; z++) {
+				for (int y = lo[1]; y <= hi[1]; y++) {
+					for (int x = lo[0]; x <= hi[0]; x++) {
+						Cell& cell = levelCells[(z * level.dims[1] + y) * level.dims[0] + x];
+						if (slots) {
+							slots[cell.first + cell.count] = sphere;
+						}
+						cell.count++;
+					}
+				}
+			}
+		};
+
+		Cell* levelCells = &cells[level.firstCell];
+		int cellCount = level.dims[0] * level.dims[1] * level.dims[2];
+		for (int i = 0; i < count; i++) {
+			forCells(boxes[list[i]], levelCells, list[i], nullptr);
+		}
+		int first = int(order.size());
+		for (int c = 0; c < cellCount; c++) {
+			levelCells[c].first = first;
+			first += levelCells[c].count;
+			levelCells[c].count = 0;
+		}
+		order.resize(first);
+		for (int i = 0; i < count; i++) {
+			forCells(boxes[list[i]], levelCells, list[i], order.data());
+		}
+	};
+
+	if (levelCount < 2) {
+		addLevel(bounds.min, bounds.max, GRID_DENSITY, all.data(), int(all.size()));
+	}
+	else {
+		// The top level's lists are only a step: each cell's spheres move to the final order, or into its own grid
+		addLevel(bounds.min, bounds.max, TOP_DENSITY, all.data(), int(all.size()));
+		vector<int> top;
+		top.swap(order);
+		Level level = levels[0];
+		for (int z = 0; z < level.dims[2]; z++) {
+			for (int y = 0; y < level.dims[1]; y++) {
+				for (int x = 0; x < level.dims[0]; x++) {
+					int c = level.firstCell + (z * level.dims[1] + y) * level.dims[0] + x;
+					Cell cell = cells[c];
+					if (cell.count <= REFINE_COUNT) {
+						cells[c].first = int(order.size());
+						order.insert(order.end(), top.begin() + cell.first, top.begin() + cell.first + cell.count);
+						continue;
+					}
+					int xyz[3] = { x, y, z };
+					double lo[3], hi[3];
+					for (int a = 0; a < 3; a++) {
+						lo[a] = level.origin[a] + xyz[a] * level.cellSize[a];
+						hi[a] = xyz[a] + 1 == level.dims[a] ? bounds.max[a] : lo[a] + level.cellSize[a];
+					}
+					cells[c].child = int(levels.size());
+					cells[c].count = 0;
+					addLevel(lo, hi, GRID_DENSITY, &top[cell.first], cell.count);
+				}
+			}
+		}
+	}
+
+	cellSpheres.build(spheres, order);
+	cellSpheresF.build(spheres, order);
+}
+
+/** Getter: whether there is a grid
+*/
+bool Grid::empty() const
+{
+	return levels.empty();
+}
+
+/** Amanatides & Woo: next[a] is the t at which the ray crosses into the next cell along axis a, delta[a] the t
+* between two crossings; the cell after this one is always across the nearest of the three
+*/
+template <typename Visit>
+bool Grid::walk(const Level& level, const double o[3], const double d[3], const double inv[3], double tEnter,
+	double tLeave, Visit& visit) const
+{
+	int cell[3];
+	int step[3];
+	double next[3];
+	double delta[3];
+	for (int a = 0; a < 3; a++) {
+		double p = o[a] + tEnter * d[a];
+		int c = int(std::floor((p - level.origin[a]) * level.invCellSize[a]));
+		cell[a] = std::max(0, std::min(level.dims[a] - 1, c));
+		if (d[a] > 0) {
+			step[a] = 1;
+			next[a] = (level.origin[a] + (cell[a] + 1) * level.cellSize[a] - o[a]) * inv[a];
+			delta[a] = level.cellSize[a] * inv[a];
+		}
+		else if (d[a] < 0) {
+			step[a] = -1;
+			next[a] = (level.origin[a] + cell[a] * level.cellSize[a] - o[a]) * inv[a];
+			delta[a] = -level.cellSize[a] * inv[a];
+		}
+		else {
+			step[a] = 0;
+			next[a] = INFINITY;
+			delta[a] = INFINITY;
+		}
+	}
+
+	double entry = tEnter;
+	while (entry < visit.limit) {
+		int axis = next[0] < next[1] ? (next[0] < next[2] ? 0 : 2) : (next[1] < next[2] ? 1 : 2);
+		const Cell& c = cells[level.firstCell + (cell[2] * level.dims[1] + cell[1]) * level.dims[0] + cell[0]];
+		if (c.child >= 0) {
+			if (walk(levels[c.child], o, d, inv, entry, std::min(next[axis], tLeave), visit)) {
+				return true;
+			}
+		}
+		else if (c.count > 0 && visit(c)) {
+			return true;
+		}
+
+		if (next[axis] >= tLeave) {
+			return false;
+		}
+		cell[axis] += step[axis];
+		if (cell[axis] < 0 || cell[axis] >= level.dims[axis]) {
+			return false;
+		}
+		entry = next[axis];
+		next[axis] += delta[axis];
+	}
+	return true;
+}
+
+namespace
+{
+	// Visitor of Grid::walk for closestHit: tests every cell's spheres, and stops the walk at cells beyond the nearest hit
+	template <typename Real, typename Store>
+	struct ClosestVisit
+	{
+		const Store& store;
+		const BasicVector<Real>& s;
+		const BasicVector<Real>& d;
+		Real& t;
+		long long* tests;
+		int hitIndex;
+		double limit;
+
+		template <typename Cell>
+		bool operator()(const Cell& cell)
+		{
+			RENDER_STATS(if (tests) *tests += cell.count;)
+			int position = store.closestHit(s, d, cell.first, cell.count, t);
+			if (position >= 0) {
+				hitIndex = store.getIndex(position);
+				limit = t;
+			}
+			return false;
+		}
+	};
+
+	// Visitor of Grid::walk for anyHit: stops at the first cell with a hit
+	template <typename Real, typename Store>
+	struct AnyVisit
+	{
+		const Store& store;
+		const BasicVector<Real>& s;
+		const BasicVector<Real>& d;
+		long long* tests;
+		bool hit;
+		double limit;
+
+		template <typename Cell>
+		bool operator()(const Cell& cell)
+		{
+			RENDER_STATS(if (tests) *tests += cell.count;)
+			hit = store.anyHit(s, d, cell.first, cell.count, Real(limit));
+			return hit;
+		}
+	};
+}
+
+/** Walk the cells from where the ray enters the grid, nearest first
+*/
+template <typename Real>
+int Grid::closestHit(const BasicVector<Real>& s, const BasicVector<Real>& d, Real& t, long long* tests) const
+{
+	if (levels.empty()) {
+		return -1;
+	}
+	double o[3] = { s.getI(), s.getJ(), s.getK() };
+	double dir[3] = { d.getI(), d.getJ(), d.getK() };
+	double inv[3] = { 1 / dir[0], 1 / dir[1], 1 / dir[2] };
+	double tEnter, tLeave;
+	if (!clip(bounds, o, inv, t, tEnter, tLeave)) {
+		return -1;
+	}
+
+	typedef BasicSphereSoA<Real> Store;
+	ClosestVisit<Real, Store> visit{ cellStore(Real()), s, d, t, tests, -1, double(t) };
+	walk(levels[0], o, dir, inv, tEnter, tLeave, visit);
+	return visit.hitIndex;
+}
+
+/** Same walk, stopping at the first hit
+*/
+template <typename Real>
+bool Grid::anyHit(const BasicVector<Real>& s, const BasicVector<Real>& d, Real tMax, long long* tests) const
+{
+	if (levels.empty()) {
+		return false;
+	}
+	double o[3] = { s.getI(), s.getJ(), s.getK() };
+	double dir[3] = { d.getI(), d.getJ(), d.getK() };
+	double inv[3] = { 1 / dir[0], 1 / dir[1], 1 / dir[2] };
+	double tEnter, tLeave;
+	if (!clip(bounds, o, inv, tMax, tEnter, tLeave)) {
+		return false;
+	}
+
+	typedef BasicSphereSoA<Real> Store;
+	AnyVisit<Real, Store> visit{ cellStore(Real()), s, d, tests, false, double(tMax) };
+	walk(levels[0], o, dir, inv, tEnter, tLeave, visit);
+	return visit.hit;
+}
+
+// The precisions the ray tracer is built with
+template int Grid::closestHit(const Vector& s, const Vector& d, double& t, long long* tests) const;
+template int Grid::closestHit(const VectorF& s, const VectorF& d, float& t, long long* tests) const;
+template bool Grid::anyHit(const Vector& s, const Vector& d, double tMax, long long* tests) const;
+template bool Grid::anyHit(const VectorF& s, const VectorF& d, float tMax, long long* tests) const;
+
+/** Cell geometry in the precision of the query
+*/
+const SphereSoA& Grid::cellStore(double) const
+{
+	return cellSpheres;
+}
+
+const SphereSoAF& Grid::cellStore(float) const
+{
+	return cellSpheresF;
+}
+
+/** Getters for the sizes
+*/
+int Grid::getCellCount() const
+{
+	return int(cells.size());
+}
+
+int Grid::getReferenceCount() const
+{
+	return cellSpheres.size();
+}
+
+/** Bin the centers into a grid of one cell per sphere, and the boxes only by the size of their cell range
+*/
+Grid::Statistics Grid::analyze(const vector<Sphere>& spheres)
+{
+	Statistics statistics;
+	if (spheres.empty()) {
+		return statistics;
+	}
+
+	AABB box;
+	for (const Sphere& sphere : spheres) {
+		Vector center = sphere.position();
+		double r = sphere.radius();
+		box.grow(center - Vector(r, r, r));
+		box.grow(center + Vector(r, r, r));
+	}
+	double extent[3];
+	for (int a = 0; a < 3; a++) {
+		extent[a] = box.max[a] - box.min[a];
+	}
+	int dims[3];
+	resolution(extent, double(spheres.size()), dims);
+	double invCellSize[3];
+	for (int a = 0; a < 3; a++) {
+		invCellSize[a] = extent[a] > 0 ? dims[a] / extent[a] : 0;
+	}
+
+	size_t cellCount = size_t(dims[0]) * dims[1] * dims[2];
+	vector<char> occupied(cellCount, 0);
+	size_t filled = 0;
+	double overlap = 0;
+	for (const Sphere& sphere : spheres) {
+		Vector center = sphere.position();
+		double c[3] = { center.getI(), center.getJ(), center.getK() };
+		double r = sphere.radius();
+		int cell[3];
+		double cellsOverlapped = 1;
+		for (int a = 0; a < 3; a++) {
+			cell[a] = std::max(0, std::min(dims[a] - 1, int(std::floor((c[a] - box.min[a]) * invCellSize[a]))));
+			int lo = std::max(0, int(std::floor((c[a] - r - box.min[a]) * invCellSize[a])));
+			int hi = std::min(dims[a] - 1, int(std::floor((c[a] + r - box.min[a]) * invCellSize[a])));
+			cellsOverlapped *= hi - lo + 1;
+		}
+		overlap += cellsOverlapped;
+		char& mark = occupied[(size_t(cell[2]) * dims[1] + cell[1]) * dims[0] + cell[0]];
+		filled += mark == 0;
+		mark = 1;
+	}
+
+	// A uniform random scene leaves a cell empty with probability exp(-spheres per cell)
+	double expected = 1 - std::exp(-double(spheres.size()) / cellCount);
+	statistics.occupancy = double(filled) / cellCount / expected;
+	statistics.overlap = overlap / spheres.size();
+	return statistics;
+}
+
+/** Numerous, even, small spheres
+*/
+bool Grid::suits(const vector<Sphere>& spheres)
+{
+	if (spheres.size() < SUITS_MIN_SPHERES) {
+		return false;
+	}
+	Statistics statistics = analyze(spheres);
+	return statistics.occupancy >= SUITS_MIN_OCCUPANCY && statistics.overlap <= SUITS_MAX_OVERLAP;
+}
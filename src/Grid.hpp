@@ -0,0 +1,130 @@
+#ifndef _GRID_HPP_
+#define _GRID_HPP_
+
+#include <vector>
+
+#include "BVH.hpp"
+#include "RenderStats.hpp"
+#include "Sphere.hpp"
+#include "SphereSoA.hpp"
+#include "Vector.hpp"
+
+/**
+ * Uniform grid over a list of spheres: the bounds of all spheres are cut into about GRID_DENSITY cells per sphere, every
+ * cell lists the spheres whose bounding box overlaps it, and a ray walks the cells it passes through in order (3D-DDA,
+ * Amanatides & Woo 1987), stopping at the first cell it enters beyond its nearest hit. Building is one counting sort,
+ * so far faster than a BVH; tracing wins over a BVH where spheres are spread evenly and all about the same size
+ * With two levels the top grid is coarser, and each of its cells that lists many spheres gets its own grid, so dense
+ * clumps in a sparse scene are refined where they are rather than everywhere
+ * The sphere geometry is copied into a SphereSoA once per cell listing it, so each cell is tested with the SIMD kernel.
+ * Queries come in double and float precision (Real) like the BVH's; cells are walked in double
+ */
+class Grid
+{
+public:
+	/**
+	 * Density statistics of a sphere list, what Grid::suits decides from
+	 */
+	struct Statistics
+	{
+		double occupancy{ 0 };	// Fraction of the cells of a one cell per sphere grid holding a center, relative to the fraction a uniform random scene would fill (about 1 for even scenes, much less for clumps)
+		double overlap{ 0 };	// Mean number of cells of that grid the bounding box of a sphere overlaps (1 to 8 for spheres smaller than a cell, more for larger ones)
+	};
+
+	/**
+	 * Create an empty grid - call build before querying
+	 */
+	Grid();
+
+	/**
+	 * Build the grid over the bounding boxes of spheres (replaces any previous grid)
+	 * @param levels - 1 for a uniform grid, 2 to refine the crowded cells of a coarser one (other values are clamped)
+	 */
+	void build(const std::vector<Sphere>& spheres, int levels = 1);
+
+	/**
+	 * @return true if there is no grid (nothing built yet, or built from no spheres)
+	 */
+	bool empty() const;
+
+	/**
+	 * Find the nearest sphere that the ray with origin s and unit direction d intersects closer than t
+	 * @param t - distance limit on input (INFINITY for none), set to the distance of the returned sphere's intersection
+	 * @param tests - if given, increased by the number of ray-sphere tests made
+	 * @return index of that sphere in the list the grid was built from, -1 if the ray misses every sphere (t is then unchanged)
+	 */
+	template <typename Real>
+	int closestHit(const BasicVector<Real>& s, const BasicVector<Real>& d, Real& t, long long* tests = nullptr) const;
+
+	/**
+	 * Test whether the ray with origin s and unit direction d intersects any sphere closer than tMax (for shadow rays)
+	 */
+	template <typename Real>
+	bool anyHit(const BasicVector<Real>& s, const BasicVector<Real>& d, Real tMax, long long* tests = nullptr) const;
+
+	/**
+	 * Sizes of the grid: cells of every level (refined cells included), and sphere references (cells listing a sphere,
+	 * summed over all spheres)
+	 */
+	int getCellCount() const;
+	int getReferenceCount() const;
+
+	/**
+	 * @return density statistics of spheres (all 0 for an empty list)
+	 */
+	static Statistics analyze(const std::vector<Sphere>& spheres);
+
+	/**
+	 * Heuristic choice between the grid and the BVH: true if the spheres are numerous, spread evenly (occupancy) and
+	 * small against the spacing between them (overlap), where a grid traces about as fast as the BVH and builds far
+	 * faster. The thresholds come from RayTracerBench grid
+	 */
+	static bool suits(const std::vector<Sphere>& spheres);
+
+private:
+	/**
+	 * Box cut into dims[0] x dims[1] x dims[2] cells of size cellSize, stored x fastest from cells[firstCell]
+	 */
+	struct Level
+	{
+		double origin[3];
+		double cellSize[3];
+		double invCellSize[3];
+		int dims[3];
+		int firstCell;
+	};
+
+	/**
+	 * Spheres getIndex(first .. first + count) of the geometry stores, or (child >= 0) a finer level covering the cell
+	 */
+	struct Cell
+	{
+		int first{ 0 };
+		int count{ 0 };
+		int child{ -1 };
+	};
+
+	std::vector<Level> levels;	// Level 0 is the top grid
+	std::vector<Cell> cells;	// Cells of every level
+	SphereSoA cellSpheres;	// Sphere geometry of every cell in turn
+	SphereSoAF cellSpheresF;	// The same in single precision, for float queries
+	AABB bounds;	// Of every sphere (the top level's box)
+
+	/**
+	 * Walk the cells of level the ray (origin o, direction d, inverse direction inv) passes through between tEnter and
+	 * tLeave, nearest first, calling visit(cell) on each cell with spheres (going into refined cells), until it
+	 * enters a cell beyond visit.limit
+	 * @return true if the walk was stopped, by visit returning true or by visit.limit
+	 */
+	template <typename Visit>
+	bool walk(const Level& level, const double o[3], const double d[3], const double inv[3], double tEnter,
+		double tLeave, Visit& visit) const;
+
+	/**
+	 * @return cellSpheres or cellSpheresF, picked by the type of the (unused) argument
+	 */
+	const SphereSoA& cellStore(double) const;
+	const SphereSoAF& cellStore(float) const;
+};
+
+#endif
@@ -0,0 +1,162 @@
+#include "Heatmap.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <lodepng.h>
+
+using std::string;
+using std::vector;
+
+namespace
+{
+	// Stops of the color scale, evenly spaced from the cheapest pixel (0) to the top of the scale (1)
+	const unsigned char SCALE[][3] = {
+		{ 0, 0, 4 }, { 87, 16, 110 }, { 188, 55, 84 }, { 249, 142, 9 }, { 252, 255, 164 }
+	};
+	const int SCALE_STOPS = 5;
+
+	// 3x5 glyphs for the legend, one row of three bits per byte (bit 2 is the left column)
+	struct Glyph
+	{
+		char character;
+		unsigned char rows[5];
+	};
+	const Glyph FONT[] = {
+		{ '0', { 7, 5, 5, 5, 7 } }, { '1', { 2, 6, 2, 2, 7 } }, { '2', { 7, 1, 7, 4, 7 } }, { '3', { 7, 1, 7, 1, 7 } },
+		{ '4', { 5, 5, 7, 1, 1 } }, { '5', { 7, 4, 7, 1, 7 } }, { '6', { 7, 4, 7, 5, 7 } }, { '7', { 7, 1, 1, 1, 1 } },
+		{ '8', { 7, 5, 7, 5, 7 } }, { '9', { 7, 5, 7, 1, 7 } }, { '.', { 0, 0, 0, 0, 2 } }, { '-', { 0, 0, 7, 0, 0 } },
+		{ '+', { 0, 2, 7, 2, 0 } },
+		{ 't', { 2, 7, 2, 2, 3 } }, { 'e', { 0, 7, 7, 4, 7 } }, { 's', { 0, 3, 6, 1, 6 } }, { 'n', { 0, 6, 5, 5, 5 } }
+	};
+	const int GLYPH_SCALE = 2;	// Each glyph bit is drawn as a GLYPH_SCALE x GLYPH_SCALE square
+	const int GLYPH_ADVANCE = 4 * GLYPH_SCALE;	// Glyph width plus one column of spacing
+
+	// The scale stops at the percentile when the max is more than this many times further above the min
+	const double OUTLIER_RATIO = 2;
+}
+
+/** Find the range of the costs and where the scale stops
+*/
+Heatmap::Heatmap(const vector<double>& costs, int width, int height, HeatmapMetric metric) :
+	costs(costs), width(width), height(height), metric(metric), min(0), max(0), scaleMax(0)
+{
+	if (costs.empty()) {
+		return;
+	}
+	auto range = std::minmax_element(costs.begin(), costs.end());
+	min = *range.first;
+	max = *range.second;
+
+	vector<double> sorted(costs);
+	auto percentile = sorted.begin() + size_t(SCALE_PERCENTILE * (sorted.size() - 1));
+	std::nth_element(sorted.begin(), percentile, sorted.end());
+	scaleMax = max - min > OUTLIER_RATIO * (*percentile - min) && *percentile > min ? *percentile : max;
+}
+
+double Heatmap::getMin() const
+{
+	return min;
+}
+
+double Heatmap::getMax() const
+{
+	return max;
+}
+
+double Heatmap::getScaleMax() const
+{
+	return scaleMax;
+}
+
+/** Interpolate between the two stops around the cost's position on the scale
+*/
+Pixel Heatmap::color(double cost) const
+{
+	double position = scaleMax > min ? (cost - min) / (scaleMax - min) : 0;
+	position = std::min(1.0, std::max(0.0, position)) * (SCALE_STOPS - 1);
+	int stop = std::min(int(position), SCALE_STOPS - 2);
+	double blend = position - stop;
+
+	Pixel pixel;
+	pixel.R = (unsigned char)std::lround(SCALE[stop][0] + blend * (SCALE[stop + 1][0] - SCALE[stop][0]));
+	pixel.G = (unsigned char)std::lround(SCALE[stop][1] + blend * (SCALE[stop + 1][1] - SCALE[stop][1]));
+	pixel.B = (unsigned char)std::lround(SCALE[stop][2] + blend * (SCALE[stop + 1][2] - SCALE[stop][2]));
+	return pixel;
+}
+
+/** Colored costs, then a gray legend band: the scale across the width, the value of each end under it
+*/
+vector<Pixel> Heatmap::image() const
+{
+	vector<Pixel> result(size_t(width) * (height + LEGEND_HEIGHT), Pixel{ 40, 40, 40, 255 });
+	for (size_t i = 0; i < size_t(width) * height; i++) {
+		result[i] = color(costs[i]);
+	}
+
+	for (int x = 0; x < width; x++) {
+		Pixel scale = color(min + (scaleMax - min) * (width > 1 ? double(x) / (width - 1) : 0));
+		for (int y = height + 2; y < height + 10; y++) {
+			result[size_t(y) * width + x] = scale;
+		}
+	}
+
+	string minLabel = label(min);
+	string maxLabel = label(scaleMax, scaleMax < max);
+	drawText(result, 2, height + 12, minLabel);
+	drawText(result, width - 2 - int(maxLabel.size()) * GLYPH_ADVANCE + GLYPH_SCALE, height + 12, maxLabel);
+	return result;
+}
+
+/** lodepng::State so the range can go in tEXt chunks next to the pixels
+*/
+bool Heatmap::saveToPNG(const string& filename) const
+{
+	vector<Pixel> pixels = image();
+	lodepng::State state;
+	lodepng_add_text(&state.info_png, "Title", "RayTracer per-pixel cost heatmap");
+	lodepng_add_text(&state.info_png, "Metric", unit(metric));
+	lodepng_add_text(&state.info_png, "Min", label(min).c_str());
+	lodepng_add_text(&state.info_png, "Max", label(max).c_str());
+	lodepng_add_text(&state.info_png, "Scale max", label(scaleMax).c_str());
+
+	vector<unsigned char> png;
+	unsigned error = lodepng::encode(png, reinterpret_cast<const unsigned char*>(pixels.data()), width,
+		height + LEGEND_HEIGHT, state);
+	return !error && !lodepng::save_file(png, filename);
+}
+
+const char* Heatmap::unit(HeatmapMetric metric)
+{
+	return metric == HeatmapMetric::IntersectionTests ? "tests" : "ns";
+}
+
+/** Characters without a glyph are left blank
+*/
+void Heatmap::drawText(vector<Pixel>& image, int x, int y, const string& text) const
+{
+	int rows = height + LEGEND_HEIGHT;
+	for (char c : text) {
+		for (const Glyph& glyph : FONT) {
+			if (glyph.character != c) {
+				continue;
+			}
+			for (int gy = 0; gy < 5 * GLYPH_SCALE; gy++) {
+				for (int gx = 0; gx < 3 * GLYPH_SCALE; gx++) {
+					int px = x + gx;
+					int py = y + gy;
+					if ((glyph.rows[gy / GLYPH_SCALE] >> (2 - gx / GLYPH_SCALE) & 1) && px >= 0 && px < width && py < rows) {
+						image[size_t(py) * width + px] = Pixel{ 255, 255, 255, 255 };
+					}
+				}
+			}
+		}
+		x += GLYPH_ADVANCE;
+	}
+}
+
+/** Costs are whole tests or nanoseconds
+*/
+string Heatmap::label(double cost, bool clipped) const
+{
+	return std::to_string(std::llround(cost)) + (clipped ? "+ " : " ") + unit(metric);
+}
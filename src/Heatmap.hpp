@@ -0,0 +1,94 @@
+#ifndef _HEATMAP_HPP_
+#define _HEATMAP_HPP_
+
+#include <string>
+#include <vector>
+
+#include "Pixel.hpp"
+
+/**
+ * What the value of each pixel of a cost heatmap measures
+ */
+enum class HeatmapMetric
+{
+	IntersectionTests,	// Ray-sphere tests made for the pixel (primary and shadow rays)
+	Nanoseconds	// Time taken to trace and shade the pixel
+};
+
+/**
+ * Diagnostic image of a per-pixel cost: every pixel is colored on a black - purple - orange - yellow scale from the
+ * cheapest pixel to the top of the scale, with a legend band under the image showing the scale and the values at its
+ * ends. The top of the scale is the max, unless a few outliers (e.g. pixels whose thread was preempted while being
+ * timed) lie far above the rest: it is then the SCALE_PERCENTILE cost, everything above it is drawn in the top color
+ * and the legend marks it with a '+'. The metric, min, max and scale top are also stored in the file as PNG text
+ * chunks
+ */
+class Heatmap
+{
+public:
+	// Height in pixels of the legend band added under the image
+	static const int LEGEND_HEIGHT = 24;
+
+	// Fraction of pixels at or below the top of the scale
+	static constexpr double SCALE_PERCENTILE = 0.999;
+
+	/**
+	 * @param costs - cost of each pixel of a width x height image, row by row (kept by reference, so it must outlive
+	 * the heatmap)
+	 */
+	Heatmap(const std::vector<double>& costs, int width, int height, HeatmapMetric metric);
+
+	/**
+	 * @return cheapest / most expensive pixel cost (both 0 for an empty image)
+	 */
+	double getMin() const;
+	double getMax() const;
+
+	/**
+	 * @return cost at the top of the scale (max, or the SCALE_PERCENTILE cost if that is much lower)
+	 */
+	double getScaleMax() const;
+
+	/**
+	 * @return color of a cost on the scale (clamped to [min, scale max])
+	 */
+	Pixel color(double cost) const;
+
+	/**
+	 * @return the image with its legend: width x (height + LEGEND_HEIGHT) pixels, row by row
+	 */
+	std::vector<Pixel> image() const;
+
+	/**
+	 * Encode image with lodepng
+	 * @return whether the file was written
+	 */
+	bool saveToPNG(const std::string& filename) const;
+
+	/**
+	 * @return unit the costs are in ("tests" or "ns")
+	 */
+	static const char* unit(HeatmapMetric metric);
+
+private:
+	const std::vector<double>& costs;
+	int width;
+	int height;
+	HeatmapMetric metric;
+	double min;
+	double max;
+	double scaleMax;
+
+	/**
+	 * Write text (digits, '.', '-', '+', ' ' and the letters of the units) in white with its top left corner at x, y,
+	 * clipped to the image
+	 */
+	void drawText(std::vector<Pixel>& image, int x, int y, const std::string& text) const;
+
+	/**
+	 * @return a cost as text with its unit, e.g. "1250 tests" ("1250+ tests" if clipped)
+	 */
+	std::string label(double cost, bool clipped = false) const;
+};
+
+#endif
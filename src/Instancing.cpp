@@ -0,0 +1,357 @@
+#include "Instancing.hpp"
+
+#include <algorithm>
+#include <climits>
+#include <math.h>
+
+using std::vector;
+
+/** Identity: no rotation, scale 1, no offset
+*/
+Transform::Transform() :
+	m{ { 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 } }, scale(1), offset(0, 0, 0)
+{}
+
+/** Factory: offset only
+*/
+Transform Transform::translation(const Vector& offset)
+{
+	Transform result;
+	result.offset = offset;
+	return result;
+}
+
+/** Factory: rotation matrix by Rodrigues' formula, R = cos I + sin [k]x + (1 - cos) k k^T for unit axis k
+*/
+Transform Transform::rotation(const Vector& axis, double radians)
+{
+	Transform result;
+	double length = std::sqrt(axis.normSquared());
+	if (!(length > 0)) {
+		return result;
+	}
+	double k[3] = { axis.getI() / length, axis.getJ() / length, axis.getK() / length };
+	double c = std::cos(radians);
+	double s = std::sin(radians);
+	double cross[3][3] = { { 0, -k[2], k[1] }, { k[2], 0, -k[0] }, { -k[1], k[0], 0 } };
+	for (int i = 0; i < 3; i++) {
+		for (int j = 0; j < 3; j++) {
+			result.m[i][j] = (i == j ? c : 0) + s * cross[i][j] + (1 - c) * k[i] * k[j];
+		}
+	}
+	return result;
+}
+
+/** Factory: uniform scale only
+*/
+Transform Transform::scaling(double factor)
+{
+	Transform result;
+	result.scale = factor;
+	return result;
+}
+
+/** this(rhs(p)) = s R (s' R' p + t') + t = (s s') (R R') p + (s R t' + t)
+*/
+Transform Transform::operator*(const Transform& rhs) const
+{
+	Transform result;
+	for (int i = 0; i < 3; i++) {
+		for (int j = 0; j < 3; j++) {
+			result.m[i][j] = m[i][0] * rhs.m[0][j] + m[i][1] * rhs.m[1][j] + m[i][2] * rhs.m[2][j];
+		}
+	}
+	result.scale = scale * rhs.scale;
+	result.offset = apply(rhs.offset);
+	return result;
+}
+
+/** s R p + t
+*/
+Vector Transform::apply(const Vector& p) const
+{
+	double v[3] = { p.getI(), p.getJ(), p.getK() };
+	return Vector(m[0][0] * v[0] + m[0][1] * v[1] + m[0][2] * v[2], m[1][0] * v[0] + m[1][1] * v[1] + m[1][2] * v[2],
+		m[2][0] * v[0] + m[2][1] * v[1] + m[2][2] * v[2]).scalarMult(scale) + offset;
+}
+
+/** R^T (p - t) / s: the inverse of a rotation is its transpose
+*/
+Vector Transform::toLocal(const Vector& p) const
+{
+	return toLocalDirection(p - offset).scalarMult(1 / scale);
+}
+
+/** R^T d, no scale so unit directions stay unit
+*/
+Vector Transform::toLocalDirection(const Vector& d) const
+{
+	double v[3] = { d.getI(), d.getJ(), d.getK() };
+	return Vector(m[0][0] * v[0] + m[1][0] * v[1] + m[2][0] * v[2], m[0][1] * v[0] + m[1][1] * v[1] + m[2][1] * v[2],
+		m[0][2] * v[0] + m[1][2] * v[1] + m[2][2] * v[2]);
+}
+
+/** Getter: scale factor
+*/
+double Transform::getScale() const
+{
+	return scale;
+}
+
+/** Finite everywhere, positive scale
+*/
+bool Transform::valid() const
+{
+	bool finite = std::isfinite(scale) && std::isfinite(offset.getI()) && std::isfinite(offset.getJ()) &&
+		std::isfinite(offset.getK());
+	for (int i = 0; i < 3; i++) {
+		for (int j = 0; j < 3; j++) {
+			finite = finite && std::isfinite(m[i][j]);
+		}
+	}
+	return finite && scale > 0;
+}
+
+/** Create empty scene
+*/
+InstancedScene::InstancedScene() :
+	topOutdated(false), sphereCount(0)
+{}
+
+/** Cluster without a BVH yet
+*/
+int InstancedScene::addCluster(const vector<Sphere>& spheres)
+{
+	if (spheres.empty()) {
+		return -1;
+	}
+	clusters.push_back(Cluster());
+	clusters.back().spheres = spheres;
+	return int(clusters.size()) - 1;
+}
+
+/** Instance numbered after every earlier one
+*/
+bool InstancedScene::addInstance(int cluster, const Transform& transform)
+{
+	if (cluster < 0 || cluster >= clusters.size() || !transform.valid() ||
+		clusters[cluster].spheres.size() > size_t(INT_MAX - sphereCount)) {
+		return false;
+	}
+	instances.push_back(Instance{ cluster, transform, sphereCount });
+	sphereCount += int(clusters[cluster].spheres.size());
+	topOutdated = true;
+	return true;
+}
+
+/** Getters for the counts
+*/
+int InstancedScene::getClusterCount() const
+{
+	return int(clusters.size());
+}
+
+int InstancedScene::getInstanceCount() const
+{
+	return int(instances.size());
+}
+
+int InstancedScene::getSphereCount() const
+{
+	return sphereCount;
+}
+
+/** No instances, nothing to hit
+*/
+bool InstancedScene::empty() const
+{
+	return instances.empty();
+}
+
+/** New instances, or clusters without a BVH
+*/
+bool InstancedScene::outdated() const
+{
+	if (topOutdated) {
+		return true;
+	}
+	for (const Cluster& cluster : clusters) {
+		if (!cluster.built) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/** Bottom level first (the top level needs the cluster bounds), then the 8 transformed corners of each cluster's root
+* box bound its instance
+*/
+void InstancedScene::build(const TileScheduler* scheduler)
+{
+	vector<int> pending;
+	for (int c = 0; c < clusters.size(); c++) {
+		if (!clusters[c].built) {
+			pending.push_back(c);
+		}
+	}
+	auto buildCluster = [&](int job, int) {
+		Cluster& cluster = clusters[pending[job]];
+		cluster.bvh.build(cluster.spheres);
+		cluster.built = true;
+	};
+	if (scheduler) {
+		scheduler->run(int(pending.size()), buildCluster);
+	}
+	else {
+		for (int job = 0; job < pending.size(); job++) {
+			buildCluster(job, 0);
+		}
+	}
+
+	vector<AABB> bounds(instances.size());
+	for (int i = 0; i < instances.size(); i++) {
+		const AABB& local = clusters[instances[i].cluster].bvh.getNodes()[0].bounds;
+		for (int corner = 0; corner < 8; corner++) {
+			Vector p((corner & 1) ? local.max[0] : local.min[0], (corner & 2) ? local.max[1] : local.min[1],
+				(corner & 4) ? local.max[2] : local.min[2]);
+			bounds[i].grow(instances[i].transform.apply(p));
+		}
+	}
+	top.build(bounds);
+	topOutdated = false;
+}
+
+/** Top level nearest box first as in BVH::closestHit; at an instance the ray (and its limit) goes into the
+* cluster's local space, where distances are 1 / scale times the world ones
+*/
+int InstancedScene::closestHit(const Vector& s, const Vector& d, double& t, long long* tests) const
+{
+	const vector<BVH::Node>& nodes = top.getNodes();
+	const vector<int>& indices = top.getIndices();
+	if (nodes.empty()) {
+		return -1;
+	}
+
+	double tEntry;
+	double origin[3] = { s.getI(), s.getJ(), s.getK() };
+	double invDirection[3] = { 1 / d.getI(), 1 / d.getJ(), 1 / d.getK() };
+	if (!nodes[0].bounds.intersect(origin, invDirection, t, tEntry)) {
+		return -1;
+	}
+
+	int hitId = -1;
+	int stack[BVH::MAX_DEPTH + 1];
+	double entry[BVH::MAX_DEPTH + 1];
+	int stackSize = 0;
+	stack[stackSize] = 0;
+	entry[stackSize++] = tEntry;
+	while (stackSize > 0) {
+		stackSize--;
+		if (entry[stackSize] >= t) {
+			continue;
+		}
+		const BVH::Node& node = nodes[stack[stackSize]];
+
+		if (node.count > 0) {
+			for (int k = node.leftFirst; k < node.leftFirst + node.count; k++) {
+				const Instance& instance = instances[indices[k]];
+				double scale = instance.transform.getScale();
+				double localT = t / scale;
+				int local = clusters[instance.cluster].bvh.closestHit(instance.transform.toLocal(s),
+					instance.transform.toLocalDirection(d), localT, tests);
+				if (local >= 0) {
+					t = localT * scale;
+					hitId = instance.firstId + local;
+				}
+			}
+			continue;
+		}
+
+		double tLeft, tRight;
+		bool hitLeft = nodes[node.leftFirst].bounds.intersect(origin, invDirection, t, tLeft);
+		bool hitRight = nodes[node.leftFirst + 1].bounds.intersect(origin, invDirection, t, tRight);
+
+		// Push the farther child first so the nearer one is visited first
+		if (hitLeft && hitRight && tLeft < tRight) {
+			stack[stackSize] = node.leftFirst + 1;
+			entry[stackSize++] = tRight;
+			hitRight = false;
+		}
+		if (hitLeft) {
+			stack[stackSize] = node.leftFirst;
+			entry[stackSize++] = tLeft;
+		}
+		if (hitRight) {
+			stack[stackSize] = node.leftFirst + 1;
+			entry[stackSize++] = tRight;
+		}
+	}
+
+	return hitId;
+}
+
+/** Any order, stopping at the first instance with a hit
+*/
+bool InstancedScene::anyHit(const Vector& s, const Vector& d, double tMax, long long* tests) const
+{
+	const vector<BVH::Node>& nodes = top.getNodes();
+	const vector<int>& indices = top.getIndices();
+	if (nodes.empty()) {
+		return false;
+	}
+
+	double tEntry;
+	double origin[3] = { s.getI(), s.getJ(), s.getK() };
+	double invDirection[3] = { 1 / d.getI(), 1 / d.getJ(), 1 / d.getK() };
+	int stack[BVH::MAX_DEPTH + 1];
+	int stackSize = 0;
+	stack[stackSize++] = 0;
+	while (stackSize > 0) {
+		const BVH::Node& node = nodes[stack[--stackSize]];
+		if (!node.bounds.intersect(origin, invDirection, tMax, tEntry)) {
+			continue;
+		}
+
+		if (node.count > 0) {
+			for (int k = node.leftFirst; k < node.leftFirst + node.count; k++) {
+				const Instance& instance = instances[indices[k]];
+				if (clusters[instance.cluster].bvh.anyHit(instance.transform.toLocal(s),
+					instance.transform.toLocalDirection(d), tMax / instance.transform.getScale(), tests)) {
+					return true;
+				}
+			}
+			continue;
+		}
+
+		stack[stackSize++] = node.leftFirst + 1;
+		stack[stackSize++] = node.leftFirst;
+	}
+
+	return false;
+}
+
+/** The instance is the last one whose first id is at most id
+*/
+Sphere InstancedScene::sphere(int id) const
+{
+	auto after = std::upper_bound(instances.begin(), instances.end(), id,
+		[](int value, const Instance& instance) { return value < instance.firstId; });
+	const Instance& instance = *(after - 1);
+	const Sphere& local = clusters[instance.cluster].spheres[id - instance.firstId];
+	return Sphere(local.radius() * instance.transform.getScale(), instance.transform.apply(local.position()),
+		local.color(), local.ambient());
+}
+
+/** Every instance's spheres in turn
+*/
+vector<Sphere> InstancedScene::expand() const
+{
+	vector<Sphere> spheres;
+	spheres.reserve(sphereCount);
+	for (const Instance& instance : instances) {
+		for (int n = 0; n < clusters[instance.cluster].spheres.size(); n++) {
+			spheres.push_back(sphere(instance.firstId + n));
+		}
+	}
+	return spheres;
+}
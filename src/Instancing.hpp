@@ -0,0 +1,159 @@
+#ifndef _INSTANCING_HPP_
+#define _INSTANCING_HPP_
+
+#include <vector>
+
+#include "BVH.hpp"
+#include "Sphere.hpp"
+#include "TileScheduler.hpp"
+#include "Vector.hpp"
+
+/**
+ * Similarity transform p -> scale * R * p + offset, with R a rotation and scale > 0: the transforms that keep a sphere
+ * a sphere (of radius scale * r). Transforms compose with *, the right operand applied first
+ */
+class Transform
+{
+public:
+	/**
+	 * Create the identity
+	 */
+	Transform();
+
+	/**
+	 * Transforms that move by offset, rotate by radians counter-clockwise about axis (through the origin, need not be
+	 * unit length; a zero axis gives the identity) and scale by factor about the origin
+	 */
+	static Transform translation(const Vector& offset);
+	static Transform rotation(const Vector& axis, double radians);
+	static Transform scaling(double factor);
+
+	/**
+	 * @return the transform that applies rhs, then this
+	 */
+	Transform operator*(const Transform& rhs) const;
+
+	/**
+	 * @return point p transformed
+	 */
+	Vector apply(const Vector& p) const;
+
+	/**
+	 * @return the point (direction) that the transform maps to world point p (direction d). A unit direction stays unit
+	 * length; distances along it shrink by getScale
+	 */
+	Vector toLocal(const Vector& p) const;
+	Vector toLocalDirection(const Vector& d) const;
+
+	/**
+	 * @return the scale factor
+	 */
+	double getScale() const;
+
+	/**
+	 * @return true if every component is finite and the scale is positive
+	 */
+	bool valid() const;
+
+private:
+	double m[3][3];	// Rotation, row-major
+	double scale;	// Uniform scale, applied after the rotation
+	Vector offset;	// Translation, applied last
+};
+
+/**
+ * Two-level scene of instanced sphere clusters: every cluster (a group of spheres in its own local space) gets one
+ * bottom-level BVH, built once however many times it is placed, and the instances (a cluster and a transform into
+ * the world) get a top-level BVH over their world bounds. A ray goes down the top level, and at each instance it meets
+ * goes on in that cluster's BVH in local space, so a thousand copies of a cluster cost a thousand boxes rather than
+ * a thousand times its spheres
+ * Every world sphere has an id: instances number theirs consecutively, in the order they were added, and within an
+ * instance in the cluster's order
+ */
+class InstancedScene
+{
+public:
+	InstancedScene();
+
+	/**
+	 * Add a cluster of spheres (in local coordinates) - call build before querying
+	 * @return id of the cluster, -1 (and nothing changes) if spheres is empty
+	 */
+	int addCluster(const std::vector<Sphere>& spheres);
+
+	/**
+	 * Place a copy of cluster in the world through transform - call build before querying
+	 * @return false (and nothing changes) if there is no such cluster, the transform is not valid or the scene would
+	 * have more spheres than an int can number
+	 */
+	bool addInstance(int cluster, const Transform& transform);
+
+	/**
+	 * Counts of clusters, instances and world spheres (the sum of every instance's cluster size)
+	 */
+	int getClusterCount() const;
+	int getInstanceCount() const;
+	int getSphereCount() const;
+
+	/**
+	 * @return true if there are no instances
+	 */
+	bool empty() const;
+
+	/**
+	 * @return true if clusters or instances were added since the last build
+	 */
+	bool outdated() const;
+
+	/**
+	 * Build the BVH of every cluster not built yet, then the top level over all instances
+	 * @param scheduler - if given, the clusters are built in parallel on its worker threads
+	 */
+	void build(const TileScheduler* scheduler = nullptr);
+
+	/**
+	 * Find the nearest world sphere that the ray with origin s and unit direction d intersects closer than t
+	 * @param t - distance limit on input (INFINITY for none), set to the distance of the returned sphere's intersection
+	 * @param tests - if given, increased by the number of ray-sphere tests made
+	 * @return id of that sphere, -1 if the ray misses every sphere (t is then unchanged)
+	 */
+	int closestHit(const Vector& s, const Vector& d, double& t, long long* tests = nullptr) const;
+
+	/**
+	 * Test whether the ray with origin s and unit direction d intersects any world sphere closer than tMax
+	 */
+	bool anyHit(const Vector& s, const Vector& d, double tMax, long long* tests = nullptr) const;
+
+	/**
+	 * @return world sphere id (0 <= id < getSphereCount()): the cluster's sphere moved, rotated and scaled by its instance
+	 */
+	Sphere sphere(int id) const;
+
+	/**
+	 * @return every world sphere, in id order (what the scene would take without instancing)
+	 */
+	std::vector<Sphere> expand() const;
+
+private:
+	struct Cluster
+	{
+		std::vector<Sphere> spheres;	// Local coordinates
+		BVH bvh;	// Over spheres
+		bool built{ false };
+	};
+
+	struct Instance
+	{
+		int cluster;
+		Transform transform;	// Local to world
+		int firstId;	// World id of the cluster's first sphere
+	};
+
+	std::vector<Cluster> clusters;
+	std::vector<Instance> instances;
+	BVH top;	// Over the world bounds of instances (its indices are instance indices)
+	bool topOutdated;	// true if instances were added since top was built
+	int sphereCount;	// Sum of the instances' cluster sizes
+};
+
+#endif
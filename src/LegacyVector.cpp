@@ -1,19 +1,19 @@
 #include <math.h>
 
-#include "Vector.hpp"
+#include "LegacyVector.hpp"
 
 using std::endl;
 
 /**
 Default constructor to set all vector components to 0
 */
-Vector::Vector() : vx(0), vy(0), vz(0) {
+LegacyVector::LegacyVector() : vx(0), vy(0), vz(0) {
 }
 
 /**
 Three-argument constructor to set vector components to user-defined values
 */
-Vector::Vector(double vx, double vy, double vz)
+LegacyVector::LegacyVector(double vx, double vy, double vz)
 {
 	this->vx = vx;
 	this->vy = vy;
@@ -23,7 +23,7 @@ Vector::Vector(double vx, double vy, double vz)
 /**
 return vector i-component scalar
 */
-double Vector::getI() const
+double LegacyVector::getI() const
 {
 	return vx;
 }
@@ -31,7 +31,7 @@ double Vector::getI() const
 /**
 return vector j-component scalar
 */
-double Vector::getJ() const
+double LegacyVector::getJ() const
 {
 	return vy;
 }
@@ -39,7 +39,7 @@ double Vector::getJ() const
 /**
 return vector k-component scalar
 */
-double Vector::getK() const
+double LegacyVector::getK() const
 {
 	return vz;
 }
@@ -47,7 +47,7 @@ double Vector::getK() const
 /**
 set vector i-component scalar
 */
-void Vector::setI(double newVx)
+void LegacyVector::setI(double newVx)
 {
 	vx = newVx;
 }
@@ -55,7 +55,7 @@ void Vector::setI(double newVx)
 /**
 set vector j-component scalar
 */
-void Vector::setJ(double newVy)
+void LegacyVector::setJ(double newVy)
 {
 	vy = newVy;
 }
@@ -63,7 +63,7 @@ void Vector::setJ(double newVy)
 /**
 set vector k-component scalar
 */
-void Vector::setK(double newVz)
+void LegacyVector::setK(double newVz)
 {
 	vz = newVz;
 }
@@ -71,7 +71,7 @@ void Vector::setK(double newVz)
 /**
 Determine if two vectors are equal, meaning that all of their vector components are equal, returning true if equal and false otherwise
 */
-bool Vector::equal(const Vector& rhs) const
+bool LegacyVector::equal(const LegacyVector& rhs) const
 {
 	return (getI() == rhs.getI() && getJ() == rhs.getJ() && getK() == rhs.getK());
 }
@@ -79,31 +79,31 @@ bool Vector::equal(const Vector& rhs) const
 /**
 Add two vectors together by adding their vector components together and return the summed vector result
 */
-Vector Vector::operator+(const Vector& rhs) const
+LegacyVector LegacyVector::operator+(const LegacyVector& rhs) const
 {
-	return Vector(getI() + rhs.getI(), getJ() + rhs.getJ(), getK() + rhs.getK());
+	return LegacyVector(getI() + rhs.getI(), getJ() + rhs.getJ(), getK() + rhs.getK());
 }
 
 /**
 Subtract two vectors by subtracting their vector components and return the difference vector result
 */
-Vector Vector::operator-(const Vector& rhs) const
+LegacyVector LegacyVector::operator-(const LegacyVector& rhs) const
 {
-	return Vector(getI() - rhs.getI(), getJ() - rhs.getJ(), getK() - rhs.getK());
+	return LegacyVector(getI() - rhs.getI(), getJ() - rhs.getJ(), getK() - rhs.getK());
 }
 
 /**
 Find the cross product of two vectors and return the vector output
 */
-Vector Vector::cross(const Vector& rhs) const
+LegacyVector LegacyVector::cross(const LegacyVector& rhs) const
 {
-	return Vector(getJ() * rhs.getK() - getK() * rhs.getJ(), getK() * rhs.getI() - getI() * rhs.getK(), getI() * rhs.getJ() - getJ() * rhs.getI());
+	return LegacyVector(getJ() * rhs.getK() - getK() * rhs.getJ(), getK() * rhs.getI() - getI() * rhs.getK(), getI() * rhs.getJ() - getJ() * rhs.getI());
 }
 
 /**
 Find the dot product of two vectors and return the scalar output
 */
-double Vector::operator*(const Vector& rhs) const
+double LegacyVector::operator*(const LegacyVector& rhs) const
 {
 	return (getI() * rhs.getI() + getJ() * rhs.getJ() + getK() * rhs.getK());
 }
@@ -111,15 +111,15 @@ double Vector::operator*(const Vector& rhs) const
 /**
 Scalar multiplication of a vector
 */
-Vector Vector::scalarMult(const double& mult) const
+LegacyVector LegacyVector::scalarMult(const double& mult) const
 {
-	return Vector(getI() * mult, getJ() * mult, getK() * mult);
+	return LegacyVector(getI() * mult, getJ() * mult, getK() * mult);
 }
 
 /**
 Calculate the norm of a vector and return the scalar output
 */
-double Vector::norm() const
+double LegacyVector::norm() const
 {
 	double result = sqrt(pow(getI(), 2) + pow(getJ(), 2) + pow(getK(), 2));
 	if (isfinite(result)) {
@@ -133,7 +133,7 @@ double Vector::norm() const
 /**
 Calculate the angle between two vectors and return the angle output in radians
 */
-double Vector::angle(const Vector& rhs) const
+double LegacyVector::angle(const LegacyVector& rhs) const
 {
 	if (*this * rhs == 0 && (norm() * rhs.norm() == 0)) {
 		return -1;
@@ -147,17 +147,17 @@ double Vector::angle(const Vector& rhs) const
 	else {
 		return -1;
 	}
-}
-
-/**	Calculate unit vector: v / ||v|| 
-*/
-Vector Vector::formUnitVector() const
-{
-	return scalarMult(1 / norm());
+}
+
+/**	Calculate unit vector: v / ||v|| 
+*/
+LegacyVector LegacyVector::formUnitVector() const
+{
+	return scalarMult(1 / norm());
 }
 
 
-void Vector::output(std::ostream& out) const
+void LegacyVector::output(std::ostream& out) const
 {
 	out << vx << "i + " << vy << "j + " << vz << "k" << endl;
 }
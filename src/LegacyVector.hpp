@@ -0,0 +1,133 @@
+#ifndef _LEGACYVECTOR_HPP_
+#define _LEGACYVECTOR_HPP_
+
+#include <iostream>
+
+/**
+ * The original out-of-line Vector (every operation in LegacyVector.cpp, norm() through pow), kept only as the baseline
+ * for RayTracerVectorBench. Use Vector everywhere else
+ */ 
+class LegacyVector
+{
+public:
+  /**
+   * Default constructor. It should set the scalar components to 0.
+   */ 
+  LegacyVector();
+  
+  /**
+   * @param vx - the scalar value to use for i component
+   * @param vy - the scalar value to use for j component
+   * @param vz - the scalar value to use for k component
+   */ 
+  LegacyVector( double vx, double vy, double vz );
+
+  /**
+   * Returns the scalar of the i component
+   * @return vx.
+   */ 
+  double getI() const;
+
+  /**
+   * Returns the scalar of the j component
+   * @return vy.
+   */ 
+  double getJ() const;
+
+  /**
+   * Returns the scalar of the k component
+   * @return vz.
+   */ 
+  double getK() const;
+
+  /**
+   * Updates the scalar of the i component to the given newVx parameter.
+   * @param newVx - the new value to use for the vx field.
+   */ 
+  void setI(double newVx);
+  
+  /**
+   * Updates the scalar of the i component to the given newVx parameter.
+   * @param newVy - the new value to use for the vx field.
+   */ 
+  void setJ(double newVy);
+
+  /**
+   * Updates the scalar of the i component to the given newVx parameter.
+   * @param newVz - the new value to use for the vx field.
+   */ 
+  void setK(double newVz);
+  
+  /**
+   * Returns true if the scalar components for this object and rhs are the same, false otherwise.
+   * @return true if scalar components in both objects are the same.
+   */ 
+  bool equal( const LegacyVector& rhs ) const;
+
+  /**
+   * Creates and returns a new LegacyVector object representing the vector addition of two LegacyVector objects
+   * @return a new LegacyVector object that contains the appropriate summed components
+   * @param rhs - the LegacyVector object to add to this object.
+   */
+  LegacyVector operator+( const LegacyVector &rhs ) const;
+
+  /**
+   * Creates and returns a new LegacyVector object representing the vector subtraction of two LegacyVector objects
+   * @return a new LegacyVector object that contains the appropriate difference components
+   * @param rhs - the LegacyVector object to subtract from this object.
+   */
+  LegacyVector operator-( const LegacyVector &rhs ) const;
+
+  /**
+   * Creates and returns a new LegacyVector object that is cross product of this and the given LegacyVector object.
+   * @return a new LegacyVector object that contains the cross product of this and the given LegacyVector object.
+   * @param rhs - the LegacyVector object to cross with this object.
+   */
+  LegacyVector cross( const LegacyVector &rhs ) const;
+
+  /**
+   * Returns the dot product of this and the given LegacyVector object.
+   * @return the dot product of this and the given LegacyVector object.
+   * @param rhs - the LegacyVector object to dot with this object.
+   */
+  double operator*( const LegacyVector &rhs ) const;
+
+  /**
+  *	@return a vector multiplied by a scalar
+  * @param mult - scalar multiplier
+  */
+  LegacyVector scalarMult(const double& mult) const;
+
+  /**
+   * Returns the norm of the LegacyVector object.
+   * @return the norm (-1 if magnitude undefined)
+   */
+  double norm() const;
+
+  /**
+   * Returns the angle between two LegacyVector objects in radians (over interval [0,2*pi)).
+   * @param rhs - the LegacyVector object to find the angle between with this object.
+   * @return the angle (-1 if angle undefined)
+   */
+  double angle(const LegacyVector &rhs) const;
+
+  /**
+  * Used to calculate the unit vector of any vector
+  * @return unit vector of any vector (length 1, same direction)
+  */
+  LegacyVector formUnitVector() const;
+
+  /**
+   * Outputs this LegacyVector object on the given ostream.  ``vxi + vyj + vzk'' (for debugging).
+   * @param out - the ostream object to use to output.
+   */ 
+  void output( std::ostream &out ) const;
+
+private:
+
+  double vx;
+  double vy;
+  double vz;
+};
+
+#endif
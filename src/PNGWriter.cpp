@@ -0,0 +1,391 @@
+#include "PNGWriter.hpp"
+
+#include <cstdlib>
+#include <string.h>
+
+using std::string;
+using std::vector;
+
+namespace
+{
+	// Compress once this many filtered bytes are pending (lodepng's deflate prefers blocks of 64 - 256 KB)
+	const size_t PIECE_SIZE = 256 * 1024;
+	// Deflate window: the most that any later piece can refer back to
+	const size_t WINDOW_SIZE = 32768;
+
+	void putBigEndian(unsigned char* out, unsigned value)
+	{
+		out[0] = (unsigned char)(value >> 24);
+		out[1] = (unsigned char)(value >> 16);
+		out[2] = (unsigned char)(value >> 8);
+		out[3] = (unsigned char)value;
+	}
+
+	/** adler32 of A followed by B from the adler32s of A and B and the length of B (as zlib's adler32_combine)
+	*/
+	unsigned adler32Combine(unsigned adler1, unsigned adler2, size_t length2)
+	{
+		const unsigned long BASE = 65521;
+		unsigned long rem = length2 % BASE;
+		unsigned long sum1 = adler1 & 0xffff;
+		unsigned long sum2 = (rem * sum1) % BASE;
+		sum1 += (adler2 & 0xffff) + BASE - 1;
+		sum2 += ((adler1 >> 16) & 0xffff) + ((adler2 >> 16) & 0xffff) + BASE - rem;
+		if (sum1 >= BASE) {
+			sum1 -= BASE;
+		}
+		if (sum1 >= BASE) {
+			sum1 -= BASE;
+		}
+		if (sum2 >= 2 * BASE) {
+			sum2 -= 2 * BASE;
+		}
+		if (sum2 >= BASE) {
+			sum2 -= BASE;
+		}
+		return unsigned(sum1 | (sum2 << 16));
+	}
+
+	unsigned char paeth(int a, int b, int c)
+	{
+		int p = a + b - c;
+		int pa = std::abs(p - a);
+		int pb = std::abs(p - b);
+		int pc = std::abs(p - c);
+		if (pa <= pb && pa <= pc) {
+			return (unsigned char)a;
+		}
+		return (unsigned char)(pb <= pc ? b : c);
+	}
+}
+
+/** Nothing open yet
+*/
+PNGWriter::PNGWriter() : width(0), height(0), rowsWritten(0), failed(false), pendingStart(0), adler(1)
+{
+	lodepng_compress_settings_init(&settings);
+	setCompressionLevel(6);
+}
+
+/** Release the file
+*/
+PNGWriter::~PNGWriter()
+{
+	if (file.is_open()) {
+		file.close();
+	}
+}
+
+/** Signature, IHDR (8 bit RGBA, no interlacing) and the zlib header of the image data
+*/
+bool PNGWriter::open(const string& filename, int width, int height)
+{
+	this->width = width;
+	this->height = height;
+	rowsWritten = 0;
+	failed = false;
+	adler = 1;
+	pendingStart = 0;
+	filtered.clear();
+	previousRow.clear();
+
+	file.open(filename.c_str(), std::ios::binary | std::ios::trunc);
+	if (!file.is_open() || width <= 0 || height <= 0) {
+		failed = true;
+		return false;
+	}
+
+	const unsigned char signature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+	file.write(reinterpret_cast<const char*>(signature), 8);
+
+	unsigned char header[13];
+	putBigEndian(header, unsigned(width));
+	putBigEndian(header + 4, unsigned(height));
+	header[8] = 8;	// bit depth
+	header[9] = 6;	// color type RGBA
+	header[10] = 0;	// compression method
+	header[11] = 0;	// filter method
+	header[12] = 0;	// no interlacing
+	writeChunk("IHDR", header, 13);
+
+	// zlib header: deflate with 32 KB window, no preset dictionary
+	const unsigned char zlibHeader[2] = { 120, 1 };
+	writeChunk("IDAT", zlibHeader, 2);
+
+	return !failed;
+}
+
+/** Filter the rows into the pending buffer, compressing whenever a full piece is pending
+*/
+bool PNGWriter::writeRows(const unsigned char* rgba, int rows)
+{
+	if (failed || !file.is_open() || rowsWritten + rows > height) {
+		return false;
+	}
+
+	size_t rowBytes = size_t(width) * 4;
+	candidates.resize(rowBytes);
+	for (int r = 0; r < rows; r++) {
+		const unsigned char* row = rgba + r * rowBytes;
+
+		size_t start = filtered.size();
+		filtered.resize(start + 1 + rowBytes);
+		filterRow(&filtered[start], row, previousRow.empty() ? nullptr : previousRow.data(), width, candidates.data());
+		previousRow.assign(row, row + rowBytes);
+
+		if (filtered.size() - pendingStart >= PIECE_SIZE) {
+			compressPending(false);
+		}
+	}
+	rowsWritten += rows;
+
+	return !failed;
+}
+
+/** Deflate fixed size pieces of the filtered image on the scheduler's workers, each filtering just the rows it needs
+*/
+bool PNGWriter::writeImage(const unsigned char* rgba, const TileScheduler& scheduler)
+{
+	if (failed || !file.is_open() || rowsWritten != 0) {
+		return false;
+	}
+
+	// Every row only needs the row above from the unfiltered image, so each piece filters its own rows (and those of
+	// the 32 KB before it) into its worker's scratch: rows in a window are filtered twice, but the filtered image is
+	// never held whole
+	size_t rowBytes = size_t(width) * 4;
+	size_t filteredRowBytes = 1 + rowBytes;
+	size_t totalSize = height * filteredRowBytes;
+	size_t scratchSize = WINDOW_SIZE + PIECE_SIZE + 2 * filteredRowBytes;
+	candidates.resize(scheduler.getThreadCount() * rowBytes);
+	pieceRows.resize(scheduler.getThreadCount() * scratchSize);
+
+	// Piece boundaries do not depend on the thread count, so neither does the file
+	// Deflated bytes, adler32 of the input and lodepng error of each piece
+	struct Piece
+	{
+		unsigned char* output;
+		size_t outputSize;
+		unsigned adler;
+		unsigned error;
+	};
+	int pieceCount = int((totalSize + PIECE_SIZE - 1) / PIECE_SIZE);
+	vector<Piece> pieces(pieceCount, Piece{ nullptr, 0, 1, 0 });
+	scheduler.run(pieceCount, [&](int piece, int worker) {
+		size_t start = piece * PIECE_SIZE;
+		size_t end = start + PIECE_SIZE < totalSize ? start + PIECE_SIZE : totalSize;
+		size_t dictionary = start > WINDOW_SIZE ? start - WINDOW_SIZE : 0;
+
+		// Rows holding bytes [dictionary, end) of the filtered image, so scratch starts at byte base of it
+		int firstRow = int(dictionary / filteredRowBytes);
+		int lastRow = int((end - 1) / filteredRowBytes);
+		size_t base = firstRow * filteredRowBytes;
+		unsigned char* scratch = &pieceRows[worker * scratchSize];
+		for (int y = firstRow; y <= lastRow; y++) {
+			filterRow(scratch + (y - firstRow) * filteredRowBytes, rgba + y * rowBytes,
+				y > 0 ? rgba + (y - 1) * rowBytes : nullptr, width, &candidates[worker * rowBytes]);
+		}
+
+		pieces[piece].error = lodepng_deflate_piece(&pieces[piece].output, &pieces[piece].outputSize, scratch,
+			dictionary - base, start - base, end - base, 0, &settings);
+		pieces[piece].adler = lodepng_update_adler32(1, scratch + (start - base), end - start);
+	});
+
+	for (int piece = 0; piece < pieceCount; piece++) {
+		if (pieces[piece].error != 0) {
+			failed = true;
+		}
+		if (!failed) {
+			writeChunk("IDAT", pieces[piece].output, pieces[piece].outputSize);
+			size_t length = (piece + 1) * PIECE_SIZE < totalSize ? PIECE_SIZE : totalSize - piece * PIECE_SIZE;
+			adler = adler32Combine(adler, pieces[piece].adler, length);
+		}
+		free(pieces[piece].output);
+	}
+	rowsWritten = height;
+
+	return !failed;
+}
+
+/** Last piece (ends the deflate stream), adler32 of the uncompressed data, IEND
+*/
+bool PNGWriter::close()
+{
+	if (!file.is_open()) {
+		return false;
+	}
+	if (rowsWritten != height) {
+		failed = true;
+	}
+
+	if (!failed) {
+		compressPending(true);
+
+		unsigned char checksum[4];
+		putBigEndian(checksum, adler);
+		writeChunk("IDAT", checksum, 4);
+		writeChunk("IEND", nullptr, 0);
+	}
+
+	file.close();
+	return !failed && !file.fail();
+}
+
+/** Map the level onto lodepng's deflate settings (block type, LZ77 window, match lengths, lazy matching)
+*/
+void PNGWriter::setCompressionLevel(int level)
+{
+	if (level < 0) {
+		level = 0;
+	}
+	if (level > 9) {
+		level = 9;
+	}
+	compressionLevel = level;
+
+	// windowsize, nicematch, lazymatching for levels 1 - 9 (level 6 is lodepng's default)
+	const unsigned levels[9][3] = {
+		{ 256, 32, 0 }, { 512, 32, 0 }, { 1024, 64, 0 },
+		{ 1024, 128, 1 }, { 2048, 64, 1 }, { 2048, 128, 1 },
+		{ 8192, 128, 1 }, { 16384, 258, 1 }, { 32768, 258, 1 }
+	};
+	if (level == 0) {
+		settings.btype = 0;
+		return;
+	}
+	settings.btype = 2;
+	settings.windowsize = levels[level - 1][0];
+	settings.nicematch = levels[level - 1][1];
+	settings.lazymatching = levels[level - 1][2];
+}
+
+int PNGWriter::getCompressionLevel() const
+{
+	return compressionLevel;
+}
+
+/** Length, type, data and CRC of type + data
+*/
+void PNGWriter::writeChunk(const char* type, const unsigned char* data, size_t size)
+{
+	unsigned char length[4];
+	putBigEndian(length, unsigned(size));
+	file.write(reinterpret_cast<const char*>(length), 4);
+	file.write(type, 4);
+	if (size > 0) {
+		file.write(reinterpret_cast<const char*>(data), size);
+	}
+
+	// The CRC covers the type and the data, run on from one to the other
+	unsigned checksum = lodepng_update_crc32(0, reinterpret_cast<const unsigned char*>(type), 4);
+	checksum = lodepng_update_crc32(checksum, data, size);
+	unsigned char crc[4];
+	putBigEndian(crc, checksum);
+	file.write(reinterpret_cast<const char*>(crc), 4);
+
+	if (file.fail()) {
+		failed = true;
+	}
+}
+
+/** Deflate the pending bytes as one piece primed with the bytes before it, then slide the window
+*/
+void PNGWriter::compressPending(bool final)
+{
+	if (failed) {
+		return;
+	}
+
+	unsigned char* out = nullptr;
+	size_t outSize = 0;
+	unsigned error = lodepng_deflate_piece(&out, &outSize, filtered.data(), 0, pendingStart, filtered.size(), final ? 1 : 0, &settings);
+	if (error == 0) {
+		writeChunk("IDAT", out, outSize);
+	}
+	else {
+		failed = true;
+	}
+	free(out);
+
+	adler = lodepng_update_adler32(adler, filtered.data() + pendingStart, filtered.size() - pendingStart);
+
+	// Keep only the last WINDOW_SIZE bytes, the most the next piece can refer back to
+	if (filtered.size() > WINDOW_SIZE) {
+		filtered.erase(filtered.begin(), filtered.end() - WINDOW_SIZE);
+	}
+	pendingStart = filtered.size();
+}
+
+/** Try every filter type and keep the one with the smallest sum of |filtered byte| (as signed bytes)
+*/
+void PNGWriter::filterRow(unsigned char* out, const unsigned char* row, const unsigned char* previous, int width,
+	unsigned char* candidate)
+{
+	const int bpp = 4;
+	int rowBytes = width * bpp;
+
+	unsigned long bestSum = 0;
+	for (int type = 0; type < 5; type++) {
+		unsigned char* f = candidate;
+		// One loop per filter so the inner loops stay branch free; the first pixel has nothing to its left
+		switch (type) {
+		case 0:
+			memcpy(f, row, rowBytes);
+			break;
+		case 1:
+			memcpy(f, row, bpp);
+			for (int i = bpp; i < rowBytes; i++) {
+				f[i] = (unsigned char)(row[i] - row[i - bpp]);
+			}
+			break;
+		case 2:
+			for (int i = 0; i < rowBytes; i++) {
+				f[i] = (unsigned char)(row[i] - (previous ? previous[i] : 0));
+			}
+			break;
+		case 3:
+			if (previous) {
+				for (int i = 0; i < bpp; i++) {
+					f[i] = (unsigned char)(row[i] - previous[i] / 2);
+				}
+				for (int i = bpp; i < rowBytes; i++) {
+					f[i] = (unsigned char)(row[i] - (row[i - bpp] + previous[i]) / 2);
+				}
+			}
+			else {
+				memcpy(f, row, bpp);
+				for (int i = bpp; i < rowBytes; i++) {
+					f[i] = (unsigned char)(row[i] - row[i - bpp] / 2);
+				}
+			}
+			break;
+		case 4:
+			if (previous) {
+				for (int i = 0; i < bpp; i++) {
+					f[i] = (unsigned char)(row[i] - previous[i]);	// paeth(0, b, 0) = b
+				}
+				for (int i = bpp; i < rowBytes; i++) {
+					f[i] = (unsigned char)(row[i] - paeth(row[i - bpp], previous[i], previous[i - bpp]));
+				}
+			}
+			else {
+				// paeth(a, 0, 0) = a: same as the sub filter
+				memcpy(f, row, bpp);
+				for (int i = bpp; i < rowBytes; i++) {
+					f[i] = (unsigned char)(row[i] - row[i - bpp]);
+				}
+			}
+			break;
+		}
+
+		unsigned long sum = 0;
+		for (int i = 0; i < rowBytes; i++) {
+			sum += f[i] < 128 ? f[i] : 256 - f[i];
+		}
+		if (type == 0 || sum < bestSum) {
+			bestSum = sum;
+			out[0] = (unsigned char)type;
+			memcpy(out + 1, f, rowBytes);
+		}
+	}
+}
@@ -0,0 +1,102 @@
+#ifndef _PNGWRITER_HPP_
+#define _PNGWRITER_HPP_
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <lodepng.h>
+
+#include "TileScheduler.hpp"
+
+/**
+ * Writes an RGBA8 PNG to disk a few rows at a time. Each batch of rows is filtered and deflated (with lodepng's
+ * deflate) as soon as enough of it is available and written out as an IDAT chunk, so memory use depends on the image
+ * width rather than on the whole image size. A whole image can instead be given at once with writeImage, which filters
+ * and deflates it on all worker threads (pigz style: independent pieces, each primed with the 32 KB before it)
+ */
+class PNGWriter
+{
+public:
+	/**
+	 * Writer with nothing open
+	 */
+	PNGWriter();
+
+	/**
+	 * Closes the file if still open (without finishing the image)
+	 */
+	~PNGWriter();
+
+	/**
+	 * Create the file and write the PNG signature and header for a width x height RGBA8 image
+	 * @return whether the file could be created
+	 */
+	bool open(const std::string& filename, int width, int height);
+
+	/**
+	 * Add the next rows of the image (top to bottom)
+	 * @param rgba - rows * width pixels, 4 bytes (R, G, B, A) each, row by row
+	 * @return false if writing failed or more rows were given than the image has
+	 */
+	bool writeRows(const unsigned char* rgba, int rows);
+
+	/**
+	 * Add every row of the image at once (instead of writeRows), filtering and compressing pieces of it in parallel. The
+	 * file is the same whatever the thread count
+	 * @param rgba - width * height pixels, 4 bytes (R, G, B, A) each, row by row
+	 * @return false if writing failed or rows were already written
+	 */
+	bool writeImage(const unsigned char* rgba, const TileScheduler& scheduler);
+
+	/**
+	 * Finish the compressed data and the file. All rows must have been written
+	 * @return whether the complete PNG was written
+	 */
+	bool close();
+
+	/**
+	 * Apply the PNG filter (0 - 4) that gives the smallest sum of absolute differences to one row, like lodepng does
+	 * @param out - 1 + 4 * width bytes: the filter type followed by the filtered row
+	 * @param previous - row above (nullptr for the first row)
+	 * @param candidate - 4 * width bytes of scratch space for the filter being tried
+	 */
+	static void filterRow(unsigned char* out, const unsigned char* row, const unsigned char* previous, int width,
+		unsigned char* candidate);
+
+	/**
+	 * Trade speed for file size like zlib's levels: 0 stores the data uncompressed, 1 is fastest, 9 compresses best.
+	 * The default, 6, uses lodepng's own settings. Set before writing any rows
+	 */
+	void setCompressionLevel(int level);
+	int getCompressionLevel() const;
+
+private:
+	std::ofstream file;
+	int width;
+	int height;
+	int rowsWritten;
+	bool failed;	// true once any write failed
+
+	std::vector<unsigned char> previousRow;	// Last row written, needed to filter the next one
+	std::vector<unsigned char> candidates;	// filterRow scratch, one row per worker, kept so no row allocates
+	std::vector<unsigned char> filtered;	// Filtered bytes: up to 32 KB already compressed (the LZ77 window) then pending ones
+	std::vector<unsigned char> pieceRows;	// writeImage scratch, one per worker: filtered rows of its piece and the 32 KB before
+	size_t pendingStart;	// Position in filtered of the first byte not compressed yet
+	unsigned adler;	// Running adler32 of all filtered bytes
+	int compressionLevel;
+	LodePNGCompressSettings settings;	// Deflate settings for compressionLevel
+
+	/**
+	 * Write one PNG chunk (length, type, data, crc), straight from data
+	 */
+	void writeChunk(const char* type, const unsigned char* data, size_t size);
+
+	/**
+	 * Compress the pending filtered bytes into an IDAT chunk, keeping the last 32 KB as the next LZ77 window
+	 * @param final - true for the last piece of the image, which ends the deflate stream
+	 */
+	void compressPending(bool final);
+};
+
+#endif
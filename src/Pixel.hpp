@@ -1,6 +1,8 @@
 #ifndef _PIXEL_HPP_
 #define _PIXEL_HPP_
 
+#include <type_traits>
+
 /** 
 * Simple structure to store a pixel's RGBA values for the Ray Tracing program
 * Black by default RGBA = {0, 0, 0, 255}
@@ -13,4 +15,8 @@ struct Pixel
 	unsigned char A{ 255 };
 };
 
+// A std::vector<Pixel> is then one contiguous RGBA8 buffer that can go straight to an image writer (e.g. lodepng)
+static_assert(sizeof(Pixel) == 4, "Pixel must be exactly 4 bytes (RGBA8)");
+static_assert(std::is_standard_layout<Pixel>::value, "Pixel must be standard layout to be passed on as raw RGBA8");
+
 #endif
@@ -0,0 +1,107 @@
+#ifndef _RAYPACKET_HPP_
+#define _RAYPACKET_HPP_
+
+#include <algorithm>
+#include <cmath>
+
+#include "Vector.hpp"
+
+/**
+ * A bundle of up to MAX_RAYS rays from one origin (the camera rays through a small square of neighbouring pixels),
+ * traced together through the BVH or the brute force loop
+ * The packet is coherent when, on every axis, all of its directions have the same non-zero sign. Then the reciprocal
+ * directions on each axis lie in one interval, and a single interval slab test tells whether any ray of the packet
+ * can hit a box. Incoherent packets are traced one ray at a time
+ * Header-only, templated on the precision Real the rays are intersected with spheres in (boxes are tested in double)
+ */
+template <typename Real>
+struct BasicRayPacket
+{
+	// Largest packet: 8x8 pixels
+	static const int MAX_RAYS = 64;
+
+	BasicVector<Real> origin;	// Shared origin of every ray
+	BasicVector<Real> directions[MAX_RAYS];	// Unit direction of each ray
+	Real t[MAX_RAYS];	// Distance to the nearest hit so far (the limit on input)
+	int hit[MAX_RAYS];	// Index of the shape hit so far, -1 for none
+	int size{ 0 };	// Number of rays in use
+
+	// Set by prepare
+	double originD[3];	// Origin in double
+	double invDirection[MAX_RAYS][3];	// Component-wise reciprocal of each direction, in double
+	double invMin[3];	// Smallest reciprocal direction of any ray, per axis
+	double invMax[3];	// Largest
+	bool coherent{ false };	// Whether every axis has one direction sign (the interval test is only valid then)
+
+	/**
+	 * Compute the double origin, reciprocal directions and their interval on each axis from origin and directions
+	 * CHANGES: originD, invDirection, invMin, invMax, coherent
+	 */
+	void prepare()
+	{
+		originD[0] = origin.getI();
+		originD[1] = origin.getJ();
+		originD[2] = origin.getK();
+		coherent = size > 0;
+		for (int a = 0; a < 3; a++) {
+			invMin[a] = INFINITY;
+			invMax[a] = -INFINITY;
+		}
+		for (int r = 0; r < size; r++) {
+			double d[3] = { directions[r].getI(), directions[r].getJ(), directions[r].getK() };
+			for (int a = 0; a < 3; a++) {
+				invDirection[r][a] = 1 / d[a];
+				invMin[a] = std::min(invMin[a], invDirection[r][a]);
+				invMax[a] = std::max(invMax[a], invDirection[r][a]);
+			}
+		}
+		for (int a = 0; a < 3; a++) {
+			if (!(invMin[a] > 0 || invMax[a] < 0) || !std::isfinite(invMin[a]) || !std::isfinite(invMax[a])) {
+				coherent = false;
+			}
+		}
+	}
+
+	/**
+	 * @return the largest t of any ray (no ray can hit anything beyond it)
+	 */
+	double maxT() const
+	{
+		double result = 0;
+		for (int r = 0; r < size; r++) {
+			result = std::max(result, double(t[r]));
+		}
+		return result;
+	}
+
+	/**
+	 * Interval slab test of a coherent packet against the box [min, max]: false only if no ray of the packet enters
+	 * the box for t in [0, tMax]. Each bound is the extreme of what AABB::intersect computes for some ray, so no box a
+	 * single ray would enter is ever culled
+	 * @param tEntry - set to a lower bound of the t at which the rays enter the box (used to order traversal)
+	 */
+	bool intersectBox(const double min[3], const double max[3], double tMax, double& tEntry) const
+	{
+		double tNear = 0;
+		double tFar = tMax;
+		for (int a = 0; a < 3; a++) {
+			// Rays travelling towards -axis enter through the max plane
+			double nearPlane = (invMin[a] > 0 ? min[a] : max[a]) - originD[a];
+			double farPlane = (invMin[a] > 0 ? max[a] : min[a]) - originD[a];
+			double t0 = std::min(nearPlane * invMin[a], nearPlane * invMax[a]);
+			double t1 = std::max(farPlane * invMin[a], farPlane * invMax[a]);
+			tNear = t0 > tNear ? t0 : tNear;
+			tFar = t1 < tFar ? t1 : tFar;
+			if (tNear > tFar) {
+				return false;
+			}
+		}
+		tEntry = tNear;
+		return true;
+	}
+};
+
+typedef BasicRayPacket<double> RayPacket;
+typedef BasicRayPacket<float> RayPacketF;
+
+#endif
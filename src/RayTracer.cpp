@@ -1,17 +1,41 @@
 #include "RayTracer.hpp"
 #include "Vector.hpp"
 #include "Sphere.hpp"
+#include "PNGWriter.hpp"
 
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include <string>
+#include <type_traits>
 #include <vector>
 #include <math.h>
-#include <lodepng.h>    // Used to create the RayTracer rendered PNG image
 
 using std::string;
 using std::vector;
 using std::cout;
 using std::endl;
 
+// Distance shadow rays start above the surface, so rounding never makes a shape shadow itself
+static const double SHADOW_BIAS = 1e-6;
+
+/** Pseudo-random number in [0, 1) that only depends on its arguments (a pixel and the index of one of its sub-pixel
+* coordinates), so supersampled pixels come out the same on any thread in any order
+*/
+static double subpixelJitter(int x, int y, int index)
+{
+    // murmur3 finalizer over the three inputs
+    unsigned int h = unsigned(x) * 0x9E3779B1u ^ unsigned(y) * 0x85EBCA77u ^ unsigned(index) * 0xC2B2AE3Du;
+    h ^= h >> 16;
+    h *= 0x85EBCA6Bu;
+    h ^= h >> 13;
+    h *= 0xC2B2AE35u;
+    h ^= h >> 16;
+    return h / 4294967296.0;
+}
+
 /** Default scene parameters with light source at (0,10,0), and camera at (5,0,0) with target (direction of camera) at (0,0,0)
 * And dimensions of 1024x1024 with image width/height of 5 units in coordinate system. Default background color of black
 * Need to add shapes - default has no shapes
@@ -22,7 +46,13 @@ RayTracer::RayTracer() : RayTracer(Vector(0, 10, 0), Vector(5, 0, 0), Vector(0,
 /** Create a ray tracing 3D scene specifying locations of light, camera, target, as well as shapes, and the dimensions and size of scene and background color
 */
 RayTracer::RayTracer(Vector light, Vector camera, Vector target, vector<Sphere> shapes, int height, int width, int hx, int hy, Pixel bgColor) :
-    light(light), camera(camera), target(target), shapes(shapes), HEIGHT(height), WIDTH(width), HX(hx), HY(hy), backgroundColor(bgColor), pixels(vector<Pixel>(WIDTH * HEIGHT)), view(vector<Vector>(WIDTH * HEIGHT))
+    light(light), camera(camera), target(target), shapes(shapes), HEIGHT(height), WIDTH(width), HX(hx), HY(hy), backgroundColor(bgColor), precomputedView(false),
+    scheduler(0), tileSize(32), compressionLevel(6), acceleration(Acceleration::BVH), bvhBuilder(BVHBuilder::SAH),
+    bvhLayout(BVHLayout::Binary), structure(Acceleration::BVH), gridLevels(1),
+    refitThreshold(1.5), binSize(1), binColumns(0), accelerationOutdated(true), shapesMoved(false),
+    layoutOutdated(false),
+    gBufferEnabled(false), gBufferValid(false), shadows(false), timelineEnabled(false),
+    antialiasing(1), antialiasThreshold(16), precision(Precision::Double), packetSize(4)
 {
     checkSceneValidity();
     generateView();
@@ -37,21 +67,32 @@ bool RayTracer::saveSceneToPNG(string filename)
     }
 
     // Render PNG named filename
-    bool flag = false;
-    unsigned error;
-
-    //write png
     if (filename.empty()) {
-        error = lodepng::encode("scene.png", createLoadablePixelVector(), WIDTH, HEIGHT);
-        cout << "Scene was saved with name scene.png" << endl;
+        filename = "scene.png";
     }
-    else {
-        error = lodepng::encode(filename, createLoadablePixelVector(), WIDTH, HEIGHT);
-        cout << "Scene was saved with name " << filename << endl;
+
+    // Nothing rendered yet (or the image was streamed): save the blank image as before
+    if (pixels.size() != size_t(WIDTH) * HEIGHT) {
+        pixels.resize(size_t(WIDTH) * HEIGHT);
     }
 
-    if (error == 0)
-        flag = true;
+    //write png, compressing on every worker thread
+    StatsClock encode;
+    bool flag;
+    {
+        TimelineScope scope(activeTimeline(), 0, "encode");
+        PNGWriter writer;
+        writer.setCompressionLevel(compressionLevel);
+        flag = writer.open(filename, WIDTH, HEIGHT) && writer.writeImage(getPixelData(), scheduler);
+        flag = writer.close() && flag;
+    }
+    RENDER_STATS(stats.encodeSeconds = encode.lap());
+    cout << "Scene was saved with name " << filename << endl;
+
+    // Timeline of the render and this encode next to the image
+    if (timelineEnabled) {
+        flag = timeline.write(timelineFilename(filename)) && flag;
+    }
 
     return flag;
 }
@@ -62,7 +103,44 @@ bool RayTracer::saveSceneToPNG()
     return saveSceneToPNG("scene.png");
 }
 
-/** Vector arithmetic to calculate each ray pointing to each pixel on the view (stored in view vector/array)
+/** Same setup as renderScene, then one pass of single rays measuring each pixel
+*/
+bool RayTracer::renderHeatmapToPNG(string filename, HeatmapMetric metric)
+{
+#if !RAYTRACER_STATS
+    if (metric == HeatmapMetric::IntersectionTests) {
+        cout << "Heatmap of intersection tests needs statistics, built with RAYTRACER_STATS off" << endl;
+        return false;
+    }
+#endif
+    checkSceneValidity();
+    if (!VALID_SCENE) {
+        return false;
+    }
+    if (filename.empty()) {
+        filename = "heatmap.png";
+    }
+
+    generateView();
+    timedBuildAcceleration(true);
+    heatmap.assign(size_t(WIDTH) * HEIGHT, 0);
+    scheduler.runTiles(WIDTH, HEIGHT, tileSize, [&](const Tile& tile, int) {
+        if (precision == Precision::Float) {
+            heatmapTile<float>(tile, metric);
+        }
+        else {
+            heatmapTile<double>(tile, metric);
+        }
+    });
+
+    Heatmap image(heatmap, WIDTH, HEIGHT, metric);
+    bool flag = image.saveToPNG(filename);
+    cout << "Heatmap (" << image.getMin() << " - " << image.getMax() << " " << Heatmap::unit(metric)
+        << " per pixel) was saved with name " << filename << endl;
+    return flag;
+}
+
+/** Vector arithmetic to find the camera basis that every ray pointing to a pixel on the view is built from
 */
 void RayTracer::generateView()
 {
@@ -88,7 +166,30 @@ void RayTracer::generateView()
     Vector viewDistance = unitCameraDirection.scalarMult(cameraDistance);   // t_n(d)
     Vector viewLeftSide = unitHorizontal.scalarMult(g_x);   // g_x(b_n)
     Vector viewTop = unitVertical.scalarMult(g_y);  // g_y(v_n)
-    Vector p_11 = viewDistance - viewLeftSide - viewTop;
+    p_11 = viewDistance - viewLeftSide - viewTop;
+
+    // q_x = (2g_x/(k-1)) * b_n, k = WIDTH
+    double x_scaleToScreen = (2 * g_x) / (WIDTH - 1.0);
+    q_x = unitHorizontal.scalarMult(x_scaleToScreen);
+
+    // q_y = (2g_y/(m-1)) * v_n, m = HEIGHT
+    double y_scaleToScreen = (2 * g_y) / (HEIGHT - 1.0);
+    q_y = unitVertical.scalarMult(y_scaleToScreen);
+
+    if (precomputedView) {
+        generatePrecomputedView();
+    }
+    else {
+        // Rays are generated while rendering, release any stored ones
+        vector<Vector>().swap(view);
+    }
+}
+
+/** Vector arithmetic to calculate each ray pointing to each pixel on the view (stored in view vector/array)
+*/
+void RayTracer::generatePrecomputedView()
+{
+    view.resize(WIDTH * HEIGHT);
 
     // Using the first pixel, find the direction of all pixels on the viewport
     for (int i = 0; i < view.size(); i++) {
@@ -97,17 +198,9 @@ void RayTracer::generateView()
         int row = (i / (WIDTH)) + 1;
         int column = (i + 1) - double((row - 1.0) * WIDTH);
 
-        // q_x = (2g_x/(k-1)) * b_n - depends on position of pixel
-        double x_scaleToScreen = (2 * g_x) / (WIDTH - 1.0);
-        Vector pixel_x_start = unitHorizontal.scalarMult(x_scaleToScreen);
-
-        // q_y = (2g_y/(m-1)) * v_n
-        double y_scaleToScreen = (2 * g_y) / (HEIGHT - 1.0);
-        Vector pixel_y_start = unitVertical.scalarMult(y_scaleToScreen);
-
         // Each pixel: p_ij = p_11 + q_x(i-1) + q_y(j-1)
-        Vector pixel_x_coord = pixel_x_start.scalarMult(column - 1.0);
-        Vector pixel_y_coord = pixel_y_start.scalarMult(row - 1.0);
+        Vector pixel_x_coord = q_x.scalarMult(column - 1.0);
+        Vector pixel_y_coord = q_y.scalarMult(row - 1.0);
         Vector p_ij = p_11 + pixel_x_coord + pixel_y_coord;
 
         // Generates view rays (for ray tracing)
@@ -134,10 +227,265 @@ void RayTracer::checkSceneValidity()
  */
 void RayTracer::renderScene()
 {
-    colorPixels();
+    stats = RenderStats();
+    StatsClock total;
+    StatsClock phase;
+    if (timelineEnabled) {
+        timeline.reset(scheduler.getThreadCount());
+    }
+
+    // Only the light moved since the last render: every ray hits the same point, so just shade again
+    if (gBufferEnabled && gBufferValid) {
+        // Shadow rays still need the acceleration structure
+        timedBuildAcceleration(false);
+        RENDER_STATS(stats.buildSeconds = phase.lap());
+        reshadePixels();
+        if (antialiasing > 1) {
+            // Shapes are still those of the last traced render
+            pixelShapes.resize(gBuffer.size());
+            for (size_t i = 0; i < gBuffer.size(); i++) {
+                pixelShapes[i] = gBuffer[i].shape;
+            }
+            antialiasRows(pixels.data(), pixelShapes.data(), 0, HEIGHT, 0, HEIGHT);
+        }
+        RENDER_STATS(stats.colorSeconds = phase.lap());
+    }
+    else {
+        // Camera or target may have moved since the last render
+        checkSceneValidity();
+        {
+            TimelineScope scope(activeTimeline(), 0, "view");
+            generateView();
+        }
+        RENDER_STATS(stats.viewSeconds = phase.lap());
+        timedBuildAcceleration(true);
+        RENDER_STATS(stats.buildSeconds = phase.lap());
+        pixels.resize(size_t(WIDTH) * HEIGHT);
+        if (gBufferEnabled) {
+            gBuffer.resize(size_t(WIDTH) * HEIGHT);
+        }
+        if (antialiasing > 1) {
+            pixelShapes.resize(size_t(WIDTH) * HEIGHT);
+        }
+        else {
+            vector<int>().swap(pixelShapes);
+        }
+        colorPixels();
+        if (antialiasing > 1) {
+            antialiasRows(pixels.data(), pixelShapes.data(), 0, HEIGHT, 0, HEIGHT);
+        }
+        RENDER_STATS(stats.colorSeconds = phase.lap());
+        gBufferValid = gBufferEnabled;
+    }
+
+    RENDER_STATS(stats.pixels = (long long)WIDTH * HEIGHT);
+    RENDER_STATS(stats.peakFramebufferBytes = pixels.capacity() * sizeof(Pixel) + gBuffer.capacity() * sizeof(SurfaceHit) +
+        view.capacity() * sizeof(Vector) + pixelShapes.capacity() * sizeof(int) + edgePixels.capacity());
+    RENDER_STATS(stats.seconds = total.lap());
     cout << "Scene rendered, ready to export to PNG" << endl;
 }
 
+/**
+ * Render a strip of rows at a time and hand each one to the PNG writer, so the full framebuffer is never allocated
+ */
+bool RayTracer::renderSceneToPNG(string filename, int stripHeight)
+{
+    checkSceneValidity();
+    if (!VALID_SCENE) {
+        return false;
+    }
+    if (filename.empty()) {
+        filename = "scene.png";
+    }
+    if (stripHeight < 1) {
+        stripHeight = 1;
+    }
+
+    stats = RenderStats();
+    StatsClock total;
+    StatsClock phase;
+    if (timelineEnabled) {
+        timeline.reset(scheduler.getThreadCount());
+    }
+    {
+        TimelineScope scope(activeTimeline(), 0, "view");
+        generateView();
+    }
+    RENDER_STATS(stats.viewSeconds = phase.lap());
+    timedBuildAcceleration(true);
+    RENDER_STATS(stats.buildSeconds = phase.lap());
+
+    PNGWriter writer;
+    writer.setCompressionLevel(compressionLevel);
+    if (!writer.open(filename, WIDTH, HEIGHT)) {
+        return false;
+    }
+
+    // Anti-aliasing compares every pixel with the rows above and below, so each strip is traced with one more row on
+    // either side (only the strip's own rows are written)
+    int apron = antialiasing > 1 ? 1 : 0;
+    vector<Pixel> strip(size_t(WIDTH) * ((stripHeight < HEIGHT ? stripHeight : HEIGHT) + 2 * apron));
+    vector<int> stripShapes(apron ? strip.size() : 0);
+    WorkerStats workerStats(scheduler.getThreadCount());
+    for (int y0 = 0; y0 < HEIGHT; y0 += stripHeight) {
+        int y1 = y0 + stripHeight < HEIGHT ? y0 + stripHeight : HEIGHT;
+        Tile region;
+        region.y0 = y0 - apron > 0 ? y0 - apron : 0;
+        region.x1 = WIDTH;
+        region.y1 = y1 + apron < HEIGHT ? y1 + apron : HEIGHT;
+
+        scheduler.runTiles(region, tileSize, [&](const Tile& tile, int worker) {
+            colorTile(tile, SampleGrid(), worker, strip.data(), apron ? stripShapes.data() : nullptr, region.y0, nullptr, workerStats[worker]);
+        });
+        if (apron) {
+            antialiasRows(strip.data(), stripShapes.data(), region.y0, region.y1, y0, y1, workerStats);
+        }
+        RENDER_STATS(stats.colorSeconds += phase.lap());
+
+        TimelineScope scope(activeTimeline(), 0, "encode", 0, y0);
+        const Pixel* rows = strip.data() + size_t(y0 - region.y0) * WIDTH;
+        if (!writer.writeRows(reinterpret_cast<const unsigned char*>(rows), y1 - y0)) {
+            writer.close();
+            return false;
+        }
+        RENDER_STATS(stats.encodeSeconds += phase.lap());
+    }
+
+    bool flag;
+    {
+        TimelineScope scope(activeTimeline(), 0, "encode");
+        flag = writer.close();
+    }
+    RENDER_STATS(stats.encodeSeconds += phase.lap());
+    if (timelineEnabled) {
+        flag = timeline.write(timelineFilename(filename)) && flag;
+    }
+    mergeStats(workerStats);
+    RENDER_STATS(stats.pixels = (long long)WIDTH * HEIGHT);
+    RENDER_STATS(stats.peakFramebufferBytes = strip.capacity() * sizeof(Pixel) + view.capacity() * sizeof(Vector) +
+        stripShapes.capacity() * sizeof(int) + edgePixels.capacity());
+    RENDER_STATS(stats.seconds = total.lap());
+    if (flag) {
+        cout << "Scene was rendered and saved with name " << filename << endl;
+    }
+    return flag;
+}
+
+/**
+ * Coarse to fine passes over the same framebuffer, each one tracing the samples halfway between the previous ones.
+ * The cancel flag is only cleared on the way out, so a cancelRender made before the render started still stops it
+ */
+bool RayTracer::renderProgressive(const ProgressCallback& progress, int coarsestSpacing)
+{
+    checkSceneValidity();
+    if (!VALID_SCENE) {
+        cancelled.value = false;
+        return false;
+    }
+    int spacing = 1;
+    while (spacing * 2 <= coarsestSpacing && spacing < 64) {
+        spacing *= 2;
+    }
+
+    stats = RenderStats();
+    StatsClock total;
+    StatsClock phase;
+    if (timelineEnabled) {
+        timeline.reset(scheduler.getThreadCount());
+    }
+    {
+        TimelineScope scope(activeTimeline(), 0, "view");
+        generateView();
+    }
+    RENDER_STATS(stats.viewSeconds = phase.lap());
+    timedBuildAcceleration(true);
+    RENDER_STATS(stats.buildSeconds = phase.lap());
+    pixels.resize(size_t(WIDTH) * HEIGHT);
+    if (gBufferEnabled) {
+        gBuffer.resize(size_t(WIDTH) * HEIGHT);
+    }
+    if (antialiasing > 1) {
+        pixelShapes.resize(size_t(WIDTH) * HEIGHT);
+    }
+    else {
+        vector<int>().swap(pixelShapes);
+    }
+    gBufferValid = false;
+
+    WorkerStats workerStats(scheduler.getThreadCount());
+    SampleGrid grid;
+    for (grid.step = spacing; grid.step >= 1; grid.step /= 2) {
+        grid.skip = grid.step == spacing ? 0 : grid.step * 2;
+        scheduler.runTiles(WIDTH, HEIGHT, tileSize, [&](const Tile& tile, int worker) {
+            if (!cancelled.value) {
+                colorTile(tile, grid, worker, pixels.data(), pixelShapes.empty() ? nullptr : pixelShapes.data(), 0,
+                    gBufferEnabled ? gBuffer.data() : nullptr, workerStats[worker]);
+            }
+        });
+        if (cancelled.value) {
+            // A pass only writes samples the earlier passes have not traced, so filling the gaps again from the last
+            // finished pass's samples undoes the part of this one that was traced
+            if (grid.step == spacing) {
+                std::fill(pixels.begin(), pixels.end(), Pixel());
+            }
+            else {
+                fillGaps(grid.step * 2);
+            }
+            break;
+        }
+        if (grid.step == 1 && antialiasing > 1) {
+            antialiasRows(pixels.data(), pixelShapes.data(), 0, HEIGHT, 0, HEIGHT, workerStats);
+        }
+        fillGaps(grid.step);
+        if (!progress(pixels, grid.step)) {
+            cancelled.value = true;
+            break;
+        }
+    }
+    mergeStats(workerStats);
+    RENDER_STATS(stats.colorSeconds = phase.lap());
+    RENDER_STATS(stats.pixels = (long long)WIDTH * HEIGHT);
+    RENDER_STATS(stats.peakFramebufferBytes = pixels.capacity() * sizeof(Pixel) + gBuffer.capacity() * sizeof(SurfaceHit) +
+        view.capacity() * sizeof(Vector) + pixelShapes.capacity() * sizeof(int) + edgePixels.capacity());
+    RENDER_STATS(stats.seconds = total.lap());
+    if (cancelled.value) {
+        cancelled.value = false;
+        return false;
+    }
+    gBufferValid = gBufferEnabled;
+    cout << "Scene rendered, ready to export to PNG" << endl;
+    return true;
+}
+
+/** Only flags the render, which checks before every tile and clears the flag when it returns
+*/
+void RayTracer::cancelRender()
+{
+    cancelled.value = true;
+}
+
+/** Copy each traced sample over the block of pixels below and right of it
+*/
+void RayTracer::fillGaps(int spacing)
+{
+    if (spacing == 1) {
+        return;
+    }
+    // Only samples are read, and they are never written, so tiles can be filled in any order
+    scheduler.runTiles(WIDTH, HEIGHT, tileSize, [&](const Tile& tile, int) {
+        for (int y = tile.y0; y < tile.y1; y++) {
+            const Pixel* samples = pixels.data() + size_t(y - y % spacing) * WIDTH;
+            Pixel* row = pixels.data() + size_t(y) * WIDTH;
+            bool sampleRow = y % spacing == 0;
+            for (int x0 = tile.x0 - tile.x0 % spacing; x0 < tile.x1; x0 += spacing) {
+                int from = std::max(sampleRow ? x0 + 1 : x0, tile.x0);
+                int to = std::min(x0 + spacing, tile.x1);
+                std::fill(row + from, row + to, samples[x0]);
+            }
+        }
+    });
+}
+
 /**
  * Setter methods to change scene parameters - call renderScene to see updates
  */
@@ -149,11 +497,13 @@ void RayTracer::changeLightLocation(const Vector& newLight)
 void RayTracer::changeCameraLocation(const Vector& newCamera)
 {
     camera = newCamera;
+    gBufferValid = false;
 }
 
 void RayTracer::changeTargetLocation(const Vector& newTarget)
 {
     target = newTarget;
+    gBufferValid = false;
 }
 
 /**
@@ -162,88 +512,1058 @@ void RayTracer::changeTargetLocation(const Vector& newTarget)
 void RayTracer::addShape(Sphere newShape)
 {
     shapes.push_back(newShape);
+    accelerationOutdated = true;
+    gBufferValid = false;
+}
+
+/**
+ * Replace a shape's geometry, keeping its color and ambience
+ */
+bool RayTracer::updateShape(int index, const Vector& position, double radius)
+{
+    if (index < 0 || index >= shapes.size() || !(radius > 0)) {
+        return false;
+    }
+    shapes[index] = Sphere(radius, position, shapes[index].color(), shapes[index].ambient());
+    shapesMoved = true;
+    gBufferValid = false;
+    return true;
+}
+
+/**
+ * Add a cluster to instance - nothing in the scene changes until it is placed
+ */
+int RayTracer::addCluster(const std::vector<Sphere>& spheres)
+{
+    return instances.addCluster(spheres);
+}
+
+/**
+ * Place a copy of a cluster - call renderScene to see updates
+ */
+bool RayTracer::addInstance(int cluster, const Transform& transform)
+{
+    if (!instances.addInstance(cluster, transform)) {
+        return false;
+    }
+    gBufferValid = false;
+    return true;
+}
+
+int RayTracer::getInstanceCount() const
+{
+    return instances.getInstanceCount();
+}
+
+/**
+ * Cost ratio at which a refitted BVH is rebuilt
+ */
+void RayTracer::setRefitThreshold(double threshold)
+{
+    refitThreshold = threshold < 1 ? 1 : threshold;
+}
+
+double RayTracer::getRefitThreshold() const
+{
+    return refitThreshold;
+}
+
+/**
+ * Number of worker threads used by renderScene
+ */
+void RayTracer::setThreadCount(int threads)
+{
+    scheduler.setThreadCount(threads);
+}
+
+int RayTracer::getThreadCount() const
+{
+    return scheduler.getThreadCount();
+}
+
+/**
+ * Size of the square tiles handed to the worker threads
+ */
+void RayTracer::setTileSize(int size)
+{
+    tileSize = size < 1 ? 1 : size;
+}
+
+int RayTracer::getTileSize() const
+{
+    return tileSize;
+}
+
+/**
+ * PNG compression level used by saveSceneToPNG and renderSceneToPNG
+ */
+void RayTracer::setCompressionLevel(int level)
+{
+    compressionLevel = level < 0 ? 0 : (level > 9 ? 9 : level);
+}
+
+int RayTracer::getCompressionLevel() const
+{
+    return compressionLevel;
+}
+
+/**
+ * Keep the surface hit of every pixel so renders after only the light moved skip tracing
+ */
+void RayTracer::setGBuffer(bool enable)
+{
+    gBufferEnabled = enable;
+    gBufferValid = false;
+    if (!enable) {
+        vector<SurfaceHit>().swap(gBuffer);
+    }
+}
+
+bool RayTracer::getGBuffer() const
+{
+    return gBufferEnabled;
+}
+
+/**
+ * Cast a shadow ray towards the light from every lit surface point
+ */
+void RayTracer::setShadows(bool enable)
+{
+    shadows = enable;
+}
+
+bool RayTracer::getShadows() const
+{
+    return shadows;
+}
+
+/**
+ * Supersample edge pixels with side x side rays
+ */
+void RayTracer::setAntialiasing(int side)
+{
+    antialiasing = side < 1 ? 1 : side > MAX_ANTIALIASING ? MAX_ANTIALIASING : side;
+}
+
+int RayTracer::getAntialiasing() const
+{
+    return antialiasing;
+}
+
+void RayTracer::setAntialiasThreshold(int threshold)
+{
+    antialiasThreshold = threshold < 0 ? 0 : threshold > 255 ? 255 : threshold;
+}
+
+int RayTracer::getAntialiasThreshold() const
+{
+    return antialiasThreshold;
+}
+
+/**
+ * Record a timeline of every render
+ */
+void RayTracer::setTimeline(bool enable)
+{
+    timelineEnabled = enable;
+}
+
+bool RayTracer::getTimeline() const
+{
+    return timelineEnabled;
+}
+
+/**
+ * The timeline if it is being recorded
+ */
+Timeline* RayTracer::activeTimeline()
+{
+    return timelineEnabled ? &timeline : nullptr;
+}
+
+/**
+ * scene.png -> scene.trace.json
+ */
+string RayTracer::timelineFilename(const string& pngFilename)
+{
+    string base = pngFilename;
+    if (base.size() >= 4 && base.compare(base.size() - 4, 4, ".png") == 0) {
+        base.erase(base.size() - 4);
+    }
+    return base + ".trace.json";
+}
+
+/**
+ * Getter: per-pixel cost of the last heatmap
+ */
+const vector<double>& RayTracer::getHeatmap() const
+{
+    return heatmap;
+}
+
+/**
+ * Getter: counters and timings of the last render
+ */
+const RenderStats& RayTracer::getRenderStats() const
+{
+    return stats;
+}
+
+/**
+ * Store every ray up front (original behaviour) instead of generating them while rendering
+ */
+void RayTracer::setPrecomputedView(bool enable)
+{
+    precomputedView = enable;
+}
+
+bool RayTracer::getPrecomputedView() const
+{
+    return precomputedView;
+}
+
+/**
+ * Scalar type of the primary ray intersection kernels
+ */
+void RayTracer::setPrecision(Precision newPrecision)
+{
+    precision = newPrecision;
+    gBufferValid = false;
+}
+
+Precision RayTracer::getPrecision() const
+{
+    return precision;
+}
+
+/**
+ * Side of the square of pixels whose rays are traced together
+ */
+void RayTracer::setPacketSize(int size)
+{
+    packetSize = size < 1 ? 1 : (size > 8 ? 8 : size);
+}
+
+int RayTracer::getPacketSize() const
+{
+    return packetSize;
+}
+
+/**
+ * Select how rays are tested against the shapes
+ */
+void RayTracer::setAcceleration(Acceleration accel)
+{
+    if (accel != acceleration) {
+        accelerationOutdated = true;
+    }
+    acceleration = accel;
+}
+
+Acceleration RayTracer::getAcceleration() const
+{
+    return acceleration;
+}
+
+Acceleration RayTracer::getActiveAcceleration() const
+{
+    return structure;
+}
+
+/**
+ * Levels of the grid, rebuilt with them on the next render
+ */
+void RayTracer::setGridLevels(int levels)
+{
+    levels = std::max(1, std::min(2, levels));
+    if (levels != gridLevels && structure == Acceleration::Grid) {
+        accelerationOutdated = true;
+    }
+    gridLevels = levels;
 }
 
-/** Determine coloring of pixels in scene based
+int RayTracer::getGridLevels() const
+{
+    return gridLevels;
+}
+
+/**
+ * Builder of the BVH, rebuilt with the new one on the next render
+ */
+void RayTracer::setBVHBuilder(BVHBuilder builder)
+{
+    if (builder != bvhBuilder && structure == Acceleration::BVH) {
+        accelerationOutdated = true;
+    }
+    bvhBuilder = builder;
+}
+
+BVHBuilder RayTracer::getBVHBuilder() const
+{
+    return bvhBuilder;
+}
+
+/**
+ * Layout of the BVH: the tree already built is collapsed into wide nodes (or not) on the next render, not rebuilt
+ */
+void RayTracer::setBVHLayout(BVHLayout layout)
+{
+    if (layout != bvhLayout) {
+        layoutOutdated = true;
+    }
+    bvhLayout = layout;
+}
+
+BVHLayout RayTracer::getBVHLayout() const
+{
+    return bvhLayout;
+}
+
+/**
+ * Getter: rendered pixels
+ */
+const vector<Pixel>& RayTracer::getPixels() const
+{
+    return pixels;
+}
+
+/**
+ * Getter: rendered pixels as raw RGBA8 - Pixel is exactly the 4 RGBA bytes, so no conversion is needed
+ */
+const unsigned char* RayTracer::getPixelData() const
+{
+    return reinterpret_cast<const unsigned char*>(pixels.data());
+}
+
+/** (Re)build the structure in use only when the shapes changed
 */
-void RayTracer::colorPixels()
+void RayTracer::buildAcceleration()
 {
-    // Code to determine color at each pixel using Lambertian shading 
-    // Loop through rays in view
-    for (int i = 0; i < view.size(); i++) {
-        // Current row
-        int row = (i / (WIDTH)) + 1;
+    if (!accelerationOutdated && !shapesMoved) {
+        if (layoutOutdated && structure == Acceleration::BVH && bvhLayout == BVHLayout::Wide) {
+            // Only the layout changed: collapse the tree already built
+            wideBvh.build(bvh, shapes);
+        }
+        layoutOutdated = false;
+        return;
+    }
 
-        // Current ray tracing vector
-        Vector ray = view[i];
-
-        // Loop through each shape and determine coloring based on:
-        /*
-        (1) If there is a shape at that pixel (ray intersects with shape)
-            -> How incident is that shape intersection vector with the light source
-        (2) If there is no shape at that pixel
-            -> Color with background color
-        */
-        bool intersectedShape = false;
+    // Collapsing is cheap next to building or refitting, so the wide tree always follows the binary one
+    if (structure == Acceleration::BVH && !accelerationOutdated) {
+        // Same shapes in new places: keep the tree unless refitting spoilt it
+        bvh.refit(shapes, &scheduler);
+        RENDER_STATS(stats.bvhRefits++;)
+        if (bvh.sahCost() > refitThreshold * bvh.getBuildCost()) {
+            bvh.build(shapes, bvhBuilder, &scheduler);
+            RENDER_STATS(stats.bvhBuilds++;)
+        }
+        if (bvhLayout == BVHLayout::Wide) {
+            wideBvh.build(bvh, shapes);
+        }
+    }
+    else if (structure == Acceleration::BVH) {
+        bvh.build(shapes, bvhBuilder, &scheduler);
+        RENDER_STATS(stats.bvhBuilds++;)
+        if (bvhLayout == BVHLayout::Wide) {
+            wideBvh.build(bvh, shapes);
+        }
+    }
+    else if (structure == Acceleration::Grid) {
+        // Grids build too fast to be worth refitting
+        grid.build(shapes, gridLevels);
+    }
+    else {
+        // Screen bins test primary rays against their own copy, made by binShapes, but shadow rays brute force
+        shapeGeometry.build(shapes);
+        shapeGeometryF.build(shapes);
+        shapeBounds.assign(shapes.size(), AABB());
         for (int n = 0; n < shapes.size(); n++) {
+            double r = shapes[n].radius();
+            shapeBounds[n].grow(shapes[n].position() - Vector(r, r, r));
+            shapeBounds[n].grow(shapes[n].position() + Vector(r, r, r));
+        }
+    }
+    accelerationOutdated = false;
+    shapesMoved = false;
+    layoutOutdated = false;
+}
 
-            Sphere shape = shapes.at(n);
+/** Build with each step on the timeline
+*/
+void RayTracer::timedBuildAcceleration(bool bin)
+{
+    // Auto only picks again when shapes are added, not when they move, so a refitted BVH stays in use
+    if (accelerationOutdated) {
+        structure = acceleration != Acceleration::Auto ? acceleration :
+            (Grid::suits(shapes) ? Acceleration::Grid : Acceleration::BVH);
+    }
+    {
+        const char* name = structure == Acceleration::Grid ? "build grid" : structure != Acceleration::BVH ? "pack shapes" :
+            (accelerationOutdated ? "build BVH" : shapesMoved ? "refit BVH" : "collapse BVH");
+        bool collapse = layoutOutdated && structure == Acceleration::BVH && bvhLayout == BVHLayout::Wide;
+        TimelineScope scope(accelerationOutdated || shapesMoved || collapse ? activeTimeline() : nullptr, 0, name);
+        buildAcceleration();
+    }
+    if (instances.outdated()) {
+        TimelineScope scope(activeTimeline(), 0, "build instances");
+        instances.build(&scheduler);
+    }
+    if (bin && structure == Acceleration::ScreenBins) {
+        TimelineScope scope(activeTimeline(), 0, "bin shapes");
+        binShapes();
+    }
+}
 
-            Vector intersectPoint = shape.intersect(camera, ray);
+/** Project each shape's bounding sphere onto the image plane through the camera basis and list it in every bin
+* (tileSize x tileSize pixels) its projection overlaps. In camera space (right, down, forward) the rays through
+* the image form a cone around each sphere; the slopes x/z of its two tangent planes along an axis bound the pixels
+* whose rays can hit it, exactly. Shapes reaching behind the image plane cannot be projected and go into every bin
+*/
+void RayTracer::binShapes()
+{
+    binSize = tileSize;
+    binColumns = (WIDTH + binSize - 1) / binSize;
+    int binRows = (HEIGHT + binSize - 1) / binSize;
 
-            // If ray intersects sphere
-            if (!isinf(intersectPoint.getI()) && !isinf(intersectPoint.getJ()) && !isinf(intersectPoint.getK())) {
-                // Calculate color of shape based on light intensity at intersection point
-                Vector lightVector = (light - intersectPoint).formUnitVector();
+    // Orthonormal camera basis: p_11 has forward component 1, q_x and q_y are along right and down
+    double pixelWidth = std::sqrt(q_x.normSquared());
+    double pixelHeight = std::sqrt(q_y.normSquared());
+    Vector right = q_x.scalarMult(1 / pixelWidth);
+    Vector down = q_y.scalarMult(1 / pixelHeight);
+    Vector forward = right.cross(down);
+    // Slope of the ray through pixel column/row 0
+    double left = p_11 * right;
+    double top = p_11 * down;
 
-                // 1 = most lit by light
-                // 0 = not lit by light (use ambient color)
-                double incidentLight = lightVector * (shape.normal(intersectPoint));
-                if (incidentLight < 0.0)
-                    incidentLight = 0.0;
+    // Range of bins each shape covers (first > last for a culled shape)
+    struct BinRange
+    {
+        int x0, y0, x1, y1;
+    };
+    vector<BinRange> ranges(shapes.size());
+    binOffsets.assign(size_t(binColumns) * binRows + 1, 0);
+    for (int n = 0; n < shapes.size(); n++) {
+        BinRange& range = ranges[n];
+        range = BinRange{ 0, 0, binColumns - 1, binRows - 1 };
 
-                // Pixel colors before scaled by ambience
-                Pixel shapeColorUnscaled = shape.color();
+        Vector v = shapes[n].position() - camera;
+        double r = shapes[n].radius();
+        double cx = v * right;
+        double cy = v * down;
+        double cz = v * forward;
 
-                // Pixel color scale factor
-                double RGBShading = shape.ambient() + (1 - shape.ambient()) * incidentLight;
+        // Every ray has a positive forward component, so nothing entirely behind the camera is ever hit
+        if (cz + r <= 0) {
+            range.x0 = 1;
+            range.x1 = 0;
+            continue;
+        }
+        if (cz > r) {
+            // Tangent slopes m of the circle (c, cz) radius r: m = (c cz -+ r sqrt(c^2 + cz^2 - r^2)) / (cz^2 - r^2),
+            // then pixel = (m - slope of pixel 0) / pixel size, widened by a pixel for rounding
+            double denominator = cz * cz - r * r;
+            double rootX = r * std::sqrt(cx * cx + denominator);
+            double rootY = r * std::sqrt(cy * cy + denominator);
+            double xMin = ((cx * cz - rootX) / denominator - left) / pixelWidth - 1;
+            double xMax = ((cx * cz + rootX) / denominator - left) / pixelWidth + 1;
+            double yMin = ((cy * cz - rootY) / denominator - top) / pixelHeight - 1;
+            double yMax = ((cy * cz + rootY) / denominator - top) / pixelHeight + 1;
 
-                Pixel pixelColor;
-                //R 
-                pixelColor.R = shapeColorUnscaled.R * RGBShading;
-                //G
-                pixelColor.G = shapeColorUnscaled.G * RGBShading;
-                //B
-                pixelColor.B = shapeColorUnscaled.B * RGBShading;
+            // Entirely outside the image
+            if (xMax < 0 || yMax < 0 || xMin > WIDTH - 1 || yMin > HEIGHT - 1) {
+                range.x0 = 1;
+                range.x1 = 0;
+                continue;
+            }
+            // Clamped in double: for spheres barely in front of the camera the slopes are far outside the int range
+            range.x0 = int(std::floor(std::max(xMin, 0.0))) / binSize;
+            range.y0 = int(std::floor(std::max(yMin, 0.0))) / binSize;
+            range.x1 = std::min(binColumns - 1, int(std::min(xMax, double(WIDTH - 1))) / binSize);
+            range.y1 = std::min(binRows - 1, int(std::min(yMax, double(HEIGHT - 1))) / binSize);
+        }
 
-                pixels.at(i) = pixelColor;
-                intersectedShape = true;
+        for (int by = range.y0; by <= range.y1; by++) {
+            for (int bx = range.x0; bx <= range.x1; bx++) {
+                binOffsets[by * binColumns + bx + 1]++;
             }
+        }
+    }
 
-            if (intersectedShape) {
-                break;  // Can only intersect one shape
+    // Counts to offsets, then list the shapes of each bin in index order (the order brute force tests them in)
+    for (int b = 1; b < binOffsets.size(); b++) {
+        binOffsets[b] += binOffsets[b - 1];
+    }
+    vector<int> binnedShapes(binOffsets.back());
+    vector<int> next(binOffsets.begin(), binOffsets.end() - 1);
+    for (int n = 0; n < shapes.size(); n++) {
+        for (int by = ranges[n].y0; by <= ranges[n].y1; by++) {
+            for (int bx = ranges[n].x0; bx <= ranges[n].x1; bx++) {
+                binnedShapes[next[by * binColumns + bx]++] = n;
             }
         }
+    }
+
+    if (precision == Precision::Float) {
+        binnedGeometryF.build(shapes, binnedShapes);
+    }
+    else {
+        binnedGeometry.build(shapes, binnedShapes);
+    }
+}
+
+/** Determine coloring of pixels in scene, splitting the image into tiles that are colored in parallel
+*/
+void RayTracer::colorPixels()
+{
+    // Every pixel only depends on the scene, so tiles can be colored in any order on any thread
+    WorkerStats workerStats(scheduler.getThreadCount());
+    scheduler.runTiles(WIDTH, HEIGHT, tileSize, [&](const Tile& tile, int worker) {
+        colorTile(tile, SampleGrid(), worker, pixels.data(), pixelShapes.empty() ? nullptr : pixelShapes.data(), 0,
+            gBufferEnabled ? gBuffer.data() : nullptr, workerStats[worker]);
+    });
+    mergeStats(workerStats);
+}
+
+/** Determine coloring of the pixels of grid inside one tile: first find what every ray hits, then shade the hits
+*/
+void RayTracer::colorTile(const Tile& tile, const SampleGrid& grid, int worker, Pixel* image, int* shapes, int firstRow,
+    SurfaceHit* hits, RenderStats& stats)
+{
+    StatsClock clock;
+    int columns = grid.columns(tile);
+    vector<SurfaceHit> tileHits(size_t(columns) * grid.rows(tile));
+    {
+        TimelineScope scope(activeTimeline(), worker, "trace", tile.x0, tile.y0);
+        if (precision == Precision::Float) {
+            traceTile<float>(tile, grid, tileHits.data(), hits, stats);
+        }
+        else {
+            traceTile<double>(tile, grid, tileHits.data(), hits, stats);
+        }
+    }
+    RENDER_STATS(stats.traceSeconds += clock.lap());
 
-        // Color with background color
-        if (!intersectedShape) {
-            pixels.at(i) = backgroundColor;
+    // Code to determine color at each pixel using Lambertian shading
+    TimelineScope scope(activeTimeline(), worker, "shade", tile.x0, tile.y0);
+    const SurfaceHit* hit = tileHits.data();
+    for (int y = grid.first(tile.y0); y < tile.y1; y += grid.step) {
+        for (int x = grid.first(tile.x0); x < tile.x1; x += grid.step, hit++) {
+            if (grid.skipped(x, y)) {
+                continue;
+            }
+            RENDER_STATS(stats.primaryRays++);
+            image[size_t(y - firstRow) * WIDTH + x] = shade(*hit, stats);
+            if (shapes) {
+                shapes[size_t(y - firstRow) * WIDTH + x] = hit->shape;
+            }
         }
     }
+    RENDER_STATS(stats.shadeSeconds += clock.lap());
 }
 
-/** Loop through each Pixel struct and extract each pixel's RGBA value to add to vector to create PNG
+/** Mark every edge first and only then supersample, so no tile compares against a neighbour that another thread has
+* already supersampled
 */
-vector<unsigned char> RayTracer::createLoadablePixelVector()
+void RayTracer::antialiasRows(Pixel* image, const int* shapes, int firstRow, int lastRow, int y0, int y1)
+{
+    WorkerStats workerStats(scheduler.getThreadCount());
+    antialiasRows(image, shapes, firstRow, lastRow, y0, y1, workerStats);
+    mergeStats(workerStats);
+}
+
+void RayTracer::antialiasRows(Pixel* image, const int* shapes, int firstRow, int lastRow, int y0, int y1,
+    WorkerStats& workerStats)
 {
-    vector<unsigned char> rawPixels;
+    Tile region;
+    region.y0 = y0;
+    region.x1 = WIDTH;
+    region.y1 = y1;
+    edgePixels.assign(size_t(WIDTH) * (y1 - y0), 0);
+    scheduler.runTiles(region, tileSize, [&](const Tile& tile, int) {
+        markEdges(tile, image, shapes, firstRow, lastRow, edgePixels.data() + size_t(tile.y0 - y0) * WIDTH);
+    });
+
+    scheduler.runTiles(region, tileSize, [&](const Tile& tile, int worker) {
+        StatsClock clock;
+        TimelineScope scope(activeTimeline(), worker, "antialias", tile.x0, tile.y0);
+        for (int y = tile.y0; y < tile.y1; y++) {
+            for (int x = tile.x0; x < tile.x1; x++) {
+                if (!edgePixels[size_t(y - y0) * WIDTH + x]) {
+                    continue;
+                }
+                image[size_t(y - firstRow) * WIDTH + x] = precision == Precision::Float ?
+                    supersample<float>(x, y, workerStats[worker]) : supersample<double>(x, y, workerStats[worker]);
+            }
+        }
+        RENDER_STATS(workerStats[worker].traceSeconds += clock.lap());
+    });
+}
 
-    for (int i = 0; i < pixels.size(); i++) {
-        rawPixels.push_back(pixels.at(i).R);
-        rawPixels.push_back(pixels.at(i).G);
-        rawPixels.push_back(pixels.at(i).B);
-        rawPixels.push_back(pixels.at(i).A);
+/** Compare with the pixels left, right, above and below that are in the image and in the rows held, a row at a time
+*/
+void RayTracer::markEdges(const Tile& tile, const Pixel* image, const int* shapes, int firstRow, int lastRow,
+    unsigned char* edges) const
+{
+    int threshold = antialiasThreshold;
+    auto differs = [threshold, image, shapes](size_t i, size_t j) {
+        // Most neighbours are the exact same color (background, flat shadow), so check that first
+        uint32_t a, b;
+        std::memcpy(&a, &image[i], sizeof(a));
+        std::memcpy(&b, &image[j], sizeof(b));
+        if (shapes[i] != shapes[j]) {
+            return true;
+        }
+        return a != b && (std::abs(image[i].R - image[j].R) > threshold || std::abs(image[i].G - image[j].G) > threshold ||
+            std::abs(image[i].B - image[j].B) > threshold);
+    };
+    for (int y = tile.y0; y < tile.y1; y++) {
+        size_t row = size_t(y - firstRow) * WIDTH;
+        bool hasAbove = y > firstRow;
+        bool hasBelow = y + 1 < lastRow;
+        unsigned char* edgeRow = edges + size_t(y - tile.y0) * WIDTH;
+        for (int x = tile.x0; x < tile.x1; x++) {
+            size_t i = row + x;
+            edgeRow[x] = (x > 0 && differs(i, i - 1)) || (x + 1 < WIDTH && differs(i, i + 1)) ||
+                (hasAbove && differs(i, i - WIDTH)) || (hasBelow && differs(i, i + WIDTH));
+        }
     }
+}
 
-    return rawPixels;
+/** Trace one jittered ray through each cell of an antialiasing x antialiasing grid over the pixel, as one packet
+*/
+template <typename Real>
+Pixel RayTracer::supersample(int x, int y, RenderStats& stats) const
+{
+    typedef BasicVector<Real> RealVector;
+    const RealVector p(p_11);
+    const RealVector qx(q_x);
+    const RealVector qy(q_y);
+    BasicRayPacket<Real> packet;
+    packet.origin = RealVector(camera);
+    packet.size = antialiasing * antialiasing;
+    for (int j = 0; j < antialiasing; j++) {
+        for (int i = 0; i < antialiasing; i++) {
+            // Cell (i, j) of the pixel's square, which is centred on the pixel's own ray
+            int r = j * antialiasing + i;
+            double sx = x - 0.5 + (i + subpixelJitter(x, y, 2 * r)) / antialiasing;
+            double sy = y - 0.5 + (j + subpixelJitter(x, y, 2 * r + 1)) / antialiasing;
+            packet.directions[r] = (p + qx.scalarMult(Real(sx)) + qy.scalarMult(Real(sy))).normalized();
+            packet.t[r] = INFINITY;
+            packet.hit[r] = -1;
+        }
+    }
+
+    int first;
+    int count;
+    pixelShapeRange(x, y, first, count);
+    tracePacket(packet, first, count, stats);
+
+    int sum[3] = { 0, 0, 0 };
+    SurfaceHit hit;
+    for (int r = 0; r < packet.size; r++) {
+        resolveHit(packet, r, hit, stats);
+        Pixel color = shade(hit, stats);
+        sum[0] += color.R;
+        sum[1] += color.G;
+        sum[2] += color.B;
+    }
+    RENDER_STATS(stats.primaryRays += packet.size);
+    RENDER_STATS(stats.supersampledPixels++);
+    RENDER_STATS(stats.supersamples += packet.size);
+
+    Pixel average;
+    average.R = (unsigned char)((sum[0] + packet.size / 2) / packet.size);
+    average.G = (unsigned char)((sum[1] + packet.size / 2) / packet.size);
+    average.B = (unsigned char)((sum[2] + packet.size / 2) / packet.size);
+    return average;
+}
+
+/** Find what the ray through each pixel of the tile hits, intersecting in precision Real
+*/
+template <typename Real>
+void RayTracer::traceTile(const Tile& tile, const SampleGrid& grid, SurfaceHit* tileHits, SurfaceHit* hits,
+    RenderStats& stats) const
+{
+    if (structure != Acceleration::ScreenBins) {
+        traceTilePart<Real>(tile, tile, grid, 0, bruteForceGeometry(Real()).size(), tileHits, hits, stats);
+        return;
+    }
+
+    // Split the tile along the bin grid so each part is only tested against the shapes of its own bin
+    Tile part;
+    for (part.y0 = tile.y0; part.y0 < tile.y1; part.y0 = part.y1) {
+        part.y1 = std::min(tile.y1, (part.y0 / binSize + 1) * binSize);
+        for (part.x0 = tile.x0; part.x0 < tile.x1; part.x0 = part.x1) {
+            part.x1 = std::min(tile.x1, (part.x0 / binSize + 1) * binSize);
+            int bin = (part.y0 / binSize) * binColumns + part.x0 / binSize;
+            traceTilePart<Real>(tile, part, grid, binOffsets[bin], binOffsets[bin + 1] - binOffsets[bin], tileHits, hits,
+                stats);
+        }
+    }
+}
+
+/** Trace the rays of part of a tile packetSize x packetSize samples of the grid at a time
+*/
+template <typename Real>
+void RayTracer::traceTilePart(const Tile& tile, const Tile& part, const SampleGrid& grid, int first, int count,
+    SurfaceHit* tileHits, SurfaceHit* hits, RenderStats& stats) const
+{
+    typedef BasicVector<Real> RealVector;
+    const RealVector p(p_11);
+    const RealVector qx(q_x);
+    const RealVector qy(q_y);
+    BasicRayPacket<Real> packet;
+    packet.origin = RealVector(camera);
+    int pixelX[BasicRayPacket<Real>::MAX_RAYS];
+    int pixelY[BasicRayPacket<Real>::MAX_RAYS];
+    SurfaceHit* sampleHits[BasicRayPacket<Real>::MAX_RAYS];
+    int span = packetSize * grid.step;
+    int columns = grid.columns(tile);
+    int tileX0 = grid.first(tile.x0);
+    int tileY0 = grid.first(tile.y0);
+
+    // Loop through squares of packetSize x packetSize samples (smaller at the right and bottom edges of the part)
+    for (int y0 = grid.first(part.y0); y0 < part.y1; y0 += span) {
+        for (int x0 = grid.first(part.x0); x0 < part.x1; x0 += span) {
+            int x1 = x0 + span < part.x1 ? x0 + span : part.x1;
+            int y1 = y0 + span < part.y1 ? y0 + span : part.y1;
+
+            // Rays through each sample of the square, row by row
+            packet.size = 0;
+            SurfaceHit* rowHits = tileHits + ((y0 - tileY0) / grid.step) * columns + (x0 - tileX0) / grid.step;
+            for (int y = y0; y < y1; y += grid.step, rowHits += columns) {
+                SurfaceHit* sampleHit = rowHits;
+                for (int x = x0; x < x1; x += grid.step, sampleHit++) {
+                    if (grid.skipped(x, y)) {
+                        continue;
+                    }
+                    // Current ray tracing vector: p_ij = p_11 + q_x(i-1) + q_y(j-1), normalized (same as generatePrecomputedView)
+                    packet.directions[packet.size] = precomputedView ? RealVector(view[size_t(y) * WIDTH + x]) :
+                        (p + qx.scalarMult(Real(x)) + qy.scalarMult(Real(y))).normalized();
+                    packet.t[packet.size] = INFINITY;
+                    packet.hit[packet.size] = -1;
+                    pixelX[packet.size] = x;
+                    pixelY[packet.size] = y;
+                    sampleHits[packet.size] = sampleHit;
+                    packet.size++;
+                }
+            }
+            if (packet.size == 0) {
+                continue;
+            }
+
+            // Nearest shape each ray hits, at distance t
+            tracePacket(packet, first, count, stats);
+
+            for (int r = 0; r < packet.size; r++) {
+                resolveHit(packet, r, *sampleHits[r], stats);
+                if (hits) {
+                    hits[size_t(pixelY[r]) * WIDTH + pixelX[r]] = *sampleHits[r];
+                }
+            }
+        }
+    }
+}
+
+/** Each pixel is a one pixel part of its own bin, counted with its own stats
+*/
+template <typename Real>
+void RayTracer::heatmapTile(const Tile& tile, HeatmapMetric metric)
+{
+    SurfaceHit hit;
+    Tile pixel;
+    for (pixel.y0 = tile.y0; pixel.y0 < tile.y1; pixel.y0++) {
+        for (pixel.x0 = tile.x0; pixel.x0 < tile.x1; pixel.x0++) {
+            pixel.x1 = pixel.x0 + 1;
+            pixel.y1 = pixel.y0 + 1;
+            int first;
+            int count;
+            pixelShapeRange(pixel.x0, pixel.y0, first, count);
+
+            RenderStats pixelStats;
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            traceTilePart<Real>(pixel, pixel, SampleGrid(), first, count, &hit, nullptr, pixelStats);
+            shade(hit, pixelStats);
+            std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+
+            heatmap[size_t(pixel.y0) * WIDTH + pixel.x0] = metric == HeatmapMetric::IntersectionTests ?
+                double(pixelStats.intersectionTests) : elapsed.count();
+        }
+    }
+}
+
+/** The hit point and normal are always worked out in double, so shading is the same code for both precisions
+*/
+template <typename Real>
+void RayTracer::resolveHit(const BasicRayPacket<Real>& packet, int r, SurfaceHit& hit, RenderStats& stats) const
+{
+    int hitShape = packet.hit[r];
+    hit.shape = hitShape;
+    if (hitShape < 0) {
+        return;
+    }
+    RENDER_STATS(stats.primaryHits++);
+
+    // A float t puts the point up to ~1e-6 off the surface, enough for shadow rays to hit their own shape: intersect
+    // the one shape found again in double (along the ray made exactly unit length)
+    Vector direction(packet.directions[r]);
+    double tHit = packet.t[r];
+    if (!std::is_same<Real, double>::value) {
+        direction = direction.normalized();
+        Intersection exact = shapeOf(hitShape).intersect(camera, direction);
+        tHit = exact.hit ? exact.t : tHit;
+    }
+    hit.point = camera + direction.scalarMult(tHit);
+    hit.normal = shapeOf(hitShape).normal(hit.point);
+}
+
+/** Instanced spheres are numbered after the plain shapes
+*/
+Sphere RayTracer::shapeOf(int id) const
+{
+    if (id < shapes.size()) {
+        return shapes[id];
+    }
+    return instances.sphere(id - int(shapes.size()));
+}
+
+/** Screen bins hold the shapes near each pixel, the other structures use every shape
+*/
+void RayTracer::pixelShapeRange(int x, int y, int& first, int& count) const
+{
+    first = 0;
+    count = bruteForceGeometry(double()).size();
+    if (structure == Acceleration::ScreenBins) {
+        int bin = (y / binSize) * binColumns + x / binSize;
+        first = binOffsets[bin];
+        count = binOffsets[bin + 1] - first;
+    }
+}
+
+/** The instances are traced one ray at a time in double, each only looking for hits nearer than the shapes'
+*/
+template <typename Real>
+void RayTracer::tracePacket(BasicRayPacket<Real>& packet, int first, int count, RenderStats& stats) const
+{
+    traceShapes(packet, first, count, stats);
+    if (instances.empty()) {
+        return;
+    }
+
+    long long* tests = nullptr;
+    RENDER_STATS(tests = &stats.intersectionTests);
+    Vector origin(packet.origin);
+    for (int r = 0; r < packet.size; r++) {
+        // Float directions are only unit length to float precision
+        Vector direction = Vector(packet.directions[r]).normalized();
+        double t = packet.t[r];
+        int id = instances.closestHit(origin, direction, t, tests);
+        if (id >= 0) {
+            packet.t[r] = Real(t);
+            packet.hit[r] = int(shapes.size()) + id;
+        }
+    }
+}
+
+/** A single ray is traced on its own, bigger packets together
+*/
+template <typename Real>
+void RayTracer::traceShapes(BasicRayPacket<Real>& packet, int first, int count, RenderStats& stats) const
+{
+    long long* tests = nullptr;
+    RENDER_STATS(tests = &stats.intersectionTests);
+    const BasicSphereSoA<Real>& geometry = bruteForceGeometry(Real());
+    if (structure == Acceleration::BVH && bvhLayout == BVHLayout::Wide) {
+        for (int r = 0; r < packet.size; r++) {
+            int hitIndex = wideBvh.closestHit(packet.origin, packet.directions[r], packet.t[r], tests);
+            if (hitIndex >= 0) {
+                packet.hit[r] = hitIndex;
+            }
+        }
+        return;
+    }
+    if (structure == Acceleration::BVH) {
+        if (packet.size == 1) {
+            packet.hit[0] = bvh.closestHit(packet.origin, packet.directions[0], packet.t[0], tests);
+        }
+        else {
+            packet.prepare();
+            bvh.closestHit(packet, tests);
+        }
+        return;
+    }
+    if (structure == Acceleration::Grid) {
+        for (int r = 0; r < packet.size; r++) {
+            int hitIndex = grid.closestHit(packet.origin, packet.directions[r], packet.t[r], tests);
+            if (hitIndex >= 0) {
+                packet.hit[r] = hitIndex;
+            }
+        }
+        return;
+    }
+
+    // Same result as calling intersect on every shape of the range, keeping only hits nearer than the nearest so far
+    if (packet.size > 1) {
+        packet.prepare();
+    }
+    if (packet.size == 1 || !packet.coherent) {
+        RENDER_STATS(stats.intersectionTests += (long long)packet.size * count);
+        for (int r = 0; r < packet.size; r++) {
+            int position = geometry.closestHit(packet.origin, packet.directions[r], first, count, packet.t[r]);
+            if (position >= 0) {
+                packet.hit[r] = geometry.getIndex(position);
+            }
+        }
+        return;
+    }
+
+    // Only the shapes whose bounds the packet may hit, in order, so every ray finds the same shape as when it is tested
+    // against all of them. Neighbouring candidates are tested together in one run
+    double tMax = packet.maxT();
+    int end = first + count;
+    int n = first;
+    while (n < end) {
+        double tEntry;
+        const AABB* bounds = &shapeBounds[geometry.getIndex(n)];
+        if (!packet.intersectBox(bounds->min, bounds->max, tMax, tEntry)) {
+            n++;
+            continue;
+        }
+        int runFirst = n++;
+        while (n < end) {
+            bounds = &shapeBounds[geometry.getIndex(n)];
+            if (!packet.intersectBox(bounds->min, bounds->max, tMax, tEntry)) {
+                break;
+            }
+            n++;
+        }
+        RENDER_STATS(stats.intersectionTests += (long long)packet.size * (n - runFirst));
+        for (int r = 0; r < packet.size; r++) {
+            int position = geometry.closestHit(packet.origin, packet.directions[r], runFirst, n - runFirst, packet.t[r]);
+            if (position >= 0) {
+                packet.hit[r] = geometry.getIndex(position);
+            }
+        }
+        tMax = packet.maxT();
+    }
+}
+
+/** Packed shapes in the precision of the query (binned for screen bins)
+*/
+const SphereSoA& RayTracer::bruteForceGeometry(double) const
+{
+    return structure == Acceleration::ScreenBins ? binnedGeometry : shapeGeometry;
+}
+
+const SphereSoAF& RayTracer::bruteForceGeometry(float) const
+{
+    return structure == Acceleration::ScreenBins ? binnedGeometryF : shapeGeometryF;
+}
+
+/** Color at one surface point using Lambertian shading
+*/
+Pixel RayTracer::shade(const SurfaceHit& hit, RenderStats& stats) const
+{
+    // Determine coloring based on:
+    /*
+    (1) If there is a shape at that pixel (ray intersects with shape)
+        -> How incident is that shape intersection vector with the light source
+    (2) If there is no shape at that pixel
+        -> Color with background color
+    */
+    if (hit.shape < 0) {
+        return backgroundColor;
+    }
+    Sphere shape = shapeOf(hit.shape);
+
+    // Calculate color of shape based on light intensity at intersection point
+    Vector lightVector = (light - hit.point).normalized();
+
+    // 1 = most lit by light
+    // 0 = not lit by light (use ambient color)
+    double incidentLight = lightVector * hit.normal;
+    if (incidentLight < 0.0)
+        incidentLight = 0.0;
+
+    // Another shape between the point and the light leaves only the ambient color
+    if (shadows && incidentLight > 0.0) {
+        StatsClock clock;
+        bool occluded = inShadow(hit, stats);
+        RENDER_STATS(stats.shadowRays++);
+        RENDER_STATS(stats.shadowSeconds += clock.lap());
+        if (occluded) {
+            incidentLight = 0.0;
+        }
+    }
+
+    // Pixel colors before scaled by ambience
+    Pixel shapeColorUnscaled = shape.color();
+
+    // Pixel color scale factor
+    double RGBShading = shape.ambient() + (1 - shape.ambient()) * incidentLight;
+
+    Pixel pixelColor;
+    //R 
+    pixelColor.R = shapeColorUnscaled.R * RGBShading;
+    //G
+    pixelColor.G = shapeColorUnscaled.G * RGBShading;
+    //B
+    pixelColor.B = shapeColorUnscaled.B * RGBShading;
+
+    return pixelColor;
+}
+
+/** Any-hit query from just above the surface towards the light, through the same structure as primary rays
+*/
+bool RayTracer::inShadow(const SurfaceHit& hit, RenderStats& stats) const
+{
+    // Start slightly off the surface so the shape does not shadow itself through rounding
+    Vector origin = hit.point + hit.normal.scalarMult(SHADOW_BIAS);
+    Vector toLight = light - origin;
+    double distance = std::sqrt(toLight.normSquared());
+    Vector direction = toLight.scalarMult(1 / distance);
+
+    if (structure == Acceleration::BVH || structure == Acceleration::Grid) {
+        long long* tests = nullptr;
+        RENDER_STATS(tests = &stats.intersectionTests);
+        bool occluded = structure == Acceleration::Grid ? grid.anyHit(origin, direction, distance, tests) :
+            bvhLayout == BVHLayout::Wide ? wideBvh.anyHit(origin, direction, distance, tests) :
+            bvh.anyHit(origin, direction, distance, tests);
+        return occluded || instances.anyHit(origin, direction, distance, tests);
+    }
+    RENDER_STATS(stats.intersectionTests += shapeGeometry.size());
+    if (shapeGeometry.anyHit(origin, direction, 0, shapeGeometry.size(), distance)) {
+        return true;
+    }
+    long long* tests = nullptr;
+    RENDER_STATS(tests = &stats.intersectionTests);
+    return instances.anyHit(origin, direction, distance, tests);
+}
+
+/** Recolor every pixel from the G-buffer - no primary rays are traced
+*/
+void RayTracer::reshadePixels()
+{
+    WorkerStats workerStats(scheduler.getThreadCount());
+    scheduler.runTiles(WIDTH, HEIGHT, tileSize, [&](const Tile& tile, int worker) {
+        StatsClock clock;
+        TimelineScope scope(activeTimeline(), worker, "shade", tile.x0, tile.y0);
+        for (int y = tile.y0; y < tile.y1; y++) {
+            for (int x = tile.x0; x < tile.x1; x++) {
+                size_t i = size_t(y) * WIDTH + x;
+                pixels[i] = shade(gBuffer[i], workerStats[worker]);
+            }
+        }
+        RENDER_STATS(workerStats[worker].shadeSeconds += clock.lap());
+    });
+    mergeStats(workerStats);
+}
+
+/** Add the statistics of every worker to stats
+*/
+void RayTracer::mergeStats(const WorkerStats& workerStats)
+{
+    for (int w = 0; w < workerStats.size(); w++) {
+        stats.add(workerStats[w]);
+    }
 }
@@ -1,13 +1,95 @@
 #ifndef _RAYTRACER_HPP_
 #define _RAYTRACER_HPP_
 
+#include <atomic>
+#include <functional>
 #include <iostream>
 #include <vector>
 
+#include "BVH.hpp"
+#include "Grid.hpp"
+#include "Heatmap.hpp"
+#include "Instancing.hpp"
+#include "RayPacket.hpp"
+#include "RenderStats.hpp"
 #include "Sphere.hpp"
+#include "SphereSoA.hpp"
+#include "TileScheduler.hpp"
+#include "Timeline.hpp"
 #include "Vector.hpp"
+#include "WideBVH.hpp"
 
 
+/**
+ * How colorPixels finds the shape each ray hits
+ */
+enum class Acceleration
+{
+	BruteForce,	// Test every ray against every shape (several at a time with SIMD)
+	BVH,	// Bounding volume hierarchy over the shapes (default)
+	ScreenBins,	// Each shape's bounds projected onto the image first, then brute force per tile over only the shapes there
+	Grid,	// Uniform grid over the shapes, each ray walking the cells it crosses (see setGridLevels)
+	Auto	// Grid or BVH, picked from the density of the shapes (Grid::suits) whenever shapes are added
+};
+
+/**
+ * Scalar type the primary rays are generated and intersected in
+ */
+enum class Precision
+{
+	Double,	// Default
+	Float	// Twice the SIMD lanes; images differ from Double only in the odd pixel at a silhouette edge
+};
+
+/**
+ * What the ray through one pixel hit: everything needed to shade the pixel again without tracing it
+ */
+struct SurfaceHit
+{
+	Vector point;	// Intersection point
+	Vector normal;	// Unit surface normal at point
+	int shape{ -1 };	// Index of the shape hit, -1 for background
+};
+
+/**
+ * Pixels traced by one pass of a render: those on every step-th row and column, except the ones on every skip-th row
+ * and column, which an earlier, coarser pass has traced (skip 0 for none). By default every pixel
+ * step and skip are powers of two, so the tests in the per-pixel loops are masks rather than divisions
+ */
+struct SampleGrid
+{
+	int step{ 1 };
+	int skip{ 0 };
+
+	/**
+	 * @return first row or column at or after v with samples on it
+	 */
+	int first(int v) const
+	{
+		return (v + step - 1) & ~(step - 1);
+	}
+
+	/**
+	 * @return number of columns / rows of tile with samples on them
+	 */
+	int columns(const Tile& tile) const
+	{
+		return (tile.x1 - first(tile.x0) + step - 1) / step;
+	}
+	int rows(const Tile& tile) const
+	{
+		return (tile.y1 - first(tile.y0) + step - 1) / step;
+	}
+
+	/**
+	 * @return true if (x, y), a pixel on every step-th row and column, was traced by the earlier pass
+	 */
+	bool skipped(int x, int y) const
+	{
+		return skip && ((x | y) & (skip - 1)) == 0;
+	}
+};
+
 /**
  * A simple ray tracer in C++: currently only supports one object in scene
  */
@@ -45,6 +127,56 @@ public:
 	 */
 	void renderScene();
 
+	/**
+	 * Render the scene straight to a png file (scene.png if filename is empty), stripHeight rows at a time. Only one
+	 * strip of pixels is ever held in memory, so very large images can be rendered; the file is the same image
+	 * renderScene and saveSceneToPNG would give, but getPixels is not updated
+	 * @return whether the scene was successfully rendered and written to disk
+	 */
+	bool renderSceneToPNG(std::string filename, int stripHeight = 64);
+
+	/**
+	 * Called by renderProgressive after each pass with the framebuffer (every pixel filled in) and the spacing of the
+	 * samples traced so far. Return false to stop rendering
+	 */
+	typedef std::function<bool(const std::vector<Pixel>& pixels, int spacing)> ProgressCallback;
+
+	/**
+	 * Progressive render for interactive previews: first trace every coarsestSpacing-th pixel of every
+	 * coarsestSpacing-th row (rounded down to a power of two, at most 64) and fill the pixels in between with the
+	 * sample above and left of them, then halve the spacing pass by pass down to 1. Each pass only traces the pixels no
+	 * earlier pass has, so the whole render traces every pixel once. After each pass progress is called
+	 * Rendering stops early when progress returns false or cancelRender is called (from any thread; the pass in flight
+	 * stops at the next tile, and the tiles it traced are undone). The framebuffer is then the image the last finished
+	 * pass gave progress, or blank (all zero) if the first pass did not finish
+	 * @return true if every pass finished - the image is then the one renderScene gives
+	 */
+	bool renderProgressive(const ProgressCallback& progress, int coarsestSpacing = 16);
+
+	/**
+	 * Stop renderProgressive as soon as possible. Safe to call from another thread while it runs. Called while no render
+	 * runs, it stops the next renderProgressive before its first pass (the flag is cleared when a render returns)
+	 */
+	void cancelRender();
+
+	/**
+	 * Diagnostic render: instead of shading, color every pixel by what it cost - the ray-sphere tests its primary (and
+	 * shadow) ray made, or the nanoseconds taken to trace and shade it - and write that as a heatmap png with a legend
+	 * of the scale and its min and max (see Heatmap). Shows where the acceleration structure does badly, e.g. clusters
+	 * of spheres that the BVH cannot separate. Every pixel is traced as a single ray so its cost is its own, whatever
+	 * the packet size. getPixels is not updated
+	 * Tests are only counted when statistics are compiled in (RAYTRACER_STATS): without them the default metric is
+	 * HeatmapMetric::Nanoseconds, and asking for HeatmapMetric::IntersectionTests fails
+	 * @return whether the heatmap was rendered and written to disk
+	 */
+	bool renderHeatmapToPNG(std::string filename,
+		HeatmapMetric metric = RAYTRACER_STATS ? HeatmapMetric::IntersectionTests : HeatmapMetric::Nanoseconds);
+
+	/**
+	 * @return cost of each pixel in the last renderHeatmapToPNG, row by row
+	 */
+	const std::vector<double>& getHeatmap() const;
+
 	/**
 	 * Setter methods to change scene parameters - call renderScene to see updates
 	 */
@@ -57,6 +189,183 @@ public:
 	 */
 	void addShape(Sphere newShape);
 
+	/**
+	 * Move shape index (counting from 0 in the order shapes were added) to position and give it radius, keeping its
+	 * color - call renderScene to see updates. The next render refits the BVH to the moved shapes instead of
+	 * rebuilding it, unless refitting leaves it worse than setRefitThreshold allows
+	 * @return false (and nothing changes) if there is no such shape or radius is not positive
+	 */
+	bool updateShape(int index, const Vector& position, double radius);
+
+	/**
+	 * Instancing: add a cluster of spheres (in its own local coordinates), then place copies of it with addInstance.
+	 * Each cluster gets one BVH, however many copies of it there are, and the copies one BVH over their bounds (see
+	 * InstancedScene), which rays go through in addition to the shapes whatever the acceleration. A cluster of a
+	 * thousand spheres placed a thousand times renders like a million shapes for the memory of a few thousand
+	 * Shapes hit in an instance are numbered after the plain shapes, in the order of InstancedScene's sphere ids
+	 * @return id of the cluster, -1 (and nothing changes) if spheres is empty
+	 */
+	int addCluster(const std::vector<Sphere>& spheres);
+
+	/**
+	 * Place a copy of cluster in the scene, moved, rotated and scaled by transform - call renderScene to see updates
+	 * @return false (and nothing changes) if there is no such cluster or transform has a non-positive or non-finite
+	 * scale
+	 */
+	bool addInstance(int cluster, const Transform& transform);
+
+	/**
+	 * @return number of instances placed with addInstance
+	 */
+	int getInstanceCount() const;
+
+	/**
+	 * A refitted BVH is rebuilt once its SAH cost (see BVH::sahCost) grows past threshold times the cost it had when
+	 * it was built: 1 rebuilds as soon as refitting makes it any worse, larger values refit for longer. 1.5 by
+	 * default (values below 1 are clamped to 1)
+	 */
+	void setRefitThreshold(double threshold);
+	double getRefitThreshold() const;
+
+	/**
+	 * Number of worker threads used by renderScene (values below 1 use one thread per hardware core, the default)
+	 * The rendered image is byte-identical whatever the thread count
+	 */
+	void setThreadCount(int threads);
+	int getThreadCount() const;
+
+	/**
+	 * Width and height (in pixels) of the square tiles the image is split into for the worker threads
+	 */
+	void setTileSize(int size);
+	int getTileSize() const;
+
+	/**
+	 * Compression level of saved PNGs, 0 (stored, fastest) to 9 (smallest file), default 6. saveSceneToPNG compresses
+	 * pieces of the image on all worker threads
+	 */
+	void setCompressionLevel(int level);
+	int getCompressionLevel() const;
+
+	/**
+	 * Relighting cache: when enabled, renderScene keeps the hit point, normal and shape of every pixel (a G-buffer,
+	 * about 56 bytes per pixel). If only the light has moved since, the next renderScene shades from it without
+	 * tracing any rays. addShape and the camera and target setters invalidate it. Off by default
+	 */
+	void setGBuffer(bool enable);
+	bool getGBuffer() const;
+
+	/**
+	 * Shadows: when enabled, every lit surface point casts a shadow ray towards the light, and a point with another shape
+	 * in between gets only its ambient color. Shadow rays use an any-hit query (stopping at the first occluder) through
+	 * the same acceleration structure as the camera rays. Off by default
+	 */
+	void setShadows(bool enable);
+	bool getShadows() const;
+
+	// Largest side of the grid of sub-pixel rays in an anti-aliased pixel
+	static const int MAX_ANTIALIASING = 4;
+
+	/**
+	 * Adaptive anti-aliasing: after one ray per pixel, every pixel whose hit shape differs from one of its four
+	 * neighbours', or whose color differs from it by more than the threshold on some channel, is traced again with
+	 * side x side stratified (jittered) sub-pixel rays and given their average color. Only silhouettes and shadow or
+	 * shading edges pay for the extra rays; RenderStats::samplesPerPixel reports the effective rate. side is clamped
+	 * to 1 .. MAX_ANTIALIASING, 1 (the default) turns it off. The threshold is 0 .. 255, 16 by default. The image is
+	 * the same whatever the thread count
+	 */
+	void setAntialiasing(int side);
+	int getAntialiasing() const;
+	void setAntialiasThreshold(int threshold);
+	int getAntialiasThreshold() const;
+
+	/**
+	 * Timeline export: when enabled, every render records when each tile was traced and shaded on which worker
+	 * thread, alongside the acceleration build and PNG encode, and saveSceneToPNG / renderSceneToPNG write it next to
+	 * the image as a Chrome trace JSON file (open it in chrome://tracing or ui.perfetto.dev). Off by default
+	 */
+	void setTimeline(bool enable);
+	bool getTimeline() const;
+
+	/**
+	 * @return name of the timeline file written next to a png: scene.png -> scene.trace.json
+	 */
+	static std::string timelineFilename(const std::string& pngFilename);
+
+	/**
+	 * @return statistics of the last renderScene or renderSceneToPNG: time per phase, rays cast (primary and shadow
+	 * separately), intersection tests, hit ratio and peak framebuffer memory. saveSceneToPNG adds its encode time.
+	 * All zero when built with RAYTRACER_STATS off
+	 */
+	const RenderStats& getRenderStats() const;
+
+	/**
+	 * Validation switch: when enabled, renderScene precomputes and stores a ray for every pixel (the original
+	 * generateView behaviour, WIDTH * HEIGHT Vectors) instead of generating each ray from the camera basis while
+	 * rendering. Both give the same image
+	 */
+	void setPrecomputedView(bool enable);
+	bool getPrecomputedView() const;
+
+	/**
+	 * Precision of the primary ray kernels (camera rays, BVH leaves and brute force intersection). Shading and shadow
+	 * rays stay in double. Double by default
+	 */
+	void setPrecision(Precision newPrecision);
+	Precision getPrecision() const;
+
+	/**
+	 * Packet tracing: rays through each square of size x size neighbouring pixels (2, 4 or 8; at most 8) are traced
+	 * together, culling BVH nodes (or, with brute force, shapes) for the whole packet at once with an interval test on
+	 * their bounds. Packets whose rays point different ways on some axis are traced one ray at a time. 1 traces every
+	 * ray on its own. 4 by default. Same image either way
+	 */
+	void setPacketSize(int size);
+	int getPacketSize() const;
+
+	/**
+	 * Choose how rays are tested against the shapes - every choice renders the same image
+	 */
+	void setAcceleration(Acceleration accel);
+	Acceleration getAcceleration() const;
+
+	/**
+	 * @return the acceleration the last render used: the one set, or with Acceleration::Auto the one it picked
+	 */
+	Acceleration getActiveAcceleration() const;
+
+	/**
+	 * Levels of the grid used by Acceleration::Grid: 1 (default) for a uniform grid, 2 to give each crowded cell of a
+	 * coarser grid its own grid, for scenes with dense clumps (values outside 1 to 2 are clamped)
+	 */
+	void setGridLevels(int levels);
+	int getGridLevels() const;
+
+	/**
+	 * How the BVH is built: BVHBuilder::SAH (default) for the fastest tracing, BVHBuilder::LBVH to rebuild far faster
+	 * (for shapes that change every frame) at some cost in tracing. Same image either way
+	 */
+	void setBVHBuilder(BVHBuilder builder);
+	BVHBuilder getBVHBuilder() const;
+
+	/**
+	 * Node layout the BVH is traced in: BVHLayout::Binary (default), or BVHLayout::Wide to collapse it into 8-wide
+	 * quantized nodes (see WideBVH) after every build or refit, for fewer node bytes and fewer, wider node visits.
+	 * Same image either way
+	 */
+	void setBVHLayout(BVHLayout layout);
+	BVHLayout getBVHLayout() const;
+
+	/**
+	 * @return RGBA values of the rendered scene, one Pixel per pixel row by row from the top left
+	 */
+	const std::vector<Pixel>& getPixels() const;
+
+	/**
+	 * @return the same pixels as a contiguous RGBA8 buffer (4 * WIDTH * HEIGHT bytes, no copy) for image writers
+	 */
+	const unsigned char* getPixelData() const;
+
 
 private:
 	//width and height (in pixels) of the image (changeable)
@@ -73,18 +382,93 @@ private:
 	Vector camera;	// Location of camera
 	Vector target;	// Location camera is looking towards (target - camera = direction of camera)
 	std::vector<Sphere> shapes;	// Multiple shapes
-	std::vector<Vector> view; //normalized vectors leaving our camera
+	// Camera basis from generateView: the (unnormalized) ray through pixel (column x, row y), counting from 0 at the
+	// top left, is p_11 + q_x * x + q_y * y
+	Vector p_11; //ray through the top left pixel
+	Vector q_x; //step between neighbouring pixels of a row
+	Vector q_y; //step between neighbouring pixels of a column
+	bool precomputedView; //true to store every ray in view instead of generating them while rendering
+	std::vector<Vector> view; //normalized vectors leaving our camera (only filled when precomputedView is true)
 
 	// One-dimensional vector being used to represented two-dimensional pixels on the view (more efficient)
-	std::vector<Pixel> pixels; //RGBA values for each pixel in image
+	// Pixel is 4 bytes RGBA, so this is also the raw RGBA8 buffer the PNG writer encodes
+	std::vector<Pixel> pixels; //RGBA values for each pixel in image (allocated by renderScene)
 	bool VALID_SCENE; //true if scene is renderable
 
+	TileScheduler scheduler; //worker threads that colorPixels hands tiles to
+	int tileSize; //width and height (in pixels) of each tile
+	int compressionLevel; //PNG compression level, see PNGWriter::setCompressionLevel
+
+	Acceleration acceleration; //how rays are tested against shapes
+	BVH bvh; //hierarchy over shapes, used when acceleration is Acceleration::BVH
+	BVHBuilder bvhBuilder; //how bvh is built
+	BVHLayout bvhLayout; //how bvh is traced
+	WideBVH wideBvh; //bvh collapsed into wide nodes, used instead of it when bvhLayout is BVHLayout::Wide
+	Acceleration structure; //acceleration in use: acceleration, or what Acceleration::Auto picked
+	Grid grid; //grid over shapes, used when structure is Acceleration::Grid
+	int gridLevels; //levels grid is built with
+	double refitThreshold; //refitted bvh is rebuilt past this many times its cost when built
+	InstancedScene instances; //instanced clusters, traced after the shapes whatever the acceleration
+	SphereSoA shapeGeometry; //packed copy of shapes, used when acceleration is Acceleration::BruteForce
+	SphereSoAF shapeGeometryF; //the same in single precision, for Precision::Float
+	std::vector<AABB> shapeBounds; //bounding box of each shape, for culling packets with brute force
+	SphereSoA binnedGeometry; //shapes of every screen bin in turn, used when acceleration is Acceleration::ScreenBins
+	SphereSoAF binnedGeometryF; //the same in single precision, for Precision::Float
+	std::vector<int> binOffsets; //shapes of bin b are at positions [binOffsets[b], binOffsets[b + 1]) of binnedGeometry
+	int binSize; //width and height (in pixels) of each screen bin
+	int binColumns; //number of screen bins across the image
+	bool accelerationOutdated; //true if shapes changed since bvh/shapeGeometry was built
+	bool shapesMoved; //true if updateShape moved shapes since bvh/shapeGeometry was built or refitted
+	bool layoutOutdated; //true if setBVHLayout changed bvhLayout since bvh was last collapsed into wideBvh
+
+	bool gBufferEnabled; //true to record gBuffer while rendering
+	bool gBufferValid; //true if gBuffer matches the current camera, target and shapes
+	std::vector<SurfaceHit> gBuffer; //surface hit of each pixel from the last traced render
+
+	bool shadows; //true to cast shadow rays when shading
+	RenderStats stats; //statistics of the last render
+	bool timelineEnabled; //true to record timeline
+	Timeline timeline; //per-thread events of the last render (and its encode)
+	std::vector<double> heatmap; //cost of each pixel in the last heatmap render
+	int antialiasing; //side of the grid of sub-pixel rays in edge pixels (1 for no anti-aliasing)
+	int antialiasThreshold; //largest channel difference between neighbouring pixels that is not an edge
+	std::vector<int> pixelShapes; //shape hit by each pixel's ray (-1 for none), kept while anti-aliasing
+	std::vector<unsigned char> edgePixels; //1 for each pixel of the rows being anti-aliased that is supersampled
+
 	/**
-	 * Establish normalized vector from camera/eye to image plane, used as main ray tracing rays from camera
-	 * CHANGES: view vector member data
+	 * Flag another thread may set while rendering; copies of the tracer start out not cancelled
+	 */
+	struct CancelFlag
+	{
+		std::atomic<bool> value{ false };
+
+		CancelFlag() {}
+		CancelFlag(const CancelFlag&) {}
+		CancelFlag& operator=(const CancelFlag&) { return *this; }
+	};
+	CancelFlag cancelled; //set by cancelRender
+	Precision precision; //scalar type of the primary ray kernels
+	int packetSize; //side of the square of pixels traced as one packet (1 for single rays)
+
+	/**
+	 * Give every pixel not on every spacing-th row and column the color of the nearest pixel above and left of it that is
+	 * CHANGES: pixels
+	 */
+	void fillGaps(int spacing);
+
+	/**
+	 * Establish the camera basis used to generate the main ray tracing rays from camera (and precompute all of them
+	 * if precomputedView is set)
+	 * CHANGES: p_11, q_x, q_y (and view) member data
 	 */
 	void generateView();
 
+	/**
+	 * Original view generation: store the normalized vector from camera/eye to every pixel on the image plane
+	 * CHANGES: view vector member data
+	 */
+	void generatePrecomputedView();
+
 	/**
 	* Ensure that camera position and direction are valid (set to VALID_SCENE)
 	* CHANGES: VALID_SCENE member data
@@ -98,9 +482,154 @@ private:
 	void colorPixels();
 
 	/**
-	* lodepng library requires pixel RGBA values to be in a vector where each pixel RGBA corresponds to 4 elements in vector instead of Pixel struct
+	* Build the acceleration structure over shapes if it is in use and shapes changed since it was built
+	* CHANGES: bvh or shapeGeometry member data
+	*/
+	void buildAcceleration();
+
+	/**
+	* Screen-space culling pre-pass: list in each bin of the image the shapes whose projection may overlap it,
+	* skipping shapes outside the view or behind the camera
+	* CHANGES: binnedGeometry (or binnedGeometryF), binOffsets, binSize, binColumns member data
+	*/
+	void binShapes();
+
+	/**
+	* buildAcceleration (and binShapes if bin), each recorded on the timeline
+	*/
+	void timedBuildAcceleration(bool bin);
+
+	/**
+	* @return &timeline if it is enabled, nullptr otherwise
+	*/
+	Timeline* activeTimeline();
+
+	/**
+	* Color the pixels of one tile of the image (called from the worker threads, tiles never overlap)
+	* @param grid - which pixels of the tile to color (SampleGrid() for all of them)
+	* @param worker - index of the worker thread running this tile
+	* @param image - rows firstRow onwards of the image, WIDTH pixels per row (pixels.data() with firstRow 0 for the
+	* whole image, or a strip buffer)
+	* @param shapes - same layout as image, to record the shape each pixel's ray hits in (nullptr to not record them)
+	* @param hits - G-buffer for the whole image to record each pixel's surface hit in (nullptr to not record them)
+	* @param stats - statistics of the worker thread running this tile
+	* CHANGES: image pixels (and hits) inside tile
+	*/
+	void colorTile(const Tile& tile, const SampleGrid& grid, int worker, Pixel* image, int* shapes, int firstRow,
+		SurfaceHit* hits, RenderStats& stats);
+
+	/**
+	* Adaptive anti-aliasing of rows [y0, y1) of an image held from row firstRow to lastRow (exclusive) in image, with
+	* the shape hit in each pixel in shapes: supersample every pixel markEdges marks, on the worker threads
+	* @param workerStats - statistics to count the extra rays in (merged into stats by the overload without it)
+	* CHANGES: edge pixels of rows [y0, y1) of image, edgePixels
+	*/
+	void antialiasRows(Pixel* image, const int* shapes, int firstRow, int lastRow, int y0, int y1);
+	void antialiasRows(Pixel* image, const int* shapes, int firstRow, int lastRow, int y0, int y1, WorkerStats& workerStats);
+
+	/**
+	* Mark the pixels of tile that hit another shape than one of their four neighbours held in image (rows firstRow
+	* to lastRow), or differ from it by more than antialiasThreshold on some channel
+	* @param edges - flag of each pixel of the tile's rows, WIDTH per row
+	* CHANGES: edges inside tile
+	*/
+	void markEdges(const Tile& tile, const Pixel* image, const int* shapes, int firstRow, int lastRow,
+		unsigned char* edges) const;
+
+	/**
+	* @return average color of antialiasing x antialiasing stratified sub-pixel rays through pixel (x, y), traced in
+	* precision Real
+	*/
+	template <typename Real>
+	Pixel supersample(int x, int y, RenderStats& stats) const;
+
+	/**
+	* Trace the rays of the pixels of grid in one tile in precision Real (float or double)
+	* @param tileHits - surface hit of each sample of grid in the tile, row by row (grid.columns(tile) per row)
+	* @param hits - G-buffer for the whole image (nullptr to not record the hits there)
+	* @param stats - statistics of the calling worker thread (counts hits and intersection tests)
+	* CHANGES: tileHits (and hits inside tile)
+	*/
+	template <typename Real>
+	void traceTile(const Tile& tile, const SampleGrid& grid, SurfaceHit* tileHits, SurfaceHit* hits, RenderStats& stats) const;
+
+	/**
+	* Trace the rays of the pixels of grid in part (inside tile) against the brute force shapes at positions
+	* [first, first + count) of bruteForceGeometry (all shapes when the BVH is used)
+	* CHANGES: tileHits (and hits) inside part
+	*/
+	template <typename Real>
+	void traceTilePart(const Tile& tile, const Tile& part, const SampleGrid& grid, int first, int count,
+		SurfaceHit* tileHits, SurfaceHit* hits, RenderStats& stats) const;
+
+	/**
+	* Trace and shade every pixel of the tile on its own, recording what each one cost
+	* CHANGES: heatmap inside tile
+	*/
+	template <typename Real>
+	void heatmapTile(const Tile& tile, HeatmapMetric metric);
+
+	/**
+	* Fill in hit from ray r of a traced packet: the shape, and (in double) the point and normal
+	*/
+	template <typename Real>
+	void resolveHit(const BasicRayPacket<Real>& packet, int r, SurfaceHit& hit, RenderStats& stats) const;
+
+	/**
+	* Positions [first, first + count) of bruteForceGeometry holding the shapes a ray through pixel (x, y) (or within
+	* a pixel of it) may hit
+	*/
+	void pixelShapeRange(int x, int y, int& first, int& count) const;
+
+	/**
+	* Find the nearest shape hit by every ray of the packet (on its own if there is only one), through the BVH, the
+	* grid or against the brute force shapes at positions [first, first + count), then through the instances
+	* CHANGES: packet.t and packet.hit
+	*/
+	template <typename Real>
+	void tracePacket(BasicRayPacket<Real>& packet, int first, int count, RenderStats& stats) const;
+
+	/**
+	* tracePacket for the shapes alone
+	*/
+	template <typename Real>
+	void traceShapes(BasicRayPacket<Real>& packet, int first, int count, RenderStats& stats) const;
+
+	/**
+	* @return shape id (as in SurfaceHit): a plain shape, or a sphere of an instance
+	*/
+	Sphere shapeOf(int id) const;
+
+	/**
+	* @return shapeGeometry or shapeGeometryF (binnedGeometry or binnedGeometryF for screen bins), picked by the type
+	* of the (unused) argument
+	*/
+	const SphereSoA& bruteForceGeometry(double) const;
+	const SphereSoAF& bruteForceGeometry(float) const;
+
+	/**
+	* @return color of a pixel whose ray hit the given surface point (backgroundColor if it hit nothing)
+	* @param stats - statistics of the calling worker thread (counts shadow rays)
+	*/
+	Pixel shade(const SurfaceHit& hit, RenderStats& stats) const;
+
+	/**
+	* @return true if a shape lies between the surface point and the light
+	* @param stats - statistics of the calling worker thread (counts intersection tests)
+	*/
+	bool inShadow(const SurfaceHit& hit, RenderStats& stats) const;
+
+	/**
+	* Color every pixel again from the G-buffer after the light moved
+	* CHANGES: pixels vector member data
+	*/
+	void reshadePixels();
+
+	/**
+	* Add the counters and thread times of each worker thread to stats
+	* CHANGES: stats member data
 	*/
-	std::vector<unsigned char> createLoadablePixelVector();
+	void mergeStats(const WorkerStats& workerStats);
 
 };
 
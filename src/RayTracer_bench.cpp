@@ -0,0 +1,1265 @@
+#include "BVH.hpp"
+#include "Grid.hpp"
+#include "Instancing.hpp"
+#include "PNGWriter.hpp"
+#include "RayTracer.hpp"
+#include "Sphere.hpp"
+#include "SphereSoA.hpp"
+#include "TileScheduler.hpp"
+#include "Timeline.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+using std::cout;
+using std::endl;
+using std::string;
+using std::vector;
+
+/**
+* Benchmarks for the RayTracer: run with no arguments to run every benchmark, or pass the names of the benchmarks to run
+* (the suite only runs when named, and then on its own)
+*	threads - rays/sec of renderScene at 1, 2, 4 ... N worker threads
+*	bvh - render time against sphere count (10 to 1,000,000) with and without the BVH
+*	simd - sphere tests per second of the SphereSoA kernels against calling Sphere::intersect in a loop
+*	save - allocations and time to hand the framebuffer to the PNG writer, alone and as part of a whole save
+*	shadows - primary and shadow ray throughput with shadows enabled
+*	relight - renderScene after moving only the light, with and without the G-buffer
+*	deflate - PNG encoding MB/s and file size of lodepng against the parallel writer at several compression levels
+*	stream - peak memory and time of renderSceneToPNG against renderScene + saveSceneToPNG for a large image
+*	precision - render time of double against float primary ray kernels
+*	packets - render time against ray packet size
+*	bins - render time of brute force against screen bins against the BVH
+*	timeline - render time with and without the timeline recorded, and the time to write it
+*	antialias - render time and effective samples per pixel of adaptive anti-aliasing at 2x2 to 4x4 sub-pixel rays
+*	progressive - time to each preview of a progressive render against the time of one full render
+*	lbvh - build time, SAH cost and render time of the SAH builder against the Morton code LBVH (1k to 1M spheres)
+*	refit - time to refit the BVH to moved spheres against rebuilding it, and an animation of drifting spheres
+*	grid - build and render time of the BVH against the uniform and two-level grids for even, clumped and mixed size
+*		clouds, with the density statistics Acceleration::Auto decides from and its pick
+*	instances - memory, build and render time of a 1000 sphere cluster instanced 1000 times against its 1M spheres added
+*		one by one
+*	wide - node bytes per sphere, single ray traversal rate (each box test kernel) and render time of the binary BVH
+*		against the 8-wide quantized one (1k to 1M spheres)
+*	suite - canonical regression suite: fixed-seed sphere clouds of 1 to 1M spheres and images of 512x512 to 8192x8192,
+*		reporting build time, SAH cost, median / p95 render time, rays/sec and peak memory as JSON (or CSV) to track
+*		across releases
+*		Options: --format=json|csv (default json), --output=FILE (default stdout), --repeats=N (default 5),
+*		--quick (skip the 1M sphere and 8192x8192 cases), --builder=sah|lbvh (default sah)
+*/
+
+// Count every operator new in the program, and every malloc and realloc of lodepng (built for the benchmarks without
+// its own allocators, see CMakeLists.txt), so benchmarks can report allocations
+static std::atomic<long long> allocationCount(0);
+
+void* lodepng_malloc(size_t size)
+{
+	allocationCount++;
+	return std::malloc(size);
+}
+
+void* lodepng_realloc(void* ptr, size_t new_size)
+{
+	allocationCount++;
+	return std::realloc(ptr, new_size);
+}
+
+void lodepng_free(void* ptr)
+{
+	std::free(ptr);
+}
+
+void* operator new(std::size_t size)
+{
+	allocationCount++;
+	void* p = std::malloc(size == 0 ? 1 : size);
+	if (p == nullptr) {
+		throw std::bad_alloc();
+	}
+	return p;
+}
+
+void operator delete(void* p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+	std::free(p);
+}
+
+namespace
+{
+	// Image size used by the benchmark scenes
+	const int BENCH_SIZE = 1024;
+
+	/** Seconds taken by the fastest of `repeats' calls to f
+	*/
+	template <typename F>
+	double bestTime(int repeats, F f)
+	{
+		double best = 0;
+		for (int r = 0; r < repeats; r++) {
+			auto start = std::chrono::steady_clock::now();
+			f();
+			std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+			if (r == 0 || elapsed.count() < best) {
+				best = elapsed.count();
+			}
+		}
+		return best;
+	}
+
+	/** 1, 2, 4 ... threads up to the hardware thread count
+	*/
+	vector<int> benchThreadCounts()
+	{
+		vector<int> threadCounts;
+		int hardware = TileScheduler::hardwareThreads();
+		for (int t = 1; t < hardware; t *= 2) {
+			threadCounts.push_back(t);
+		}
+		threadCounts.push_back(hardware);
+		return threadCounts;
+	}
+
+	/** Same kind of scene as RayTracer_main.cpp (random spheres and light) but with a fixed seed so runs are comparable
+	*/
+	RayTracer randomScene(int sphereCount, unsigned int seed)
+	{
+		RayTracer r(Vector(0, 10, 0), Vector(5, 0, 0), Vector(0, 0, 0), vector<Sphere>(), BENCH_SIZE, BENCH_SIZE, 5, 5, Pixel());
+
+		std::mt19937 rng(seed);
+		auto randInt = [&rng](int lo, int hi) { return std::uniform_int_distribution<int>(lo, hi)(rng); };
+
+		r.changeLightLocation(Vector(randInt(0, 9), randInt(-10, 10), randInt(-5, 5)));
+		for (int i = 0; i < sphereCount; i++) {
+			int radius = randInt(1, 3);
+			Vector position(randInt(-10, 10), randInt(-10, 10), randInt(-10, 10));
+			Pixel color{ (unsigned char)randInt(50, 254), (unsigned char)randInt(50, 254), (unsigned char)randInt(50, 254) };
+			r.addShape(Sphere(radius, position, color, 0.2));
+		}
+		return r;
+	}
+
+	/** `count' spheres spread evenly through a 20x20x20 cube in front of the camera, shrinking as count grows so the
+	* cube stays about equally full
+	*/
+	vector<Sphere> cloudSpheres(int count, unsigned int seed)
+	{
+		std::mt19937 rng(seed);
+		std::uniform_real_distribution<double> coordinate(-10, 10);
+		std::uniform_int_distribution<int> channel(50, 254);
+		double radius = 5.0 / std::cbrt(double(count));
+
+		vector<Sphere> spheres;
+		spheres.reserve(count);
+		for (int i = 0; i < count; i++) {
+			Vector position(coordinate(rng) - 20, coordinate(rng), coordinate(rng));
+			Pixel color{ (unsigned char)channel(rng), (unsigned char)channel(rng), (unsigned char)channel(rng) };
+			spheres.push_back(Sphere(radius, position, color, 0.2));
+		}
+		return spheres;
+	}
+
+	/** Scene looking into a cloud of spheres from cloudSpheres
+	*/
+	RayTracer cloudScene(const vector<Sphere>& spheres, int size)
+	{
+		return RayTracer(Vector(10, 20, 10), Vector(5, 0, 0), Vector(0, 0, 0), spheres, size, size, 5, 5, Pixel());
+	}
+
+	/** Render the random 10 sphere scene with 1, 2, 4 ... N threads (N = hardware threads) and report rays/sec
+	*/
+	void benchThreads()
+	{
+		RayTracer r = randomScene(10, 1);
+		vector<int> threadCounts = benchThreadCounts();
+
+		cout << "threads: " << BENCH_SIZE << "x" << BENCH_SIZE << ", 10 spheres, tile size " << r.getTileSize() << endl;
+		double singleThread = 0;
+		for (int i = 0; i < threadCounts.size(); i++) {
+			r.setThreadCount(threadCounts[i]);
+			double seconds = bestTime(3, [&r]() { r.renderScene(); });
+			if (i == 0) {
+				singleThread = seconds;
+			}
+			double raysPerSecond = double(BENCH_SIZE) * BENCH_SIZE / seconds;
+			cout << "  " << threadCounts[i] << " threads: " << raysPerSecond / 1e6 << " Mrays/s, speedup "
+				<< singleThread / seconds << "x" << endl;
+		}
+	}
+
+	/** Render time of cloud scenes from 10 to 1,000,000 spheres - with the BVH it should grow far slower than the
+	* sphere count, testing every sphere (only run up to 1000 spheres) grows linearly
+	*/
+	void benchBVH()
+	{
+		const int size = 512;
+		const int bruteForceLimit = 1000;
+
+		cout << "bvh: " << size << "x" << size << " cloud scenes, " << TileScheduler::hardwareThreads() << " threads" << endl;
+		double firstRender = 0;
+		for (int count = 10; count <= 1000000; count *= 10) {
+			vector<Sphere> spheres = cloudSpheres(count, 1);
+			BVH bvh;
+			double build = bestTime(1, [&]() { bvh.build(spheres); });
+
+			// First call builds the scene's own hierarchy, later ones reuse it
+			RayTracer r = cloudScene(spheres, size);
+			r.renderScene();
+			double render = bestTime(3, [&r]() { r.renderScene(); });
+			if (count == 10) {
+				firstRender = render;
+			}
+
+			double bruteForce = 0;
+			if (count <= bruteForceLimit) {
+				r.setAcceleration(Acceleration::BruteForce);
+				bruteForce = bestTime(3, [&r]() { r.renderScene(); });
+			}
+
+			cout << "  " << count << " spheres: build " << build * 1e3 << " ms, render "
+				<< render * 1e3 << " ms (" << render / firstRender << "x the 10 sphere render)";
+			if (bruteForce > 0) {
+				cout << ", brute force " << bruteForce * 1e3 << " ms";
+			}
+			cout << endl;
+		}
+	}
+
+	/** One ray at a time against 4096 spheres: scalar Sphere::intersect loop against each SphereSoA kernel
+	*/
+	void benchSIMD()
+	{
+		const int sphereCount = 4096;
+		const int rayCount = 1024;
+		vector<Sphere> spheres = cloudSpheres(sphereCount, 2);
+
+		std::mt19937 rng(3);
+		std::uniform_real_distribution<double> coordinate(-10, 10);
+		vector<Vector> directions(rayCount);
+		for (int r = 0; r < rayCount; r++) {
+			directions[r] = (Vector(-20, coordinate(rng), coordinate(rng)) - Vector(5, 0, 0)).formUnitVector();
+		}
+		Vector origin(5, 0, 0);
+		double tests = double(sphereCount) * rayCount;
+
+		// Sum of hit indices keeps the compiler from dropping the work
+		long long checksum = 0;
+		double scalar = bestTime(3, [&]() {
+			for (int r = 0; r < rayCount; r++) {
+				double t = INFINITY;
+				int hitIndex = -1;
+				for (int n = 0; n < sphereCount; n++) {
+					Intersection hit = spheres[n].intersect(origin, directions[r], t);
+					if (hit.hit) {
+						t = hit.t;
+						hitIndex = n;
+					}
+				}
+				checksum += hitIndex;
+			}
+		});
+		cout << "simd: " << sphereCount << " spheres x " << rayCount << " rays" << endl;
+		cout << "  Sphere::intersect: " << tests / scalar / 1e6 << " M tests/s" << endl;
+
+		SimdISA kernels[] = { SimdISA::Scalar, SimdISA::SSE2, SimdISA::AVX2, SimdISA::AVX512 };
+		for (int k = 0; k < 4; k++) {
+			if (!SphereSoA::supported(kernels[k])) {
+				cout << "  " << SphereSoA::isaName(kernels[k]) << ": not supported by this CPU" << endl;
+				continue;
+			}
+			SphereSoA soa;
+			soa.build(spheres);
+			soa.setISA(kernels[k]);
+			double seconds = bestTime(3, [&]() {
+				for (int r = 0; r < rayCount; r++) {
+					double t = INFINITY;
+					checksum += soa.closestHit(origin, directions[r], 0, sphereCount, t);
+				}
+			});
+			cout << "  SphereSoA " << SphereSoA::isaName(kernels[k]) << ": " << tests / seconds / 1e6 << " M tests/s ("
+				<< scalar / seconds << "x Sphere::intersect)" << endl;
+		}
+		cout << "  (checksum " << checksum << ")" << endl;
+	}
+
+	/** The RGBA copy saveSceneToPNG used to make before handing pixels to lodepng (kept here as the baseline)
+	*/
+	vector<unsigned char> copyToRGBA(const vector<Pixel>& pixels)
+	{
+		vector<unsigned char> rawPixels;
+
+		for (int i = 0; i < pixels.size(); i++) {
+			rawPixels.push_back(pixels.at(i).R);
+			rawPixels.push_back(pixels.at(i).G);
+			rawPixels.push_back(pixels.at(i).B);
+			rawPixels.push_back(pixels.at(i).A);
+		}
+
+		return rawPixels;
+	}
+
+	/** Allocations and time to get the framebuffer into the form the PNG writer takes, old copy against the raw view
+	*/
+	void benchSave()
+	{
+		RayTracer r = randomScene(10, 1);
+		r.renderScene();
+		cout << "save: " << BENCH_SIZE << "x" << BENCH_SIZE << " framebuffer" << endl;
+
+		long long checksum = 0;
+		long long before = allocationCount;
+		double copy = bestTime(3, [&]() { checksum += copyToRGBA(r.getPixels()).size(); });
+		cout << "  old RGBA copy: " << (allocationCount - before) / 3 << " allocations, " << copy * 1e3 << " ms" << endl;
+
+		before = allocationCount;
+		double view = bestTime(3, [&]() { checksum += r.getPixelData()[0]; });
+		cout << "  raw RGBA view: " << (allocationCount - before) / 3 << " allocations, " << view * 1e3 << " ms" << endl;
+
+		// The old save and the new one with the same encoder: allocations made before the encoder gets its input (the
+		// handoff of the framebuffer), then by the encoder itself
+		for (int copied = 1; copied >= 0; copied--) {
+			long long handoff = 0;
+			long long encoder = 0;
+			double seconds = bestTime(1, [&]() {
+				vector<unsigned char> encoded;
+				before = allocationCount;
+				if (copied) {
+					vector<unsigned char> rgba = copyToRGBA(r.getPixels());
+					handoff = allocationCount - before;
+					lodepng::encode(encoded, rgba, BENCH_SIZE, BENCH_SIZE);
+				}
+				else {
+					const unsigned char* rgba = r.getPixelData();
+					handoff = allocationCount - before;
+					lodepng::encode(encoded, rgba, BENCH_SIZE, BENCH_SIZE);
+				}
+				encoder = allocationCount - before - handoff;
+				checksum += encoded.size();
+			});
+			cout << "  save from " << (copied ? "RGBA copy" : "raw view") << ": " << handoff << " allocations to hand the "
+				<< "framebuffer over, then " << encoder << " in lodepng::encode, " << seconds * 1e3 << " ms" << endl;
+		}
+
+		const char* filename = "bench_save.png";
+		before = allocationCount;
+		double save = bestTime(1, [&]() { r.saveSceneToPNG(filename); });
+		cout << "  saveSceneToPNG: " << allocationCount - before << " allocations (PNGWriter buffers, scheduler jobs and "
+			<< "lodepng's deflate tables and output), no copy of the framebuffer, " << save * 1e3 << " ms" << endl;
+		std::remove(filename);
+		cout << "  (checksum " << checksum << ")" << endl;
+	}
+
+	/** PNG encoding speed (MB/s of RGBA input) and file size of lodepng::encode and of PNGWriter::writeImage at several
+	* compression levels and thread counts
+	*/
+	void benchDeflate()
+	{
+		RayTracer r = randomScene(10, 1);
+		r.renderScene();
+		const char* filename = "bench_deflate.png";
+		double megabytes = 4.0 * BENCH_SIZE * BENCH_SIZE / (1024 * 1024);
+		cout << "deflate: " << BENCH_SIZE << "x" << BENCH_SIZE << " RGBA (" << megabytes << " MB)" << endl;
+
+		vector<unsigned char> encoded;
+		double seconds = bestTime(1, [&]() {
+			encoded.clear();
+			lodepng::encode(encoded, r.getPixelData(), BENCH_SIZE, BENCH_SIZE);
+		});
+		cout << "  lodepng::encode: " << megabytes / seconds << " MB/s, " << encoded.size() / 1024 << " KB" << endl;
+
+		vector<int> threadCounts = benchThreadCounts();
+		int levels[] = { 0, 1, 6, 9 };
+		for (int level : levels) {
+			for (int i = 0; i < threadCounts.size(); i++) {
+				TileScheduler scheduler(threadCounts[i]);
+				seconds = bestTime(1, [&]() {
+					PNGWriter writer;
+					writer.setCompressionLevel(level);
+					writer.open(filename, BENCH_SIZE, BENCH_SIZE);
+					writer.writeImage(r.getPixelData(), scheduler);
+					writer.close();
+				});
+				vector<unsigned char> file;
+				lodepng::load_file(file, filename);
+				cout << "  PNGWriter level " << level << ", " << threadCounts[i] << " threads: " << megabytes / seconds
+					<< " MB/s, " << file.size() / 1024 << " KB" << endl;
+			}
+		}
+		std::remove(filename);
+	}
+
+	/** Primary and shadow ray throughput from the render statistics, for growing sphere clouds
+	*/
+	void benchShadows()
+	{
+		const int size = 512;
+		cout << "shadows: " << size << "x" << size << " sphere cloud, BVH, throughput per thread second" << endl;
+		int counts[] = { 100, 10000, 1000000 };
+		for (int count : counts) {
+			RayTracer r = cloudScene(cloudSpheres(count, 1), size);
+			r.renderScene();
+			double plain = bestTime(3, [&r]() { r.renderScene(); });
+			r.setShadows(true);
+			double shadowed = bestTime(3, [&r]() { r.renderScene(); });
+			const RenderStats& stats = r.getRenderStats();
+			cout << "  " << count << " spheres: " << stats.primaryRaysPerSecond() / 1e6 << " M primary rays/s, "
+				<< stats.shadowRaysPerSecond() / 1e6 << " M shadow rays/s (" << stats.shadowRays << " shadow rays), render "
+				<< plain * 1e3 << " ms without shadows, " << shadowed * 1e3 << " ms with" << endl;
+		}
+	}
+
+	/** Render time after only the light moved, tracing every ray again against shading from the G-buffer
+	*/
+	void benchRelight()
+	{
+		RayTracer r = randomScene(10, 1);
+		cout << "relight: " << BENCH_SIZE << "x" << BENCH_SIZE << ", 10 spheres, light moved between renders" << endl;
+
+		int step = 0;
+		auto relight = [&]() {
+			step++;
+			r.changeLightLocation(Vector(5 * std::cos(step * 0.1), 10, 5 * std::sin(step * 0.1)));
+			r.renderScene();
+		};
+		double traced = bestTime(3, relight);
+
+		r.setGBuffer(true);
+		r.renderScene();
+		double cached = bestTime(3, relight);
+		cout << "  traced: " << traced * 1e3 << " ms, from G-buffer: " << cached * 1e3 << " ms (" << traced / cached
+			<< "x)" << endl;
+	}
+
+	/** Double against float: the SphereSoA kernels on their own (one ray at a time against 4096 spheres), then whole
+	* renders of sphere clouds through the BVH and brute force
+	*/
+	void benchPrecision()
+	{
+		const int sphereCount = 4096;
+		const int rayCount = 1024;
+		vector<Sphere> spheres = cloudSpheres(sphereCount, 2);
+
+		std::mt19937 rng(3);
+		std::uniform_real_distribution<double> coordinate(-10, 10);
+		vector<Vector> directions(rayCount);
+		vector<VectorF> directionsF(rayCount);
+		for (int r = 0; r < rayCount; r++) {
+			directions[r] = (Vector(-20, coordinate(rng), coordinate(rng)) - Vector(5, 0, 0)).formUnitVector();
+			directionsF[r] = VectorF(directions[r]);
+		}
+		Vector origin(5, 0, 0);
+		VectorF originF(origin);
+		double tests = double(sphereCount) * rayCount;
+
+		cout << "precision: " << sphereCount << " spheres x " << rayCount << " rays" << endl;
+		long long checksum = 0;
+		SimdISA kernels[] = { SimdISA::Scalar, SimdISA::SSE2, SimdISA::AVX2, SimdISA::AVX512 };
+		for (int k = 0; k < 4; k++) {
+			if (!SphereSoA::supported(kernels[k])) {
+				continue;
+			}
+			SphereSoA soa;
+			soa.build(spheres);
+			soa.setISA(kernels[k]);
+			double seconds = bestTime(3, [&]() {
+				for (int r = 0; r < rayCount; r++) {
+					double t = INFINITY;
+					checksum += soa.closestHit(origin, directions[r], 0, sphereCount, t);
+				}
+			});
+			SphereSoAF soaF;
+			soaF.build(spheres);
+			soaF.setISA(kernels[k]);
+			double secondsF = bestTime(3, [&]() {
+				for (int r = 0; r < rayCount; r++) {
+					float t = INFINITY;
+					checksum += soaF.closestHit(originF, directionsF[r], 0, sphereCount, t);
+				}
+			});
+			cout << "  " << SphereSoA::isaName(kernels[k]) << ": double " << tests / seconds / 1e6 << " M tests/s, float "
+				<< tests / secondsF / 1e6 << " M tests/s (" << seconds / secondsF << "x)" << endl;
+		}
+		cout << "  (checksum " << checksum << ")" << endl;
+
+		const int size = 512;
+		cout << "  " << size << "x" << size << " cloud renders, " << TileScheduler::hardwareThreads() << " threads:" << endl;
+		int counts[] = { 100, 1000, 100000 };
+		for (int count : counts) {
+			RayTracer r = cloudScene(cloudSpheres(count, 1), size);
+			Acceleration accelerations[] = { Acceleration::BVH, Acceleration::BruteForce };
+			for (Acceleration acceleration : accelerations) {
+				if (acceleration == Acceleration::BruteForce && count > 1000) {
+					continue;
+				}
+				r.setAcceleration(acceleration);
+				r.setPrecision(Precision::Double);
+				r.renderScene();
+				double render = bestTime(3, [&r]() { r.renderScene(); });
+				r.setPrecision(Precision::Float);
+				r.renderScene();
+				double renderF = bestTime(3, [&r]() { r.renderScene(); });
+				cout << "  " << count << " spheres, " << (acceleration == Acceleration::BVH ? "BVH" : "brute force")
+					<< ": double " << render * 1e3 << " ms, float " << renderF * 1e3 << " ms (" << render / renderF << "x)"
+					<< endl;
+			}
+		}
+	}
+
+	/** Primary rays/s tracing single rays against 2x2, 4x4 and 8x8 packets, on the random 10 sphere scene (BVH and
+	* brute force) and on a 100,000 sphere cloud
+	*/
+	void benchPackets()
+	{
+		cout << "packets: " << BENCH_SIZE << "x" << BENCH_SIZE << ", " << TileScheduler::hardwareThreads() << " threads" << endl;
+		vector<Sphere> cloud = cloudSpheres(100000, 1);
+		RayTracer scenes[] = { randomScene(10, 1), randomScene(10, 1), cloudScene(cloud, BENCH_SIZE) };
+		const char* names[] = { "10 spheres, BVH", "10 spheres, brute force", "100000 spheres, BVH" };
+		scenes[1].setAcceleration(Acceleration::BruteForce);
+
+		int sizes[] = { 1, 2, 4, 8 };
+		for (int n = 0; n < 3; n++) {
+			RayTracer& r = scenes[n];
+			// renderScene prints as it goes, so build the line first
+			std::ostringstream line;
+			line << "  " << names[n] << ":";
+			double single = 0;
+			for (int size : sizes) {
+				r.setPacketSize(size);
+				r.renderScene();
+				double seconds = bestTime(3, [&r]() { r.renderScene(); });
+				if (size == 1) {
+					single = seconds;
+				}
+				line << (size == 1 ? " single " : ", " + std::to_string(size) + "x" + std::to_string(size) + " ")
+					<< double(BENCH_SIZE) * BENCH_SIZE / seconds / 1e6 << " Mrays/s";
+				if (size > 1) {
+					line << " (" << single / seconds << "x)";
+				}
+			}
+			cout << line.str() << endl;
+		}
+	}
+
+	/** Brute force against screen bins (and the BVH for reference) on the random 10 sphere scene and sphere clouds
+	*/
+	void benchBins()
+	{
+		cout << "bins: " << BENCH_SIZE << "x" << BENCH_SIZE << ", " << TileScheduler::hardwareThreads() << " threads" << endl;
+		int counts[] = { 10, 100, 1000, 10000 };
+		for (int count : counts) {
+			RayTracer r = count == 10 ? randomScene(10, 1) : cloudScene(cloudSpheres(count, 1), BENCH_SIZE);
+			Acceleration accelerations[] = { Acceleration::BruteForce, Acceleration::ScreenBins, Acceleration::BVH };
+			const char* names[] = { "brute force", "screen bins", "BVH" };
+			double seconds[3];
+			for (int a = 0; a < 3; a++) {
+				r.setAcceleration(accelerations[a]);
+				r.renderScene();
+				seconds[a] = bestTime(3, [&r]() { r.renderScene(); });
+			}
+			cout << "  " << count << (count == 10 ? " random" : "") << " spheres:";
+			for (int a = 0; a < 3; a++) {
+				cout << (a ? ", " : " ") << names[a] << " " << seconds[a] * 1e3 << " ms";
+			}
+			cout << " (bins " << seconds[0] / seconds[1] << "x brute force)" << endl;
+		}
+	}
+
+	/** Cost of recording the timeline on a render with many small tiles, and of writing it out
+	*/
+	void benchTimeline()
+	{
+		const char* filename = "bench_timeline.trace.json";
+		RayTracer r = cloudScene(cloudSpheres(1000, 1), BENCH_SIZE);
+		r.setTileSize(16);
+		cout << "timeline: " << BENCH_SIZE << "x" << BENCH_SIZE << ", 16x16 tiles, " << TileScheduler::hardwareThreads()
+			<< " threads" << endl;
+		r.renderScene();
+		double off = bestTime(5, [&r]() { r.renderScene(); });
+		r.setTimeline(true);
+		double on = bestTime(5, [&r]() { r.renderScene(); });
+		cout << "  off " << off * 1e3 << " ms, on " << on * 1e3 << " ms (" << (on / off - 1) * 100 << "% overhead)" << endl;
+
+		// Write the events of the last render on their own, as saveSceneToPNG does after encoding
+		Timeline timeline;
+		timeline.reset(1);
+		for (int e = 0; e < 2 * (BENCH_SIZE / 16) * (BENCH_SIZE / 16); e++) {
+			timeline.record(0, "trace", e, e + 1, 0, 0);
+		}
+		double write = bestTime(3, [&]() { timeline.write(filename); });
+		cout << "  writing " << timeline.eventCount() << " events: " << write * 1e3 << " ms" << endl;
+		std::remove(filename);
+	}
+
+	/** Adaptive anti-aliasing against one ray per pixel on the random 10 sphere scene with shadows. Supersampling
+	* every pixel would cost about side^2 times the single ray render
+	*/
+	void benchAntialias()
+	{
+		RayTracer r = randomScene(10, 1);
+		r.setShadows(true);
+		cout << "antialias: " << BENCH_SIZE << "x" << BENCH_SIZE << ", 10 spheres with shadows, "
+			<< TileScheduler::hardwareThreads() << " threads" << endl;
+		r.renderScene();
+		double single = bestTime(3, [&r]() { r.renderScene(); });
+		cout << "  1 ray per pixel: " << single * 1e3 << " ms" << endl;
+		for (int side = 2; side <= RayTracer::MAX_ANTIALIASING; side++) {
+			r.setAntialiasing(side);
+			double seconds = bestTime(3, [&r]() { r.renderScene(); });
+			std::ostringstream line;
+			line << "  " << side << "x" << side << " at edges: " << seconds * 1e3 << " ms (" << seconds / single << "x), "
+				<< r.getRenderStats().samplesPerPixel() << " samples per pixel, " << r.getRenderStats().supersampledPixels
+				<< " pixels supersampled";
+			cout << line.str() << endl;
+		}
+	}
+
+	/** When each pass of a progressive render of a 1000 sphere cloud reaches the callback, against renderScene
+	*/
+	void benchProgressive()
+	{
+		RayTracer r = cloudScene(cloudSpheres(1000, 1), BENCH_SIZE);
+		r.setShadows(true);
+		cout << "progressive: " << BENCH_SIZE << "x" << BENCH_SIZE << ", 1000 spheres with shadows, "
+			<< TileScheduler::hardwareThreads() << " threads" << endl;
+		r.renderScene();
+		double full = bestTime(3, [&r]() { r.renderScene(); });
+
+		std::ostringstream line;
+		line << "  renderScene " << full * 1e3 << " ms; progressive:";
+		auto start = std::chrono::steady_clock::now();
+		r.renderProgressive([&](const vector<Pixel>&, int spacing) {
+			std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+			line << " spacing " << spacing << " at " << elapsed.count() * 1e3 << " ms,";
+			return true;
+		});
+		cout << line.str() << endl;
+	}
+
+	/** Build each kind of BVH over cloud scenes of 1000 to 1,000,000 spheres: the LBVH should rebuild in a fraction
+	* of the SAH build's time, for a somewhat higher SAH cost (and render time)
+	*/
+	void benchLBVH()
+	{
+		const int size = 512;
+		TileScheduler scheduler(0);
+		cout << "lbvh: " << size << "x" << size << " cloud scenes, " << scheduler.getThreadCount() << " threads" << endl;
+		for (int count = 1000; count <= 1000000; count *= 10) {
+			vector<Sphere> spheres = cloudSpheres(count, 1);
+			RayTracer r = cloudScene(spheres, size);
+			std::ostringstream line;
+			line << "  " << count << " spheres:";
+			BVHBuilder builders[] = { BVHBuilder::SAH, BVHBuilder::LBVH };
+			for (BVHBuilder builder : builders) {
+				BVH bvh;
+				double build = bestTime(3, [&]() { bvh.build(spheres, builder, &scheduler); });
+				r.setBVHBuilder(builder);
+				r.renderScene();
+				double render = bestTime(3, [&r]() { r.renderScene(); });
+				line << (builder == BVHBuilder::SAH ? " SAH" : "; LBVH") << " build " << build * 1e3 << " ms, SAH cost "
+					<< bvh.sahCost() << ", render " << render * 1e3 << " ms";
+			}
+			cout << line.str() << endl;
+		}
+	}
+
+	/** Refit against both builds for 100,000 spheres that all moved a little, then 20 frames of the spheres drifting
+	* further each frame through updateShape, refitting until the tree is worse than the threshold
+	*/
+	void benchRefit()
+	{
+		const int count = 100000;
+		TileScheduler scheduler(0);
+		vector<Sphere> spheres = cloudSpheres(count, 1);
+		std::mt19937 rng(2);
+		std::uniform_real_distribution<double> jitter(-1, 1);
+		double step = spheres[0].radius() * 0.5;
+		auto drift = [&](vector<Sphere>& shapes) {
+			for (Sphere& sphere : shapes) {
+				Vector offset(jitter(rng) * step, jitter(rng) * step, jitter(rng) * step);
+				sphere = Sphere(sphere.radius(), sphere.position() + offset, sphere.color(), sphere.ambient());
+			}
+		};
+
+		cout << "refit: " << count << " cloud spheres, " << scheduler.getThreadCount() << " threads" << endl;
+		BVH bvh;
+		double sah = bestTime(3, [&]() { bvh.build(spheres, BVHBuilder::SAH, &scheduler); });
+		double lbvh = bestTime(3, [&]() { bvh.build(spheres, BVHBuilder::LBVH, &scheduler); });
+		bvh.build(spheres, BVHBuilder::SAH, &scheduler);
+		drift(spheres);
+		double refit = bestTime(3, [&]() { bvh.refit(spheres, &scheduler); });
+		cout << "  SAH build " << sah * 1e3 << " ms, LBVH build " << lbvh * 1e3 << " ms, refit " << refit * 1e3
+			<< " ms (SAH cost " << bvh.getBuildCost() << " -> " << bvh.sahCost() << ")" << endl;
+
+		RayTracer r = cloudScene(spheres, 512);
+		std::ostringstream silenced;
+		std::streambuf* console = cout.rdbuf(silenced.rdbuf());
+		r.renderScene();
+		std::ostringstream line;
+		line << "  build ms per frame:";
+		for (int frame = 0; frame < 20; frame++) {
+			drift(spheres);
+			for (int n = 0; n < count; n++) {
+				r.updateShape(n, spheres[n].position(), spheres[n].radius());
+			}
+			r.renderScene();
+			line << " " << r.getRenderStats().buildSeconds * 1e3 << (r.getRenderStats().bvhBuilds ? " (rebuilt)" : "");
+		}
+		cout.rdbuf(console);
+		cout << line.str() << endl;
+	}
+
+	/** Cloud scenes of 1k to 1M spheres, then 100k spheres with 90% of them in a clump 1/1000 of the volume, and with
+	* one sphere in 100 ten times larger: build and render time of each structure, to place the grid's crossover
+	*/
+	void benchGrid()
+	{
+		const int size = 512;
+		cout << "grid: " << size << "x" << size << " cloud scenes" << endl;
+		vector<string> names;
+		vector<vector<Sphere> > scenes;
+		for (int count = 1000; count <= 1000000; count *= 10) {
+			names.push_back(std::to_string(count) + " even");
+			scenes.push_back(cloudSpheres(count, 1));
+		}
+		std::mt19937 rng(2);
+		std::uniform_real_distribution<double> unit(-1, 1);
+		vector<Sphere> clumped = cloudSpheres(100000, 1);
+		for (int i = 0; i < 90000; i++) {
+			Vector position(-20 + unit(rng), unit(rng), unit(rng));
+			clumped[i] = Sphere(clumped[i].radius() * 0.1, position, clumped[i].color(), clumped[i].ambient());
+		}
+		names.push_back("100000 clumped");
+		scenes.push_back(clumped);
+		vector<Sphere> mixed = cloudSpheres(100000, 1);
+		for (int i = 0; i < mixed.size(); i += 100) {
+			mixed[i] = Sphere(mixed[i].radius() * 10, mixed[i].position(), mixed[i].color(), mixed[i].ambient());
+		}
+		names.push_back("100000 mixed");
+		scenes.push_back(mixed);
+
+		std::ostringstream silenced;
+		std::streambuf* console = cout.rdbuf(silenced.rdbuf());
+		std::ostringstream lines;
+		for (int n = 0; n < scenes.size(); n++) {
+			const vector<Sphere>& spheres = scenes[n];
+			Grid::Statistics statistics = Grid::analyze(spheres);
+			lines << "  " << names[n] << ": occupancy " << statistics.occupancy << ", overlap " << statistics.overlap
+				<< ", auto picks " << (Grid::suits(spheres) ? "grid" : "BVH") << endl;
+
+			RayTracer r = cloudScene(spheres, size);
+			BVH bvh;
+			double build = bestTime(1, [&]() { bvh.build(spheres); });
+			r.renderScene();
+			double render = bestTime(3, [&r]() { r.renderScene(); });
+			lines << "    BVH build " << build * 1e3 << " ms, render " << render * 1e3 << " ms" << endl;
+
+			r.setAcceleration(Acceleration::Grid);
+			for (int levels = 1; levels <= 2; levels++) {
+				Grid grid;
+				build = bestTime(1, [&]() { grid.build(spheres, levels); });
+				r.setGridLevels(levels);
+				r.renderScene();
+				render = bestTime(3, [&r]() { r.renderScene(); });
+				lines << "    " << (levels == 1 ? "uniform" : "two-level") << " grid build " << build * 1e3 << " ms, render "
+					<< render * 1e3 << " ms, " << grid.getCellCount() << " cells, "
+					<< double(grid.getReferenceCount()) / spheres.size() << " references per sphere" << endl;
+			}
+		}
+		cout.rdbuf(console);
+		cout << lines.str();
+	}
+
+	/** Peak resident memory of the process so far in MB (0 where the system cannot tell)
+	*/
+	double peakMemoryMB()
+	{
+#ifndef _WIN32
+		struct rusage usage;
+		if (getrusage(RUSAGE_SELF, &usage) == 0) {
+			// ru_maxrss is in kilobytes on Linux (bytes on macOS)
+#ifdef __APPLE__
+			return usage.ru_maxrss / (1024.0 * 1024.0);
+#else
+			return usage.ru_maxrss / 1024.0;
+#endif
+		}
+#endif
+		return 0;
+	}
+
+	/** Peak memory of streaming a large render to disk, then of rendering it to the framebuffer and saving that
+	* The peak only ever grows, so the streamed render runs first
+	*/
+	void benchStream()
+	{
+		const int size = 4096;
+		const char* filename = "bench_stream.png";
+		RayTracer r(Vector(0, 10, 0), Vector(5, 0, 0), Vector(0, 0, 0), vector<Sphere>(), size, size, 5, 5, Pixel());
+		r.addShape(Sphere(1.5, Vector(0, 0, 0), Pixel{ 200, 60, 30 }, 0.2));
+		r.addShape(Sphere(0.7, Vector(1, 1, 1), Pixel{ 40, 160, 220 }, 0.3));
+		cout << "stream: " << size << "x" << size << " image (" << 4.0 * size * size / (1024 * 1024) << " MB framebuffer)" << endl;
+
+		double before = peakMemoryMB();
+		double streamed = bestTime(1, [&]() { r.renderSceneToPNG(filename); });
+		cout << "  renderSceneToPNG: " << streamed << " s, peak memory " << peakMemoryMB() << " MB (" << before
+			<< " MB before)" << endl;
+
+		double inMemory = bestTime(1, [&]() {
+			r.renderScene();
+			r.saveSceneToPNG(filename);
+		});
+		cout << "  renderScene + saveSceneToPNG: " << inMemory << " s, peak memory " << peakMemoryMB() << " MB" << endl;
+		std::remove(filename);
+	}
+
+	/** One scene of the canonical suite
+	*/
+	struct SuiteCase
+	{
+		const char* name;
+		int spheres;
+		int size;	// Image width and height
+		bool quick;	// Part of the --quick run
+	};
+
+	/** Sphere count sweep at 1024x1024, then resolution sweep at 1000 spheres
+	*/
+	const SuiteCase SUITE_CASES[] = {
+		{ "spheres_1", 1, 1024, true },
+		{ "spheres_10", 10, 1024, true },
+		{ "spheres_1k", 1000, 1024, true },
+		{ "spheres_100k", 100000, 1024, true },
+		{ "spheres_1m", 1000000, 1024, false },
+		{ "size_512", 1000, 512, true },
+		{ "size_2048", 1000, 2048, true },
+		{ "size_4096", 1000, 4096, true },
+		{ "size_8192", 1000, 8192, false }
+	};
+
+	/** Measurements of one suite case
+	*/
+	struct SuiteResult
+	{
+		const SuiteCase* scene;
+		double buildSeconds;	// Acceleration build of the first render
+		double sahCost;	// Quality of the BVH, see BVH::sahCost
+		double medianSeconds;
+		double p95Seconds;
+		double minSeconds;
+		double raysPerSecond;	// Primary rays of the median render
+		double peakMemoryMB;	// Peak resident memory of the process during the case
+	};
+
+	/** Spheres placed like cloudSpheres, but drawn straight from the raw mt19937 stream (which, unlike the std
+	* distributions, is the same on every standard library) so every build renders exactly the same scene
+	*/
+	vector<Sphere> canonicalSpheres(int count, unsigned int seed)
+	{
+		std::mt19937 rng(seed);
+		auto coordinate = [&rng]() { return -10 + 20 * (rng() / 4294967296.0); };
+		auto channel = [&rng]() { return (unsigned char)(50 + rng() % 205); };
+		double radius = 5.0 / std::cbrt(double(count));
+
+		vector<Sphere> spheres;
+		spheres.reserve(count);
+		for (int i = 0; i < count; i++) {
+			double x = coordinate() - 20;
+			double y = coordinate();
+			double z = coordinate();
+			unsigned char red = channel();
+			unsigned char green = channel();
+			unsigned char blue = channel();
+			spheres.push_back(Sphere(radius, Vector(x, y, z), Pixel{ red, green, blue }, 0.2));
+		}
+		return spheres;
+	}
+
+	/** Value below which `fraction' of the sorted samples lie (nearest rank)
+	*/
+	double percentile(const vector<double>& sorted, double fraction)
+	{
+		size_t rank = size_t(std::ceil(fraction * sorted.size()));
+		return sorted[rank > 0 ? rank - 1 : 0];
+	}
+
+	/** Restart the peak resident memory from the current resident memory where the system allows it (Linux), so each
+	* case reports its own peak rather than that of the biggest case before it
+	* @return whether the peak was restarted
+	*/
+	bool resetPeakMemory()
+	{
+		std::ofstream clearRefs("/proc/self/clear_refs");
+		return clearRefs << "5" && clearRefs.flush();
+	}
+
+	/** Peak resident memory in MB since resetPeakMemory (VmHWM), or of the whole process if it cannot be read
+	*/
+	double casePeakMemoryMB()
+	{
+		std::ifstream status("/proc/self/status");
+		string line;
+		while (std::getline(status, line)) {
+			if (line.compare(0, 6, "VmHWM:") == 0) {
+				return std::atof(line.c_str() + 6) / 1024.0;
+			}
+		}
+		return peakMemoryMB();
+	}
+
+	/** A cluster of 1000 spheres in a 2 x 2 x 2 cube, placed in every cell of a 10 x 10 x 10 grid (randomly rotated)
+	* through instancing, against the same 1M spheres added as shapes: the same density as a 1M sphere cloudSpheres
+	*/
+	void benchInstances()
+	{
+		const int side = 10;
+		vector<Sphere> cluster;
+		for (const Sphere& sphere : cloudSpheres(1000, 1)) {
+			Vector local = (sphere.position() - Vector(-20, 0, 0)).scalarMult(0.1);
+			cluster.push_back(Sphere(sphere.radius() * 0.1, local, sphere.color(), sphere.ambient()));
+		}
+		std::mt19937 rng(2);
+		std::uniform_real_distribution<double> unit(-1, 1);
+		vector<Transform> places;
+		for (int i = 0; i < side * side * side; i++) {
+			Vector cell(-29 + 2 * (i % side), -9 + 2 * (i / side % side), -9 + 2 * (i / (side * side)));
+			places.push_back(Transform::translation(cell) *
+				Transform::rotation(Vector(unit(rng), unit(rng), unit(rng)), unit(rng) * M_PI));
+		}
+
+		cout << "instances: " << cluster.size() << " sphere cluster x " << places.size() << " instances, " << BENCH_SIZE
+			<< "x" << BENCH_SIZE << endl;
+		std::ostringstream silenced;
+		std::streambuf* console = cout.rdbuf(silenced.rdbuf());
+		std::ostringstream lines;
+		for (int expanded = 0; expanded < 2; expanded++) {
+			resetPeakMemory();
+			RayTracer r = cloudScene(vector<Sphere>(), BENCH_SIZE);
+			if (expanded) {
+				InstancedScene scene;
+				int id = scene.addCluster(cluster);
+				for (const Transform& place : places) {
+					scene.addInstance(id, place);
+				}
+				for (const Sphere& sphere : scene.expand()) {
+					r.addShape(sphere);
+				}
+			}
+			else {
+				int id = r.addCluster(cluster);
+				for (const Transform& place : places) {
+					r.addInstance(id, place);
+				}
+			}
+			r.renderScene();
+			double build = r.getRenderStats().buildSeconds;
+			double render = bestTime(3, [&r]() { r.renderScene(); });
+			lines << (expanded ? "  1M shapes" : "  instanced") << ": build " << build * 1e3 << " ms, render "
+				<< render * 1e3 << " ms, peak memory " << casePeakMemoryMB() << " MB" << endl;
+		}
+		cout.rdbuf(console);
+		cout << lines.str();
+	}
+
+	/** Cloud scenes of 1k to 1M spheres: bytes per sphere of the binary and wide nodes (the sphere geometry, the same
+	* for both, apart), single rays through each, and renders with each layout
+	*/
+	void benchWide()
+	{
+		const int size = 512;
+		const int rayCount = 100000;
+		cout << "wide: binary against 8-wide BVH, " << rayCount << " rays, " << size << "x" << size << " renders" << endl;
+		std::mt19937 rng(3);
+		std::uniform_real_distribution<double> coordinate(-10, 10);
+		vector<Vector> directions(rayCount);
+		for (int r = 0; r < rayCount; r++) {
+			directions[r] = (Vector(-20, coordinate(rng), coordinate(rng)) - Vector(5, 0, 0)).formUnitVector();
+		}
+		Vector origin(5, 0, 0);
+
+		std::ostringstream silenced;
+		std::streambuf* console = cout.rdbuf(silenced.rdbuf());
+		std::ostringstream lines;
+		long long checksum = 0;
+		for (int count = 1000; count <= 1000000; count *= 10) {
+			vector<Sphere> spheres = cloudSpheres(count, 1);
+			BVH bvh;
+			bvh.build(spheres);
+			WideBVH wide;
+			double collapse = bestTime(1, [&]() { wide.build(bvh, spheres); });
+			double binaryBytes = double(bvh.getNodes().size() * sizeof(BVH::Node)) / count;
+			lines << "  " << count << " spheres: binary " << bvh.getNodes().size() << " nodes, " << binaryBytes
+				<< " B/sphere; wide " << wide.getNodes().size() << " nodes, " << double(wide.getNodeBytes()) / count
+				<< " B/sphere (" << binaryBytes * count / wide.getNodeBytes() << "x smaller), collapsed in "
+				<< collapse * 1e3 << " ms" << endl;
+
+			double binary = bestTime(3, [&]() {
+				for (int r = 0; r < rayCount; r++) {
+					double t = INFINITY;
+					checksum += bvh.closestHit(origin, directions[r], t);
+				}
+			});
+			lines << "    binary " << rayCount / binary / 1e6 << " M rays/s";
+			SimdISA kernels[] = { SimdISA::Scalar, SimdISA::SSE2, SimdISA::AVX2, SimdISA::AVX512 };
+			for (int k = 0; k < 4; k++) {
+				if (!SphereSoA::supported(kernels[k])) {
+					continue;
+				}
+				wide.setISA(kernels[k]);
+				double seconds = bestTime(3, [&]() {
+					for (int r = 0; r < rayCount; r++) {
+						double t = INFINITY;
+						checksum += wide.closestHit(origin, directions[r], t);
+					}
+				});
+				lines << ", wide " << SphereSoA::isaName(kernels[k]) << " " << rayCount / seconds / 1e6 << " M rays/s ("
+					<< binary / seconds << "x)";
+			}
+			lines << endl;
+
+			RayTracer r = cloudScene(spheres, size);
+			r.renderScene();
+			double render = bestTime(3, [&r]() { r.renderScene(); });
+			r.setBVHLayout(BVHLayout::Wide);
+			r.renderScene();
+			double renderWide = bestTime(3, [&r]() { r.renderScene(); });
+			lines << "    render binary " << render * 1e3 << " ms, wide " << renderWide * 1e3 << " ms" << endl;
+		}
+		cout.rdbuf(console);
+		cout << lines.str() << "  (checksum " << checksum << ")" << endl;
+	}
+
+	/** Build the case's scene, render it once to warm up (timing the build), then `repeats' times
+	*/
+	SuiteResult runSuiteCase(const SuiteCase& scene, int repeats, BVHBuilder builder)
+	{
+		resetPeakMemory();
+		vector<Sphere> spheres = canonicalSpheres(scene.spheres, 1);
+		RayTracer r = cloudScene(spheres, scene.size);
+		r.setBVHBuilder(builder);
+		r.renderScene();
+		SuiteResult result;
+		result.scene = &scene;
+		result.buildSeconds = r.getRenderStats().buildSeconds;
+
+		vector<double> seconds;
+		for (int i = 0; i < repeats; i++) {
+			seconds.push_back(bestTime(1, [&r]() { r.renderScene(); }));
+		}
+		std::sort(seconds.begin(), seconds.end());
+		result.medianSeconds = seconds.size() % 2 ? seconds[seconds.size() / 2] :
+			(seconds[seconds.size() / 2 - 1] + seconds[seconds.size() / 2]) / 2;
+		result.p95Seconds = percentile(seconds, 0.95);
+		result.minSeconds = seconds.front();
+		result.raysPerSecond = double(scene.size) * scene.size / result.medianSeconds;
+		result.peakMemoryMB = casePeakMemoryMB();
+
+		// A copy of the scene's hierarchy, built after the peak is read
+		BVH bvh;
+		bvh.build(spheres, builder);
+		result.sahCost = bvh.sahCost();
+		return result;
+	}
+
+	/** Write the results as one JSON object (times in milliseconds)
+	*/
+	void writeSuiteJSON(std::ostream& out, const vector<SuiteResult>& results, int repeats, const string& builder)
+	{
+		out << "{\n  \"suite\": \"canonical\",\n  \"version\": 2,\n  \"threads\": " << TileScheduler::hardwareThreads()
+			<< ",\n  \"repeats\": " << repeats << ",\n  \"stats\": " << (RAYTRACER_STATS ? "true" : "false")
+			<< ",\n  \"builder\": \"" << builder << "\",\n  \"cases\": [";
+		for (size_t i = 0; i < results.size(); i++) {
+			const SuiteResult& result = results[i];
+			out << (i ? ",\n" : "\n") << "    {\"name\": \"" << result.scene->name << "\", \"spheres\": " << result.scene->spheres
+				<< ", \"width\": " << result.scene->size << ", \"height\": " << result.scene->size
+				<< ", \"build_ms\": " << result.buildSeconds * 1e3 << ", \"sah_cost\": " << result.sahCost << ", \"median_ms\": " << result.medianSeconds * 1e3
+				<< ", \"p95_ms\": " << result.p95Seconds * 1e3 << ", \"min_ms\": " << result.minSeconds * 1e3
+				<< ", \"rays_per_sec\": " << result.raysPerSecond << ", \"peak_rss_mb\": " << result.peakMemoryMB << "}";
+		}
+		out << "\n  ]\n}" << endl;
+	}
+
+	/** Write the results as CSV with a header row (times in milliseconds)
+	*/
+	void writeSuiteCSV(std::ostream& out, const vector<SuiteResult>& results, int repeats, const string& builder)
+	{
+		out << "name,spheres,width,height,threads,repeats,builder,build_ms,sah_cost,median_ms,p95_ms,min_ms,rays_per_sec,"
+			"peak_rss_mb" << endl;
+		for (const SuiteResult& result : results) {
+			out << result.scene->name << "," << result.scene->spheres << "," << result.scene->size << "," << result.scene->size
+				<< "," << TileScheduler::hardwareThreads() << "," << repeats << "," << builder << ","
+				<< result.buildSeconds * 1e3 << "," << result.sahCost << ","
+				<< result.medianSeconds * 1e3 << "," << result.p95Seconds * 1e3 << "," << result.minSeconds * 1e3 << ","
+				<< result.raysPerSecond << "," << result.peakMemoryMB << endl;
+		}
+	}
+
+	/** Run every case in order with the renderer's own progress messages silenced, so the report is the only output
+	* @param options - command line arguments starting with --
+	* @return process exit code
+	*/
+	int benchSuite(const vector<string>& options)
+	{
+		string format = "json";
+		string output;
+		int repeats = 5;
+		bool quick = false;
+		string builder = "sah";
+		for (const string& option : options) {
+			if (option.compare(0, 9, "--format=") == 0) {
+				format = option.substr(9);
+			}
+			else if (option.compare(0, 9, "--output=") == 0) {
+				output = option.substr(9);
+			}
+			else if (option.compare(0, 10, "--repeats=") == 0) {
+				repeats = std::max(1, std::atoi(option.c_str() + 10));
+			}
+			else if (option == "--quick") {
+				quick = true;
+			}
+			else if (option.compare(0, 10, "--builder=") == 0) {
+				builder = option.substr(10);
+			}
+			else {
+				std::cerr << "suite: unknown option " << option << endl;
+				return 1;
+			}
+		}
+		if (format != "json" && format != "csv") {
+			std::cerr << "suite: format must be json or csv" << endl;
+			return 1;
+		}
+		if (builder != "sah" && builder != "lbvh") {
+			std::cerr << "suite: builder must be sah or lbvh" << endl;
+			return 1;
+		}
+
+		std::ostringstream silenced;
+		std::streambuf* console = cout.rdbuf(silenced.rdbuf());
+		vector<SuiteResult> results;
+		for (const SuiteCase& scene : SUITE_CASES) {
+			if (scene.quick || !quick) {
+				std::cerr << "suite: " << scene.name << endl;
+				results.push_back(runSuiteCase(scene, repeats, builder == "lbvh" ? BVHBuilder::LBVH : BVHBuilder::SAH));
+				silenced.str("");
+			}
+		}
+		cout.rdbuf(console);
+
+		std::ofstream file;
+		if (!output.empty()) {
+			file.open(output);
+			if (!file) {
+				std::cerr << "suite: cannot write " << output << endl;
+				return 1;
+			}
+		}
+		std::ostream& out = output.empty() ? cout : file;
+		if (format == "json") {
+			writeSuiteJSON(out, results, repeats, builder);
+		}
+		else {
+			writeSuiteCSV(out, results, repeats, builder);
+		}
+		return out ? 0 : 1;
+	}
+}
+
+int main(int argc, char** argv) {
+	vector<string> names;
+	vector<string> options;
+	for (int i = 1; i < argc; i++) {
+		(string(argv[i]).compare(0, 2, "--") == 0 ? options : names).push_back(argv[i]);
+	}
+	if (std::find(names.begin(), names.end(), "suite") != names.end()) {
+		return benchSuite(options);
+	}
+	auto selected = [&names](const string& name) {
+		if (names.empty()) {
+			return true;
+		}
+		for (int i = 0; i < names.size(); i++) {
+			if (names[i] == name) {
+				return true;
+			}
+		}
+		return false;
+	};
+
+	if (selected("threads")) {
+		benchThreads();
+	}
+	if (selected("bvh")) {
+		benchBVH();
+	}
+	if (selected("simd")) {
+		benchSIMD();
+	}
+	if (selected("save")) {
+		benchSave();
+	}
+	if (selected("shadows")) {
+		benchShadows();
+	}
+	if (selected("relight")) {
+		benchRelight();
+	}
+	if (selected("deflate")) {
+		benchDeflate();
+	}
+	if (selected("stream")) {
+		benchStream();
+	}
+	if (selected("precision")) {
+		benchPrecision();
+	}
+	if (selected("packets")) {
+		benchPackets();
+	}
+	if (selected("bins")) {
+		benchBins();
+	}
+	if (selected("timeline")) {
+		benchTimeline();
+	}
+	if (selected("antialias")) {
+		benchAntialias();
+	}
+	if (selected("progressive")) {
+		benchProgressive();
+	}
+	if (selected("lbvh")) {
+		benchLBVH();
+	}
+	if (selected("refit")) {
+		benchRefit();
+	}
+	if (selected("grid")) {
+		benchGrid();
+	}
+	if (selected("instances")) {
+		benchInstances();
+	}
+	if (selected("wide")) {
+		benchWide();
+	}
+}
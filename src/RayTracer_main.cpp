@@ -15,12 +15,13 @@ using std::srand;
 */
 // Think of everything on a 3D coordinate system (x = front/back, y = vertical, z = horizontal, where Vector(x, y, z))
 
-int main() {
+// Pass a seed (RayTracerMain 42) to render the same scene every run
+int main(int argc, char** argv) {
 	RayTracer r1;
 
 	// Generate random shapes and light location
-	// Random seed
-	srand(time(0));
+	// Random seed, from the time unless one is given
+	srand(argc > 1 ? atoi(argv[1]) : time(0));
 	int randLightX = rand() % 10;	// 0 - 9
 	int randLightY = rand() % 21 - 10;	// -10 - 10
 	int randLightZ = rand() % 11 - 5;	// -5 - 5
@@ -40,4 +41,5 @@ int main() {
 
 	r1.renderScene();
 	r1.saveSceneToPNG("Renders/Main/raytracing_scene_random10.png");
+	r1.getRenderStats().print(std::cout);
 }
\ No newline at end of file
@@ -1,19 +1,84 @@
 #define CATCH_CONFIG_MAIN
 #define CATCH_CONFIG_COLOUR_NONE
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
 #include <math.h>
+#include <random>
+#include <thread>
 #include <iostream>
 #include <vector>
 
 #include "catch.hpp"
+#include <lodepng.h>
+#include "BVH.hpp"
+#include "Grid.hpp"
+#include "Heatmap.hpp"
+#include "Instancing.hpp"
 #include "RayTracer.hpp"
 #include "Sphere.hpp"
+#include "SphereSoA.hpp"
+#include "Timeline.hpp"
 #include "Vector.hpp"
+#include "WideBVH.hpp"
 
 using std::vector;
 using std::cout;
 using std::endl;
 
+// True if both images have the same size and every RGBA value matches
+static bool samePixels(const vector<Pixel>& a, const vector<Pixel>& b)
+{
+	if (a.size() != b.size())
+		return false;
+	for (int i = 0; i < a.size(); i++) {
+		if (a[i].R != b[i].R || a[i].G != b[i].G || a[i].B != b[i].B || a[i].A != b[i].A)
+			return false;
+	}
+	return true;
+}
+
+// Fraction of pixels where some RGB value differs by more than tolerance (images of the same size)
+static double differingFraction(const vector<Pixel>& a, const vector<Pixel>& b, int tolerance)
+{
+	int differing = 0;
+	for (int i = 0; i < a.size(); i++) {
+		if (abs(a[i].R - b[i].R) > tolerance || abs(a[i].G - b[i].G) > tolerance || abs(a[i].B - b[i].B) > tolerance)
+			differing++;
+	}
+	return double(differing) / a.size();
+}
+
+// Deterministic pseudo-random spheres of many sizes and colors, many overlapping: x from x0 in steps of xStep, y and z
+// from yz0 in steps of yzStep
+static vector<Sphere> scatteredSpheres(int count, double x0, double yz0, double xStep, double yzStep)
+{
+	vector<Sphere> spheres;
+	for (int n = 0; n < count; n++) {
+		double x = x0 + (n * 37 % 100) * xStep;
+		double y = yz0 + (n * 53 % 100) * yzStep;
+		double z = yz0 + (n * 71 % 100) * yzStep;
+		unsigned char c = 50 + n % 200;
+		spheres.push_back(Sphere(0.2 + (n % 7) * 0.15, Vector(x, y, z), Pixel{ c, (unsigned char)(255 - c), 128 }, 0.2));
+	}
+	return spheres;
+}
+
+// Deterministic pseudo-random plain spheres in the 10x10x10 box around the origin
+static vector<Sphere> spheresAroundOrigin(int count)
+{
+	vector<Sphere> spheres;
+	for (int n = 0; n < count; n++) {
+		Vector position(-5 + (n * 37 % 100) * 0.1, -5 + (n * 53 % 100) * 0.1, -5 + (n * 71 % 100) * 0.1);
+		spheres.push_back(Sphere(0.1 + (n % 9) * 0.2, position, Pixel(), 0.2));
+	}
+	return spheres;
+}
+
 // This is just a simple example for demonstration - black screen
 TEST_CASE( "Test default constructor and no shapes", "[RayTracer]" ) 
 {
@@ -45,6 +110,1416 @@ TEST_CASE("Test default constructor and custom shapes", "[RayTracer]")
 	r1.saveSceneToPNG("Renders/Tests/TEST_CUSTOMSHAPES_3.png");
 }
 
+TEST_CASE("Test rendered image does not depend on thread count or tile size", "[RayTracer]")
+{
+	RayTracer r;
+	r.changeLightLocation(Vector(3, 8, -2));
+	r.addShape(Sphere(2, Vector(0, -3, 1), Pixel{ 255, 0, 0 }, 0.1));
+	r.addShape(Sphere(1, Vector(-1, 1, -2), Pixel{ 0, 255, 0 }, 0.3));
+	r.addShape(Sphere(3, Vector(-6, 2, 3), Pixel{ 0, 0, 255 }, 0.2));
+
+	r.setThreadCount(1);
+	r.renderScene();
+	vector<Pixel> singleThread = r.getPixels();
+
+	r.setThreadCount(4);
+	r.setTileSize(7);
+	r.renderScene();
+	vector<Pixel> multiThread = r.getPixels();
+
+	REQUIRE(samePixels(singleThread, multiThread));
+}
+
+TEST_CASE("Test scheduler workers run every job once, run after run", "[TileScheduler]")
+{
+	TileScheduler scheduler(4);
+	REQUIRE(scheduler.getThreadCount() == 4);
+	for (int round = 0; round < 200; round++) {
+		int jobs = 1 + round * 7 % 50;
+		vector<std::atomic<int> > calls(jobs);
+		std::atomic<int> badWorker(0);
+		scheduler.run(jobs, [&](int job, int worker) {
+			calls[job]++;
+			if (worker < 0 || worker >= 4)
+				badWorker++;
+		});
+		for (int job = 0; job < jobs; job++)
+			REQUIRE(calls[job] == 1);
+		REQUIRE(badWorker == 0);
+	}
+
+	// A run from inside a job gets threads of its own; a copy gets its own workers
+	std::atomic<int> inner(0);
+	scheduler.run(8, [&](int, int) {
+		scheduler.run(5, [&](int, int) { inner++; });
+	});
+	REQUIRE(inner == 40);
+	TileScheduler copy(scheduler);
+	REQUIRE(copy.getThreadCount() == 4);
+	std::atomic<int> total(0);
+	copy.run(100, [&](int job, int) { total += job; });
+	REQUIRE(total == 4950);
+	copy.setThreadCount(2);
+	total = 0;
+	copy.run(100, [&](int job, int) { total += job; });
+	REQUIRE(total == 4950);
+}
+
+TEST_CASE("Test BVH renders the same image as testing every shape", "[RayTracer]")
+{
+	RayTracer r;
+	r.changeLightLocation(Vector(4, 6, 3));
+	// Many overlapping spheres, so the lowest-index hit matters
+	for (const Sphere& sphere : scatteredSpheres(300, -12, -6, 0.12, 0.12)) {
+		r.addShape(sphere);
+	}
+
+	r.setAcceleration(Acceleration::BruteForce);
+	r.renderScene();
+	vector<Pixel> bruteForce = r.getPixels();
+
+	r.setAcceleration(Acceleration::BVH);
+	r.renderScene();
+	vector<Pixel> bvh = r.getPixels();
+
+	REQUIRE(samePixels(bruteForce, bvh));
+}
+
+TEST_CASE("Test LBVH renders the same image as the SAH BVH", "[RayTracer]")
+{
+	RayTracer r;
+	r.changeLightLocation(Vector(4, 6, 3));
+	r.setShadows(true);
+	for (const Sphere& sphere : scatteredSpheres(300, -12, -6, 0.12, 0.12)) {
+		r.addShape(sphere);
+	}
+
+	REQUIRE(r.getBVHBuilder() == BVHBuilder::SAH);
+	r.renderScene();
+	vector<Pixel> sah = r.getPixels();
+
+	r.setBVHBuilder(BVHBuilder::LBVH);
+	REQUIRE(r.getBVHBuilder() == BVHBuilder::LBVH);
+	int packetSizes[] = { 1, 4 };
+	for (int packetSize : packetSizes) {
+		r.setPacketSize(packetSize);
+		r.renderScene();
+		REQUIRE(samePixels(sah, r.getPixels()));
+	}
+}
+
+TEST_CASE("Test LBVH holds every sphere once inside its node boxes", "[BVH]")
+{
+	// Spread out spheres, then a pile sharing one center (too many equal 30-bit Morton codes), then one and two spheres
+	vector<vector<Sphere> > scenes(4);
+	for (int n = 0; n < 1000; n++) {
+		Vector position(-5 + (n * 37 % 101) * 0.1, -5 + (n * 53 % 103) * 0.1, -5 + (n * 71 % 107) * 0.1);
+		scenes[0].push_back(Sphere(0.05 + (n % 9) * 0.02, position, Pixel(), 0.2));
+	}
+	for (int n = 0; n < 200; n++) {
+		Vector position = n < 150 ? Vector(1, 2, 3) : Vector(-5 + (n * 37 % 100) * 0.1, 0, -5 + (n * 71 % 100) * 0.1);
+		scenes[1].push_back(Sphere(0.01 * (n + 1), position, Pixel(), 0.2));
+	}
+	scenes[2].push_back(Sphere(1, Vector(0, 0, 0), Pixel(), 0.2));
+	scenes[3] = { Sphere(1, Vector(0, 0, 0), Pixel(), 0.2), Sphere(1, Vector(0, 0, 0), Pixel(), 0.2) };
+
+	auto contains = [](const AABB& outer, const AABB& inner) {
+		for (int a = 0; a < 3; a++) {
+			if (inner.min[a] < outer.min[a] || inner.max[a] > outer.max[a])
+				return false;
+		}
+		return true;
+	};
+
+	TileScheduler scheduler(3);
+	for (const vector<Sphere>& spheres : scenes) {
+		BVH bvh;
+		bvh.build(spheres, BVHBuilder::LBVH, &scheduler);
+		const vector<BVH::Node>& nodes = bvh.getNodes();
+		const vector<int>& indices = bvh.getIndices();
+
+		// Walk the tree: the leaves cover every position of indices once, every box holds what is below it
+		vector<int> covered(spheres.size(), 0);
+		vector<int> stack(1, 0);
+		while (!stack.empty()) {
+			const BVH::Node& node = nodes[stack.back()];
+			stack.pop_back();
+			if (node.count > 0) {
+				for (int k = node.leftFirst; k < node.leftFirst + node.count; k++) {
+					covered[k]++;
+					const Sphere& sphere = spheres[indices[k]];
+					double r = sphere.radius();
+					AABB box;
+					box.grow(sphere.position() - Vector(r, r, r));
+					box.grow(sphere.position() + Vector(r, r, r));
+					REQUIRE(contains(node.bounds, box));
+				}
+				continue;
+			}
+			REQUIRE(contains(node.bounds, nodes[node.leftFirst].bounds));
+			REQUIRE(contains(node.bounds, nodes[node.leftFirst + 1].bounds));
+			stack.push_back(node.leftFirst);
+			stack.push_back(node.leftFirst + 1);
+		}
+		REQUIRE(std::count(covered.begin(), covered.end(), 1) == spheres.size());
+		vector<int> sorted(indices);
+		std::sort(sorted.begin(), sorted.end());
+		for (int i = 0; i < sorted.size(); i++)
+			REQUIRE(sorted[i] == i);
+
+		// Same nearest sphere as testing every one, also in the pile where only the radius tells them apart
+		for (int ray = 0; ray < 100; ray++) {
+			Vector s(8, -3 + (ray % 7), -3 + (ray % 5));
+			Vector d = (Vector(0, (ray * 13 % 40) * 0.1 - 2, (ray * 29 % 40) * 0.1 - 2) - s).formUnitVector();
+			double expectedT = INFINITY;
+			int expected = -1;
+			for (int n = 0; n < spheres.size(); n++) {
+				Intersection hit = spheres[n].intersect(s, d, expectedT);
+				if (hit.hit && hit.t < expectedT) {
+					expectedT = hit.t;
+					expected = n;
+				}
+			}
+			double t = INFINITY;
+			REQUIRE(bvh.closestHit(s, d, t) == expected);
+		}
+	}
+
+	// The SAH builder searches for its splits, so it makes the cheaper tree
+	BVH sah;
+	sah.build(scenes[0]);
+	BVH lbvh;
+	lbvh.build(scenes[0], BVHBuilder::LBVH);
+	REQUIRE(sah.sahCost() > 0);
+	REQUIRE(sah.sahCost() <= lbvh.sahCost());
+}
+
+TEST_CASE("Test wide BVH renders the same image as the binary BVH", "[RayTracer]")
+{
+	RayTracer r;
+	r.changeLightLocation(Vector(4, 6, 3));
+	r.setShadows(true);
+	for (const Sphere& sphere : scatteredSpheres(300, -12, -6, 0.12, 0.12)) {
+		r.addShape(sphere);
+	}
+
+	REQUIRE(r.getBVHLayout() == BVHLayout::Binary);
+	Precision precisions[] = { Precision::Double, Precision::Float };
+	for (Precision precision : precisions) {
+		r.setPrecision(precision);
+		r.setBVHLayout(BVHLayout::Binary);
+		r.renderScene();
+		vector<Pixel> binary = r.getPixels();
+
+		// Only the layout changed, so the tree built for the binary render is collapsed, not rebuilt
+		r.setBVHLayout(BVHLayout::Wide);
+		REQUIRE(r.getBVHLayout() == BVHLayout::Wide);
+		r.renderScene();
+#if RAYTRACER_STATS
+		REQUIRE(r.getRenderStats().bvhBuilds == 0);
+#endif
+		REQUIRE(samePixels(binary, r.getPixels()));
+	}
+
+	// Moved shapes refit the binary tree, and the wide one follows it
+	r.setPrecision(Precision::Double);
+	for (int n = 0; n < 300; n += 3) {
+		REQUIRE(r.updateShape(n, Vector(-12 + (n * 29 % 100) * 0.12, 0, -6 + (n * 13 % 100) * 0.12), 0.3));
+	}
+	r.renderScene();
+	vector<Pixel> wide = r.getPixels();
+	r.setBVHLayout(BVHLayout::Binary);
+	r.renderScene();
+	REQUIRE(samePixels(wide, r.getPixels()));
+}
+
+TEST_CASE("Test wide BVH finds the nearest sphere like the binary BVH", "[WideBVH]")
+{
+	// A cloud of mixed sizes, a flat layer, and a pile of more spheres on one center than a leaf child can hold
+	vector<vector<Sphere> > scenes(3);
+	std::mt19937 rng(11);
+	std::uniform_real_distribution<double> unit(-1, 1);
+	for (int n = 0; n < 3000; n++) {
+		scenes[0].push_back(Sphere(0.02 + (n % 9) * 0.03, Vector(unit(rng) * 5, unit(rng) * 5, unit(rng) * 5), Pixel(), 0.2));
+		scenes[1].push_back(Sphere(0.1, Vector(unit(rng) * 8, unit(rng) * 8, 0), Pixel(), 0.2));
+	}
+	for (int n = 0; n < 70000; n++) {
+		scenes[2].push_back(Sphere(0.5 + n * 1e-6, Vector(1, 2, 3), Pixel(), 0.2));
+	}
+
+	BVHBuilder builders[] = { BVHBuilder::SAH, BVHBuilder::LBVH };
+	SimdISA kernels[] = { SimdISA::Scalar, SimdISA::SSE2, SimdISA::AVX2, SimdISA::AVX512 };
+	for (int scene = 0; scene < scenes.size(); scene++) {
+		const vector<Sphere>& spheres = scenes[scene];
+		for (BVHBuilder builder : builders) {
+			BVH bvh;
+			bvh.build(spheres, builder);
+			WideBVH wide;
+			REQUIRE(wide.empty());
+			wide.build(bvh, spheres);
+			REQUIRE_FALSE(wide.empty());
+			REQUIRE(wide.getNodes().size() <= bvh.getNodes().size());
+			REQUIRE(wide.getNodeBytes() == wide.getNodes().size() * sizeof(WideBVH::Node));
+
+			// Every sphere sits in exactly one leaf child, inside the decoded boxes of all the nodes above it
+			vector<int> covered(spheres.size(), 0);
+			const auto& nodes = wide.getNodes();
+			vector<std::pair<int, AABB> > stack(1, std::make_pair(0, AABB()));
+			while (!stack.empty()) {
+				const WideBVH::Node& node = nodes[stack.back().first];
+				stack.pop_back();
+				REQUIRE(node.childCount >= 2);
+				REQUIRE(node.childCount <= WideBVH::WIDTH);
+				for (int c = 0; c < node.childCount; c++) {
+					AABB box;
+					for (int a = 0; a < 3; a++) {
+						double scale = std::ldexp(1.0, node.exponent[a]);
+						box.min[a] = node.origin[a] + node.lo[a][c] * scale;
+						box.max[a] = node.origin[a] + node.hi[a][c] * scale;
+					}
+					if (node.count[c] == 0) {
+						stack.push_back(std::make_pair(node.child[c], box));
+						continue;
+					}
+					for (int k = node.child[c]; k < node.child[c] + node.count[c]; k++) {
+						covered[bvh.getIndices()[k]]++;
+						const Sphere& sphere = spheres[bvh.getIndices()[k]];
+						for (int a = 0; a < 3; a++) {
+							double center = a == 0 ? sphere.position().getI() : a == 1 ? sphere.position().getJ() :
+								sphere.position().getK();
+							REQUIRE(box.min[a] <= center - sphere.radius());
+							REQUIRE(box.max[a] >= center + sphere.radius());
+						}
+					}
+				}
+			}
+			REQUIRE(std::count(covered.begin(), covered.end(), 1) == spheres.size());
+
+			// Same sphere at the same distance as the binary tree with every kernel, in both precisions, from
+			// outside and inside the spheres' bounds, some rays along the axes
+			for (SimdISA kernel : kernels) {
+				wide.setISA(kernel);
+				REQUIRE(wide.getISA() == (SphereSoA::supported(kernel) ? kernel : SimdISA::Scalar));
+				for (int n = 0; n < 300; n++) {
+					Vector s = n % 2 ? Vector(unit(rng) * 3, unit(rng) * 3, unit(rng) * 3) : Vector(20, unit(rng) * 4, unit(rng) * 4);
+					Vector d = n % 10 == 3 ? Vector(0, 0, -1) : n % 10 == 5 ? Vector(-1, 0, 0) :
+						Vector(n % 2 ? unit(rng) : -1, unit(rng) * 0.4, unit(rng) * 0.4).normalized();
+					double expectedT = INFINITY;
+					int expected = bvh.closestHit(s, d, expectedT);
+					double t = INFINITY;
+					REQUIRE(wide.closestHit(s, d, t) == expected);
+					REQUIRE(t == expectedT);
+					REQUIRE(wide.anyHit(s, d, double(INFINITY)) == (expected >= 0));
+					if (expected >= 0) {
+						REQUIRE_FALSE(wide.anyHit(s, d, expectedT * 0.999 - 1e-9));
+					}
+
+					VectorF sF(s);
+					VectorF dF(d);
+					float expectedF = INFINITY;
+					int expectedIndexF = bvh.closestHit(sF, dF, expectedF);
+					float tF = INFINITY;
+					REQUIRE(wide.closestHit(sF, dF, tF) == expectedIndexF);
+					REQUIRE(tF == expectedF);
+				}
+			}
+		}
+	}
+
+	// Two cache lines per node, allocated on a cache line boundary
+	REQUIRE(sizeof(WideBVH::Node) == 128);
+	REQUIRE(alignof(WideBVH::Node) == 64);
+	BVH bvh;
+	bvh.build(scenes[0]);
+	WideBVH wide;
+	wide.build(bvh, scenes[0]);
+	REQUIRE(reinterpret_cast<uintptr_t>(wide.getNodes().data()) % 64 == 0);
+}
+
+TEST_CASE("Test moved shapes refit the BVH and render like a new scene", "[RayTracer]")
+{
+	vector<Sphere> spheres = scatteredSpheres(300, -12, -6, 0.12, 0.12);
+	auto newScene = [](const vector<Sphere>& shapes) {
+		RayTracer r;
+		r.changeLightLocation(Vector(4, 6, 3));
+		r.setShadows(true);
+		for (const Sphere& shape : shapes)
+			r.addShape(shape);
+		return r;
+	};
+	// Move every sphere to the place of sphere (n * step) % 300 (step 1: nudge it) and grow it a little
+	auto move = [](RayTracer& r, vector<Sphere>& shapes, int step) {
+		vector<Sphere> moved;
+		for (int n = 0; n < shapes.size(); n++) {
+			const Sphere& target = shapes[n * step % shapes.size()];
+			Vector position = target.position() + Vector(0.05, -0.03 * (n % 3), 0.02);
+			double radius = shapes[n].radius() * 1.05;
+			REQUIRE(r.updateShape(n, position, radius));
+			moved.push_back(Sphere(radius, position, shapes[n].color(), shapes[n].ambient()));
+		}
+		shapes = moved;
+	};
+
+	RayTracer r = newScene(spheres);
+	REQUIRE(r.getRefitThreshold() == 1.5);
+	r.renderScene();
+	REQUIRE_FALSE(r.updateShape(-1, Vector(0, 0, 0), 1));
+	REQUIRE_FALSE(r.updateShape(300, Vector(0, 0, 0), 1));
+	REQUIRE_FALSE(r.updateShape(0, Vector(0, 0, 0), 0));
+
+	auto renderNew = [&newScene](const vector<Sphere>& shapes) {
+		RayTracer fresh = newScene(shapes);
+		fresh.renderScene();
+		return fresh.getPixels();
+	};
+
+	// A nudge only refits the tree
+	move(r, spheres, 1);
+	r.renderScene();
+	REQUIRE(samePixels(r.getPixels(), renderNew(spheres)));
+#if RAYTRACER_STATS
+	REQUIRE(r.getRenderStats().bvhRefits == 1);
+	REQUIRE(r.getRenderStats().bvhBuilds == 0);
+#endif
+
+	// Shuffling the spheres around spoils it, so it is rebuilt
+	r.setRefitThreshold(0.5);
+	REQUIRE(r.getRefitThreshold() == 1);
+	move(r, spheres, 7);
+	r.renderScene();
+	REQUIRE(samePixels(r.getPixels(), renderNew(spheres)));
+#if RAYTRACER_STATS
+	REQUIRE(r.getRenderStats().bvhRefits == 1);
+	REQUIRE(r.getRenderStats().bvhBuilds == 1);
+#endif
+
+	// Refitting to the spheres a tree was built from gives the tree as built, whichever builder made it
+	TileScheduler scheduler(3);
+	BVHBuilder builders[] = { BVHBuilder::SAH, BVHBuilder::LBVH };
+	for (BVHBuilder builder : builders) {
+		BVH bvh;
+		bvh.build(spheres, builder);
+		REQUIRE(bvh.getBuildCost() == bvh.sahCost());
+		bvh.refit(spheres, &scheduler);
+		REQUIRE(bvh.sahCost() == bvh.getBuildCost());
+	}
+}
+
+TEST_CASE("Test packet tracing renders the same image as single rays", "[RayTracer]")
+{
+	RayTracer r;
+	r.changeLightLocation(Vector(4, 6, 3));
+	for (const Sphere& sphere : scatteredSpheres(300, -12, -6, 0.12, 0.12)) {
+		r.addShape(sphere);
+	}
+	// Tiles that are not a multiple of the packet size leave partial packets at their edges
+	r.setTileSize(20);
+
+	Acceleration accelerations[] = { Acceleration::BVH, Acceleration::BruteForce };
+	for (int a = 0; a < 2; a++) {
+		r.setAcceleration(accelerations[a]);
+		r.setPacketSize(1);
+		r.renderScene();
+		vector<Pixel> single = r.getPixels();
+
+		int sizes[] = { 2, 3, 4, 8 };
+		for (int size : sizes) {
+			r.setPacketSize(size);
+			REQUIRE(r.getPacketSize() == size);
+			r.renderScene();
+			REQUIRE(samePixels(single, r.getPixels()));
+		}
+	}
+}
+
+TEST_CASE("Test screen bins render the same image as testing every shape", "[RayTracer]")
+{
+	// Spheres all around the camera at (5, 0, 0): in view, off to the sides, behind it and crossing the image plane
+	RayTracer r;
+	r.changeLightLocation(Vector(4, 6, 3));
+	for (const Sphere& sphere : scatteredSpheres(400, -14, -8, 0.25, 0.16)) {
+		r.addShape(sphere);
+	}
+
+	r.setAcceleration(Acceleration::BruteForce);
+	r.setPacketSize(1);
+	r.renderScene();
+	vector<Pixel> bruteForce = r.getPixels();
+
+	r.setAcceleration(Acceleration::ScreenBins);
+	int tileSizes[] = { 32, 7 };
+	int packetSizes[] = { 1, 4 };
+	for (int tileSize : tileSizes) {
+		for (int packetSize : packetSizes) {
+			r.setTileSize(tileSize);
+			r.setPacketSize(packetSize);
+			r.renderScene();
+			REQUIRE(samePixels(bruteForce, r.getPixels()));
+		}
+	}
+
+	// Strips do not line up with the bins
+	r.renderSceneToPNG("scene_bins.png", 50);
+	vector<unsigned char> decoded;
+	unsigned width, height;
+	REQUIRE(lodepng::decode(decoded, width, height, "scene_bins.png") == 0);
+	std::remove("scene_bins.png");
+	REQUIRE(decoded.size() == bruteForce.size() * 4);
+	REQUIRE(std::equal(decoded.begin(), decoded.end(), reinterpret_cast<const unsigned char*>(bruteForce.data())));
+}
+
+TEST_CASE("Test screen bins hold spheres barely in front of the camera", "[RayTracer]")
+{
+	// Camera at (5, 0, 0) looking down -x: each sphere's near side is a hair in front of it, so its tangent slopes (and
+	// bin range before clamping) are far outside the int range, on every side of the image
+	RayTracer r;
+	r.changeLightLocation(Vector(4, 6, 3));
+	r.addShape(Sphere(1, Vector(5 - 1.000000001, 2, 0), Pixel{ 255, 0, 0 }, 0.2));
+	r.addShape(Sphere(1, Vector(5 - 1.000000001, -2, 0), Pixel{ 0, 255, 0 }, 0.2));
+	r.addShape(Sphere(1, Vector(5 - 1.000000001, 0, 2), Pixel{ 0, 0, 255 }, 0.2));
+	r.addShape(Sphere(1, Vector(5 - 1.000000001, 0, -2), Pixel{ 255, 255, 0 }, 0.2));
+	r.addShape(Sphere(0.5, Vector(0, 0, 0), Pixel{ 0, 255, 255 }, 0.2));
+
+	r.setAcceleration(Acceleration::BruteForce);
+	r.renderScene();
+	vector<Pixel> bruteForce = r.getPixels();
+
+	r.setAcceleration(Acceleration::ScreenBins);
+	r.renderScene();
+	REQUIRE(samePixels(bruteForce, r.getPixels()));
+}
+
+TEST_CASE("Test grid renders the same image as testing every shape", "[RayTracer]")
+{
+	// The scene of the screen bins test, with shadows
+	RayTracer r;
+	r.changeLightLocation(Vector(4, 6, 3));
+	r.setShadows(true);
+	for (const Sphere& sphere : scatteredSpheres(400, -14, -8, 0.25, 0.16)) {
+		r.addShape(sphere);
+	}
+
+	Precision precisions[] = { Precision::Double, Precision::Float };
+	for (Precision precision : precisions) {
+		r.setPrecision(precision);
+		r.setAcceleration(Acceleration::BruteForce);
+		r.renderScene();
+		vector<Pixel> bruteForce = r.getPixels();
+
+		r.setAcceleration(Acceleration::Grid);
+		for (int levels = 1; levels <= 2; levels++) {
+			for (int packetSize = 1; packetSize <= 4; packetSize *= 4) {
+				r.setGridLevels(levels);
+				r.setPacketSize(packetSize);
+				r.renderScene();
+				REQUIRE(r.getActiveAcceleration() == Acceleration::Grid);
+				REQUIRE(samePixels(bruteForce, r.getPixels()));
+			}
+		}
+	}
+	r.setGridLevels(5);
+	REQUIRE(r.getGridLevels() == 2);
+}
+
+TEST_CASE("Test grid finds the nearest sphere like testing every sphere", "[Grid]")
+{
+	// An even cloud, a dense clump in a sparse cloud, and a flat layer one sphere thick
+	vector<vector<Sphere> > scenes(3);
+	std::mt19937 rng(7);
+	std::uniform_real_distribution<double> unit(-1, 1);
+	for (int n = 0; n < 2000; n++) {
+		scenes[0].push_back(Sphere(0.15, Vector(unit(rng) * 5, unit(rng) * 5, unit(rng) * 5), Pixel(), 0.2));
+		double spread = n < 1800 ? 0.5 : 10;
+		scenes[1].push_back(Sphere(0.02 + (n % 5) * 0.05, Vector(unit(rng) * spread, unit(rng) * spread,
+			unit(rng) * spread), Pixel(), 0.2));
+		scenes[2].push_back(Sphere(0.1, Vector(unit(rng) * 8, unit(rng) * 8, 0), Pixel(), 0.2));
+	}
+
+	for (const vector<Sphere>& spheres : scenes) {
+		for (int levels = 1; levels <= 2; levels++) {
+			Grid grid;
+			REQUIRE(grid.empty());
+			grid.build(spheres, levels);
+			REQUIRE_FALSE(grid.empty());
+			REQUIRE(grid.getReferenceCount() >= spheres.size());
+
+			// Rays from outside and from inside the grid, some along the axes
+			for (int n = 0; n < 500; n++) {
+				Vector s = n % 2 ? Vector(unit(rng) * 3, unit(rng) * 3, unit(rng) * 3) : Vector(20, unit(rng) * 4, unit(rng) * 4);
+				Vector d = n % 10 == 3 ? Vector(0, 0, -1) : n % 10 == 5 ? Vector(-1, 0, 0) :
+					Vector(n % 2 ? unit(rng) : -1, unit(rng) * 0.4, unit(rng) * 0.4).normalized();
+				double expected = INFINITY;
+				int nearest = -1;
+				for (int i = 0; i < spheres.size(); i++) {
+					Intersection hit = spheres[i].intersect(s, d, expected);
+					if (hit.hit) {
+						expected = hit.t;
+						nearest = i;
+					}
+				}
+				double t = INFINITY;
+				REQUIRE(grid.closestHit(s, d, t) == nearest);
+				REQUIRE(t == expected);
+				REQUIRE(grid.anyHit(s, d, double(INFINITY)) == (nearest >= 0));
+				if (nearest >= 0) {
+					REQUIRE_FALSE(grid.anyHit(s, d, expected * 0.999 - 1e-9));
+				}
+			}
+		}
+	}
+
+	// An even cloud fills as many cells as a random one would; the clump leaves most of them empty
+	Grid::Statistics even = Grid::analyze(scenes[0]);
+	Grid::Statistics clumped = Grid::analyze(scenes[1]);
+	REQUIRE(even.occupancy > 0.9);
+	REQUIRE(clumped.occupancy < 0.5);
+	REQUIRE(even.overlap >= 1);
+	REQUIRE(Grid::analyze(vector<Sphere>()).occupancy == 0);
+	Grid empty;
+	empty.build(vector<Sphere>());
+	double t = INFINITY;
+	REQUIRE(empty.closestHit(Vector(0, 0, 0), Vector(1, 0, 0), t) == -1);
+}
+
+TEST_CASE("Test automatic acceleration picks the grid for even scenes", "[RayTracer]")
+{
+	std::mt19937 rng(3);
+	std::uniform_real_distribution<double> coordinate(-10, 10);
+	vector<Sphere> cloud;
+	for (int n = 0; n < 20000; n++) {
+		cloud.push_back(Sphere(0.15, Vector(coordinate(rng) - 20, coordinate(rng), coordinate(rng)), Pixel{ 200, 80, 40 }, 0.2));
+	}
+	RayTracer r(Vector(10, 20, 10), Vector(5, 0, 0), Vector(0, 0, 0), cloud, 64, 64, 5, 5, Pixel());
+	r.setAcceleration(Acceleration::BVH);
+	r.renderScene();
+	vector<Pixel> reference = r.getPixels();
+
+	r.setAcceleration(Acceleration::Auto);
+	r.renderScene();
+	REQUIRE(r.getAcceleration() == Acceleration::Auto);
+	REQUIRE(r.getActiveAcceleration() == Acceleration::Grid);
+	REQUIRE(samePixels(reference, r.getPixels()));
+
+	// A few spheres are not worth a grid
+	RayTracer few;
+	few.addShape(Sphere(2, Vector(0, -3, 1), Pixel{ 255, 0, 0 }, 0.1));
+	few.setAcceleration(Acceleration::Auto);
+	few.renderScene();
+	REQUIRE(few.getActiveAcceleration() == Acceleration::BVH);
+}
+
+TEST_CASE("Test Sphere intersect returns nearest distance in front of the ray", "[Sphere]")
+{
+	Sphere sph(1, Vector(0, 0, 0), Pixel{ 255, 0, 255 }, 0.5);
+
+	// Straight at the sphere: enters at x = 1
+	Intersection hit = sph.intersect(Vector(5, 0, 0), Vector(-1, 0, 0));
+	REQUIRE(hit.hit);
+	REQUIRE(hit.t == Approx(4));
+
+	// Same ray, but something nearer was already found
+	REQUIRE_FALSE(sph.intersect(Vector(5, 0, 0), Vector(-1, 0, 0), 3.5).hit);
+
+	// Pointing away from the sphere
+	REQUIRE_FALSE(sph.intersect(Vector(5, 0, 0), Vector(1, 0, 0)).hit);
+
+	// Missing to the side
+	REQUIRE_FALSE(sph.intersect(Vector(5, 2, 0), Vector(-1, 0, 0)).hit);
+
+	// Starting inside: leaves through the far side
+	hit = sph.intersect(Vector(0, 0, 0), Vector(0, 1, 0));
+	REQUIRE(hit.hit);
+	REQUIRE(hit.t == Approx(1));
+}
+
+TEST_CASE("Test SIMD sphere kernels match Sphere intersect", "[SphereSoA]")
+{
+	vector<Sphere> spheres = spheresAroundOrigin(101);
+
+	SimdISA kernels[] = { SimdISA::Scalar, SimdISA::SSE2, SimdISA::AVX2, SimdISA::AVX512 };
+	for (int k = 0; k < 4; k++) {
+		if (!SphereSoA::supported(kernels[k]))
+			continue;
+		SphereSoA soa;
+		soa.build(spheres);
+		soa.setISA(kernels[k]);
+		REQUIRE(soa.getISA() == kernels[k]);
+
+		for (int r = 0; r < 200; r++) {
+			Vector s(8, -3 + (r % 7), -3 + (r % 5));
+			Vector d = (Vector(0, (r * 13 % 40) * 0.1 - 2, (r * 29 % 40) * 0.1 - 2) - s).formUnitVector();
+
+			// Reference: every sphere in turn, only keeping nearer hits
+			int expected = -1;
+			double expectedT = INFINITY;
+			for (int n = 0; n < spheres.size(); n++) {
+				Intersection hit = spheres[n].intersect(s, d, expectedT);
+				if (hit.hit) {
+					expected = n;
+					expectedT = hit.t;
+				}
+			}
+
+			// Odd sub-ranges exercise the partially filled lanes
+			double t = INFINITY;
+			int found = soa.closestHit(s, d, 0, soa.size(), t);
+			REQUIRE(found == expected);
+			REQUIRE(t == expectedT);
+
+			double tRange = INFINITY;
+			int foundRange = soa.closestHit(s, d, 3, 7, tRange);
+			if (foundRange >= 0) {
+				REQUIRE(foundRange >= 3);
+				REQUIRE(foundRange < 10);
+				REQUIRE(tRange == spheres[foundRange].intersect(s, d).t);
+			}
+		}
+	}
+}
+
+TEST_CASE("Test float SIMD sphere kernels match SphereF intersect", "[SphereSoA]")
+{
+	vector<Sphere> spheres = spheresAroundOrigin(101);
+
+	SimdISA kernels[] = { SimdISA::Scalar, SimdISA::SSE2, SimdISA::AVX2, SimdISA::AVX512 };
+	for (int k = 0; k < 4; k++) {
+		if (!SphereSoAF::supported(kernels[k]))
+			continue;
+		SphereSoAF soa;
+		soa.build(spheres);
+		soa.setISA(kernels[k]);
+
+		for (int r = 0; r < 200; r++) {
+			VectorF s(8, -3 + (r % 7), -3 + (r % 5));
+			VectorF d = (VectorF(0, (r * 13 % 40) * 0.1f - 2, (r * 29 % 40) * 0.1f - 2) - s).formUnitVector();
+
+			// Reference: the same spheres rounded to float, in turn
+			int expected = -1;
+			float expectedT = INFINITY;
+			for (int n = 0; n < spheres.size(); n++) {
+				BasicIntersection<float> hit = SphereF(spheres[n]).intersect(s, d, expectedT);
+				if (hit.hit) {
+					expected = n;
+					expectedT = hit.t;
+				}
+			}
+
+			float t = INFINITY;
+			REQUIRE(soa.closestHit(s, d, 0, soa.size(), t) == expected);
+			REQUIRE(t == expectedT);
+			REQUIRE(soa.anyHit(s, d, 0, soa.size(), INFINITY) == (expected >= 0));
+		}
+	}
+}
+
+TEST_CASE("Test transforms compose and invert", "[Instancing]")
+{
+	Transform quarter = Transform::rotation(Vector(0, 0, 2), M_PI / 2);
+	Vector p = quarter.apply(Vector(1, 0, 0));
+	REQUIRE(fabs(p.getI()) < 1e-12);
+	REQUIRE(fabs(p.getJ() - 1) < 1e-12);
+	REQUIRE(fabs(p.getK()) < 1e-12);
+
+	// Scale, then rotate, then move
+	Transform t = Transform::translation(Vector(3, -1, 2)) * Transform::rotation(Vector(1, 2, 3), 0.7) *
+		Transform::scaling(2.5);
+	REQUIRE(t.getScale() == 2.5);
+	REQUIRE(t.valid());
+	Vector q(0.3, -4, 1.5);
+	Vector back = t.toLocal(t.apply(q));
+	REQUIRE(fabs(back.getI() - q.getI()) < 1e-12);
+	REQUIRE(fabs(back.getJ() - q.getJ()) < 1e-12);
+	REQUIRE(fabs(back.getK() - q.getK()) < 1e-12);
+	REQUIRE(fabs(t.toLocalDirection(Vector(0.6, 0, 0.8)).normSquared() - 1) < 1e-12);
+
+	REQUIRE_FALSE(Transform::scaling(0).valid());
+	REQUIRE_FALSE(Transform::translation(Vector(NAN, 0, 0)).valid());
+}
+
+TEST_CASE("Test instanced clusters render like their spheres added one by one", "[RayTracer]")
+{
+	vector<Sphere> cluster;
+	for (int n = 0; n < 40; n++) {
+		double x = -1 + (n * 37 % 40) * 0.05;
+		double y = -1 + (n * 53 % 40) * 0.05;
+		double z = -1 + (n * 71 % 40) * 0.05;
+		unsigned char c = 50 + n * 5;
+		cluster.push_back(Sphere(0.1 + (n % 5) * 0.05, Vector(x, y, z), Pixel{ c, (unsigned char)(255 - c), 128 }, 0.2));
+	}
+
+	InstancedScene scene;
+	REQUIRE(scene.addCluster(vector<Sphere>()) == -1);
+	int id = scene.addCluster(cluster);
+	REQUIRE(id == 0);
+	REQUIRE_FALSE(scene.addInstance(1, Transform()));
+	REQUIRE_FALSE(scene.addInstance(-1, Transform()));
+	REQUIRE_FALSE(scene.addInstance(id, Transform::scaling(-1)));
+	REQUIRE(scene.empty());
+	for (int i = 0; i < 9; i++) {
+		Transform place = Transform::translation(Vector(-4 - (i % 3) * 3, -3 + (i / 3) * 3, -3 + (i % 3) * 3)) *
+			Transform::rotation(Vector(1, i, 2), 0.4 * i) * Transform::scaling(0.6 + 0.1 * i);
+		REQUIRE(scene.addInstance(id, place));
+	}
+	REQUIRE(scene.getInstanceCount() == 9);
+	REQUIRE(scene.getSphereCount() == 360);
+	REQUIRE(scene.outdated());
+	scene.build();
+	REQUIRE_FALSE(scene.outdated());
+
+	// The nearest hit is the nearest of the expanded spheres
+	vector<Sphere> world = scene.expand();
+	REQUIRE(world.size() == 360);
+	for (int n = 0; n < 200; n++) {
+		Vector s(8, 0, 0);
+		Vector d = Vector(-1, -0.6 + (n % 20) * 0.06, -0.6 + (n / 20) * 0.12).normalized();
+		double t = INFINITY;
+		int hit = scene.closestHit(s, d, t);
+		double expected = INFINITY;
+		for (const Sphere& sphere : world) {
+			Intersection i = sphere.intersect(s, d, expected);
+			expected = i.hit ? i.t : expected;
+		}
+		REQUIRE((hit >= 0) == (expected < INFINITY));
+		if (hit >= 0) {
+			REQUIRE(fabs(t - expected) < 1e-9);
+			REQUIRE(fabs(world[hit].intersect(s, d).t - t) < 1e-9);
+		}
+		REQUIRE(scene.anyHit(s, d, INFINITY) == (hit >= 0));
+	}
+
+	// Whatever the acceleration, an instanced render matches the same spheres as plain shapes, mixed with other shapes
+	Acceleration accelerations[] = { Acceleration::BVH, Acceleration::BruteForce, Acceleration::ScreenBins };
+	for (Acceleration acceleration : accelerations) {
+		for (int packetSize = 1; packetSize <= 4; packetSize *= 4) {
+			RayTracer plain;
+			RayTracer instanced;
+			RayTracer* both[] = { &plain, &instanced };
+			for (RayTracer* r : both) {
+				r->changeLightLocation(Vector(4, 6, 3));
+				r->setShadows(true);
+				r->setAcceleration(acceleration);
+				r->setPacketSize(packetSize);
+				r->addShape(Sphere(1.5, Vector(-8, 2, 4), Pixel{ 255, 255, 0 }, 0.1));
+				r->addShape(Sphere(0.8, Vector(-2, -1, 1), Pixel{ 0, 255, 255 }, 0.3));
+			}
+			for (const Sphere& sphere : world)
+				plain.addShape(sphere);
+			int c = instanced.addCluster(cluster);
+			for (int i = 0; i < 9; i++) {
+				Transform place = Transform::translation(Vector(-4 - (i % 3) * 3, -3 + (i / 3) * 3, -3 + (i % 3) * 3)) *
+					Transform::rotation(Vector(1, i, 2), 0.4 * i) * Transform::scaling(0.6 + 0.1 * i);
+				REQUIRE(instanced.addInstance(c, place));
+			}
+			REQUIRE(instanced.getInstanceCount() == 9);
+			plain.renderScene();
+			instanced.renderScene();
+			// Transformed rays round differently, so only a grazing ray may land on the other side of a silhouette
+			REQUIRE(differingFraction(plain.getPixels(), instanced.getPixels(), 2) < 0.001);
+		}
+	}
+}
+
+TEST_CASE("Test float precision renders look the same as double", "[RayTracer]")
+{
+	// The scenes of the tests above: a few large spheres, and many small overlapping ones
+	RayTracer few;
+	few.changeLightLocation(Vector(3, 8, -2));
+	few.addShape(Sphere(2, Vector(0, -3, 1), Pixel{ 255, 0, 0 }, 0.1));
+	few.addShape(Sphere(1, Vector(-1, 1, -2), Pixel{ 0, 255, 0 }, 0.3));
+	few.addShape(Sphere(3, Vector(-6, 2, 3), Pixel{ 0, 0, 255 }, 0.2));
+
+	RayTracer many;
+	many.changeLightLocation(Vector(4, 6, 3));
+	for (const Sphere& sphere : scatteredSpheres(300, -12, -6, 0.12, 0.12)) {
+		many.addShape(sphere);
+	}
+
+	RayTracer* scenes[] = { &few, &many };
+	Acceleration accelerations[] = { Acceleration::BVH, Acceleration::BruteForce };
+	for (int n = 0; n < 2; n++) {
+		for (int a = 0; a < 2; a++) {
+			RayTracer& r = *scenes[n];
+			r.setAcceleration(accelerations[a]);
+			r.setShadows(n == 1);
+			r.setPrecision(Precision::Double);
+			r.renderScene();
+			vector<Pixel> reference = r.getPixels();
+
+			r.setPrecision(Precision::Float);
+			REQUIRE(r.getPrecision() == Precision::Float);
+			r.renderScene();
+
+			// Shading is the same; only rays grazing a silhouette may land on the other side of it
+			REQUIRE(differingFraction(reference, r.getPixels(), 2) < 0.001);
+		}
+	}
+}
+
+TEST_CASE("Test any-hit queries agree with Sphere intersect", "[SphereSoA]")
+{
+	vector<Sphere> spheres = spheresAroundOrigin(101);
+	BVH bvh;
+	bvh.build(spheres);
+
+	SimdISA kernels[] = { SimdISA::Scalar, SimdISA::SSE2, SimdISA::AVX2, SimdISA::AVX512 };
+	for (int k = 0; k < 4; k++) {
+		if (!SphereSoA::supported(kernels[k]))
+			continue;
+		SphereSoA soa;
+		soa.build(spheres);
+		soa.setISA(kernels[k]);
+
+		for (int r = 0; r < 200; r++) {
+			Vector s(8, -3 + (r % 7), -3 + (r % 5));
+			Vector d = (Vector(0, (r * 13 % 40) * 0.1 - 2, (r * 29 % 40) * 0.1 - 2) - s).formUnitVector();
+			double tMax = 2 + (r % 11);
+
+			// Reference: is any sphere (or any of spheres 3 - 9) hit closer than tMax
+			bool expected = false;
+			bool expectedRange = false;
+			for (int n = 0; n < spheres.size(); n++) {
+				if (spheres[n].intersect(s, d, tMax).hit) {
+					expected = true;
+					expectedRange = expectedRange || (n >= 3 && n < 10);
+				}
+			}
+
+			REQUIRE(soa.anyHit(s, d, 0, soa.size(), tMax) == expected);
+			REQUIRE(soa.anyHit(s, d, 3, 7, tMax) == expectedRange);
+			REQUIRE(bvh.anyHit(s, d, tMax) == expected);
+		}
+	}
+}
+
+TEST_CASE("Test shadows darken points with a shape between them and the light", "[RayTracer]")
+{
+	// Small sphere between the light and the top of the large one
+	RayTracer r;
+	r.addShape(Sphere(1, Vector(0, 0, 0), Pixel{ 200, 100, 50 }, 0.2));
+	r.addShape(Sphere(0.5, Vector(0, 3, 0), Pixel{ 0, 0, 255 }, 0.2));
+	int shadowedPixel = 474 * 1024 + 512;
+
+	r.renderScene();
+	Pixel lit = r.getPixels()[shadowedPixel];
+#if RAYTRACER_STATS
+	REQUIRE(r.getRenderStats().primaryRays == 1024 * 1024);
+	REQUIRE(r.getRenderStats().shadowRays == 0);
+#endif
+
+	r.setShadows(true);
+	r.renderScene();
+	Pixel shadowed = r.getPixels()[shadowedPixel];
+	REQUIRE(shadowed.R < lit.R);
+	REQUIRE(shadowed.R == (unsigned char)(200 * 0.2));
+#if RAYTRACER_STATS
+	REQUIRE(r.getRenderStats().shadowRays > 0);
+#endif
+
+	// Any-hit through the BVH and through every shape give the same image, also when reshading from the G-buffer
+	vector<Pixel> bvh = r.getPixels();
+	r.setAcceleration(Acceleration::BruteForce);
+	r.renderScene();
+	REQUIRE(samePixels(bvh, r.getPixels()));
+
+	r.setAcceleration(Acceleration::BVH);
+	r.setGBuffer(true);
+	r.renderScene();
+	r.changeLightLocation(Vector(0, 10, 0.1));
+	r.renderScene();
+#if RAYTRACER_STATS
+	REQUIRE(r.getRenderStats().primaryRays == 0);
+	REQUIRE(r.getRenderStats().shadowRays > 0);
+#endif
+	REQUIRE(r.getPixels()[shadowedPixel].R == shadowed.R);
+}
+
+#if RAYTRACER_STATS
+TEST_CASE("Test render statistics count rays, hits and intersection tests", "[RayTracer]")
+{
+	RayTracer r;
+	r.addShape(Sphere(1, Vector(0, 0, 0), Pixel{ 200, 100, 50 }, 0.2));
+	r.addShape(Sphere(0.5, Vector(0, 3, 0), Pixel{ 0, 0, 255 }, 0.2));
+	r.addShape(Sphere(1, Vector(-3, -1, 2), Pixel{ 0, 255, 0 }, 0.2));
+
+	// Single rays, brute force: every ray is tested against every shape
+	r.setAcceleration(Acceleration::BruteForce);
+	r.setPacketSize(1);
+	r.setThreadCount(1);
+	r.renderScene();
+	RenderStats single = r.getRenderStats();
+	REQUIRE(single.primaryRays == 1024 * 1024);
+	REQUIRE(single.intersectionTests == 3LL * 1024 * 1024);
+	REQUIRE(single.primaryHits > 0);
+	REQUIRE(single.primaryHits < single.primaryRays);
+	REQUIRE(single.hitRatio() == Approx(double(single.primaryHits) / single.primaryRays));
+	REQUIRE(single.peakFramebufferBytes == 1024 * 1024 * sizeof(Pixel));
+	REQUIRE(single.seconds > 0);
+	REQUIRE(single.colorSeconds > 0);
+	REQUIRE(single.traceSeconds > 0);
+	REQUIRE(single.seconds >= single.viewSeconds + single.buildSeconds + single.colorSeconds);
+
+	// Counters are per thread and only added up at the end, so they do not depend on the thread count
+	r.setThreadCount(4);
+	r.renderScene();
+	REQUIRE(r.getRenderStats().primaryHits == single.primaryHits);
+	REQUIRE(r.getRenderStats().intersectionTests == single.intersectionTests);
+
+	// The BVH and packets test far fewer spheres, and hit the same pixels
+	r.setAcceleration(Acceleration::BVH);
+	r.setPacketSize(4);
+	r.renderScene();
+	REQUIRE(r.getRenderStats().primaryHits == single.primaryHits);
+	REQUIRE(r.getRenderStats().intersectionTests < single.intersectionTests);
+
+	// Encoding is timed by the save, and the G-buffer counts towards the framebuffer
+	r.saveSceneToPNG("scene_stats.png");
+	std::remove("scene_stats.png");
+	REQUIRE(r.getRenderStats().encodeSeconds > 0);
+	r.setGBuffer(true);
+	r.renderScene();
+	REQUIRE(r.getRenderStats().peakFramebufferBytes == 1024 * 1024 * (sizeof(Pixel) + sizeof(SurfaceHit)));
+}
+#endif
+
+TEST_CASE("Test timeline ring buffers keep the newest events", "[Timeline]")
+{
+	Timeline timeline;
+	timeline.reset(2, 5);	// rounded up to 8 per thread
+	for (int e = 0; e < 20; e++) {
+		timeline.record(0, "a", e, e + 1);
+	}
+	timeline.record(1, "b", 0, 1, 32, 64);
+	REQUIRE(timeline.eventCount() == 8 + 1);
+	REQUIRE(timeline.droppedCount() == 12);
+
+	timeline.reset(2, 8);
+	REQUIRE(timeline.eventCount() == 0);
+	REQUIRE(timeline.droppedCount() == 0);
+}
+
+/**
+ * Number of times text occurs in s
+ */
+static int countOf(const std::string& s, const std::string& text)
+{
+	int count = 0;
+	for (size_t at = s.find(text); at != std::string::npos; at = s.find(text, at + 1)) {
+		count++;
+	}
+	return count;
+}
+
+TEST_CASE("Test timeline is written next to the png", "[RayTracer]")
+{
+	REQUIRE(RayTracer::timelineFilename("scene.png") == "scene.trace.json");
+	REQUIRE(RayTracer::timelineFilename("scene") == "scene.trace.json");
+
+	RayTracer r;
+	r.addShape(Sphere(1, Vector(0, 0, 0), Pixel{ 255, 0, 0 }, 0.2));
+	r.setThreadCount(4);
+	r.setTileSize(128);
+	r.setTimeline(true);
+	r.renderScene();
+	REQUIRE(r.saveSceneToPNG("scene_timeline.png"));
+
+	std::ifstream in("scene_timeline.trace.json");
+	REQUIRE(in);
+	std::stringstream json;
+	json << in.rdbuf();
+	in.close();
+	std::remove("scene_timeline.trace.json");
+
+	// Every 128x128 tile of the 1024x1024 image is traced and shaded once, on a named worker thread
+	REQUIRE(json.str().find("\"traceEvents\"") != std::string::npos);
+	REQUIRE(countOf(json.str(), "\"name\":\"trace\"") == 64);
+	REQUIRE(countOf(json.str(), "\"name\":\"shade\"") == 64);
+	REQUIRE(countOf(json.str(), "\"name\":\"build BVH\"") == 1);
+	REQUIRE(countOf(json.str(), "\"name\":\"encode\"") == 1);
+	REQUIRE(countOf(json.str(), "\"thread_name\"") == 4);
+
+	// Streaming render writes its own
+	REQUIRE(r.renderSceneToPNG("scene_timeline.png"));
+	std::ifstream streamed("scene_timeline.trace.json");
+	REQUIRE(streamed);
+	streamed.close();
+	std::remove("scene_timeline.trace.json");
+
+	// Nothing is written when disabled
+	r.setTimeline(false);
+	REQUIRE(r.saveSceneToPNG("scene_timeline.png"));
+	REQUIRE(!std::ifstream("scene_timeline.trace.json"));
+	std::remove("scene_timeline.png");
+}
+
+TEST_CASE("Test heatmap color scale and legend", "[Heatmap]")
+{
+	vector<double> costs = { 10, 20, 30, 40 };
+	Heatmap heatmap(costs, 2, 2, HeatmapMetric::IntersectionTests);
+	REQUIRE(heatmap.getMin() == 10);
+	REQUIRE(heatmap.getMax() == 40);
+
+	// Ends of the scale, clamped outside the range
+	Pixel cheapest = heatmap.color(10);
+	Pixel dearest = heatmap.color(40);
+	REQUIRE((cheapest.R == 0 && cheapest.G == 0 && cheapest.B == 4));
+	REQUIRE((dearest.R == 252 && dearest.G == 255 && dearest.B == 164));
+	REQUIRE(heatmap.color(0).B == cheapest.B);
+	REQUIRE(heatmap.color(100).B == dearest.B);
+
+	vector<Pixel> image = heatmap.image();
+	REQUIRE(image.size() == 2 * (2 + Heatmap::LEGEND_HEIGHT));
+	REQUIRE(image[3].R == dearest.R);
+}
+
+#if RAYTRACER_STATS
+TEST_CASE("Test heatmap of intersection tests", "[RayTracer]")
+{
+	RayTracer r;
+	for (int i = 0; i < 8; i++) {
+		r.addShape(Sphere(0.5, Vector(i - 4, 0, 0), Pixel{ 255, 0, 0 }, 0.2));
+	}
+
+	// Brute force tests every shape for every pixel
+	r.setAcceleration(Acceleration::BruteForce);
+	REQUIRE(r.renderHeatmapToPNG("scene_heatmap.png"));
+	const vector<double>& costs = r.getHeatmap();
+	REQUIRE(costs.size() == 1024 * 1024);
+	REQUIRE(*std::min_element(costs.begin(), costs.end()) == 8);
+	REQUIRE(*std::max_element(costs.begin(), costs.end()) == 8);
+
+	// The BVH tests fewer, and only near the spheres
+	r.setAcceleration(Acceleration::BVH);
+	r.setPacketSize(8);
+	REQUIRE(r.renderHeatmapToPNG("scene_heatmap.png", HeatmapMetric::IntersectionTests));
+	REQUIRE(*std::max_element(costs.begin(), costs.end()) < 8);
+	REQUIRE(costs[0] == 0);
+	REQUIRE(costs[512 * 1024 + 512] > 0);
+
+	// The image has the legend under it and the range in its text chunks
+	vector<unsigned char> png;
+	vector<unsigned char> decoded;
+	unsigned width, height;
+	lodepng::State state;
+	REQUIRE(lodepng::load_file(png, "scene_heatmap.png") == 0);
+	REQUIRE(lodepng::decode(decoded, width, height, state, png) == 0);
+	REQUIRE(width == 1024);
+	REQUIRE(height == 1024 + Heatmap::LEGEND_HEIGHT);
+	vector<std::string> keys(state.info_png.text_keys, state.info_png.text_keys + state.info_png.text_num);
+	REQUIRE(std::find(keys.begin(), keys.end(), "Min") != keys.end());
+	REQUIRE(std::find(keys.begin(), keys.end(), "Max") != keys.end());
+
+	REQUIRE(r.renderHeatmapToPNG("scene_heatmap.png", HeatmapMetric::Nanoseconds));
+	std::remove("scene_heatmap.png");
+	REQUIRE(*std::max_element(costs.begin(), costs.end()) > 0);
+}
+#else
+TEST_CASE("Test heatmap measures time without statistics", "[RayTracer]")
+{
+	RayTracer r;
+	r.addShape(Sphere(1, Vector(0, 0, 0), Pixel{ 255, 0, 0 }, 0.2));
+
+	// Intersection tests are not counted, so the default is the time taken
+	REQUIRE_FALSE(r.renderHeatmapToPNG("scene_heatmap.png", HeatmapMetric::IntersectionTests));
+	REQUIRE(r.renderHeatmapToPNG("scene_heatmap.png"));
+	REQUIRE(*std::max_element(r.getHeatmap().begin(), r.getHeatmap().end()) > 0);
+	std::remove("scene_heatmap.png");
+}
+#endif
+
+TEST_CASE("Test nearest shape is drawn whatever order shapes are added in", "[RayTracer]")
+{
+	Sphere nearSphere(1, Vector(2, 0, 0), Pixel{ 255, 0, 0 }, 0.2);
+	Sphere farSphere(2, Vector(-2, 0, 0), Pixel{ 0, 0, 255 }, 0.2);
+	Acceleration accelerations[] = { Acceleration::BruteForce, Acceleration::BVH };
+
+	for (int a = 0; a < 2; a++) {
+		RayTracer nearFirst;
+		nearFirst.setAcceleration(accelerations[a]);
+		nearFirst.addShape(nearSphere);
+		nearFirst.addShape(farSphere);
+		nearFirst.renderScene();
+
+		RayTracer farFirst;
+		farFirst.setAcceleration(accelerations[a]);
+		farFirst.addShape(farSphere);
+		farFirst.addShape(nearSphere);
+		farFirst.renderScene();
+
+		REQUIRE(samePixels(nearFirst.getPixels(), farFirst.getPixels()));
+
+		// Center of the image looks straight through both spheres: the near (red) one must win
+		const Pixel& center = nearFirst.getPixels()[512 * 1024 + 512];
+		REQUIRE(center.R > 0);
+		REQUIRE(center.B == 0);
+	}
+}
+
+TEST_CASE("Test rays generated while rendering match the precomputed view", "[RayTracer]")
+{
+	RayTracer r(Vector(2, 9, -4), Vector(6, 1, 2), Vector(0, 0, 0), vector<Sphere>(), 300, 200, 6, 4, Pixel{ 20, 20, 40 });
+	r.addShape(Sphere(2, Vector(0, 0, 0), Pixel{ 200, 100, 0 }, 0.2));
+	r.addShape(Sphere(1, Vector(-2, 2, 1), Pixel{ 0, 150, 250 }, 0.3));
+
+	r.renderScene();
+	vector<Pixel> generated = r.getPixels();
+
+	r.setPrecomputedView(true);
+	r.renderScene();
+	REQUIRE(samePixels(generated, r.getPixels()));
+
+	// Moving the camera is picked up by the next render in both modes
+	r.changeCameraLocation(Vector(-6, 1, 2));
+	r.renderScene();
+	vector<Pixel> precomputedMoved = r.getPixels();
+	r.setPrecomputedView(false);
+	r.renderScene();
+	REQUIRE(samePixels(precomputedMoved, r.getPixels()));
+	REQUIRE_FALSE(samePixels(generated, r.getPixels()));
+}
+
+TEST_CASE("Test streamed PNG decodes to the rendered image", "[RayTracer]")
+{
+	// Tall enough that the writer compresses several pieces, with a strip height that does not divide the image
+	RayTracer r(Vector(2, 9, -4), Vector(6, 1, 2), Vector(0, 0, 0), vector<Sphere>(), 700, 300, 6, 4, Pixel{ 20, 20, 40 });
+	r.addShape(Sphere(2, Vector(0, 0, 0), Pixel{ 200, 100, 0 }, 0.2));
+	r.addShape(Sphere(1, Vector(-2, 2, 1), Pixel{ 0, 150, 250 }, 0.3));
+
+	REQUIRE(r.renderSceneToPNG("scene_streamed.png", 37));
+	r.renderScene();
+
+	vector<unsigned char> decoded;
+	unsigned width = 0, height = 0;
+	REQUIRE(lodepng::decode(decoded, width, height, "scene_streamed.png") == 0);
+	std::remove("scene_streamed.png");
+	REQUIRE(width == 300);
+	REQUIRE(height == 700);
+
+	const unsigned char* rendered = r.getPixelData();
+	REQUIRE(decoded.size() == r.getPixels().size() * 4);
+	REQUIRE(std::equal(decoded.begin(), decoded.end(), rendered));
+}
+
+TEST_CASE("Test adaptive anti-aliasing only supersamples edges", "[RayTracer]")
+{
+	RayTracer r(Vector(2, 9, -4), Vector(6, 1, 2), Vector(0, 0, 0), vector<Sphere>(), 300, 400, 6, 4, Pixel{ 20, 20, 40 });
+	r.addShape(Sphere(2, Vector(0, 0, 0), Pixel{ 200, 100, 0 }, 0.2));
+	r.addShape(Sphere(1, Vector(-2, 2, 1), Pixel{ 0, 150, 250 }, 0.3));
+	r.setShadows(true);
+	r.renderScene();
+	vector<Pixel> aliased = r.getPixels();
+
+	r.setAntialiasing(4);
+	r.setThreadCount(1);
+	r.renderScene();
+	vector<Pixel> smooth = r.getPixels();
+
+	// Pixels inside flat regions keep their single ray color, and a few hundred silhouette pixels change
+	int changed = 0;
+	for (int i = 0; i < smooth.size(); i++) {
+		changed += smooth[i].R != aliased[i].R || smooth[i].G != aliased[i].G || smooth[i].B != aliased[i].B;
+	}
+	REQUIRE(changed > 100);
+	REQUIRE(changed < smooth.size() / 10);
+	REQUIRE(smooth[150 * 400 + 5].B == 40);
+
+#if RAYTRACER_STATS
+	const RenderStats& stats = r.getRenderStats();
+	REQUIRE(stats.pixels == 300 * 400);
+	REQUIRE(stats.supersampledPixels >= changed);
+	REQUIRE(stats.supersamples == 16 * stats.supersampledPixels);
+	REQUIRE(stats.samplesPerPixel() > 1);
+	REQUIRE(stats.samplesPerPixel() < 2);
+#endif
+
+	// Jitter depends only on the pixel: same image on any number of threads
+	r.setThreadCount(4);
+	r.renderScene();
+	REQUIRE(samePixels(smooth, r.getPixels()));
+
+	// Streamed strips see the rows above and below them
+	REQUIRE(r.renderSceneToPNG("scene_antialiased.png", 37));
+	vector<unsigned char> decoded;
+	unsigned width, height;
+	REQUIRE(lodepng::decode(decoded, width, height, "scene_antialiased.png") == 0);
+	std::remove("scene_antialiased.png");
+	REQUIRE(std::equal(decoded.begin(), decoded.end(), reinterpret_cast<const unsigned char*>(smooth.data())));
+
+	// Relighting from the G-buffer supersamples the new edges too
+	r.setGBuffer(true);
+	r.renderScene();
+	r.changeLightLocation(Vector(6, 0, 8));
+	r.renderScene();
+	RayTracer fresh(Vector(6, 0, 8), Vector(6, 1, 2), Vector(0, 0, 0), vector<Sphere>(), 300, 400, 6, 4, Pixel{ 20, 20, 40 });
+	fresh.addShape(Sphere(2, Vector(0, 0, 0), Pixel{ 200, 100, 0 }, 0.2));
+	fresh.addShape(Sphere(1, Vector(-2, 2, 1), Pixel{ 0, 150, 250 }, 0.3));
+	fresh.setShadows(true);
+	fresh.setAntialiasing(4);
+	fresh.renderScene();
+	REQUIRE(samePixels(fresh.getPixels(), r.getPixels()));
+}
+
+TEST_CASE("Test progressive render refines to the full render", "[RayTracer]")
+{
+	RayTracer r(Vector(2, 9, -4), Vector(6, 1, 2), Vector(0, 0, 0), vector<Sphere>(), 300, 400, 6, 4, Pixel{ 20, 20, 40 });
+	r.addShape(Sphere(2, Vector(0, 0, 0), Pixel{ 200, 100, 0 }, 0.2));
+	r.addShape(Sphere(1, Vector(-2, 2, 1), Pixel{ 0, 150, 250 }, 0.3));
+	r.setShadows(true);
+	r.setThreadCount(4);
+	r.renderScene();
+	vector<Pixel> full = r.getPixels();
+
+	vector<int> spacings;
+	vector<Pixel> first;
+	REQUIRE(r.renderProgressive([&](const vector<Pixel>& pixels, int spacing) {
+		if (spacings.empty()) {
+			first = pixels;
+		}
+		spacings.push_back(spacing);
+		return true;
+	}));
+	REQUIRE(spacings == vector<int>({ 16, 8, 4, 2, 1 }));
+	REQUIRE(samePixels(full, r.getPixels()));
+#if RAYTRACER_STATS
+	// Later passes reuse the samples of earlier ones: every pixel is traced once
+	REQUIRE(r.getRenderStats().primaryRays == 300 * 400);
+#endif
+
+	// The first pass is exact on its samples and fills the blocks between them
+	for (int y = 0; y < 300; y += 16) {
+		for (int x = 0; x < 400; x += 16) {
+			const Pixel& sample = first[y * 400 + x];
+			REQUIRE(sample.R == full[y * 400 + x].R);
+			REQUIRE(sample.B == full[y * 400 + x].B);
+			const Pixel& filled = first[std::min(y + 15, 299) * 400 + std::min(x + 15, 399)];
+			REQUIRE((filled.R == sample.R && filled.G == sample.G && filled.B == sample.B));
+		}
+	}
+
+	// Also with screen bins, anti-aliasing and a spacing that is not a power of two
+	r.setAcceleration(Acceleration::ScreenBins);
+	r.setAntialiasing(2);
+	r.renderScene();
+	full = r.getPixels();
+	spacings.clear();
+	REQUIRE(r.renderProgressive([&](const vector<Pixel>&, int spacing) {
+		spacings.push_back(spacing);
+		return true;
+	}, 6));
+	REQUIRE(spacings == vector<int>({ 4, 2, 1 }));
+	REQUIRE(samePixels(full, r.getPixels()));
+}
+
+TEST_CASE("Test progressive render can be cancelled", "[RayTracer]")
+{
+	RayTracer r;
+	r.addShape(Sphere(1, Vector(0, 0, 0), Pixel{ 255, 0, 0 }, 0.2));
+
+	// By the callback
+	int passes = 0;
+	REQUIRE_FALSE(r.renderProgressive([&](const vector<Pixel>&, int) {
+		return ++passes < 2;
+	}));
+	REQUIRE(passes == 2);
+
+	// By cancelRender while a pass runs (here from the callback, the pass after it stops)
+	passes = 0;
+	REQUIRE_FALSE(r.renderProgressive([&](const vector<Pixel>&, int) {
+		passes++;
+		r.cancelRender();
+		return true;
+	}));
+	REQUIRE(passes == 1);
+
+	// By cancelRender from another thread, somewhere in a pass: the traced part of that pass is undone, leaving the
+	// image the last finished pass gave the callback (the render may also finish first)
+	vector<Pixel> lastPass;
+	std::atomic<int> finished(0);
+	std::thread canceller([&]() {
+		while (finished == 0)
+			std::this_thread::yield();
+		std::this_thread::sleep_for(std::chrono::milliseconds(2));
+		r.cancelRender();
+	});
+	r.renderProgressive([&](const vector<Pixel>& pixels, int) {
+		lastPass = pixels;
+		finished++;
+		return true;
+	});
+	canceller.join();
+	REQUIRE(samePixels(lastPass, r.getPixels()));
+
+	// Before the render starts: it stops before the first pass, leaving a blank image
+	r.cancelRender();
+	passes = 0;
+	REQUIRE_FALSE(r.renderProgressive([&](const vector<Pixel>&, int) { return ++passes > 0; }));
+	REQUIRE(passes == 0);
+	REQUIRE(samePixels(vector<Pixel>(r.getPixels().size(), Pixel()), r.getPixels()));
+
+	// A cancelled render does not stop the next one
+	REQUIRE(r.renderProgressive([](const vector<Pixel>&, int) { return true; }));
+}
+
+TEST_CASE("Test parallel PNG export decodes to the rendered image", "[RayTracer]")
+{
+	RayTracer r(Vector(2, 9, -4), Vector(6, 1, 2), Vector(0, 0, 0), vector<Sphere>(), 700, 300, 6, 4, Pixel{ 20, 20, 40 });
+	r.addShape(Sphere(2, Vector(0, 0, 0), Pixel{ 200, 100, 0 }, 0.2));
+	r.addShape(Sphere(1, Vector(-2, 2, 1), Pixel{ 0, 150, 250 }, 0.3));
+	r.renderScene();
+
+	int levels[] = { 0, 1, 6, 9 };
+	for (int level : levels) {
+		r.setCompressionLevel(level);
+		vector<unsigned char> files[2];
+		int threads[] = { 1, 4 };
+		for (int i = 0; i < 2; i++) {
+			r.setThreadCount(threads[i]);
+			REQUIRE(r.saveSceneToPNG("scene_parallel.png"));
+			REQUIRE(lodepng::load_file(files[i], "scene_parallel.png") == 0);
+		}
+		std::remove("scene_parallel.png");
+		// Pieces do not depend on the thread count, so neither does the file
+		REQUIRE(files[0] == files[1]);
+
+		vector<unsigned char> decoded;
+		unsigned width = 0, height = 0;
+		REQUIRE(lodepng::decode(decoded, width, height, files[0]) == 0);
+		REQUIRE(width == 300);
+		REQUIRE(height == 700);
+		REQUIRE(decoded.size() == r.getPixels().size() * 4);
+		REQUIRE(std::equal(decoded.begin(), decoded.end(), r.getPixelData()));
+	}
+}
+
+TEST_CASE("Test relighting from the G-buffer matches a full render", "[RayTracer]")
+{
+	vector<Sphere> spheres;
+	spheres.push_back(Sphere(2, Vector(0, 0, 0), Pixel{ 200, 100, 0 }, 0.2));
+	spheres.push_back(Sphere(1, Vector(-2, 2, 1), Pixel{ 0, 150, 250 }, 0.3));
+	RayTracer cached(Vector(2, 9, -4), Vector(6, 1, 2), Vector(0, 0, 0), spheres, 300, 200, 6, 4, Pixel{ 20, 20, 40 });
+	cached.setGBuffer(true);
+	cached.renderScene();
+
+	// Light moves: shaded again from the cache
+	cached.changeLightLocation(Vector(-5, 3, 8));
+	cached.renderScene();
+	RayTracer fresh(Vector(-5, 3, 8), Vector(6, 1, 2), Vector(0, 0, 0), spheres, 300, 200, 6, 4, Pixel{ 20, 20, 40 });
+	fresh.renderScene();
+	REQUIRE(samePixels(cached.getPixels(), fresh.getPixels()));
+
+	// Camera moves and a shape is added: the cache must not be used
+	cached.changeCameraLocation(Vector(-6, 1, 2));
+	cached.renderScene();
+	fresh.changeCameraLocation(Vector(-6, 1, 2));
+	fresh.renderScene();
+	REQUIRE(samePixels(cached.getPixels(), fresh.getPixels()));
+
+	cached.addShape(Sphere(1, Vector(-4, 0, 0), Pixel{ 50, 250, 50 }, 0.1));
+	cached.renderScene();
+	fresh.addShape(Sphere(1, Vector(-4, 0, 0), Pixel{ 50, 250, 50 }, 0.1));
+	fresh.renderScene();
+	REQUIRE(samePixels(cached.getPixels(), fresh.getPixels()));
+}
+
 /*
 TEST_CASE( "Test parameterized constructor", "[RayTracer]" ) {
   Vector light(-5,5,5), camera(0,0,5), target(0,0,0);
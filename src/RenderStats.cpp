@@ -0,0 +1,60 @@
+#include "RenderStats.hpp"
+
+/** Sum counters and thread times, the wall clock times are left alone
+*/
+void RenderStats::add(const RenderStats& other)
+{
+	primaryRays += other.primaryRays;
+	primaryHits += other.primaryHits;
+	shadowRays += other.shadowRays;
+	intersectionTests += other.intersectionTests;
+	supersampledPixels += other.supersampledPixels;
+	supersamples += other.supersamples;
+	traceSeconds += other.traceSeconds;
+	shadeSeconds += other.shadeSeconds;
+	shadowSeconds += other.shadowSeconds;
+}
+
+/** Primary ray throughput
+*/
+double RenderStats::primaryRaysPerSecond() const
+{
+	return traceSeconds > 0 ? primaryRays / traceSeconds : 0;
+}
+
+/** Shadow ray throughput
+*/
+double RenderStats::shadowRaysPerSecond() const
+{
+	return shadowSeconds > 0 ? shadowRays / shadowSeconds : 0;
+}
+
+/** Samples that went into the image over pixels
+*/
+double RenderStats::samplesPerPixel() const
+{
+	return pixels > 0 ? double(pixels - supersampledPixels + supersamples) / pixels : 0;
+}
+
+/** Hits over primary rays
+*/
+double RenderStats::hitRatio() const
+{
+	return primaryRays > 0 ? double(primaryHits) / primaryRays : 0;
+}
+
+/** Counters, then phase times, then thread times
+*/
+void RenderStats::print(std::ostream& out) const
+{
+	out << "primary rays: " << primaryRays << " (hit ratio " << hitRatio() << ")" << std::endl;
+	out << "shadow rays: " << shadowRays << std::endl;
+	out << "samples per pixel: " << samplesPerPixel() << " (" << supersampledPixels << " pixels supersampled)" << std::endl;
+	out << "intersection tests: " << intersectionTests << std::endl;
+	out << "bvh: " << bvhBuilds << " builds, " << bvhRefits << " refits" << std::endl;
+	out << "peak framebuffer memory: " << peakFramebufferBytes / (1024.0 * 1024.0) << " MB" << std::endl;
+	out << "wall time: " << seconds << " s (view " << viewSeconds << " s, build " << buildSeconds << " s, trace and shade "
+		<< colorSeconds << " s, encode " << encodeSeconds << " s)" << std::endl;
+	out << "thread time: trace " << traceSeconds << " s, shade " << shadeSeconds << " s (shadow rays " << shadowSeconds
+		<< " s)" << std::endl;
+}
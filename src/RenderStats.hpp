@@ -0,0 +1,124 @@
+#ifndef _RENDERSTATS_HPP_
+#define _RENDERSTATS_HPP_
+
+#include <chrono>
+#include <cstddef>
+#include <iostream>
+#include <vector>
+
+#include "AlignedAllocator.hpp"
+
+// Counting and timing of renders can be compiled out by defining RAYTRACER_STATS as 0 (CMake option
+// -DRAYTRACER_STATS=OFF): the statistics then stay zero and the hot loops carry no instrumentation at all
+#ifndef RAYTRACER_STATS
+#define RAYTRACER_STATS 1
+#endif
+
+#if RAYTRACER_STATS
+#define RENDER_STATS(statement) statement
+#else
+#define RENDER_STATS(statement)
+#endif
+
+/**
+ * Counters and timings of one render. Phase times are wall clock times of the calling thread; trace, shade and
+ * shadow times are spent inside the worker threads and summed over all threads (thread seconds), so they can exceed
+ * the wall clock time when several threads are used
+ * Each worker thread counts into its own RenderStats (cache line aligned, so threads never share a line) and the
+ * render adds them up once at the end - no atomics on the hot path
+ */
+struct alignas(64) RenderStats
+{
+	// Counters
+	long long primaryRays{ 0 };	// Rays traced from the camera
+	long long primaryHits{ 0 };	// Primary rays that hit a shape
+	long long shadowRays{ 0 };	// Any-hit rays traced from a surface towards the light
+	long long intersectionTests{ 0 };	// Ray-sphere tests handed to the intersection kernels (an any-hit kernel may stop early)
+	long long pixels{ 0 };	// Pixels in the image
+	long long supersampledPixels{ 0 };	// Edge pixels colored from sub-pixel rays by adaptive anti-aliasing
+	long long supersamples{ 0 };	// Sub-pixel rays traced for them (also counted in primaryRays)
+	long long bvhBuilds{ 0 };	// Full BVH builds made for the render
+	long long bvhRefits{ 0 };	// BVH refits made for the render instead (a build follows one that spoilt the tree)
+
+	// Wall clock phase times
+	double seconds{ 0 };	// Whole render
+	double viewSeconds{ 0 };	// Generating the camera basis (and precomputed view)
+	double buildSeconds{ 0 };	// Building the acceleration structure and screen bins
+	double colorSeconds{ 0 };	// Tracing and shading every tile on the worker threads
+	double encodeSeconds{ 0 };	// Compressing and writing the PNG (saveSceneToPNG after renderScene, or renderSceneToPNG)
+
+	// Thread times
+	double traceSeconds{ 0 };	// Thread time finding the nearest hit of primary rays
+	double shadeSeconds{ 0 };	// Thread time shading hits, including their shadow rays
+	double shadowSeconds{ 0 };	// Thread time in shadow ray queries alone
+
+	std::size_t peakFramebufferBytes{ 0 };	// Largest memory held at once by the image, G-buffer and stored view
+
+	/**
+	 * Add the counters and thread times of other (used to merge the statistics of each worker thread)
+	 */
+	void add(const RenderStats& other);
+
+	/**
+	 * @return primary rays per thread second (0 if none were traced)
+	 */
+	double primaryRaysPerSecond() const;
+
+	/**
+	 * @return shadow rays per thread second spent in shadow queries (0 if none were traced)
+	 */
+	double shadowRaysPerSecond() const;
+
+	/**
+	 * @return effective samples per pixel: one for every pixel, except that supersampled pixels count their sub-pixel
+	 * rays instead (0 for no pixels)
+	 */
+	double samplesPerPixel() const;
+
+	/**
+	 * @return fraction of primary rays that hit a shape (0 if none were traced)
+	 */
+	double hitRatio() const;
+
+	/**
+	 * Write every statistic on out, one per line
+	 */
+	void print(std::ostream& out) const;
+};
+
+/**
+ * One RenderStats per worker thread
+ */
+typedef std::vector<RenderStats, AlignedAllocator<RenderStats, 64> > WorkerStats;
+
+/**
+ * Stopwatch for RenderStats times (empty when statistics are compiled out)
+ */
+class StatsClock
+{
+public:
+#if RAYTRACER_STATS
+	StatsClock() : start(std::chrono::steady_clock::now()) {}
+
+	/**
+	 * @return seconds since the clock was made or last lapped, restarting it
+	 */
+	double lap()
+	{
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		std::chrono::duration<double> elapsed = now - start;
+		start = now;
+		return elapsed.count();
+	}
+
+private:
+	std::chrono::steady_clock::time_point start;
+#else
+	double lap()
+	{
+		return 0;
+	}
+#endif
+};
+
+#endif
@@ -6,31 +6,36 @@ using std::vector;
 
 /** Create default sphere (red, with radius 1, and position 0)
 */
-Sphere::Sphere() : rad(1), pos(Vector(0, 0, 0)), col(Pixel{ 255, 0, 0, 255 }), amb(0.2)
+template <typename Real>
+BasicSphere<Real>::BasicSphere() : rad(1), pos(BasicVector<Real>(0, 0, 0)), col(Pixel{ 255, 0, 0, 255 }), amb(0.2)
 {}
 
 /** Constructor to create any type of sphere
 */
-Sphere::Sphere(double rad, Vector pos, Pixel col, double amb) : rad(rad), pos(pos), col(col), amb(amb)
+template <typename Real>
+BasicSphere<Real>::BasicSphere(Real rad, BasicVector<Real> pos, Pixel col, Real amb) : rad(rad), pos(pos), col(col), amb(amb)
 {}
 
 /** Getter: Return color vector/array of sphere
 */
-Pixel Sphere::color() const
+template <typename Real>
+Pixel BasicSphere<Real>::color() const
 {
 	return col;
 }
 
 /**	Getter: Return sphere position
 */
-Vector Sphere::position() const
+template <typename Real>
+BasicVector<Real> BasicSphere<Real>::position() const
 {
 	return pos;
 }
 
 /** Getter: Return sphere ambient color (darkest possible color)
 */
-double Sphere::ambient() const
+template <typename Real>
+Real BasicSphere<Real>::ambient() const
 {
 	return amb;
 }
@@ -38,49 +43,58 @@ double Sphere::ambient() const
 /**
 * Intersect method determines if a ray (d) intersects with the sphere using 3D vector arithmetic
 */
-Vector Sphere::intersect(const Vector& s, const Vector& d) const
+template <typename Real>
+BasicIntersection<Real> BasicSphere<Real>::intersect(const BasicVector<Real>& s, const BasicVector<Real>& d, Real tMax) const
 {
+	BasicIntersection<Real> result;
+
 	// v = S - C = position of camera - center of sphere
-	Vector v = s - pos;
+	BasicVector<Real> v = s - pos;
 
 	// ((v dot d)^2 - ((norm v)^2 - r^2))
-	double determineIntersect = pow(v * d, 2) - (pow(v.norm(), 2) - pow(rad, 2));
+	Real vd = v * d;
+	Real determineIntersect = vd * vd - (v * v - rad * rad);
 
 	// Determine if intersects: ((v dot d)^2 - ((norm v)^2 - r^2)) > 0
-	// Intersection occurs
-	if (determineIntersect > 0) {
-		// Find intersection point
-		// t = -(v dot d) +- sqrt((v dot d)^2 - (
-		double intersectLength = -(v * d) - sqrt((pow(v * d, 2)) - (pow(v.norm(), 2) - pow(rad, 2)));
-
-		// Intersection point at y = S + t*d
-		// scalar multiplication
-		Vector rayScale = d.scalarMult(intersectLength);
-		Vector intersection = s + rayScale;
-
-		return intersection;
+	if (determineIntersect <= 0) {
+		return result;
+	}
+
+	// t = -(v dot d) +- sqrt((v dot d)^2 - ((norm v)^2 - r^2)), nearest root first
+	Real root = sqrt(determineIntersect);
+	Real t = -vd - root;
+	if (t <= 0) {
+		// Ray starts inside the sphere (or the sphere is behind it): only the far root can be in front
+		t = -vd + root;
 	}
 
-	// If no intersection occurs
-	return Vector(INFINITY, INFINITY, INFINITY);
+	// Intersection point at y = S + t*d, must be in front of S and closer than anything found before
+	if (t > 0 && t < tMax) {
+		result.hit = true;
+		result.t = t;
+	}
 
+	return result;
 }
 
 /** Determine vector normal to Sphere surface at a point on the Sphere
 */
-Vector Sphere::normal(const Vector& pos) const
+template <typename Real>
+BasicVector<Real> BasicSphere<Real>::normal(const BasicVector<Real>& pos) const
 {
 	// n = (y - C) / norm(y - C)
-	Vector normalVector = pos - this->pos;
-	double nNormRecip = 1 / normalVector.norm();
-	Vector n(normalVector.getI() * nNormRecip, normalVector.getJ() * nNormRecip, normalVector.getK() * nNormRecip);
-
-	return n;
+	BasicVector<Real> normalVector = pos - this->pos;
+	return normalVector.normalized();
 }
 
 /** Getter: Return sphere radius
 */
-double Sphere::radius() const
+template <typename Real>
+Real BasicSphere<Real>::radius() const
 {
 	return rad;
-}
\ No newline at end of file
+}
+
+// The precisions the ray tracer is built with
+template class BasicSphere<double>;
+template class BasicSphere<float>;
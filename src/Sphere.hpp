@@ -2,24 +2,51 @@
 #define SPHERE_HPP
 
 #include <vector>
+#include <math.h>
 
 #include "Vector.hpp"
 #include "Pixel.hpp"
 
-class Sphere
+/**
+ * Result of a ray/shape intersection test: when hit is true the ray with origin s and unit direction d meets the
+ * shape at s + t * d
+ */
+template <typename Real>
+struct BasicIntersection
+{
+  bool hit{ false };
+  Real t{ INFINITY };
+};
+
+typedef BasicIntersection<double> Intersection;
+
+/**
+ * Sphere templated on the scalar type Real of its geometry: use Sphere (double) or SphereF (float). Both are compiled
+ * in Sphere.cpp
+ */
+template <typename Real>
+class BasicSphere
 {
 public:
   /** 
    * default constructor: creates a purely red sphere with radius one at position (0,0,0) and with ambience of 0.2
    * @return sets data fields appropriately
    */
-  Sphere();
+  BasicSphere();
   
   /** 
    * parameterized constructor: creates a sphere with user supplied color at given position with specified radius
    * @return sets data fields appropriately
    */
-  Sphere(double rad, Vector pos, Pixel col, double amb);
+  BasicSphere(Real rad, BasicVector<Real> pos, Pixel col, Real amb);
+
+  /**
+   * converting constructor: the same sphere with its geometry rounded to the nearest Real
+   */
+  template <typename Other>
+  explicit BasicSphere(const BasicSphere<Other>& other) :
+    rad(Real(other.radius())), pos(other.position()), col(other.color()), amb(Real(other.ambient()))
+  {}
 
   /** 
    * The color of the sphere
@@ -31,38 +58,42 @@ public:
    * The position of the sphere
    * @return position of sphere (center) w/r/t Vector(0,0,0)
    */
-  Vector position() const;
+  BasicVector<Real> position() const;
 
   /** 
    * The ambient of the sphere
    * @return ambience of sphere on the interval [0,1]
    */
-  double ambient() const;
+  Real ambient() const;
 
   /**
-   * calculates the intersection point, if one exists, between the sphere surface and the ray originating from position s with direction d (a unit vector)
-   * @return position (as Vector w/r/t (0,0,0)) of where ray with origin s and unit direction d intersects with sphere, (inf,inf,inf) for no intersection
+   * calculates the nearest intersection, if one exists, between the sphere surface and the ray originating from position s with direction d (a unit vector)
+   * only intersections in front of s and closer than tMax count, so callers can pass the distance of the nearest hit found so far
+   * @return hit = false for no intersection, otherwise t such that s + t * d is the intersection point (0 < t < tMax)
    */
-  Vector intersect(const Vector& s, const Vector& d) const;
+  BasicIntersection<Real> intersect(const BasicVector<Real>& s, const BasicVector<Real>& d, Real tMax = INFINITY) const;
   
   /**
    * determines the unit normal vector on the surface of the sphere at the position given by the vector pos (w/r/t (0,0,0))
    * @return unit normal vector for the surface of the sphere at a user-specified position on the surface
    */
-  Vector normal(const Vector& pos) const;
+  BasicVector<Real> normal(const BasicVector<Real>& pos) const;
 
   /** 
    * This shape (but not all shapes) has a radius, so we add a new member function to allow the user to query it
    * @return the radius of the sphere
    */
-  double radius() const;
+  Real radius() const;
 
 private:
 
-  double rad;  //radius of sphere
-  Vector pos;  //position of sphere (center) w/r/t (0,0,0)
+  Real rad;  //radius of sphere
+  BasicVector<Real> pos;  //position of sphere (center) w/r/t (0,0,0)
   Pixel col; //color of sphere: struct data is rgba with rgb in the interval [0,255] and a = 255;
-  double amb; //ambience of sphere on the interval [0,1] 
+  Real amb; //ambience of sphere on the interval [0,1] 
 };
 
+typedef BasicSphere<double> Sphere;
+typedef BasicSphere<float> SphereF;
+
 #endif
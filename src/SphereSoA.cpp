@@ -0,0 +1,791 @@
+#include "SphereSoA.hpp"
+
+#include <cmath>
+#include <limits>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define SPHERESOA_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// GCC and Clang only emit AVX instructions in functions marked for them, MSVC emits whatever intrinsics are used
+#if defined(__GNUC__)
+#define SPHERESOA_TARGET(isa) __attribute__((target(isa)))
+#else
+#define SPHERESOA_TARGET(isa)
+#endif
+
+using std::vector;
+
+/**
+* Every kernel below computes, per sphere, exactly the same sequence of operations as BasicSphere<Real>::intersect, in the same precision:
+*	v = s - c, vd = v.d, disc = vd*vd - (v.v - r*r), t = -vd - sqrt(disc), or -vd + sqrt(disc) if that is not in front
+* and keeps a hit only if 0 < t < (nearest t so far), visiting spheres in store order. This makes every kernel return
+* the same sphere and bit-identical t as the scalar loop. Floating point contraction (FMA) must stay off for this file
+* The any-hit kernels make the same test against a fixed limit and stop at the first sphere that passes it
+*/
+namespace
+{
+	template <typename Real>
+	int closestHitScalar(const Real* x, const Real* y, const Real* z, const Real* radiusSquared,
+		const Real s[3], const Real d[3], int first, int count, Real& t)
+	{
+		int hit = -1;
+		for (int i = first; i < first + count; i++) {
+			Real vx = s[0] - x[i];
+			Real vy = s[1] - y[i];
+			Real vz = s[2] - z[i];
+			Real vd = vx * d[0] + vy * d[1] + vz * d[2];
+			Real determineIntersect = vd * vd - ((vx * vx + vy * vy + vz * vz) - radiusSquared[i]);
+			if (determineIntersect <= 0) {
+				continue;
+			}
+			Real root = std::sqrt(determineIntersect);
+			Real ti = -vd - root;
+			if (ti <= 0) {
+				ti = -vd + root;
+			}
+			if (ti > 0 && ti < t) {
+				t = ti;
+				hit = i;
+			}
+		}
+		return hit;
+	}
+
+	template <typename Real>
+	bool anyHitScalar(const Real* x, const Real* y, const Real* z, const Real* radiusSquared,
+		const Real s[3], const Real d[3], int first, int count, Real tMax)
+	{
+		for (int i = first; i < first + count; i++) {
+			Real vx = s[0] - x[i];
+			Real vy = s[1] - y[i];
+			Real vz = s[2] - z[i];
+			Real vd = vx * d[0] + vy * d[1] + vz * d[2];
+			Real determineIntersect = vd * vd - ((vx * vx + vy * vy + vz * vz) - radiusSquared[i]);
+			if (determineIntersect <= 0) {
+				continue;
+			}
+			Real root = std::sqrt(determineIntersect);
+			Real ti = -vd - root;
+			if (ti <= 0) {
+				ti = -vd + root;
+			}
+			if (ti > 0 && ti < tMax) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	/** Lanes of a batch starting at i that are inside the range ending at end
+	*/
+	inline unsigned int laneMask(int i, int end, int lanes)
+	{
+		return end - i < lanes ? (1u << (end - i)) - 1 : (1u << lanes) - 1;
+	}
+
+	/** Resolve a batch of candidate lanes in order, exactly like the scalar loop would
+	*/
+	template <typename Real>
+	inline void keepNearest(const Real* candidates, unsigned int mask, int lanes, int base, int& hit, Real& t)
+	{
+		for (int lane = 0; lane < lanes; lane++) {
+			if ((mask >> lane) & 1u && candidates[lane] < t) {
+				t = candidates[lane];
+				hit = base + lane;
+			}
+		}
+	}
+
+#ifdef SPHERESOA_X86
+	SPHERESOA_TARGET("sse2")
+	int closestHitSSE2(const double* x, const double* y, const double* z, const double* radiusSquared,
+		const double s[3], const double d[3], int first, int count, double& t)
+	{
+		const __m128d zero = _mm_setzero_pd();
+		const __m128d sx = _mm_set1_pd(s[0]), sy = _mm_set1_pd(s[1]), sz = _mm_set1_pd(s[2]);
+		const __m128d dx = _mm_set1_pd(d[0]), dy = _mm_set1_pd(d[1]), dz = _mm_set1_pd(d[2]);
+
+		int hit = -1;
+		int end = first + count;
+		for (int i = first; i < end; i += 2) {
+			__m128d vx = _mm_sub_pd(sx, _mm_loadu_pd(x + i));
+			__m128d vy = _mm_sub_pd(sy, _mm_loadu_pd(y + i));
+			__m128d vz = _mm_sub_pd(sz, _mm_loadu_pd(z + i));
+			__m128d vd = _mm_add_pd(_mm_add_pd(_mm_mul_pd(vx, dx), _mm_mul_pd(vy, dy)), _mm_mul_pd(vz, dz));
+			__m128d vv = _mm_add_pd(_mm_add_pd(_mm_mul_pd(vx, vx), _mm_mul_pd(vy, vy)), _mm_mul_pd(vz, vz));
+			__m128d disc = _mm_sub_pd(_mm_mul_pd(vd, vd), _mm_sub_pd(vv, _mm_loadu_pd(radiusSquared + i)));
+			__m128d intersects = _mm_cmpgt_pd(disc, zero);
+			if (_mm_movemask_pd(intersects) == 0) {
+				continue;
+			}
+
+			__m128d root = _mm_sqrt_pd(disc);
+			__m128d minusVd = _mm_sub_pd(zero, vd);
+			__m128d tNear = _mm_sub_pd(minusVd, root);
+			__m128d tFar = _mm_add_pd(minusVd, root);
+			__m128d nearInFront = _mm_cmpgt_pd(tNear, zero);
+			__m128d ti = _mm_or_pd(_mm_and_pd(nearInFront, tNear), _mm_andnot_pd(nearInFront, tFar));
+			__m128d valid = _mm_and_pd(intersects, _mm_and_pd(_mm_cmpgt_pd(ti, zero), _mm_cmplt_pd(ti, _mm_set1_pd(t))));
+
+			unsigned int mask = _mm_movemask_pd(valid);
+			if (mask != 0) {
+				double candidates[2];
+				_mm_storeu_pd(candidates, ti);
+				keepNearest(candidates, mask, end - i < 2 ? end - i : 2, i, hit, t);
+			}
+		}
+		return hit;
+	}
+
+	SPHERESOA_TARGET("sse2")
+	bool anyHitSSE2(const double* x, const double* y, const double* z, const double* radiusSquared,
+		const double s[3], const double d[3], int first, int count, double tMax)
+	{
+		const __m128d zero = _mm_setzero_pd();
+		const __m128d limit = _mm_set1_pd(tMax);
+		const __m128d sx = _mm_set1_pd(s[0]), sy = _mm_set1_pd(s[1]), sz = _mm_set1_pd(s[2]);
+		const __m128d dx = _mm_set1_pd(d[0]), dy = _mm_set1_pd(d[1]), dz = _mm_set1_pd(d[2]);
+
+		int end = first + count;
+		for (int i = first; i < end; i += 2) {
+			__m128d vx = _mm_sub_pd(sx, _mm_loadu_pd(x + i));
+			__m128d vy = _mm_sub_pd(sy, _mm_loadu_pd(y + i));
+			__m128d vz = _mm_sub_pd(sz, _mm_loadu_pd(z + i));
+			__m128d vd = _mm_add_pd(_mm_add_pd(_mm_mul_pd(vx, dx), _mm_mul_pd(vy, dy)), _mm_mul_pd(vz, dz));
+			__m128d vv = _mm_add_pd(_mm_add_pd(_mm_mul_pd(vx, vx), _mm_mul_pd(vy, vy)), _mm_mul_pd(vz, vz));
+			__m128d disc = _mm_sub_pd(_mm_mul_pd(vd, vd), _mm_sub_pd(vv, _mm_loadu_pd(radiusSquared + i)));
+			__m128d intersects = _mm_cmpgt_pd(disc, zero);
+			if (_mm_movemask_pd(intersects) == 0) {
+				continue;
+			}
+
+			__m128d root = _mm_sqrt_pd(disc);
+			__m128d minusVd = _mm_sub_pd(zero, vd);
+			__m128d tNear = _mm_sub_pd(minusVd, root);
+			__m128d tFar = _mm_add_pd(minusVd, root);
+			__m128d nearInFront = _mm_cmpgt_pd(tNear, zero);
+			__m128d ti = _mm_or_pd(_mm_and_pd(nearInFront, tNear), _mm_andnot_pd(nearInFront, tFar));
+			__m128d valid = _mm_and_pd(intersects, _mm_and_pd(_mm_cmpgt_pd(ti, zero), _mm_cmplt_pd(ti, limit)));
+			if (_mm_movemask_pd(valid) & laneMask(i, end, 2)) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	SPHERESOA_TARGET("avx2")
+	int closestHitAVX2(const double* x, const double* y, const double* z, const double* radiusSquared,
+		const double s[3], const double d[3], int first, int count, double& t)
+	{
+		const __m256d zero = _mm256_setzero_pd();
+		const __m256d sx = _mm256_set1_pd(s[0]), sy = _mm256_set1_pd(s[1]), sz = _mm256_set1_pd(s[2]);
+		const __m256d dx = _mm256_set1_pd(d[0]), dy = _mm256_set1_pd(d[1]), dz = _mm256_set1_pd(d[2]);
+
+		int hit = -1;
+		int end = first + count;
+		for (int i = first; i < end; i += 4) {
+			__m256d vx = _mm256_sub_pd(sx, _mm256_loadu_pd(x + i));
+			__m256d vy = _mm256_sub_pd(sy, _mm256_loadu_pd(y + i));
+			__m256d vz = _mm256_sub_pd(sz, _mm256_loadu_pd(z + i));
+			__m256d vd = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(vx, dx), _mm256_mul_pd(vy, dy)), _mm256_mul_pd(vz, dz));
+			__m256d vv = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(vx, vx), _mm256_mul_pd(vy, vy)), _mm256_mul_pd(vz, vz));
+			__m256d disc = _mm256_sub_pd(_mm256_mul_pd(vd, vd), _mm256_sub_pd(vv, _mm256_loadu_pd(radiusSquared + i)));
+			__m256d intersects = _mm256_cmp_pd(disc, zero, _CMP_GT_OQ);
+			if (_mm256_movemask_pd(intersects) == 0) {
+				continue;
+			}
+
+			__m256d root = _mm256_sqrt_pd(disc);
+			__m256d minusVd = _mm256_sub_pd(zero, vd);
+			__m256d tNear = _mm256_sub_pd(minusVd, root);
+			__m256d tFar = _mm256_add_pd(minusVd, root);
+			__m256d ti = _mm256_blendv_pd(tFar, tNear, _mm256_cmp_pd(tNear, zero, _CMP_GT_OQ));
+			__m256d valid = _mm256_and_pd(intersects,
+				_mm256_and_pd(_mm256_cmp_pd(ti, zero, _CMP_GT_OQ), _mm256_cmp_pd(ti, _mm256_set1_pd(t), _CMP_LT_OQ)));
+
+			unsigned int mask = _mm256_movemask_pd(valid);
+			if (mask != 0) {
+				double candidates[4];
+				_mm256_storeu_pd(candidates, ti);
+				keepNearest(candidates, mask, end - i < 4 ? end - i : 4, i, hit, t);
+			}
+		}
+		return hit;
+	}
+
+	SPHERESOA_TARGET("avx2")
+	bool anyHitAVX2(const double* x, const double* y, const double* z, const double* radiusSquared,
+		const double s[3], const double d[3], int first, int count, double tMax)
+	{
+		const __m256d zero = _mm256_setzero_pd();
+		const __m256d limit = _mm256_set1_pd(tMax);
+		const __m256d sx = _mm256_set1_pd(s[0]), sy = _mm256_set1_pd(s[1]), sz = _mm256_set1_pd(s[2]);
+		const __m256d dx = _mm256_set1_pd(d[0]), dy = _mm256_set1_pd(d[1]), dz = _mm256_set1_pd(d[2]);
+
+		int end = first + count;
+		for (int i = first; i < end; i += 4) {
+			__m256d vx = _mm256_sub_pd(sx, _mm256_loadu_pd(x + i));
+			__m256d vy = _mm256_sub_pd(sy, _mm256_loadu_pd(y + i));
+			__m256d vz = _mm256_sub_pd(sz, _mm256_loadu_pd(z + i));
+			__m256d vd = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(vx, dx), _mm256_mul_pd(vy, dy)), _mm256_mul_pd(vz, dz));
+			__m256d vv = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(vx, vx), _mm256_mul_pd(vy, vy)), _mm256_mul_pd(vz, vz));
+			__m256d disc = _mm256_sub_pd(_mm256_mul_pd(vd, vd), _mm256_sub_pd(vv, _mm256_loadu_pd(radiusSquared + i)));
+			__m256d intersects = _mm256_cmp_pd(disc, zero, _CMP_GT_OQ);
+			if (_mm256_movemask_pd(intersects) == 0) {
+				continue;
+			}
+
+			__m256d root = _mm256_sqrt_pd(disc);
+			__m256d minusVd = _mm256_sub_pd(zero, vd);
+			__m256d tNear = _mm256_sub_pd(minusVd, root);
+			__m256d tFar = _mm256_add_pd(minusVd, root);
+			__m256d ti = _mm256_blendv_pd(tFar, tNear, _mm256_cmp_pd(tNear, zero, _CMP_GT_OQ));
+			__m256d valid = _mm256_and_pd(intersects,
+				_mm256_and_pd(_mm256_cmp_pd(ti, zero, _CMP_GT_OQ), _mm256_cmp_pd(ti, limit, _CMP_LT_OQ)));
+			if (_mm256_movemask_pd(valid) & laneMask(i, end, 4)) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	SPHERESOA_TARGET("avx512f")
+	int closestHitAVX512(const double* x, const double* y, const double* z, const double* radiusSquared,
+		const double s[3], const double d[3], int first, int count, double& t)
+	{
+		const __m512d zero = _mm512_setzero_pd();
+		const __m512d sx = _mm512_set1_pd(s[0]), sy = _mm512_set1_pd(s[1]), sz = _mm512_set1_pd(s[2]);
+		const __m512d dx = _mm512_set1_pd(d[0]), dy = _mm512_set1_pd(d[1]), dz = _mm512_set1_pd(d[2]);
+
+		int hit = -1;
+		int end = first + count;
+		for (int i = first; i < end; i += 8) {
+			__m512d vx = _mm512_sub_pd(sx, _mm512_loadu_pd(x + i));
+			__m512d vy = _mm512_sub_pd(sy, _mm512_loadu_pd(y + i));
+			__m512d vz = _mm512_sub_pd(sz, _mm512_loadu_pd(z + i));
+			__m512d vd = _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(vx, dx), _mm512_mul_pd(vy, dy)), _mm512_mul_pd(vz, dz));
+			__m512d vv = _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(vx, vx), _mm512_mul_pd(vy, vy)), _mm512_mul_pd(vz, vz));
+			__m512d disc = _mm512_sub_pd(_mm512_mul_pd(vd, vd), _mm512_sub_pd(vv, _mm512_loadu_pd(radiusSquared + i)));
+			__mmask8 intersects = _mm512_cmp_pd_mask(disc, zero, _CMP_GT_OQ);
+			if (intersects == 0) {
+				continue;
+			}
+
+			__m512d root = _mm512_sqrt_pd(disc);
+			__m512d minusVd = _mm512_sub_pd(zero, vd);
+			__m512d tNear = _mm512_sub_pd(minusVd, root);
+			__m512d tFar = _mm512_add_pd(minusVd, root);
+			__m512d ti = _mm512_mask_blend_pd(_mm512_cmp_pd_mask(tNear, zero, _CMP_GT_OQ), tFar, tNear);
+			__mmask8 valid = intersects & _mm512_cmp_pd_mask(ti, zero, _CMP_GT_OQ) & _mm512_cmp_pd_mask(ti, _mm512_set1_pd(t), _CMP_LT_OQ);
+
+			if (valid != 0) {
+				double candidates[8];
+				_mm512_storeu_pd(candidates, ti);
+				keepNearest(candidates, valid, end - i < 8 ? end - i : 8, i, hit, t);
+			}
+		}
+		return hit;
+	}
+
+	SPHERESOA_TARGET("avx512f")
+	bool anyHitAVX512(const double* x, const double* y, const double* z, const double* radiusSquared,
+		const double s[3], const double d[3], int first, int count, double tMax)
+	{
+		const __m512d zero = _mm512_setzero_pd();
+		const __m512d limit = _mm512_set1_pd(tMax);
+		const __m512d sx = _mm512_set1_pd(s[0]), sy = _mm512_set1_pd(s[1]), sz = _mm512_set1_pd(s[2]);
+		const __m512d dx = _mm512_set1_pd(d[0]), dy = _mm512_set1_pd(d[1]), dz = _mm512_set1_pd(d[2]);
+
+		int end = first + count;
+		for (int i = first; i < end; i += 8) {
+			__m512d vx = _mm512_sub_pd(sx, _mm512_loadu_pd(x + i));
+			__m512d vy = _mm512_sub_pd(sy, _mm512_loadu_pd(y + i));
+			__m512d vz = _mm512_sub_pd(sz, _mm512_loadu_pd(z + i));
+			__m512d vd = _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(vx, dx), _mm512_mul_pd(vy, dy)), _mm512_mul_pd(vz, dz));
+			__m512d vv = _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(vx, vx), _mm512_mul_pd(vy, vy)), _mm512_mul_pd(vz, vz));
+			__m512d disc = _mm512_sub_pd(_mm512_mul_pd(vd, vd), _mm512_sub_pd(vv, _mm512_loadu_pd(radiusSquared + i)));
+			__mmask8 intersects = _mm512_cmp_pd_mask(disc, zero, _CMP_GT_OQ);
+			if (intersects == 0) {
+				continue;
+			}
+
+			__m512d root = _mm512_sqrt_pd(disc);
+			__m512d minusVd = _mm512_sub_pd(zero, vd);
+			__m512d tNear = _mm512_sub_pd(minusVd, root);
+			__m512d tFar = _mm512_add_pd(minusVd, root);
+			__m512d ti = _mm512_mask_blend_pd(_mm512_cmp_pd_mask(tNear, zero, _CMP_GT_OQ), tFar, tNear);
+			__mmask8 valid = intersects & _mm512_cmp_pd_mask(ti, zero, _CMP_GT_OQ) & _mm512_cmp_pd_mask(ti, limit, _CMP_LT_OQ);
+			if (valid & laneMask(i, end, 8)) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// Single precision versions: the same operations on twice as many spheres per instruction
+	SPHERESOA_TARGET("sse2")
+	int closestHitSSE2(const float* x, const float* y, const float* z, const float* radiusSquared,
+		const float s[3], const float d[3], int first, int count, float& t)
+	{
+		const __m128 zero = _mm_setzero_ps();
+		const __m128 sx = _mm_set1_ps(s[0]), sy = _mm_set1_ps(s[1]), sz = _mm_set1_ps(s[2]);
+		const __m128 dx = _mm_set1_ps(d[0]), dy = _mm_set1_ps(d[1]), dz = _mm_set1_ps(d[2]);
+
+		int hit = -1;
+		int end = first + count;
+		for (int i = first; i < end; i += 4) {
+			__m128 vx = _mm_sub_ps(sx, _mm_loadu_ps(x + i));
+			__m128 vy = _mm_sub_ps(sy, _mm_loadu_ps(y + i));
+			__m128 vz = _mm_sub_ps(sz, _mm_loadu_ps(z + i));
+			__m128 vd = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, dx), _mm_mul_ps(vy, dy)), _mm_mul_ps(vz, dz));
+			__m128 vv = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, vx), _mm_mul_ps(vy, vy)), _mm_mul_ps(vz, vz));
+			__m128 disc = _mm_sub_ps(_mm_mul_ps(vd, vd), _mm_sub_ps(vv, _mm_loadu_ps(radiusSquared + i)));
+			__m128 intersects = _mm_cmpgt_ps(disc, zero);
+			if (_mm_movemask_ps(intersects) == 0) {
+				continue;
+			}
+
+			__m128 root = _mm_sqrt_ps(disc);
+			__m128 minusVd = _mm_sub_ps(zero, vd);
+			__m128 tNear = _mm_sub_ps(minusVd, root);
+			__m128 tFar = _mm_add_ps(minusVd, root);
+			__m128 nearInFront = _mm_cmpgt_ps(tNear, zero);
+			__m128 ti = _mm_or_ps(_mm_and_ps(nearInFront, tNear), _mm_andnot_ps(nearInFront, tFar));
+			__m128 valid = _mm_and_ps(intersects, _mm_and_ps(_mm_cmpgt_ps(ti, zero), _mm_cmplt_ps(ti, _mm_set1_ps(t))));
+
+			unsigned int mask = _mm_movemask_ps(valid);
+			if (mask != 0) {
+				float candidates[4];
+				_mm_storeu_ps(candidates, ti);
+				keepNearest(candidates, mask, end - i < 4 ? end - i : 4, i, hit, t);
+			}
+		}
+		return hit;
+	}
+
+	SPHERESOA_TARGET("sse2")
+	bool anyHitSSE2(const float* x, const float* y, const float* z, const float* radiusSquared,
+		const float s[3], const float d[3], int first, int count, float tMax)
+	{
+		const __m128 zero = _mm_setzero_ps();
+		const __m128 limit = _mm_set1_ps(tMax);
+		const __m128 sx = _mm_set1_ps(s[0]), sy = _mm_set1_ps(s[1]), sz = _mm_set1_ps(s[2]);
+		const __m128 dx = _mm_set1_ps(d[0]), dy = _mm_set1_ps(d[1]), dz = _mm_set1_ps(d[2]);
+
+		int end = first + count;
+		for (int i = first; i < end; i += 4) {
+			__m128 vx = _mm_sub_ps(sx, _mm_loadu_ps(x + i));
+			__m128 vy = _mm_sub_ps(sy, _mm_loadu_ps(y + i));
+			__m128 vz = _mm_sub_ps(sz, _mm_loadu_ps(z + i));
+			__m128 vd = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, dx), _mm_mul_ps(vy, dy)), _mm_mul_ps(vz, dz));
+			__m128 vv = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, vx), _mm_mul_ps(vy, vy)), _mm_mul_ps(vz, vz));
+			__m128 disc = _mm_sub_ps(_mm_mul_ps(vd, vd), _mm_sub_ps(vv, _mm_loadu_ps(radiusSquared + i)));
+			__m128 intersects = _mm_cmpgt_ps(disc, zero);
+			if (_mm_movemask_ps(intersects) == 0) {
+				continue;
+			}
+
+			__m128 root = _mm_sqrt_ps(disc);
+			__m128 minusVd = _mm_sub_ps(zero, vd);
+			__m128 tNear = _mm_sub_ps(minusVd, root);
+			__m128 tFar = _mm_add_ps(minusVd, root);
+			__m128 nearInFront = _mm_cmpgt_ps(tNear, zero);
+			__m128 ti = _mm_or_ps(_mm_and_ps(nearInFront, tNear), _mm_andnot_ps(nearInFront, tFar));
+			__m128 valid = _mm_and_ps(intersects, _mm_and_ps(_mm_cmpgt_ps(ti, zero), _mm_cmplt_ps(ti, limit)));
+			if (_mm_movemask_ps(valid) & laneMask(i, end, 4)) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	SPHERESOA_TARGET("avx2")
+	int closestHitAVX2(const float* x, const float* y, const float* z, const float* radiusSquared,
+		const float s[3], const float d[3], int first, int count, float& t)
+	{
+		const __m256 zero = _mm256_setzero_ps();
+		const __m256 sx = _mm256_set1_ps(s[0]), sy = _mm256_set1_ps(s[1]), sz = _mm256_set1_ps(s[2]);
+		const __m256 dx = _mm256_set1_ps(d[0]), dy = _mm256_set1_ps(d[1]), dz = _mm256_set1_ps(d[2]);
+
+		int hit = -1;
+		int end = first + count;
+		for (int i = first; i < end; i += 8) {
+			__m256 vx = _mm256_sub_ps(sx, _mm256_loadu_ps(x + i));
+			__m256 vy = _mm256_sub_ps(sy, _mm256_loadu_ps(y + i));
+			__m256 vz = _mm256_sub_ps(sz, _mm256_loadu_ps(z + i));
+			__m256 vd = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(vx, dx), _mm256_mul_ps(vy, dy)), _mm256_mul_ps(vz, dz));
+			__m256 vv = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(vx, vx), _mm256_mul_ps(vy, vy)), _mm256_mul_ps(vz, vz));
+			__m256 disc = _mm256_sub_ps(_mm256_mul_ps(vd, vd), _mm256_sub_ps(vv, _mm256_loadu_ps(radiusSquared + i)));
+			__m256 intersects = _mm256_cmp_ps(disc, zero, _CMP_GT_OQ);
+			if (_mm256_movemask_ps(intersects) == 0) {
+				continue;
+			}
+
+			__m256 root = _mm256_sqrt_ps(disc);
+			__m256 minusVd = _mm256_sub_ps(zero, vd);
+			__m256 tNear = _mm256_sub_ps(minusVd, root);
+			__m256 tFar = _mm256_add_ps(minusVd, root);
+			__m256 ti = _mm256_blendv_ps(tFar, tNear, _mm256_cmp_ps(tNear, zero, _CMP_GT_OQ));
+			__m256 valid = _mm256_and_ps(intersects,
+				_mm256_and_ps(_mm256_cmp_ps(ti, zero, _CMP_GT_OQ), _mm256_cmp_ps(ti, _mm256_set1_ps(t), _CMP_LT_OQ)));
+
+			unsigned int mask = _mm256_movemask_ps(valid);
+			if (mask != 0) {
+				float candidates[8];
+				_mm256_storeu_ps(candidates, ti);
+				keepNearest(candidates, mask, end - i < 8 ? end - i : 8, i, hit, t);
+			}
+		}
+		return hit;
+	}
+
+	SPHERESOA_TARGET("avx2")
+	bool anyHitAVX2(const float* x, const float* y, const float* z, const float* radiusSquared,
+		const float s[3], const float d[3], int first, int count, float tMax)
+	{
+		const __m256 zero = _mm256_setzero_ps();
+		const __m256 limit = _mm256_set1_ps(tMax);
+		const __m256 sx = _mm256_set1_ps(s[0]), sy = _mm256_set1_ps(s[1]), sz = _mm256_set1_ps(s[2]);
+		const __m256 dx = _mm256_set1_ps(d[0]), dy = _mm256_set1_ps(d[1]), dz = _mm256_set1_ps(d[2]);
+
+		int end = first + count;
+		for (int i = first; i < end; i += 8) {
+			__m256 vx = _mm256_sub_ps(sx, _mm256_loadu_ps(x + i));
+			__m256 vy = _mm256_sub_ps(sy, _mm256_loadu_ps(y + i));
+			__m256 vz = _mm256_sub_ps(sz, _mm256_loadu_ps(z + i));
+			__m256 vd = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(vx, dx), _mm256_mul_ps(vy, dy)), _mm256_mul_ps(vz, dz));
+			__m256 vv = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(vx, vx), _mm256_mul_ps(vy, vy)), _mm256_mul_ps(vz, vz));
+			__m256 disc = _mm256_sub_ps(_mm256_mul_ps(vd, vd), _mm256_sub_ps(vv, _mm256_loadu_ps(radiusSquared + i)));
+			__m256 intersects = _mm256_cmp_ps(disc, zero, _CMP_GT_OQ);
+			if (_mm256_movemask_ps(intersects) == 0) {
+				continue;
+			}
+
+			__m256 root = _mm256_sqrt_ps(disc);
+			__m256 minusVd = _mm256_sub_ps(zero, vd);
+			__m256 tNear = _mm256_sub_ps(minusVd, root);
+			__m256 tFar = _mm256_add_ps(minusVd, root);
+			__m256 ti = _mm256_blendv_ps(tFar, tNear, _mm256_cmp_ps(tNear, zero, _CMP_GT_OQ));
+			__m256 valid = _mm256_and_ps(intersects,
+				_mm256_and_ps(_mm256_cmp_ps(ti, zero, _CMP_GT_OQ), _mm256_cmp_ps(ti, limit, _CMP_LT_OQ)));
+			if (_mm256_movemask_ps(valid) & laneMask(i, end, 8)) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	SPHERESOA_TARGET("avx512f")
+	int closestHitAVX512(const float* x, const float* y, const float* z, const float* radiusSquared,
+		const float s[3], const float d[3], int first, int count, float& t)
+	{
+		const __m512 zero = _mm512_setzero_ps();
+		const __m512 sx = _mm512_set1_ps(s[0]), sy = _mm512_set1_ps(s[1]), sz = _mm512_set1_ps(s[2]);
+		const __m512 dx = _mm512_set1_ps(d[0]), dy = _mm512_set1_ps(d[1]), dz = _mm512_set1_ps(d[2]);
+
+		int hit = -1;
+		int end = first + count;
+		for (int i = first; i < end; i += 16) {
+			__m512 vx = _mm512_sub_ps(sx, _mm512_loadu_ps(x + i));
+			__m512 vy = _mm512_sub_ps(sy, _mm512_loadu_ps(y + i));
+			__m512 vz = _mm512_sub_ps(sz, _mm512_loadu_ps(z + i));
+			__m512 vd = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(vx, dx), _mm512_mul_ps(vy, dy)), _mm512_mul_ps(vz, dz));
+			__m512 vv = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(vx, vx), _mm512_mul_ps(vy, vy)), _mm512_mul_ps(vz, vz));
+			__m512 disc = _mm512_sub_ps(_mm512_mul_ps(vd, vd), _mm512_sub_ps(vv, _mm512_loadu_ps(radiusSquared + i)));
+			__mmask16 intersects = _mm512_cmp_ps_mask(disc, zero, _CMP_GT_OQ);
+			if (intersects == 0) {
+				continue;
+			}
+
+			__m512 root = _mm512_sqrt_ps(disc);
+			__m512 minusVd = _mm512_sub_ps(zero, vd);
+			__m512 tNear = _mm512_sub_ps(minusVd, root);
+			__m512 tFar = _mm512_add_ps(minusVd, root);
+			__m512 ti = _mm512_mask_blend_ps(_mm512_cmp_ps_mask(tNear, zero, _CMP_GT_OQ), tFar, tNear);
+			__mmask16 valid = intersects & _mm512_cmp_ps_mask(ti, zero, _CMP_GT_OQ) & _mm512_cmp_ps_mask(ti, _mm512_set1_ps(t), _CMP_LT_OQ);
+
+			if (valid != 0) {
+				float candidates[16];
+				_mm512_storeu_ps(candidates, ti);
+				keepNearest(candidates, valid, end - i < 16 ? end - i : 16, i, hit, t);
+			}
+		}
+		return hit;
+	}
+
+	SPHERESOA_TARGET("avx512f")
+	bool anyHitAVX512(const float* x, const float* y, const float* z, const float* radiusSquared,
+		const float s[3], const float d[3], int first, int count, float tMax)
+	{
+		const __m512 zero = _mm512_setzero_ps();
+		const __m512 limit = _mm512_set1_ps(tMax);
+		const __m512 sx = _mm512_set1_ps(s[0]), sy = _mm512_set1_ps(s[1]), sz = _mm512_set1_ps(s[2]);
+		const __m512 dx = _mm512_set1_ps(d[0]), dy = _mm512_set1_ps(d[1]), dz = _mm512_set1_ps(d[2]);
+
+		int end = first + count;
+		for (int i = first; i < end; i += 16) {
+			__m512 vx = _mm512_sub_ps(sx, _mm512_loadu_ps(x + i));
+			__m512 vy = _mm512_sub_ps(sy, _mm512_loadu_ps(y + i));
+			__m512 vz = _mm512_sub_ps(sz, _mm512_loadu_ps(z + i));
+			__m512 vd = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(vx, dx), _mm512_mul_ps(vy, dy)), _mm512_mul_ps(vz, dz));
+			__m512 vv = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(vx, vx), _mm512_mul_ps(vy, vy)), _mm512_mul_ps(vz, vz));
+			__m512 disc = _mm512_sub_ps(_mm512_mul_ps(vd, vd), _mm512_sub_ps(vv, _mm512_loadu_ps(radiusSquared + i)));
+			__mmask16 intersects = _mm512_cmp_ps_mask(disc, zero, _CMP_GT_OQ);
+			if (intersects == 0) {
+				continue;
+			}
+
+			__m512 root = _mm512_sqrt_ps(disc);
+			__m512 minusVd = _mm512_sub_ps(zero, vd);
+			__m512 tNear = _mm512_sub_ps(minusVd, root);
+			__m512 tFar = _mm512_add_ps(minusVd, root);
+			__m512 ti = _mm512_mask_blend_ps(_mm512_cmp_ps_mask(tNear, zero, _CMP_GT_OQ), tFar, tNear);
+			__mmask16 valid = intersects & _mm512_cmp_ps_mask(ti, zero, _CMP_GT_OQ) & _mm512_cmp_ps_mask(ti, limit, _CMP_LT_OQ);
+			if (valid & laneMask(i, end, 16)) {
+				return true;
+			}
+		}
+		return false;
+	}
+#endif
+
+	/** Ask the CPU which instruction sets it (and the operating system) supports
+	*/
+	bool cpuSupports(SimdISA isa)
+	{
+#ifdef SPHERESOA_X86
+#if defined(__GNUC__)
+		__builtin_cpu_init();
+		switch (isa) {
+		case SimdISA::Scalar:
+			return true;
+		case SimdISA::SSE2:
+			return __builtin_cpu_supports("sse2");
+		case SimdISA::AVX2:
+			return __builtin_cpu_supports("avx2");
+		case SimdISA::AVX512:
+			return __builtin_cpu_supports("avx512f");
+		}
+#elif defined(_MSC_VER)
+		int info[4];
+		__cpuid(info, 0);
+		int maxLeaf = info[0];
+		__cpuid(info, 1);
+		bool osSavesYmm = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (_xgetbv(0) & 0x6) == 0x6;
+		bool osSavesZmm = osSavesYmm && (_xgetbv(0) & 0xE6) == 0xE6;
+		int extended = 0;
+		if (maxLeaf >= 7) {
+			__cpuidex(info, 7, 0);
+			extended = info[1];
+		}
+		switch (isa) {
+		case SimdISA::Scalar:
+		case SimdISA::SSE2:
+			return true;
+		case SimdISA::AVX2:
+			return osSavesYmm && (extended & (1 << 5));
+		case SimdISA::AVX512:
+			return osSavesZmm && (extended & (1 << 16));
+		}
+#endif
+#endif
+		return isa == SimdISA::Scalar;
+	}
+
+	/** Kernels of one precision for one instruction set
+	*/
+	template <typename Real>
+	struct KernelSet
+	{
+		int (*closestHit)(const Real*, const Real*, const Real*, const Real*, const Real[3], const Real[3], int, int, Real&);
+		bool (*anyHit)(const Real*, const Real*, const Real*, const Real*, const Real[3], const Real[3], int, int, Real);
+	};
+
+	/** Kernels for isa (scalar ones if isa is not compiled in), the overload of each name matching Real is picked
+	*/
+	template <typename Real>
+	KernelSet<Real> kernelSet(SimdISA isa)
+	{
+		KernelSet<Real> set;
+		set.closestHit = closestHitScalar<Real>;
+		set.anyHit = anyHitScalar<Real>;
+#ifdef SPHERESOA_X86
+		if (isa == SimdISA::SSE2) {
+			set.closestHit = closestHitSSE2;
+			set.anyHit = anyHitSSE2;
+		}
+		else if (isa == SimdISA::AVX2) {
+			set.closestHit = closestHitAVX2;
+			set.anyHit = anyHitAVX2;
+		}
+		else if (isa == SimdISA::AVX512) {
+			set.closestHit = closestHitAVX512;
+			set.anyHit = anyHitAVX512;
+		}
+#endif
+		return set;
+	}
+}
+
+/** Empty store using the widest kernel available
+*/
+template <typename Real>
+BasicSphereSoA<Real>::BasicSphereSoA()
+{
+	setISA(bestISA());
+	build(vector<Sphere>());
+}
+
+/** Copy geometry in the given order, followed by PADDING spheres that are never hit
+*/
+template <typename Real>
+void BasicSphereSoA<Real>::build(const vector<Sphere>& spheres, const vector<int>& order)
+{
+	int n = int(order.size());
+	x.assign(n + PADDING, Real(0));
+	y.assign(n + PADDING, Real(0));
+	z.assign(n + PADDING, Real(0));
+	radiusSquared.assign(n + PADDING, -std::numeric_limits<Real>::infinity());
+	indices = order;
+	update(spheres, 0, n);
+}
+
+/** Copy geometry in list order
+*/
+template <typename Real>
+void BasicSphereSoA<Real>::build(const vector<Sphere>& spheres)
+{
+	vector<int> order(spheres.size());
+	for (int i = 0; i < order.size(); i++) {
+		order[i] = i;
+	}
+	build(spheres, order);
+}
+
+/** Copy geometry of the stored range from the spheres it refers to
+*/
+template <typename Real>
+void BasicSphereSoA<Real>::update(const vector<Sphere>& spheres, int first, int count)
+{
+	for (int i = first; i < first + count; i++) {
+		const Sphere& sphere = spheres[indices[i]];
+		// Round the geometry first, then square, exactly as BasicSphere<Real> of the sphere does
+		BasicVector<Real> center(sphere.position());
+		Real r = Real(sphere.radius());
+		x[i] = center.getI();
+		y[i] = center.getJ();
+		z[i] = center.getK();
+		radiusSquared[i] = r * r;
+	}
+}
+
+/** Getter: number of spheres stored
+*/
+template <typename Real>
+int BasicSphereSoA<Real>::size() const
+{
+	return int(indices.size());
+}
+
+/** Getter: original index of stored sphere i
+*/
+template <typename Real>
+int BasicSphereSoA<Real>::getIndex(int i) const
+{
+	return indices[i];
+}
+
+/** Run the selected kernel over the range
+*/
+template <typename Real>
+int BasicSphereSoA<Real>::closestHit(const BasicVector<Real>& s, const BasicVector<Real>& d, int first, int count, Real& t) const
+{
+	Real origin[3] = { s.getI(), s.getJ(), s.getK() };
+	Real direction[3] = { d.getI(), d.getJ(), d.getK() };
+	return kernel(x.data(), y.data(), z.data(), radiusSquared.data(), origin, direction, first, count, t);
+}
+
+/** Run the selected any-hit kernel over the range
+*/
+template <typename Real>
+bool BasicSphereSoA<Real>::anyHit(const BasicVector<Real>& s, const BasicVector<Real>& d, int first, int count, Real tMax) const
+{
+	Real origin[3] = { s.getI(), s.getJ(), s.getK() };
+	Real direction[3] = { d.getI(), d.getJ(), d.getK() };
+	return anyKernel(x.data(), y.data(), z.data(), radiusSquared.data(), origin, direction, first, count, tMax);
+}
+
+/** Select the kernel (falls back to the scalar one if the CPU cannot run the requested one)
+*/
+template <typename Real>
+void BasicSphereSoA<Real>::setISA(SimdISA isa)
+{
+	if (!supported(isa)) {
+		isa = SimdISA::Scalar;
+	}
+	this->isa = isa;
+
+	KernelSet<Real> set = kernelSet<Real>(isa);
+	kernel = set.closestHit;
+	anyKernel = set.anyHit;
+}
+
+template <typename Real>
+SimdISA BasicSphereSoA<Real>::getISA() const
+{
+	return isa;
+}
+
+/** Detected once, the answer never changes while the program runs
+*/
+template <typename Real>
+bool BasicSphereSoA<Real>::supported(SimdISA isa)
+{
+	static const bool support[4] = {
+		cpuSupports(SimdISA::Scalar), cpuSupports(SimdISA::SSE2), cpuSupports(SimdISA::AVX2), cpuSupports(SimdISA::AVX512)
+	};
+	return support[int(isa)];
+}
+
+/** Widest supported kernel
+*/
+template <typename Real>
+SimdISA BasicSphereSoA<Real>::bestISA()
+{
+	if (supported(SimdISA::AVX512)) {
+		return SimdISA::AVX512;
+	}
+	if (supported(SimdISA::AVX2)) {
+		return SimdISA::AVX2;
+	}
+	if (supported(SimdISA::SSE2)) {
+		return SimdISA::SSE2;
+	}
+	return SimdISA::Scalar;
+}
+
+/** Name of each kernel for printing
+*/
+template <typename Real>
+const char* BasicSphereSoA<Real>::isaName(SimdISA isa)
+{
+	switch (isa) {
+	case SimdISA::SSE2:
+		return "sse2";
+	case SimdISA::AVX2:
+		return "avx2";
+	case SimdISA::AVX512:
+		return "avx512";
+	default:
+		return "scalar";
+	}
+}
+
+// The precisions the ray tracer is built with
+template class BasicSphereSoA<double>;
+template class BasicSphereSoA<float>;
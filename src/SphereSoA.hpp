@@ -0,0 +1,124 @@
+#ifndef _SPHERESOA_HPP_
+#define _SPHERESOA_HPP_
+
+#include <vector>
+
+#include "AlignedAllocator.hpp"
+#include "Sphere.hpp"
+#include "Vector.hpp"
+
+/**
+ * Instruction set used by the SphereSoA intersection kernel, from narrowest to widest
+ */
+enum class SimdISA
+{
+	Scalar,	// One sphere at a time, no intrinsics
+	SSE2,	// 2 spheres per instruction (4 in float)
+	AVX2,	// 4 spheres per instruction (8 in float)
+	AVX512	// 8 spheres per instruction (16 in float)
+};
+
+/**
+ * Packed structure-of-arrays copy of sphere geometry (center x/y/z and radius squared, each in its own cache line
+ * aligned array) so one ray can be tested against several spheres per SIMD instruction. Colors and ambience stay in
+ * the Sphere objects; entry i of the store refers back to sphere getIndex(i)
+ * Templated on the scalar type Real the geometry is stored and tested in: SphereSoA (double) or SphereSoAF (float,
+ * twice the spheres per instruction). Both are compiled in SphereSoA.cpp
+ */
+template <typename Real>
+class BasicSphereSoA
+{
+public:
+	/**
+	 * Empty store using the widest instruction set the CPU supports
+	 */
+	BasicSphereSoA();
+
+	/**
+	 * Copy the geometry of spheres[order[0]], spheres[order[1]], ... into the store (replaces previous contents),
+	 * rounded to Real
+	 */
+	void build(const std::vector<Sphere>& spheres, const std::vector<int>& order);
+
+	/**
+	 * Copy the geometry of every sphere, in list order
+	 */
+	void build(const std::vector<Sphere>& spheres);
+
+	/**
+	 * Copy the geometry of the spheres stored at positions [first, first + count) again from spheres (the list the
+	 * store was built from, with the same number of spheres), e.g. after they moved
+	 */
+	void update(const std::vector<Sphere>& spheres, int first, int count);
+
+	/**
+	 * @return number of spheres in the store
+	 */
+	int size() const;
+
+	/**
+	 * @return index (in the list passed to build) of the sphere stored at position i
+	 */
+	int getIndex(int i) const;
+
+	/**
+	 * Find the nearest of the spheres at positions [first, first + count) that the ray with origin s and unit
+	 * direction d intersects closer than t. Gives exactly the same result as calling Sphere::intersect on each in turn
+	 * @param t - distance limit on input, set to the distance of the returned sphere's intersection
+	 * @return position of that sphere in the store, -1 if none is hit (t is then unchanged)
+	 */
+	int closestHit(const BasicVector<Real>& s, const BasicVector<Real>& d, int first, int count, Real& t) const;
+
+	/**
+	 * Test whether the ray with origin s and unit direction d intersects any of the spheres at positions
+	 * [first, first + count) closer than tMax, stopping at the first one found (for shadow rays)
+	 */
+	bool anyHit(const BasicVector<Real>& s, const BasicVector<Real>& d, int first, int count, Real tMax) const;
+
+	/**
+	 * Choose the kernel used by closestHit (must be supported by the CPU, see supported)
+	 */
+	void setISA(SimdISA isa);
+	SimdISA getISA() const;
+
+	/**
+	 * @return true if the CPU (and operating system) can run the given kernel
+	 */
+	static bool supported(SimdISA isa);
+
+	/**
+	 * @return widest kernel the CPU supports, used by default
+	 */
+	static SimdISA bestISA();
+
+	/**
+	 * @return printable name of a kernel ("scalar", "sse2", "avx2" or "avx512")
+	 */
+	static const char* isaName(SimdISA isa);
+
+	// Extra never-hit spheres after the last one (the widest kernel's width) so loads never run past the end
+	static const int PADDING = 16;
+
+private:
+	typedef std::vector<Real, AlignedAllocator<Real, 64> > AlignedArray;
+
+	// Signature shared by every kernel (see SphereSoA.cpp)
+	typedef int (*Kernel)(const Real* x, const Real* y, const Real* z, const Real* radiusSquared,
+		const Real s[3], const Real d[3], int first, int count, Real& t);
+	typedef bool (*AnyKernel)(const Real* x, const Real* y, const Real* z, const Real* radiusSquared,
+		const Real s[3], const Real d[3], int first, int count, Real tMax);
+
+	AlignedArray x;	// Center x of each sphere
+	AlignedArray y;	// Center y of each sphere
+	AlignedArray z;	// Center z of each sphere
+	AlignedArray radiusSquared;	// Radius squared of each sphere (-inf for padding, which is never hit)
+	std::vector<int> indices;	// Position in the original sphere list
+	SimdISA isa;
+	Kernel kernel;
+	AnyKernel anyKernel;
+};
+
+typedef BasicSphereSoA<double> SphereSoA;
+typedef BasicSphereSoA<float> SphereSoAF;
+
+#endif
@@ -0,0 +1,224 @@
+#include "TileScheduler.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using std::vector;
+
+/**
+ * Parked workers and the batch of jobs they are handed. A run publishes a batch under mutex and bumps batch; each
+ * worker wakes, takes part if its index is among the workers the batch needs, and the last one done wakes run
+ */
+struct TileScheduler::Pool
+{
+	vector<std::thread> workers;	// workers[w - 1] is worker w
+	std::mutex mutex;	// Guards everything below but nextJob
+	std::condition_variable wake;	// Workers wait here for a new batch (or stopping)
+	std::condition_variable finished;	// run waits here for the workers of its batch
+	std::atomic<bool> inUse{ false };	// Set by the run handing jobs to the workers (a flag, not a mutex, so a run nested in worker 0 can test it)
+	unsigned long long batch{ 0 };	// Number of batches handed out
+	const std::function<void(int job, int worker)>* work{ nullptr };
+	int jobs{ 0 };
+	std::atomic<int> nextJob{ 0 };
+	int participants{ 0 };	// Workers 1 .. participants take part in the batch
+	int active{ 0 };	// Of those, the ones still working on it
+	bool stopping{ false };
+};
+
+namespace
+{
+	/** Take jobs from the shared counter until there are none left
+	*/
+	void takeJobs(std::atomic<int>& nextJob, int jobs, const std::function<void(int job, int worker)>& work, int worker)
+	{
+		for (int job = nextJob++; job < jobs; job = nextJob++) {
+			work(job, worker);
+		}
+	}
+}
+
+/** Create a scheduler with the given number of workers
+*/
+TileScheduler::TileScheduler(int threads) : threads(1)
+{
+	setThreadCount(threads);
+}
+
+/** Same thread count, new workers
+*/
+TileScheduler::TileScheduler(const TileScheduler& other) : threads(1)
+{
+	setThreadCount(other.threads);
+}
+
+TileScheduler& TileScheduler::operator=(const TileScheduler& other)
+{
+	if (this != &other) {
+		setThreadCount(other.threads);
+	}
+	return *this;
+}
+
+/** Wake every worker to stop, then join them
+*/
+TileScheduler::~TileScheduler()
+{
+	setThreadCount(1);
+}
+
+/** Setter: number of workers, falling back to the hardware thread count for values below 1. The old workers are
+* stopped and the new ones started parked
+*/
+void TileScheduler::setThreadCount(int threads)
+{
+	threads = threads < 1 ? hardwareThreads() : threads;
+	if (pool && threads == this->threads) {
+		return;
+	}
+
+	if (pool) {
+		{
+			std::lock_guard<std::mutex> lock(pool->mutex);
+			pool->stopping = true;
+		}
+		pool->wake.notify_all();
+		for (std::thread& worker : pool->workers) {
+			worker.join();
+		}
+		pool.reset();
+	}
+
+	this->threads = threads;
+	if (threads == 1) {
+		return;
+	}
+	pool.reset(new Pool());
+	Pool* shared = pool.get();
+	for (int w = 1; w < threads; w++) {
+		pool->workers.emplace_back([shared, w]() {
+			unsigned long long seen = 0;
+			std::unique_lock<std::mutex> lock(shared->mutex);
+			for (;;) {
+				shared->wake.wait(lock, [&]() { return shared->stopping || shared->batch != seen; });
+				if (shared->stopping) {
+					return;
+				}
+				seen = shared->batch;
+				if (w > shared->participants) {
+					continue;
+				}
+				lock.unlock();
+				takeJobs(shared->nextJob, shared->jobs, *shared->work, w);
+				lock.lock();
+				if (--shared->active == 0) {
+					shared->finished.notify_one();
+				}
+			}
+		});
+	}
+}
+
+/** Getter: number of workers
+*/
+int TileScheduler::getThreadCount() const
+{
+	return threads;
+}
+
+/** Hand the batch to the parked workers and work on it as worker 0 until every job has finished
+*/
+void TileScheduler::run(int jobs, const std::function<void(int job, int worker)>& work) const
+{
+	if (jobs <= 0) {
+		return;
+	}
+
+	// No point waking more workers than there are jobs
+	int workers = threads < jobs ? threads : jobs;
+	std::atomic<int> nextJob(0);
+	if (workers == 1) {
+		takeJobs(nextJob, jobs, work, 0);
+		return;
+	}
+
+	bool idle = false;
+	if (!pool->inUse.compare_exchange_strong(idle, true)) {
+		// The workers are busy with another run: start threads for this one, as before there was a pool
+		vector<std::thread> extra;
+		extra.reserve(workers - 1);
+		for (int w = 1; w < workers; w++) {
+			extra.emplace_back(takeJobs, std::ref(nextJob), jobs, std::cref(work), w);
+		}
+		takeJobs(nextJob, jobs, work, 0);
+		for (std::thread& thread : extra) {
+			thread.join();
+		}
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(pool->mutex);
+		pool->work = &work;
+		pool->jobs = jobs;
+		pool->nextJob = 0;
+		pool->participants = workers - 1;
+		pool->active = workers - 1;
+		pool->batch++;
+	}
+	pool->wake.notify_all();
+
+	// Calling thread is worker 0
+	takeJobs(pool->nextJob, jobs, work, 0);
+
+	std::unique_lock<std::mutex> lock(pool->mutex);
+	pool->finished.wait(lock, [this]() { return pool->active == 0; });
+	pool->work = nullptr;
+	pool->inUse = false;
+}
+
+/** Tiles over the whole image
+*/
+void TileScheduler::runTiles(int width, int height, int tileSize, const std::function<void(const Tile& tile, int worker)>& work) const
+{
+	Tile region;
+	region.x1 = width;
+	region.y1 = height;
+	runTiles(region, tileSize, work);
+}
+
+/** Map each job index to a tile of the region, in row-major tile order
+*/
+void TileScheduler::runTiles(const Tile& region, int tileSize, const std::function<void(const Tile& tile, int worker)>& work) const
+{
+	if (tileSize < 1) {
+		tileSize = 1;
+	}
+
+	int width = region.x1 - region.x0;
+	int height = region.y1 - region.y0;
+	if (width <= 0 || height <= 0) {
+		return;
+	}
+	int tilesAcross = (width + tileSize - 1) / tileSize;
+	int tilesDown = (height + tileSize - 1) / tileSize;
+
+	run(tilesAcross * tilesDown, [&](int job, int worker) {
+		Tile tile;
+		tile.x0 = region.x0 + (job % tilesAcross) * tileSize;
+		tile.y0 = region.y0 + (job / tilesAcross) * tileSize;
+		tile.x1 = tile.x0 + tileSize < region.x1 ? tile.x0 + tileSize : region.x1;
+		tile.y1 = tile.y0 + tileSize < region.y1 ? tile.y0 + tileSize : region.y1;
+		work(tile, worker);
+	});
+}
+
+/** Number of hardware threads, or 1 if the system cannot tell
+*/
+int TileScheduler::hardwareThreads()
+{
+	unsigned int count = std::thread::hardware_concurrency();
+	return count == 0 ? 1 : int(count);
+}
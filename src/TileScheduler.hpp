@@ -0,0 +1,84 @@
+#ifndef _TILESCHEDULER_HPP_
+#define _TILESCHEDULER_HPP_
+
+#include <functional>
+#include <memory>
+
+/**
+ * Rectangular block of pixels covering columns [x0, x1) and rows [y0, y1) of an image
+ */
+struct Tile
+{
+	int x0{ 0 };
+	int y0{ 0 };
+	int x1{ 0 };
+	int y1{ 0 };
+};
+
+/**
+ * Runs independent jobs (usually image tiles) on a pool of worker threads. Each worker pulls the next job index from a
+ * shared atomic counter, so threads that finish early simply take more jobs. The workers are started with the
+ * scheduler and wait on a condition variable between calls to run, so a run costs no thread creation
+ */
+class TileScheduler
+{
+public:
+	/**
+	 * @param threads - number of worker threads to use (values below 1 use one thread per hardware core)
+	 */
+	TileScheduler(int threads);
+
+	/**
+	 * Copies get their own workers, as many as other has
+	 */
+	TileScheduler(const TileScheduler& other);
+	TileScheduler& operator=(const TileScheduler& other);
+
+	/**
+	 * Stops and joins the workers
+	 */
+	~TileScheduler();
+
+	/**
+	 * Change the number of worker threads used by run (values below 1 use one thread per hardware core), restarting
+	 * the workers. Not while run is in progress
+	 */
+	void setThreadCount(int threads);
+
+	/**
+	 * @return number of worker threads used by run
+	 */
+	int getThreadCount() const;
+
+	/**
+	 * Call work(job, worker) once for every job in [0, jobs), spread over the worker threads. The calling thread acts as
+	 * worker 0 and run returns once every job has finished. worker is in [0, getThreadCount())
+	 * A run made while another is using the workers (from inside a job, or from another thread) starts threads of its
+	 * own for its jobs instead
+	 */
+	void run(int jobs, const std::function<void(int job, int worker)>& work) const;
+
+	/**
+	 * Split a width x height image into tileSize x tileSize tiles (smaller along the right and bottom edges) in
+	 * row-major order and call work(tile, worker) once for every tile
+	 */
+	void runTiles(int width, int height, int tileSize, const std::function<void(const Tile& tile, int worker)>& work) const;
+
+	/**
+	 * Same as above for the part of an image covered by region (tiles start at its top left corner)
+	 */
+	void runTiles(const Tile& region, int tileSize, const std::function<void(const Tile& tile, int worker)>& work) const;
+
+	/**
+	 * @return number of hardware threads reported by the system (at least 1)
+	 */
+	static int hardwareThreads();
+
+private:
+	struct Pool;
+
+	int threads;	// Number of workers, including the calling thread
+	std::unique_ptr<Pool> pool;	// Worker threads 1 .. threads - 1 (none for one thread)
+};
+
+#endif
@@ -0,0 +1,108 @@
+#include "Timeline.hpp"
+
+#include <fstream>
+
+using std::size_t;
+
+/** No buffers until reset
+*/
+Timeline::Timeline() : mask(0), epoch(std::chrono::steady_clock::now())
+{}
+
+/** Keep the buffers when the sizes match, so a render only allocates the first time
+*/
+void Timeline::reset(int threads, size_t capacity)
+{
+	size_t rounded = 1;
+	while (rounded < capacity) {
+		rounded *= 2;
+	}
+
+	buffers.resize(threads < 1 ? 1 : threads);
+	for (int t = 0; t < buffers.size(); t++) {
+		buffers[t].events.resize(rounded);
+		buffers[t].next = 0;
+	}
+	mask = rounded - 1;
+	epoch = std::chrono::steady_clock::now();
+}
+
+/** Microseconds since epoch
+*/
+double Timeline::now() const
+{
+	std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - epoch;
+	return elapsed.count();
+}
+
+/** Overwrite the oldest slot of the thread's ring
+*/
+void Timeline::record(int thread, const char* name, double begin, double end, int x, int y)
+{
+	Buffer& buffer = buffers[thread];
+	TimelineEvent& event = buffer.events[buffer.next & mask];
+	event.name = name;
+	event.begin = begin;
+	event.end = end;
+	event.x = x;
+	event.y = y;
+	buffer.next++;
+}
+
+/** Events still in the rings
+*/
+size_t Timeline::eventCount() const
+{
+	size_t count = 0;
+	for (int t = 0; t < buffers.size(); t++) {
+		count += buffers[t].next < mask + 1 ? buffers[t].next : mask + 1;
+	}
+	return count;
+}
+
+/** Events pushed out of full rings
+*/
+size_t Timeline::droppedCount() const
+{
+	size_t dropped = 0;
+	for (int t = 0; t < buffers.size(); t++) {
+		dropped += buffers[t].next > mask + 1 ? buffers[t].next - (mask + 1) : 0;
+	}
+	return dropped;
+}
+
+/** Complete ("X") events with the tile corner as arguments, then a name for every thread
+*/
+bool Timeline::write(const std::string& filename) const
+{
+	std::ofstream out(filename);
+	if (!out) {
+		return false;
+	}
+	out.setf(std::ios::fixed);
+	out.precision(3);
+
+	out << "{\"traceEvents\":[";
+	bool first = true;
+	for (int t = 0; t < buffers.size(); t++) {
+		const Buffer& buffer = buffers[t];
+		size_t held = buffer.next < mask + 1 ? buffer.next : mask + 1;
+		for (size_t e = buffer.next - held; e < buffer.next; e++) {
+			const TimelineEvent& event = buffer.events[e & mask];
+			out << (first ? "\n" : ",\n") << "{\"name\":\"" << event.name << "\",\"cat\":\"render\",\"ph\":\"X\",\"pid\":1,\"tid\":"
+				<< t << ",\"ts\":" << event.begin << ",\"dur\":" << event.end - event.begin;
+			if (event.x >= 0) {
+				out << ",\"args\":{\"x\":" << event.x << ",\"y\":" << event.y << "}";
+			}
+			out << "}";
+			first = false;
+		}
+	}
+	for (int t = 0; t < buffers.size(); t++) {
+		out << (first ? "\n" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << t
+			<< ",\"args\":{\"name\":\"" << (t == 0 ? "worker 0 (calling thread)" : "worker " + std::to_string(t)) << "\"}}";
+		first = false;
+	}
+	out << "\n],\"displayTimeUnit\":\"ms\",\"otherData\":{\"droppedEvents\":" << droppedCount() << "}}\n";
+	return bool(out);
+}
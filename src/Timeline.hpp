@@ -0,0 +1,107 @@
+#ifndef _TIMELINE_HPP_
+#define _TIMELINE_HPP_
+
+#include <chrono>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "AlignedAllocator.hpp"
+
+/**
+ * One timed span on the timeline: a tile traced, a pass shaded, a structure built, an image encoded
+ */
+struct TimelineEvent
+{
+	const char* name{ nullptr };	// Static string naming what was timed
+	double begin{ 0 };	// Microseconds since the timeline was reset
+	double end{ 0 };
+	int x{ -1 };	// Top left pixel of the tile the event covers (-1 if it is not about a tile)
+	int y{ -1 };
+};
+
+/**
+ * Optional per-thread event recorder for render timelines, written out in the Chrome trace event format (open the
+ * file in chrome://tracing or ui.perfetto.dev) to see how tiles are spread over the threads and where they stall
+ * Every thread owns a fixed size ring buffer, so recording an event is a clock read and a store: no locks, no
+ * atomics, no allocation. Once a buffer is full the oldest events are overwritten (and counted as dropped). The
+ * buffers are only read by write, after the threads that filled them have been joined
+ */
+class Timeline
+{
+public:
+	// Events kept per thread (a power of two)
+	static const std::size_t DEFAULT_CAPACITY = 1 << 16;
+
+	/**
+	 * Empty timeline with no threads - call reset before recording
+	 */
+	Timeline();
+
+	/**
+	 * Drop every event, make room for `threads' threads (thread indices [0, threads)) keeping `capacity' events each
+	 * (rounded up to a power of two), and restart the clock at 0
+	 */
+	void reset(int threads, std::size_t capacity = DEFAULT_CAPACITY);
+
+	/**
+	 * @return microseconds since the last reset
+	 */
+	double now() const;
+
+	/**
+	 * Record a span on the given thread's buffer (only that thread may record on it)
+	 */
+	void record(int thread, const char* name, double begin, double end, int x = -1, int y = -1);
+
+	/**
+	 * @return number of events held (at most the capacity per thread) / overwritten since the last reset
+	 */
+	std::size_t eventCount() const;
+	std::size_t droppedCount() const;
+
+	/**
+	 * Write every held event, oldest first per thread, as a Chrome trace JSON file
+	 * @return whether the file was written
+	 */
+	bool write(const std::string& filename) const;
+
+private:
+	// Ring buffer of one thread, on its own cache lines
+	struct alignas(64) Buffer
+	{
+		std::vector<TimelineEvent> events;
+		std::size_t next{ 0 };	// Number of events ever recorded, events[next & mask] is overwritten next
+	};
+
+	std::vector<Buffer, AlignedAllocator<Buffer, 64> > buffers;
+	std::size_t mask;	// Capacity - 1
+	std::chrono::steady_clock::time_point epoch;	// Time 0
+};
+
+/**
+ * Records the span from its construction to its destruction on a timeline (nothing if the timeline is nullptr)
+ */
+class TimelineScope
+{
+public:
+	TimelineScope(Timeline* timeline, int thread, const char* name, int x = -1, int y = -1) :
+		timeline(timeline), thread(thread), name(name), x(x), y(y), begin(timeline ? timeline->now() : 0) {}
+
+	~TimelineScope()
+	{
+		if (timeline) {
+			timeline->record(thread, name, begin, timeline->now(), x, y);
+		}
+	}
+
+private:
+	Timeline* timeline;
+	int thread;
+	const char* name;
+	int x;
+	int y;
+	double begin;
+};
+
+#endif
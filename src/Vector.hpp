@@ -1,132 +1,238 @@
 #ifndef _VECTOR_HPP_
 #define _VECTOR_HPP_
 
+#include <cmath>
 #include <iostream>
 
 /**
  * This is a basic C++ class to represent three-dimensional numbers.
- */ 
-class Vector
+ * Header-only so every operation can be inlined into the ray tracing loops (and used in constant expressions)
+ * Templated on the scalar type Real: use Vector (double) or VectorF (float)
+ */
+template <typename Real>
+class BasicVector
 {
 public:
   /**
    * Default constructor. It should set the scalar components to 0.
-   */ 
-  Vector();
-  
+   */
+  constexpr BasicVector() : vx(0), vy(0), vz(0) {}
+
   /**
    * @param vx - the scalar value to use for i component
    * @param vy - the scalar value to use for j component
    * @param vz - the scalar value to use for k component
-   */ 
-  Vector( double vx, double vy, double vz );
+   */
+  constexpr BasicVector( Real vx, Real vy, Real vz ) : vx(vx), vy(vy), vz(vz) {}
+
+  /**
+   * Convert from a Vector of another precision (rounding each component to the nearest Real)
+   * @param other - the Vector to convert
+   */
+  template <typename Other>
+  explicit constexpr BasicVector( const BasicVector<Other>& other ) :
+    vx(Real(other.getI())), vy(Real(other.getJ())), vz(Real(other.getK())) {}
 
   /**
    * Returns the scalar of the i component
    * @return vx.
-   */ 
-  double getI() const;
+   */
+  constexpr Real getI() const { return vx; }
 
   /**
    * Returns the scalar of the j component
    * @return vy.
-   */ 
-  double getJ() const;
+   */
+  constexpr Real getJ() const { return vy; }
 
   /**
    * Returns the scalar of the k component
    * @return vz.
-   */ 
-  double getK() const;
+   */
+  constexpr Real getK() const { return vz; }
 
   /**
    * Updates the scalar of the i component to the given newVx parameter.
    * @param newVx - the new value to use for the vx field.
-   */ 
-  void setI(double newVx);
-  
+   */
+  constexpr void setI(Real newVx) { vx = newVx; }
+
   /**
-   * Updates the scalar of the i component to the given newVx parameter.
-   * @param newVy - the new value to use for the vx field.
-   */ 
-  void setJ(double newVy);
+   * Updates the scalar of the j component to the given newVy parameter.
+   * @param newVy - the new value to use for the vy field.
+   */
+  constexpr void setJ(Real newVy) { vy = newVy; }
 
   /**
-   * Updates the scalar of the i component to the given newVx parameter.
-   * @param newVz - the new value to use for the vx field.
-   */ 
-  void setK(double newVz);
-  
+   * Updates the scalar of the k component to the given newVz parameter.
+   * @param newVz - the new value to use for the vz field.
+   */
+  constexpr void setK(Real newVz) { vz = newVz; }
+
   /**
    * Returns true if the scalar components for this object and rhs are the same, false otherwise.
    * @return true if scalar components in both objects are the same.
-   */ 
-  bool equal( const Vector& rhs ) const;
+   */
+  constexpr bool equal( const BasicVector& rhs ) const
+  {
+    return vx == rhs.vx && vy == rhs.vy && vz == rhs.vz;
+  }
 
   /**
    * Creates and returns a new Vector object representing the vector addition of two Vector objects
    * @return a new Vector object that contains the appropriate summed components
    * @param rhs - the Vector object to add to this object.
    */
-  Vector operator+( const Vector &rhs ) const;
+  constexpr BasicVector operator+( const BasicVector &rhs ) const
+  {
+    return BasicVector(vx + rhs.vx, vy + rhs.vy, vz + rhs.vz);
+  }
 
   /**
    * Creates and returns a new Vector object representing the vector subtraction of two Vector objects
    * @return a new Vector object that contains the appropriate difference components
    * @param rhs - the Vector object to subtract from this object.
    */
-  Vector operator-( const Vector &rhs ) const;
+  constexpr BasicVector operator-( const BasicVector &rhs ) const
+  {
+    return BasicVector(vx - rhs.vx, vy - rhs.vy, vz - rhs.vz);
+  }
+
+  /**
+   * Compound assignment versions of +, - and scalarMult (and division by a scalar), changing this Vector in place
+   * @return this Vector
+   */
+  constexpr BasicVector& operator+=( const BasicVector &rhs )
+  {
+    vx += rhs.vx;
+    vy += rhs.vy;
+    vz += rhs.vz;
+    return *this;
+  }
+
+  constexpr BasicVector& operator-=( const BasicVector &rhs )
+  {
+    vx -= rhs.vx;
+    vy -= rhs.vy;
+    vz -= rhs.vz;
+    return *this;
+  }
+
+  constexpr BasicVector& operator*=( Real mult )
+  {
+    vx *= mult;
+    vy *= mult;
+    vz *= mult;
+    return *this;
+  }
+
+  constexpr BasicVector& operator/=( Real div )
+  {
+    vx /= div;
+    vy /= div;
+    vz /= div;
+    return *this;
+  }
 
   /**
    * Creates and returns a new Vector object that is cross product of this and the given Vector object.
    * @return a new Vector object that contains the cross product of this and the given Vector object.
    * @param rhs - the Vector object to cross with this object.
    */
-  Vector cross( const Vector &rhs ) const;
+  constexpr BasicVector cross( const BasicVector &rhs ) const
+  {
+    return BasicVector(vy * rhs.vz - vz * rhs.vy, vz * rhs.vx - vx * rhs.vz, vx * rhs.vy - vy * rhs.vx);
+  }
 
   /**
    * Returns the dot product of this and the given Vector object.
    * @return the dot product of this and the given Vector object.
    * @param rhs - the Vector object to dot with this object.
    */
-  double operator*( const Vector &rhs ) const;
+  constexpr Real operator*( const BasicVector &rhs ) const
+  {
+    return vx * rhs.vx + vy * rhs.vy + vz * rhs.vz;
+  }
 
   /**
   *	@return a vector multiplied by a scalar
   * @param mult - scalar multiplier
   */
-  Vector scalarMult(const double& mult) const;
+  constexpr BasicVector scalarMult(const Real& mult) const
+  {
+    return BasicVector(vx * mult, vy * mult, vz * mult);
+  }
+
+  /**
+   * Returns the squared norm (the dot product with itself) - no square root, so prefer it for comparing lengths
+   * @return the squared norm
+   */
+  constexpr Real normSquared() const
+  {
+    return vx * vx + vy * vy + vz * vz;
+  }
 
   /**
    * Returns the norm of the Vector object.
    * @return the norm (-1 if magnitude undefined)
    */
-  double norm() const;
+  Real norm() const
+  {
+    Real result = std::sqrt(normSquared());
+    return std::isfinite(result) ? result : -1;
+  }
 
   /**
    * Returns the angle between two Vector objects in radians (over interval [0,2*pi)).
    * @param rhs - the Vector object to find the angle between with this object.
    * @return the angle (-1 if angle undefined)
    */
-  double angle(const Vector &rhs) const;
+  Real angle(const BasicVector &rhs) const
+  {
+    if (*this * rhs == 0 && (norm() * rhs.norm() == 0)) {
+      return -1;
+    }
+
+    Real result = std::acos(*this * rhs / (norm() * rhs.norm()));
+    return std::isfinite(result) ? result : -1;
+  }
 
   /**
   * Used to calculate the unit vector of any vector
   * @return unit vector of any vector (length 1, same direction)
   */
-  Vector formUnitVector() const;
+  BasicVector formUnitVector() const
+  {
+    return scalarMult(1 / norm());
+  }
+
+  /**
+  * Fast normalize: the same unit vector as formUnitVector for any finite, non-zero vector, without the check for an
+  * undefined magnitude (a zero or non-finite vector gives non-finite components)
+  * @return unit vector (length 1, same direction)
+  */
+  BasicVector normalized() const
+  {
+    return scalarMult(1 / std::sqrt(normSquared()));
+  }
 
   /**
    * Outputs this Vector object on the given ostream.  ``vxi + vyj + vzk'' (for debugging).
    * @param out - the ostream object to use to output.
-   */ 
-  void output( std::ostream &out ) const;
+   */
+  void output( std::ostream &out ) const
+  {
+    out << vx << "i + " << vy << "j + " << vz << "k" << std::endl;
+  }
 
 private:
 
-  double vx;
-  double vy;
-  double vz;
+  Real vx;
+  Real vy;
+  Real vz;
 };
 
+typedef BasicVector<double> Vector;	// Default precision, used for the scene description
+typedef BasicVector<float> VectorF;	// Single precision, for the float ray tracing kernels
+
 #endif
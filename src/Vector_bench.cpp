@@ -0,0 +1,136 @@
+#include "LegacyVector.hpp"
+#include "Vector.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <vector>
+
+using std::cout;
+using std::endl;
+using std::vector;
+
+/**
+* Microbenchmark of the header-only Vector against the original out-of-line one (LegacyVector, compiled in its own
+* translation unit so nothing is inlined, as before). Both run the same two loops:
+*	intersect - the Sphere::intersect arithmetic for every ray against every sphere, keeping the nearest hit
+*	view - the generateView arithmetic, one normalized ray per pixel
+* and must give identical checksums
+*/
+
+namespace
+{
+	/** Seconds taken by the fastest of `repeats' calls to f
+	*/
+	template <typename F>
+	double bestTime(int repeats, F f)
+	{
+		double best = 0;
+		for (int r = 0; r < repeats; r++) {
+			auto start = std::chrono::steady_clock::now();
+			f();
+			std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+			if (r == 0 || elapsed.count() < best) {
+				best = elapsed.count();
+			}
+		}
+		return best;
+	}
+
+	/** Nearest sphere hit by each ray, exactly as Sphere::intersect computes it. Returns the sum of the nearest t's
+	*/
+	template <typename V>
+	double intersectLoop(const V& origin, const vector<V>& directions, const vector<V>& centers, const vector<double>& radii)
+	{
+		double sum = 0;
+		for (int r = 0; r < directions.size(); r++) {
+			const V& d = directions[r];
+			double nearest = INFINITY;
+			for (int n = 0; n < centers.size(); n++) {
+				V v = origin - centers[n];
+				double vd = v * d;
+				double determineIntersect = vd * vd - (v * v - radii[n] * radii[n]);
+				if (determineIntersect <= 0) {
+					continue;
+				}
+				double root = sqrt(determineIntersect);
+				double t = -vd - root;
+				if (t <= 0) {
+					t = -vd + root;
+				}
+				if (t > 0 && t < nearest) {
+					nearest = t;
+				}
+			}
+			if (nearest < INFINITY) {
+				sum += nearest;
+			}
+		}
+		return sum;
+	}
+
+	/** Normalized ray through every pixel of a size x size view, as generateView computes it. Returns the sum of components
+	*/
+	template <typename V>
+	double viewLoop(const V& p_11, const V& q_x, const V& q_y, int size)
+	{
+		double sum = 0;
+		for (int y = 0; y < size; y++) {
+			for (int x = 0; x < size; x++) {
+				V ray = (p_11 + q_x.scalarMult(x) + q_y.scalarMult(y)).formUnitVector();
+				sum += ray.getI() + ray.getJ() + ray.getK();
+			}
+		}
+		return sum;
+	}
+
+	/** Run both loops with vector type V on the same random scene
+	*/
+	template <typename V>
+	void run(const char* name, int sphereCount, int rayCount, int viewSize, double& intersectSeconds, double& viewSeconds,
+		double& checksum)
+	{
+		std::mt19937 rng(1);
+		std::uniform_real_distribution<double> coordinate(-5, 5);
+		std::uniform_real_distribution<double> radius(0.1, 0.6);
+
+		vector<V> centers;
+		vector<double> radii;
+		for (int n = 0; n < sphereCount; n++) {
+			centers.push_back(V(coordinate(rng), coordinate(rng), coordinate(rng)));
+			radii.push_back(radius(rng));
+		}
+		V origin(10, 0, 0);
+		vector<V> directions;
+		for (int r = 0; r < rayCount; r++) {
+			directions.push_back((V(0, coordinate(rng), coordinate(rng)) - origin).formUnitVector());
+		}
+
+		double intersectSum = 0;
+		intersectSeconds = bestTime(5, [&]() { intersectSum = intersectLoop(origin, directions, centers, radii); });
+		double viewSum = 0;
+		viewSeconds = bestTime(5, [&]() { viewSum = viewLoop(V(1, 2.5, -2.5), V(0, 0, 0.005), V(0, -0.005, 0), viewSize); });
+		checksum = intersectSum + viewSum;
+
+		cout << "  " << name << ": intersect " << double(sphereCount) * rayCount / intersectSeconds / 1e6
+			<< " M tests/s, view " << double(viewSize) * viewSize / viewSeconds / 1e6 << " M rays/s" << endl;
+	}
+}
+
+int main()
+{
+	const int sphereCount = 100;
+	const int rayCount = 100000;
+	const int viewSize = 1024;
+	cout << "Vector: " << sphereCount << " spheres x " << rayCount << " rays, " << viewSize << "x" << viewSize << " view" << endl;
+
+	double legacyIntersect, legacyView, legacyChecksum;
+	run<LegacyVector>("out-of-line (old)", sphereCount, rayCount, viewSize, legacyIntersect, legacyView, legacyChecksum);
+	double inlineIntersect, inlineView, inlineChecksum;
+	run<Vector>("header-only", sphereCount, rayCount, viewSize, inlineIntersect, inlineView, inlineChecksum);
+
+	cout << "  speedup: intersect " << legacyIntersect / inlineIntersect << "x, view " << legacyView / inlineView << "x" << endl;
+	cout << "  checksums " << (legacyChecksum == inlineChecksum ? "match" : "DIFFER") << endl;
+	return legacyChecksum == inlineChecksum ? 0 : 1;
+}
@@ -0,0 +1,496 @@
+#include "WideBVH.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <math.h>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define WIDEBVH_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// GCC and Clang only emit AVX instructions in functions marked for them, MSVC emits whatever intrinsics are used
+#if defined(__GNUC__)
+#define WIDEBVH_TARGET(isa) __attribute__((target(isa)))
+#else
+#define WIDEBVH_TARGET(isa)
+#endif
+
+using std::vector;
+
+static_assert(sizeof(WideBVH::Node) == 128, "a wide node is two cache lines");
+
+const int WideBVH::WIDTH;
+
+namespace
+{
+	// Most spheres one leaf child can hold (count is 16 bits); bigger binary leaves are cut into slices
+	const int MAX_LEAF_COUNT = 65535;
+	// Deepest a wide tree can get: the binary tree's depth, plus halvings of slices of up to 2^31 spheres
+	const int MAX_WIDE_DEPTH = BVH::MAX_DEPTH + 16;
+
+	/** 2^e as a double, built from its bits (e is well inside the normal range)
+	*/
+	inline double powerOfTwo(int e)
+	{
+		uint64_t bits = uint64_t(1023 + e) << 52;
+		double result;
+		std::memcpy(&result, &bits, sizeof(result));
+		return result;
+	}
+
+	/** Index of the lowest set bit of a nonzero mask
+	*/
+	inline int lowestBit(unsigned int mask)
+	{
+#if defined(__GNUC__)
+		return __builtin_ctz(mask);
+#elif defined(_MSC_VER)
+		unsigned long bit;
+		_BitScanForward(&bit, mask);
+		return int(bit);
+#else
+		int bit = 0;
+		while (!(mask & 1u)) {
+			mask >>= 1;
+			bit++;
+		}
+		return bit;
+#endif
+	}
+
+	/** Quantize the interval [lo, hi] to cells of size scale counted from origin, rounding outwards so that the
+	* decoded interval origin + [qlo, qhi] * scale (computed exactly as the kernels do) contains it
+	* @return false if it needs more than 255 cells
+	*/
+	bool quantize(double origin, double scale, double lo, double hi, uint8_t& qlo, uint8_t& qhi)
+	{
+		double a = std::max(0.0, std::floor((lo - origin) / scale));
+		while (a > 0 && origin + a * scale > lo) {
+			a--;
+		}
+		double b = std::max(a, std::ceil((hi - origin) / scale));
+		while (origin + b * scale < hi) {
+			b++;
+		}
+		if (b > 255) {
+			return false;
+		}
+		qlo = uint8_t(a);
+		qhi = uint8_t(b);
+		return true;
+	}
+
+	/**
+	* Box test kernels: decode each child's box and slab test it like AABB::intersect, NaN (a ray in a box plane)
+	* counting as inside. Every kernel computes the same operations in double, so all return the same children
+	*/
+	unsigned int boxesScalar(const WideBVH::Node& node, const double o[3], const double inv[3], double tMax,
+		double tEntry[WideBVH::WIDTH])
+	{
+		double scale[3] = { powerOfTwo(node.exponent[0]), powerOfTwo(node.exponent[1]), powerOfTwo(node.exponent[2]) };
+		unsigned int mask = 0;
+		for (int c = 0; c < node.childCount; c++) {
+			double tNear = 0;
+			double tFar = tMax;
+			for (int a = 0; a < 3; a++) {
+				double t0 = (node.origin[a] + double(node.lo[a][c]) * scale[a] - o[a]) * inv[a];
+				double t1 = (node.origin[a] + double(node.hi[a][c]) * scale[a] - o[a]) * inv[a];
+				if (t0 > t1) {
+					std::swap(t0, t1);
+				}
+				tNear = t0 > tNear ? t0 : tNear;
+				tFar = t1 < tFar ? t1 : tFar;
+			}
+			if (tNear <= tFar) {
+				mask |= 1u << c;
+				tEntry[c] = tNear;
+			}
+		}
+		return mask;
+	}
+
+#ifdef WIDEBVH_X86
+	// min(t1, t0) and max(t0, t1) return the other plane's t when one is NaN, and max(x, tNear) / min(x, tFar) ignore
+	// a NaN x: the same as the scalar comparisons
+	WIDEBVH_TARGET("sse2")
+	unsigned int boxesSSE2(const WideBVH::Node& node, const double o[3], const double inv[3], double tMax,
+		double tEntry[WideBVH::WIDTH])
+	{
+		unsigned int mask = 0;
+		for (int c = 0; c < node.childCount; c += 2) {
+			__m128d tNear = _mm_setzero_pd();
+			__m128d tFar = _mm_set1_pd(tMax);
+			for (int a = 0; a < 3; a++) {
+				__m128d origin = _mm_set1_pd(node.origin[a]);
+				__m128d scale = _mm_set1_pd(powerOfTwo(node.exponent[a]));
+				__m128d s = _mm_set1_pd(o[a]);
+				__m128d invA = _mm_set1_pd(inv[a]);
+				__m128d lo = _mm_add_pd(origin, _mm_mul_pd(_mm_set_pd(node.lo[a][c + 1], node.lo[a][c]), scale));
+				__m128d hi = _mm_add_pd(origin, _mm_mul_pd(_mm_set_pd(node.hi[a][c + 1], node.hi[a][c]), scale));
+				__m128d t0 = _mm_mul_pd(_mm_sub_pd(lo, s), invA);
+				__m128d t1 = _mm_mul_pd(_mm_sub_pd(hi, s), invA);
+				tNear = _mm_max_pd(_mm_min_pd(t1, t0), tNear);
+				tFar = _mm_min_pd(_mm_max_pd(t0, t1), tFar);
+			}
+			_mm_storeu_pd(tEntry + c, tNear);
+			mask |= unsigned(_mm_movemask_pd(_mm_cmple_pd(tNear, tFar))) << c;
+		}
+		return mask & ((1u << node.childCount) - 1);
+	}
+
+	WIDEBVH_TARGET("avx2")
+	unsigned int boxesAVX2(const WideBVH::Node& node, const double o[3], const double inv[3], double tMax,
+		double tEntry[WideBVH::WIDTH])
+	{
+		unsigned int mask = 0;
+		for (int c = 0; c < node.childCount; c += 4) {
+			__m256d tNear = _mm256_setzero_pd();
+			__m256d tFar = _mm256_set1_pd(tMax);
+			for (int a = 0; a < 3; a++) {
+				int32_t packedLo, packedHi;
+				std::memcpy(&packedLo, &node.lo[a][c], sizeof(packedLo));
+				std::memcpy(&packedHi, &node.hi[a][c], sizeof(packedHi));
+				__m256d origin = _mm256_set1_pd(node.origin[a]);
+				__m256d scale = _mm256_set1_pd(powerOfTwo(node.exponent[a]));
+				__m256d s = _mm256_set1_pd(o[a]);
+				__m256d invA = _mm256_set1_pd(inv[a]);
+				__m256d qlo = _mm256_cvtepi32_pd(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(packedLo)));
+				__m256d qhi = _mm256_cvtepi32_pd(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(packedHi)));
+				__m256d t0 = _mm256_mul_pd(_mm256_sub_pd(_mm256_add_pd(origin, _mm256_mul_pd(qlo, scale)), s), invA);
+				__m256d t1 = _mm256_mul_pd(_mm256_sub_pd(_mm256_add_pd(origin, _mm256_mul_pd(qhi, scale)), s), invA);
+				tNear = _mm256_max_pd(_mm256_min_pd(t1, t0), tNear);
+				tFar = _mm256_min_pd(_mm256_max_pd(t0, t1), tFar);
+			}
+			_mm256_storeu_pd(tEntry + c, tNear);
+			mask |= unsigned(_mm256_movemask_pd(_mm256_cmp_pd(tNear, tFar, _CMP_LE_OQ))) << c;
+		}
+		return mask & ((1u << node.childCount) - 1);
+	}
+
+	WIDEBVH_TARGET("avx512f")
+	unsigned int boxesAVX512(const WideBVH::Node& node, const double o[3], const double inv[3], double tMax,
+		double tEntry[WideBVH::WIDTH])
+	{
+		__m512d tNear = _mm512_setzero_pd();
+		__m512d tFar = _mm512_set1_pd(tMax);
+		for (int a = 0; a < 3; a++) {
+			__m512d origin = _mm512_set1_pd(node.origin[a]);
+			__m512d scale = _mm512_set1_pd(powerOfTwo(node.exponent[a]));
+			__m512d s = _mm512_set1_pd(o[a]);
+			__m512d invA = _mm512_set1_pd(inv[a]);
+			__m512d qlo = _mm512_cvtepi32_pd(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)node.lo[a])));
+			__m512d qhi = _mm512_cvtepi32_pd(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)node.hi[a])));
+			__m512d t0 = _mm512_mul_pd(_mm512_sub_pd(_mm512_add_pd(origin, _mm512_mul_pd(qlo, scale)), s), invA);
+			__m512d t1 = _mm512_mul_pd(_mm512_sub_pd(_mm512_add_pd(origin, _mm512_mul_pd(qhi, scale)), s), invA);
+			tNear = _mm512_max_pd(_mm512_min_pd(t1, t0), tNear);
+			tFar = _mm512_min_pd(_mm512_max_pd(t0, t1), tFar);
+		}
+		_mm512_storeu_pd(tEntry, tNear);
+		return unsigned(_mm512_cmp_pd_mask(tNear, tFar, _CMP_LE_OQ)) & ((1u << node.childCount) - 1);
+	}
+#endif
+
+	// Subtree of the binary tree (node >= 0), or a slice [first, first + count) of the spheres of a leaf too big for
+	// one child (node -1), while collapsing
+	struct Item
+	{
+		int node;
+		int first;
+		int count;
+		AABB bounds;
+	};
+
+	// Traversal stack entry: a node (count 0) or leaf, entered at t
+	struct Entry
+	{
+		int child;
+		int count;
+		double t;
+	};
+}
+
+/** Create empty hierarchy
+*/
+WideBVH::WideBVH()
+{
+	setISA(SphereSoA::bestISA());
+}
+
+/** Top-down: each wide node opens the largest of its children until it has eight, then the inner ones become nodes
+*/
+void WideBVH::build(const BVH& bvh, const vector<Sphere>& spheres)
+{
+	nodes.clear();
+	bounds = AABB();
+	const vector<BVH::Node>& binary = bvh.getNodes();
+	if (binary.empty()) {
+		leafSpheres.build(vector<Sphere>());
+		leafSpheresF.build(vector<Sphere>());
+		return;
+	}
+	leafSpheres.build(spheres, bvh.getIndices());
+	leafSpheresF.build(spheres, bvh.getIndices());
+	bounds = binary[0].bounds;
+
+	auto itemOf = [&binary](int n) {
+		const BVH::Node& node = binary[n];
+		return Item{ node.count > 0 ? -1 : n, node.leftFirst, node.count, node.bounds };
+	};
+	auto openable = [](const Item& item) {
+		return item.node >= 0 || item.count > MAX_LEAF_COUNT;
+	};
+	auto open = [&](const Item& item, Item& left, Item& right) {
+		if (item.node >= 0) {
+			left = itemOf(binary[item.node].leftFirst);
+			right = itemOf(binary[item.node].leftFirst + 1);
+		}
+		else {
+			int half = item.count / 2;
+			left = Item{ -1, item.first, half, item.bounds };
+			right = Item{ -1, item.first + half, item.count - half, item.bounds };
+		}
+	};
+
+	// Each task fills node `first' with the children of item
+	vector<std::pair<int, Item> > tasks;
+	nodes.push_back(Node());
+	tasks.push_back(std::make_pair(0, itemOf(0)));
+	while (!tasks.empty()) {
+		int index = tasks.back().first;
+		Item item = tasks.back().second;
+		tasks.pop_back();
+
+		vector<Item> children;
+		if (openable(item)) {
+			children.resize(2);
+			open(item, children[0], children[1]);
+		}
+		else {
+			children.push_back(item);
+		}
+		while (children.size() < WIDTH) {
+			int largest = -1;
+			double largestArea = -1;
+			for (int c = 0; c < children.size(); c++) {
+				double area = children[c].bounds.surfaceArea();
+				if (openable(children[c]) && area > largestArea) {
+					largest = c;
+					largestArea = area;
+				}
+			}
+			if (largest < 0) {
+				break;
+			}
+			Item left, right;
+			open(children[largest], left, right);
+			children[largest] = left;
+			children.push_back(right);
+		}
+
+		// Quantization grid over the children's box, with the smallest power of two cells that fit every child
+		AABB box;
+		for (const Item& child : children) {
+			box.grow(child.bounds);
+		}
+		Node node = Node();
+		node.childCount = uint8_t(children.size());
+		for (int a = 0; a < 3; a++) {
+			node.origin[a] = box.min[a];
+			double extent = box.max[a] - box.min[a];
+			int exponent = extent > 0 ? int(std::ceil(std::log2(extent / 255))) : -1000;
+			exponent = std::max(-1000, std::min(1000, exponent));
+			for (;; exponent++) {
+				double scale = powerOfTwo(exponent);
+				bool fits = true;
+				for (int c = 0; c < children.size() && fits; c++) {
+					fits = quantize(node.origin[a], scale, children[c].bounds.min[a], children[c].bounds.max[a],
+						node.lo[a][c], node.hi[a][c]);
+				}
+				if (fits) {
+					break;
+				}
+			}
+			node.exponent[a] = int8_t(std::max(-128, std::min(127, exponent)));
+		}
+
+		for (int c = 0; c < children.size(); c++) {
+			if (openable(children[c])) {
+				node.child[c] = int(nodes.size());
+				node.count[c] = 0;
+				nodes.push_back(Node());
+				tasks.push_back(std::make_pair(node.child[c], children[c]));
+			}
+			else {
+				node.child[c] = children[c].first;
+				node.count[c] = uint16_t(children[c].count);
+			}
+		}
+		nodes[index] = node;
+	}
+}
+
+/** Getter: whether there is a hierarchy
+*/
+bool WideBVH::empty() const
+{
+	return nodes.empty();
+}
+
+/** Depth-first traversal: the children a node's box test keeps go on the stack farthest first, so the nearest is
+* visited next, and entries the nearest hit so far has overtaken are dropped when popped
+*/
+template <typename Real>
+int WideBVH::closestHit(const BasicVector<Real>& s, const BasicVector<Real>& d, Real& t, long long* tests) const
+{
+	if (nodes.empty()) {
+		return -1;
+	}
+
+	double tEntry;
+	double origin[3] = { s.getI(), s.getJ(), s.getK() };
+	double invDirection[3] = { 1 / double(d.getI()), 1 / double(d.getJ()), 1 / double(d.getK()) };
+	if (!bounds.intersect(origin, invDirection, t, tEntry)) {
+		return -1;
+	}
+
+	const BasicSphereSoA<Real>& leaves = leafStore(Real());
+	int hitIndex = -1;
+	Entry stack[(WIDTH - 1) * MAX_WIDE_DEPTH + 1];
+	int stackSize = 0;
+	stack[stackSize++] = Entry{ 0, 0, tEntry };
+	while (stackSize > 0) {
+		Entry entry = stack[--stackSize];
+		if (entry.t >= t) {
+			continue;
+		}
+
+		if (entry.count > 0) {
+			RENDER_STATS(if (tests) *tests += entry.count;)
+			int position = leaves.closestHit(s, d, entry.child, entry.count, t);
+			if (position >= 0) {
+				hitIndex = leaves.getIndex(position);
+			}
+			continue;
+		}
+
+		const Node& node = nodes[entry.child];
+		double entries[WIDTH];
+		unsigned int mask = boxKernel(node, origin, invDirection, t, entries);
+		int bottom = stackSize;
+		while (mask) {
+			int c = lowestBit(mask);
+			mask &= mask - 1;
+			Entry child{ node.child[c], node.count[c], entries[c] };
+			int k = stackSize++;
+			while (k > bottom && stack[k - 1].t < child.t) {
+				stack[k] = stack[k - 1];
+				k--;
+			}
+			stack[k] = child;
+		}
+	}
+
+	return hitIndex;
+}
+
+/** Depth-first traversal in any order, returning at the first leaf with a hit
+*/
+template <typename Real>
+bool WideBVH::anyHit(const BasicVector<Real>& s, const BasicVector<Real>& d, Real tMax, long long* tests) const
+{
+	if (nodes.empty()) {
+		return false;
+	}
+
+	double tEntry;
+	double origin[3] = { s.getI(), s.getJ(), s.getK() };
+	double invDirection[3] = { 1 / double(d.getI()), 1 / double(d.getJ()), 1 / double(d.getK()) };
+	if (!bounds.intersect(origin, invDirection, tMax, tEntry)) {
+		return false;
+	}
+
+	const BasicSphereSoA<Real>& leaves = leafStore(Real());
+	int stack[(WIDTH - 1) * MAX_WIDE_DEPTH + 1];
+	int stackSize = 0;
+	stack[stackSize++] = 0;
+	while (stackSize > 0) {
+		const Node& node = nodes[stack[--stackSize]];
+		double entries[WIDTH];
+		unsigned int mask = boxKernel(node, origin, invDirection, tMax, entries);
+		while (mask) {
+			int c = lowestBit(mask);
+			mask &= mask - 1;
+			if (node.count[c] == 0) {
+				stack[stackSize++] = node.child[c];
+				continue;
+			}
+			RENDER_STATS(if (tests) *tests += node.count[c];)
+			if (leaves.anyHit(s, d, node.child[c], node.count[c], tMax)) {
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+// The precisions the ray tracer is built with
+template int WideBVH::closestHit(const Vector& s, const Vector& d, double& t, long long* tests) const;
+template int WideBVH::closestHit(const VectorF& s, const VectorF& d, float& t, long long* tests) const;
+template bool WideBVH::anyHit(const Vector& s, const Vector& d, double tMax, long long* tests) const;
+template bool WideBVH::anyHit(const VectorF& s, const VectorF& d, float tMax, long long* tests) const;
+
+/** Kernel for isa, scalar if the CPU cannot run it
+*/
+void WideBVH::setISA(SimdISA isa)
+{
+	if (!SphereSoA::supported(isa)) {
+		isa = SimdISA::Scalar;
+	}
+	this->isa = isa;
+	boxKernel = boxesScalar;
+#ifdef WIDEBVH_X86
+	if (isa == SimdISA::SSE2) {
+		boxKernel = boxesSSE2;
+	}
+	else if (isa == SimdISA::AVX2) {
+		boxKernel = boxesAVX2;
+	}
+	else if (isa == SimdISA::AVX512) {
+		boxKernel = boxesAVX512;
+	}
+#endif
+}
+
+SimdISA WideBVH::getISA() const
+{
+	return isa;
+}
+
+/** Getters for the nodes
+*/
+const vector<WideBVH::Node, AlignedAllocator<WideBVH::Node, 64> >& WideBVH::getNodes() const
+{
+	return nodes;
+}
+
+size_t WideBVH::getNodeBytes() const
+{
+	return nodes.size() * sizeof(Node);
+}
+
+/** Leaf geometry in the precision of the query
+*/
+const SphereSoA& WideBVH::leafStore(double) const
+{
+	return leafSpheres;
+}
+
+const SphereSoAF& WideBVH::leafStore(float) const
+{
+	return leafSpheresF;
+}
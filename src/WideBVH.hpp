@@ -0,0 +1,119 @@
+#ifndef _WIDEBVH_HPP_
+#define _WIDEBVH_HPP_
+
+#include <cstdint>
+#include <vector>
+
+#include "AlignedAllocator.hpp"
+#include "BVH.hpp"
+#include "RenderStats.hpp"
+#include "Sphere.hpp"
+#include "SphereSoA.hpp"
+#include "Vector.hpp"
+
+/**
+ * Node layout the ray tracer traces a BVH in
+ */
+enum class BVHLayout
+{
+	Binary,	// BVH::Node: two children per node, full double precision boxes (default)
+	Wide	// WideBVH::Node: eight children per 128 byte node, boxes quantized to 8 bits
+};
+
+/**
+ * Compressed 8-wide BVH, made by collapsing a binary BVH: every node keeps up to eight of the binary tree's nodes
+ * below it as children (opening the largest by surface area first), and stores their boxes quantized to 8 bits per
+ * plane on a grid spanning its own box, whose cell size is a power of two per axis. A node is 128 bytes (two cache
+ * lines, allocated aligned) against 56 bytes for each binary node, but replaces about five of them (leaf ranges
+ * become children), so under half the node bytes per sphere, and one node fetch tests eight boxes with SIMD (SSE2,
+ * AVX2 or AVX-512, as SphereSoA picks its kernels)
+ * Quantized boxes only ever grow, so rays hit the same spheres as through the binary tree. Boxes are decoded and
+ * tested in double, spheres in the precision of the query (Real) with the SphereSoA kernels, like BVH's
+ */
+class WideBVH
+{
+public:
+	// Children per node
+	static const int WIDTH = 8;
+
+	/**
+	 * Node of the hierarchy: child c (c < childCount) is the inner node child[c] if count[c] == 0, otherwise a leaf
+	 * with the spheres at positions [child[c], child[c] + count[c]) of the geometry stores. Its box along axis a is
+	 * origin[a] + [lo[a][c], hi[a][c]] * 2^exponent[a]
+	 */
+	struct alignas(64) Node
+	{
+		double origin[3];
+		int32_t child[WIDTH];
+		uint8_t lo[3][WIDTH];
+		uint8_t hi[3][WIDTH];
+		uint16_t count[WIDTH];
+		int8_t exponent[3];
+		uint8_t childCount;
+	};
+
+	/**
+	 * Create an empty hierarchy - call build before querying
+	 */
+	WideBVH();
+
+	/**
+	 * Collapse bvh (built over spheres) into 8-wide nodes and copy the spheres' geometry in its leaf order (replaces
+	 * any previous hierarchy). The binary tree is not needed afterwards
+	 */
+	void build(const BVH& bvh, const std::vector<Sphere>& spheres);
+
+	/**
+	 * @return true if there is no hierarchy (nothing built yet, or built from no spheres)
+	 */
+	bool empty() const;
+
+	/**
+	 * Find the nearest sphere that the ray with origin s and unit direction d intersects closer than t, visiting the
+	 * children of each node nearest first
+	 * @param t - distance limit on input (INFINITY for none), set to the distance of the returned sphere's intersection
+	 * @param tests - if given, increased by the number of ray-sphere tests made
+	 * @return index of that sphere in the list the hierarchy was built from, -1 if the ray misses every sphere (t is then unchanged)
+	 */
+	template <typename Real>
+	int closestHit(const BasicVector<Real>& s, const BasicVector<Real>& d, Real& t, long long* tests = nullptr) const;
+
+	/**
+	 * Test whether the ray with origin s and unit direction d intersects any sphere closer than tMax (for shadow rays)
+	 */
+	template <typename Real>
+	bool anyHit(const BasicVector<Real>& s, const BasicVector<Real>& d, Real tMax, long long* tests = nullptr) const;
+
+	/**
+	 * Choose the box test kernel (must be supported by the CPU, see BasicSphereSoA::supported); AVX-512 by default
+	 * where the CPU has it, else the widest it has
+	 */
+	void setISA(SimdISA isa);
+	SimdISA getISA() const;
+
+	/**
+	 * Getters for the nodes (root is node 0) and their size in bytes
+	 */
+	const std::vector<Node, AlignedAllocator<Node, 64> >& getNodes() const;
+	size_t getNodeBytes() const;
+
+private:
+	// Box test of the children of a node: bit c of the result is set if the ray enters child c before tMax, at tEntry[c]
+	typedef unsigned int (*BoxKernel)(const Node& node, const double origin[3], const double invDirection[3], double tMax,
+		double tEntry[WIDTH]);
+
+	std::vector<Node, AlignedAllocator<Node, 64> > nodes;	// Node 0 is the root
+	AABB bounds;	// Of the whole tree (the root's box)
+	SphereSoA leafSpheres;	// Sphere geometry in leaf order
+	SphereSoAF leafSpheresF;	// The same in single precision, for float queries
+	SimdISA isa;
+	BoxKernel boxKernel;
+
+	/**
+	 * @return leafSpheres or leafSpheresF, picked by the type of the (unused) argument
+	 */
+	const SphereSoA& leafStore(double) const;
+	const SphereSoAF& leafStore(float) const;
+};
+
+#endif
@@ -2064,6 +2064,100 @@ unsigned lodepng_deflate(unsigned char** out, size_t* outsize,
   return error;
 }
 
+unsigned lodepng_deflate_piece(unsigned char** out, size_t* outsize,
+                               const unsigned char* data, size_t dictstart, size_t datapos, size_t dataend,
+                               unsigned final, const LodePNGCompressSettings* settings)
+{
+  unsigned error = 0;
+  size_t i, blocksize, start, end;
+  size_t bp; /*the bit pointer*/
+  ucvector v;
+  Hash hash;
+
+  if(settings->btype > 2) return 61;
+  if(dictstart > datapos || datapos > dataend) return 87; /*error: invalid range*/
+  ucvector_init_buffer(&v, *out, *outsize);
+  bp = v.size * 8;
+
+  if(settings->btype == 0)
+  {
+    /*non-final stored blocks of at most 65535 bytes: BFINAL, BTYPE=00, pad to byte, LEN, NLEN, data*/
+    for(start = datapos; start < dataend && !error; start = end)
+    {
+      unsigned LEN;
+      end = dataend - start > 65535 ? start + 65535 : dataend;
+      LEN = (unsigned)(end - start);
+      if(!ucvector_push_back(&v, 0)
+         || !ucvector_push_back(&v, (unsigned char)(LEN & 255)) || !ucvector_push_back(&v, (unsigned char)(LEN >> 8))
+         || !ucvector_push_back(&v, (unsigned char)(~LEN & 255)) || !ucvector_push_back(&v, (unsigned char)((~LEN >> 8) & 255)))
+      {
+        error = 83; /*alloc fail*/
+      }
+      if(!error)
+      {
+        size_t pos = v.size;
+        if(!ucvector_resize(&v, pos + LEN)) error = 83; /*alloc fail*/
+        else if(LEN) memcpy(v.data + pos, data + start, LEN);
+      }
+    }
+    bp = v.size * 8;
+  }
+  else
+  {
+    /*same block sizes as lodepng_deflatev*/
+    blocksize = dataend - datapos;
+    if(settings->btype == 2)
+    {
+      blocksize = blocksize / 8 + 8;
+      if(blocksize < 65536) blocksize = 65536;
+      if(blocksize > 262144) blocksize = 262144;
+    }
+    if(blocksize == 0) blocksize = 1;
+
+    error = hash_init(&hash, settings->windowsize);
+    if(!error)
+    {
+      /*prime the LZ77 window with the dictionary, exactly as encodeLZ77 would have while passing over it*/
+      unsigned numzeros = 0;
+      if(datapos - dictstart > settings->windowsize) dictstart = datapos - settings->windowsize;
+      for(i = dictstart; i < datapos; ++i)
+      {
+        unsigned hashval = getHash(data, dataend, i);
+        if(hashval == 0)
+        {
+          if(numzeros == 0) numzeros = countZeros(data, dataend, i);
+          else if(i + numzeros > dataend || data[i + numzeros - 1] != 0) --numzeros;
+        }
+        else numzeros = 0;
+        updateHashChain(&hash, i & (settings->windowsize - 1), hashval, numzeros);
+      }
+
+      for(start = datapos; start < dataend && !error; start = end)
+      {
+        end = dataend - start > blocksize ? start + blocksize : dataend;
+        if(settings->btype == 1) error = deflateFixed(&v, &bp, &hash, data, start, end, settings, 0);
+        else error = deflateDynamic(&v, &bp, &hash, data, start, end, settings, 0);
+      }
+      hash_cleanup(&hash);
+    }
+  }
+
+  /*empty stored block: ends the piece on a byte boundary (and the stream if final)*/
+  if(!error)
+  {
+    addBitsToStream(&bp, &v, final ? 1 : 0, 3); /*BFINAL, then BTYPE 00*/
+    if(!ucvector_push_back(&v, 0) || !ucvector_push_back(&v, 0)
+       || !ucvector_push_back(&v, 255) || !ucvector_push_back(&v, 255))
+    {
+      error = 83; /*alloc fail*/
+    }
+  }
+
+  *out = v.data;
+  *outsize = v.size;
+  return error;
+}
+
 static unsigned deflate(unsigned char** out, size_t* outsize,
                         const unsigned char* in, size_t insize,
                         const LodePNGCompressSettings* settings)
@@ -2113,6 +2207,18 @@ static unsigned adler32(const unsigned char* data, unsigned len)
   return update_adler32(1L, data, len);
 }
 
+unsigned lodepng_update_adler32(unsigned adler, const unsigned char* data, size_t len)
+{
+  while(len > 0)
+  {
+    unsigned amount = len > 1073741824u ? 1073741824u : (unsigned)len;
+    adler = update_adler32(adler, data, amount);
+    data += amount;
+    len -= amount;
+  }
+  return adler;
+}
+
 /* ////////////////////////////////////////////////////////////////////////// */
 /* / Zlib                                                                   / */
 /* ////////////////////////////////////////////////////////////////////////// */
@@ -2354,7 +2460,12 @@ static unsigned lodepng_crc32_table[256] = {
 /*Return the CRC of the bytes buf[0..len-1].*/
 unsigned lodepng_crc32(const unsigned char* data, size_t length)
 {
-  unsigned r = 0xffffffffu;
+  return lodepng_update_crc32(0u, data, length);
+}
+
+unsigned lodepng_update_crc32(unsigned crc, const unsigned char* data, size_t length)
+{
+  unsigned r = crc ^ 0xffffffffu;
   size_t i;
   for(i = 0; i < length; ++i)
   {
@@ -2364,6 +2475,7 @@ unsigned lodepng_crc32(const unsigned char* data, size_t length)
 }
 #else /* !LODEPNG_NO_COMPILE_CRC */
 unsigned lodepng_crc32(const unsigned char* data, size_t length);
+unsigned lodepng_update_crc32(unsigned crc, const unsigned char* data, size_t length);
 #endif /* !LODEPNG_NO_COMPILE_CRC */
 
 /* ////////////////////////////////////////////////////////////////////////// */
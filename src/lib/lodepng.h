@@ -862,6 +862,9 @@ unsigned lodepng_chunk_create(unsigned char** out, size_t* outlength, unsigned l
 
 /*Calculate CRC32 of buffer*/
 unsigned lodepng_crc32(const unsigned char* buf, size_t len);
+
+/*Update a running CRC32 (start with 0) with len more bytes, so data in several buffers needs no copy.*/
+unsigned lodepng_update_crc32(unsigned crc, const unsigned char* buf, size_t len);
 #endif /*LODEPNG_COMPILE_PNG*/
 
 
@@ -913,6 +916,23 @@ unsigned lodepng_deflate(unsigned char** out, size_t* outsize,
                          const unsigned char* in, size_t insize,
                          const LodePNGCompressSettings* settings);
 
+/*
+Compress data[datapos..dataend) as one piece of a larger raw deflate stream, for encoders that
+compress a stream incrementally or in independent parallel pieces (as pigz does). The bytes
+data[dictstart..datapos) are the data preceding the piece: they are only used to prime the LZ77
+window (at most windowsize bytes of them), so matches may refer back into them but they are not
+output. The piece ends on a byte boundary with an empty non-final stored block (like zlib's
+Z_SYNC_FLUSH) so pieces can simply be concatenated, or, if final is set, with an empty final
+stored block that ends the stream. There is no zlib header or adler32. Appends to the out buffer
+like lodepng_deflate.
+*/
+unsigned lodepng_deflate_piece(unsigned char** out, size_t* outsize,
+                               const unsigned char* data, size_t dictstart, size_t datapos, size_t dataend,
+                               unsigned final, const LodePNGCompressSettings* settings);
+
+/*Update a running adler32 checksum (start with 1) with len more bytes.*/
+unsigned lodepng_update_adler32(unsigned adler, const unsigned char* data, size_t len);
+
 #endif /*LODEPNG_COMPILE_ENCODER*/
 #endif /*LODEPNG_COMPILE_ZLIB*/
 